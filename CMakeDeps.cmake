@@ -91,10 +91,12 @@
 # tools/tismet/tismet.rc
 # tools/tismet/tsbackup.cpp
 # tools/tismet/tscarbon.cpp
+# tools/tismet/tscompact.cpp
 # tools/tismet/tsdata.cpp
 # tools/tismet/tsgraphite.cpp
 # tools/tismet/tsmain.cpp
 # tools/tismet/tsperf.cpp
+# tools/tismet/tsscrub.cpp
 # tools/tismet/tsservice.cpp
 # tools/tismet/tsweb.cpp
 # tools/tismet/tswebcontent.cpp
@@ -109,6 +111,7 @@
 # tools/tsm/tcmain.cpp
 # tools/tsm/tcrecord.cpp
 # tools/tsm/tcreplay.cpp
+# tools/tsm/tcrestore.cpp
 # tools/tsm/tctext.cpp
 # vendor/dimapp
 # vendor/dimapp/libs/app/app.cpp
@@ -346,7 +349,9 @@
 # vendor/dimcli/libs/dimcli/cli.h
 # web/admin-about.html
 # web/admin-common.js
+# web/admin-compact.html
 # web/admin-graphite.html
+# web/admin-scrub.html
 # web/favicon.ico
 # web/initapp.js
 # web/logo.png
@@ -103,6 +103,7 @@ unsigned ICarbonNotify::append(string_view src) {
                 m_requestIds.insert(id);
                 s_incompletes[id] = {this, incomplete};
             }
+            onCarbonValuesEnd();
             return incomplete;
         }
         s_perfUpdates += 1;
@@ -110,6 +111,7 @@ unsigned ICarbonNotify::append(string_view src) {
             incomplete += 1;
     }
 
+    onCarbonValuesEnd();
     s_perfErrors += 1;
     return (unsigned) EOF;
 }
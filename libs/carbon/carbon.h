@@ -51,6 +51,10 @@ public:
         uint32_t idHint = 0
     ) = 0;
 
+    // Called after all onCarbonValue calls for the request have been made,
+    // allows delayed values to be processed together as a batch.
+    virtual void onCarbonValuesEnd() {}
+
     //-----------------------------------------------------------------------
     // For producers (ICarbonSocketNotify and ICarbonFileNotify)
 
@@ -17,6 +17,26 @@ using namespace Dim;
 
 const unsigned kRequestBuckets = 8;
 
+// Incremental backups and restores read pages in batches of this size.
+const size_t kBackupBatchBytes = 0x10'0000; // 1MiB
+
+// While waiting for the pages it freed to be saved and checkpointed,
+// compaction retries truncating the file this often, and gives up after this
+// long.
+constexpr Duration kCompactRetryInterval = 1min;
+constexpr Duration kCompactMaxWait = 2h;
+
+// How often a follower checks for new WAL from the database it follows.
+constexpr Duration kFollowInterval = 1s;
+
+// Times a query is retried, each time from a new snapshot, when its snapshot
+// was missing a version of a page it read, before it fails.
+const unsigned kMaxQueryRetries = 3;
+
+// Number of metrics whose pages are prefetched together when reading the
+// samples of many metrics.
+const size_t kPrefetchMetrics = 64;
+
 
 /****************************************************************************
 *
@@ -29,10 +49,21 @@ namespace {
 enum DbReqType {
     kGetMetric,
     kGetSamples,
+    kGetSummaries,
     kEraseMetric,
     kInsertMetric,
     kUpdateMetric,
     kUpdateSample,
+    kUpdateSamples,
+    kCompactMetric,
+    kBackfillRollups,
+};
+// Shared by the requests of a dbUpdateSamples call, the task is queued once
+// the last of them has been applied and become durable.
+struct DbDurableWait {
+    atomic<unsigned> pending;
+    ITaskNotify * task;
+    TaskQueueHandle hq;
 };
 struct DbReq {
     DbReqType type;
@@ -40,11 +71,64 @@ struct DbReq {
     DbSampleType sampleType;
     Duration retention;
     Duration interval;
+    vector<DbMetricRollup> rollups;
     IDbDataNotify * notify;
     TimePoint first;
     TimePoint last;
     unsigned presamples;
     double value;
+    vector<DbSample> samples;
+    shared_ptr<DbDurableWait> durable;
+    unsigned retries = 0;
+};
+
+// Holds what a query reports until it's known to have been read from a
+// complete snapshot, so it can be thrown away if the query has to be retried.
+class DbQueryBuffer : public IDbDataNotify {
+public:
+    void clear();
+    // Reports what was held, ending each series early where the notifier
+    // aborts it.
+    void replay(IDbDataNotify * notify) const;
+
+    // Inherited via IDbDataNotify
+    bool onDbSeriesStart(const DbSeriesInfo & info) override;
+    void onDbSeriesEnd(uint32_t id) override;
+    bool onDbSample(uint32_t id, TimePoint time, double value) override;
+    bool onDbSamples(
+        uint32_t id,
+        TimePoint first,
+        Duration interval,
+        span<const double> values
+    ) override;
+    bool onDbSummary(uint32_t id, const DbSampleSummary & summary) override;
+
+private:
+    enum EventType {
+        kSeriesStart,
+        kSeriesEnd,
+        kSample,
+        kSamples,
+        kSummary,
+    };
+    struct Event {
+        EventType type;
+        uint32_t id;
+        TimePoint first;
+        Duration interval;
+        // Position and count within m_series, m_values, or m_summaries.
+        size_t pos;
+        size_t count;
+    };
+    struct Series {
+        DbSeriesInfoEx info;
+        string target;
+        string name;
+    };
+    vector<Event> m_events;
+    vector<Series> m_series;
+    vector<double> m_values;
+    vector<DbSampleSummary> m_summaries;
 };
 
 class DbBase
@@ -52,6 +136,7 @@ class DbBase
     , IDbDataNotify
     , IDbProgressNotify
     , IFileReadNotify
+    , ITaskNotify
 {
 public:
     DbBase();
@@ -59,13 +144,20 @@ public:
     bool open(
         string_view name,
         EnumFlags<DbOpenFlags> flags,
-        size_t pageSize
+        size_t pageSize,
+        const DbMapOptions & mapOpts
     );
     void close();
     void configure(const DbConfig & conf);
     DbStats queryStats();
     void blockCheckpoint(IDbProgressNotify * notify, bool enable);
-    bool backup(IDbProgressNotify * notify, string_view dst);
+    bool backup(
+        IDbProgressNotify * notify,
+        string_view dst,
+        string_view prev
+    );
+    bool scrub(IDbProgressNotify * notify, size_t maxBytesPerSec);
+    bool compact(IDbProgressNotify * notify);
 
     uint64_t acquireInstanceRef();
     void releaseInstanceRef(uint64_t instance);
@@ -87,18 +179,41 @@ public:
     void findBranches(UnsignedSet * out, string_view pattern) const;
 
     void updateSample(uint32_t id, TimePoint time, double value);
+    void updateSamples(
+        span<const DbSampleUpdate> samples,
+        ITaskNotify * durable,
+        TaskQueueHandle hq
+    );
     bool getSamples(
         IDbDataNotify * notify,
         uint32_t id,
         TimePoint first,
         TimePoint last,
-        unsigned presamples
+        unsigned presamples,
+        Duration minInterval
+    );
+    void getSamplesMulti(
+        IDbDataNotify * notify,
+        const UnsignedSet & ids,
+        TimePoint first,
+        TimePoint last,
+        unsigned presamples,
+        Duration minInterval
+    );
+    bool getSummaries(
+        IDbDataNotify * notify,
+        uint32_t id,
+        TimePoint first,
+        TimePoint last
     );
 
 private:
     // Returns true if it completed synchronously
     bool transact(uint32_t id, DbReq && req);
-    void apply(uint32_t id, DbReq && req);
+    // Returns false if the request was detached from the queue.
+    bool apply(uint32_t id, DbReq && req);
+    bool detach(uint32_t id);
+    void releaseDurable(DbDurableWait * wait);
 
     // Inherited via IDbDataNotify
     bool onDbSeriesStart(const DbSeriesInfo & info) override;
@@ -107,16 +222,31 @@ private:
     bool onDbProgress(RunMode mode, const DbProgressInfo & info) override;
 
     void backupNextFile();
+    void backupData();
+    void backupEnd();
 
     // Inherited via IFileReadNotify
     bool onFileRead(size_t * bytesUsed, const FileReadData & data) override;
 
+    bool compactProgress(const DbProgressInfo & info);
+
+    Duration onFollowTimer();
+    void followTask();
+    // Applies the updates that can be, from WAL added by the writer since the
+    // last call. Returns false if the WAL needed was already discarded.
+    bool follow(bool loaded);
+
+    // Inherited via ITaskNotify, runs compaction.
+    void onTask() override;
+
     struct RequestBucket {
         mutex mut;
         unordered_map<uint32_t, deque<DbReq>> requests;
     };
     unique_ptr<RequestBucket[]> m_reqBuckets;
     bool m_verbose{false};
+    // Metric index snapshot to save on close, empty if read only.
+    Path m_indexFile;
 
     // Backup process
     RunMode m_backupMode{kRunStopped};
@@ -124,6 +254,30 @@ private:
     IDbProgressNotify * m_backer{};
     vector<pair<Path, Path>> m_backupFiles;
     FileAppendStream m_dstFile;
+    // Copy of the data file, empty for incremental backups.
+    Path m_backupDataFile;
+    // Incremental backups save the data pages changed since their base LSN to
+    // this file, instead of copying the data file. All backups end it with a
+    // trailer.
+    FileAppendStream m_deltaFile;
+    bool m_backupIncremental{false};
+    Lsn m_backupBaseLsn{};
+    Lsn m_backupLsn{};
+    size_t m_backupEntries{0};
+    TaskProxy m_backupDataTask;
+
+    // Compaction process
+    RunMode m_compactMode{kRunStopped};
+    IDbProgressNotify * m_compacter{};
+    mutex m_compactMut;
+    condition_variable m_compactCv;
+
+    // Following another process's updates
+    TimerProxy m_followTimer;
+    mutex m_followMut;
+    condition_variable m_followCv;
+    bool m_following{false};
+    bool m_followBusy{false};
 
     // Metric name search
     mutable shared_mutex m_indexMut;
@@ -153,6 +307,8 @@ static HandleMap<DbHandle, DbBase> s_files;
 static auto & s_perfCreated = uperf("db.metrics created");
 static auto & s_perfDeleted = uperf("db.metrics deleted");
 static auto & s_perfTrunc = uperf("db.metric names truncated");
+static auto & s_perfQueryRetries = uperf("db.queries retried");
+static auto & s_perfQueryFails = uperf("db.queries failed");
 
 
 /****************************************************************************
@@ -167,6 +323,20 @@ inline static DbBase * db(DbHandle h) {
     return s_files.find(h);
 }
 
+//===========================================================================
+// Reports the metric of a query that failed, after being retried, as if it
+// didn't exist, rather than with samples that may be from different versions
+// of its pages.
+static void queryFailed(IDbDataNotify * notify, uint32_t id) {
+    s_perfQueryFails += 1;
+    logMsgError() << "Query of metric #" << id
+        << " failed, snapshot missing page versions";
+    DbSeriesInfo info;
+    info.id = id;
+    if (notify->onDbSeriesStart(info))
+        notify->onDbSeriesEnd(id);
+}
+
 
 /****************************************************************************
 *
@@ -177,6 +347,8 @@ inline static DbBase * db(DbHandle h) {
 //===========================================================================
 DbBase::DbBase ()
     : m_dstFile(100, 2, envMemoryConfig().pageSize)
+    , m_backupDataTask([&]{ backupData(); })
+    , m_followTimer([&](auto){ return onFollowTimer(); })
     , m_wal(&m_data, &m_page)
 {
     m_reqBuckets.reset(new RequestBucket[kRequestBuckets]);
@@ -186,12 +358,19 @@ DbBase::DbBase ()
 bool DbBase::open(
     string_view name,
     EnumFlags<DbOpenFlags> flags,
-    size_t pageSize
+    size_t pageSize,
+    const DbMapOptions & mapOpts
 ) {
     m_verbose = flags.any(fDbOpenVerbose);
+    bool follower = flags.any(fDbOpenFollow);
+    if (follower) {
+        flags |= fDbOpenReadOnly | fDbOpenLazyMetrics;
+        flags.reset(fDbOpenCreat | fDbOpenTrunc | fDbOpenExcl);
+    }
 
     auto datafile = Path(name).setExt("tsd");
-    auto workfile = Path(name).setExt("tsw");
+    // Followers have their own work file, the writer's is in use.
+    auto workfile = Path(name).setExt(follower ? "tsf" : "tsw");
     auto walfile = Path(name).setExt("tsl");
     if (!m_wal.open(walfile, flags, pageSize))
         return false;
@@ -202,31 +381,95 @@ bool DbBase::open(
         workfile,
         m_wal.dataPageSize(),
         m_wal.walPageSize(),
-        flags
+        flags,
+        mapOpts
     )) {
         m_wal.close();
         return false;
     }
-    m_data.openForApply(m_page.pageSize(), flags);
-    if (!m_wal.recover())
+    {
+        auto zp = m_page.rptr(0, (pgno_t) 0, true);
+        m_data.openForApply(
+            m_page.pageSize(),
+            flags,
+            static_cast<const DbPageHeader *>(zp)
+        );
+        UnsignedSet pages;
+        pages.insert(0);
+        m_page.unpin(pages);
+    }
+    if (!m_wal.recover(DbWal::fRecoverParallel))
+        return false;
+    if (follower && !follow(false))
         return false;
     m_maxNameLen = m_data.queryStats().metricNameSize - 1;
     DbTxn txn{m_wal, m_page, m_data.metricRootsInstance()};
-    if (!m_data.openForUpdate(txn, this, datafile, flags))
+    auto indexfile = Path(name).setExt("tsi");
+    if (!m_data.openForUpdate(
+        txn,
+        this,
+        datafile,
+        flags,
+        indexfile,
+        m_wal.lastLsn()
+    )) {
         return false;
+    }
+    auto backfills = flags.any(fDbOpenReadOnly)
+        ? vector<uint32_t>{}
+        : m_data.rollupBackfills(txn);
     auto freePages = txn.commit();
     m_data.publishFreePages(freePages);
     m_wal.checkpoint();
+    if (!flags.any(fDbOpenReadOnly))
+        m_indexFile = indexfile;
+    // Finish populating the rollups of metrics that were interrupted.
+    for (auto && id : backfills) {
+        DbReq req;
+        req.type = kBackfillRollups;
+        transact(id, move(req));
+    }
+    if (follower) {
+        scoped_lock lk{m_followMut};
+        m_following = true;
+        timerUpdate(&m_followTimer, kFollowInterval);
+    }
     return true;
 }
 
 //===========================================================================
 void DbBase::close() {
+    {
+        unique_lock lk{m_followMut};
+        m_following = false;
+        while (m_followBusy)
+            m_followCv.wait(lk);
+    }
+    timerCloseWait(&m_followTimer);
+    {
+        unique_lock lk{m_compactMut};
+        if (m_compactMode != kRunStopped) {
+            m_compactMode = kRunStopping;
+            m_compactCv.notify_all();
+            while (m_compactMode != kRunStopped)
+                m_compactCv.wait(lk);
+        }
+    }
     m_wal.close();
+    if (m_indexFile) {
+        // Nothing more will be logged, so the metric positions are now in
+        // sync with the last LSN.
+        DbTxn txn{m_wal, m_page, m_data.metricRootsInstance()};
+        shared_lock lk{m_indexMut};
+        m_data.saveMetricIndex(txn, m_indexFile, m_wal.lastLsn(), m_leaf);
+        m_indexFile = {};
+    }
 }
 
 //===========================================================================
 bool DbBase::onDbSeriesStart(const DbSeriesInfo & info) {
+    // Also called while following, when lookups may be running.
+    scoped_lock lk{m_indexMut};
     m_leaf.insert(info.id, info.name);
     m_branch.insertBranches(info.name);
     return true;
@@ -234,8 +477,11 @@ bool DbBase::onDbSeriesStart(const DbSeriesInfo & info) {
 
 //===========================================================================
 void DbBase::configure(const DbConfig & conf) {
-    m_page.configure(conf);
-    m_wal.configure(conf);
+    // Checkpoint settings are validated, with zeros replaced by the current
+    // values, by DbWal before being given to DbPage.
+    auto tmp = m_wal.configure(conf);
+    m_page.configure(tmp);
+    m_data.configure(tmp);
 }
 
 //===========================================================================
@@ -249,43 +495,324 @@ void DbBase::blockCheckpoint(IDbProgressNotify * notify, bool enable) {
 }
 
 
+/****************************************************************************
+*
+*   Follow
+*
+*   Followers poll the WAL of the writer, applying its updates to their own
+*   work copies of the pages. The metric positions and name index are then
+*   brought up to date with the metric pages that were changed.
+*
+***/
+
+//===========================================================================
+Duration DbBase::onFollowTimer() {
+    scoped_lock lk{m_followMut};
+    if (m_following) {
+        m_followBusy = true;
+        taskPushCompute([this]() { followTask(); });
+    }
+    return kTimerInfinite;
+}
+
+//===========================================================================
+void DbBase::followTask() {
+    auto found = follow(true);
+    {
+        scoped_lock lk{m_followMut};
+        m_followBusy = false;
+        if (!found) {
+            logMsgError() << "Follower fell behind, reopen to catch up";
+            m_following = false;
+        }
+        if (m_following)
+            timerUpdate(&m_followTimer, kFollowInterval);
+    }
+    m_followCv.notify_all();
+}
+
+//===========================================================================
+bool DbBase::follow(bool loaded) {
+    m_page.followDataFile();
+
+    // Metrics that owned the updated pages before they were updated.
+    unordered_map<pgno_t, uint32_t> pages;
+    {
+        DbTxn txn{m_wal, m_page, m_data.metricRootsInstance()};
+        auto fn = [&](Lsn lsn, const DbWal::Record & rec) {
+            auto pgno = DbWal::getPgno(rec);
+            m_page.growToFit(pgno);
+            if (!m_page.followPage(pgno)) {
+                // Torn, try again with the next poll.
+                return false;
+            }
+            auto hdr = txn.pin<DbPageHeader>(pgno);
+            if (lsn <= hdr->lsn) {
+                // Already in the data file.
+                return true;
+            }
+            pages.try_emplace(pgno, DbData::followOwner(*hdr));
+            m_wal.followApply(lsn, rec);
+            return true;
+        };
+        if (!m_wal.follow(fn))
+            return false;
+    }
+    if (!loaded || pages.empty())
+        return true;
+
+    DbTxn txn{m_wal, m_page, m_data.metricRootsInstance()};
+    vector<pgno_t> newMetrics;
+    auto erased = m_data.followPages(txn, &newMetrics, pages);
+    if (!erased.empty()) {
+        scoped_lock lk{m_indexMut};
+        for (auto && id : erased) {
+            if (auto name = m_leaf.name(id)) {
+                string tmp = name;
+                m_leaf.erase(tmp);
+                m_branch.eraseBranches(tmp);
+            }
+        }
+    }
+    for (auto && pgno : newMetrics)
+        m_data.followMetric(txn, this, pgno);
+    return true;
+}
+
+
 /****************************************************************************
 *
 *   Backup
 *
+*   Checkpoints are blocked only while the WAL is copied. The data file is
+*   copied afterwards, as it was when the WAL copy began, with the original
+*   contents of pages that get written before the copy reaches them kept by
+*   DbPage until it does.
+*
+*   Every backup also saves a .tsb file, written last so an incomplete backup
+*   is never mistaken for a complete one. Incremental backups save the data
+*   pages changed since the previous backup in it, each preceded by its page
+*   number, instead of copying the data file. It ends with a trailer that
+*   records the LSN the next incremental backup copies changes since.
+*
+*   Pages only change after their WAL, which is redone from the checkpoint,
+*   so pages last changed before the checkpoint in effect during a backup are
+*   the same in every later copy of the data file.
+*
 ***/
 
+namespace {
+
+const Guid kBackupSig = "4a8ba21b-b301-48e6-a6ed-97574a4e996a"_Guid;
+
+#pragma pack(push, 1)
+
+struct BackupTrailer {
+    Guid signature;
+    // LSN of the backup this is incremental to, the pages included are those
+    // changed at or after it.
+    Lsn baseLsn;
+    // First LSN redone by recovery of the backup.
+    Lsn lsn;
+    uint64_t numPages;
+    uint64_t numEntries;
+    uint32_t pageSize;
+    uint8_t incremental;
+};
+
+#pragma pack(pop)
+
+} // namespace
+
+//===========================================================================
+// The data file is copied with synchronous reads and writes, so it gets its
+// own thread instead of tying up one of the compute threads.
+static TaskQueueHandle backupQueue() {
+    static TaskQueueHandle s_hq = taskCreateQueue("Backup", 1);
+    return s_hq;
+}
+
 //===========================================================================
-bool DbBase::backup(IDbProgressNotify * notify, string_view dstStem) {
+static bool loadBackupTrailer(BackupTrailer * out, FileHandle f) {
+    uint64_t len = 0;
+    if (fileSize(&len, f) || len < sizeof *out)
+        return false;
+    uint64_t bytes = 0;
+    fileReadWait(&bytes, out, sizeof *out, f, len - sizeof *out);
+    if (bytes != sizeof *out || out->signature != kBackupSig)
+        return false;
+    auto entryLen = sizeof(pgno_t) + out->pageSize;
+    return len == sizeof *out + out->numEntries * entryLen;
+}
+
+//===========================================================================
+static bool copyBackupFile(string_view dst, string_view src) {
+    using enum File::OpenMode;
+    FileHandle fin;
+    fileOpen(&fin, src, fReadOnly | fBlocking | fDenyNone | fSequential);
+    if (!fin) {
+        logMsgError() << "Open failed, " << src;
+        return false;
+    }
+    Finally finFin([&]() { fileClose(fin); });
+    FileHandle fout;
+    auto oflags = fCreat | fTrunc | fReadWrite | fDenyWrite | fBlocking;
+    fileOpen(&fout, dst, oflags);
+    if (!fout) {
+        logMsgError() << "Create failed, " << dst;
+        return false;
+    }
+    Finally foutFin([&]() { fileClose(fout); });
+
+    auto buf = make_unique<char[]>(kBackupBatchBytes);
+    for (uint64_t pos = 0;; ) {
+        uint64_t bytes = 0;
+        fileReadWait(&bytes, buf.get(), kBackupBatchBytes, fin, pos);
+        if (!bytes)
+            return true;
+        if (fileWriteWait(nullptr, fout, pos, buf.get(), bytes)) {
+            logMsgError() << "Write failed, " << dst;
+            return false;
+        }
+        pos += bytes;
+    }
+}
+
+//===========================================================================
+// Writes the pages saved by an incremental backup to the data file, and
+// resizes it to the size it was when the backup was made.
+static bool applyBackupDelta(
+    FileHandle fdata,
+    FileHandle fdelta,
+    const BackupTrailer & trailer
+) {
+    auto entryLen = sizeof(pgno_t) + trailer.pageSize;
+    auto maxEntries = max<size_t>(kBackupBatchBytes / entryLen, 1);
+    auto buf = make_unique<char[]>(maxEntries * entryLen);
+    for (uint64_t ent = 0; ent < trailer.numEntries; ) {
+        auto count = min<uint64_t>(maxEntries, trailer.numEntries - ent);
+        uint64_t bytes = 0;
+        fileReadWait(
+            &bytes,
+            buf.get(),
+            count * entryLen,
+            fdelta,
+            ent * entryLen
+        );
+        if (bytes != count * entryLen) {
+            logMsgError() << "Read failed, " << filePath(fdelta);
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            auto ptr = buf.get() + i * entryLen;
+            pgno_t pgno;
+            memcpy(&pgno, ptr, sizeof pgno);
+            if (pgno >= trailer.numPages) {
+                logMsgError() << "Invalid backup, " << filePath(fdelta);
+                return false;
+            }
+            if (fileWriteWait(
+                nullptr,
+                fdata,
+                (uint64_t) pgno * trailer.pageSize,
+                ptr + sizeof pgno,
+                trailer.pageSize
+            )) {
+                logMsgError() << "Write failed, " << filePath(fdata);
+                return false;
+            }
+        }
+        ent += count;
+    }
+    if (fileResize(fdata, trailer.numPages * trailer.pageSize)) {
+        logMsgError() << "Resize failed, " << filePath(fdata);
+        return false;
+    }
+    return true;
+}
+
+//===========================================================================
+bool DbBase::backup(
+    IDbProgressNotify * notify,
+    string_view dstStem,
+    string_view prevStem
+) {
     if (m_backupMode != kRunStopped)
         return false;
 
-    if (m_verbose)
-        logMsgInfo() << "Backup started";
-    m_backupFiles.clear();
-    auto src = (Path) filePath(m_page.dataFile());
+    m_backupIncremental = !prevStem.empty();
+    m_backupBaseLsn = {};
+    if (m_backupIncremental) {
+        using enum File::OpenMode;
+        auto prev = Path(prevStem).setExt("tsb");
+        FileHandle f;
+        fileOpen(&f, prev, fReadOnly | fBlocking | fDenyNone);
+        BackupTrailer trailer;
+        auto found = f && loadBackupTrailer(&trailer, f);
+        fileClose(f);
+        if (!found || trailer.pageSize != m_page.pageSize()) {
+            logMsgError() << "Invalid backup, " << prev;
+            return false;
+        }
+        m_backupBaseLsn = trailer.lsn;
+    }
     auto dst = (Path) dstStem;
-    dst.setExt(src.extension());
-    m_backupFiles.push_back(make_pair(dst, src));
-    src = filePath(m_wal.walFile());
+    dst.setExt("tsb");
+    if (!m_deltaFile.open(dst, FileAppendStream::kTrunc)) {
+        logMsgError() << "Create failed, " << dst;
+        return false;
+    }
+
+    if (m_verbose) {
+        logMsgInfo() << (m_backupIncremental ? "Incremental backup" : "Backup")
+            << " started";
+    }
+    m_backupFiles.clear();
+    m_backupDataFile = {};
+    if (!m_backupIncremental) {
+        m_backupDataFile = dst;
+        m_backupDataFile.setExt(filePath(m_page.dataFile()).extension());
+    }
+    auto src = (Path) filePath(m_wal.walFile());
     dst.setExt(src.extension());
     m_backupFiles.push_back(make_pair(dst, src));
     m_backer = notify;
     m_backupMode = kRunStarting;
+    m_backupEntries = 0;
     m_info = {};
-    m_info.totalFiles = m_backupFiles.size();
+    m_info.totalFiles = m_backupIncremental ? 2 : 3;
     blockCheckpoint(this, true);
     return true;
 }
 
+//===========================================================================
+bool DbBase::scrub(IDbProgressNotify * notify, size_t maxBytesPerSec) {
+    if (m_verbose)
+        logMsgInfo() << "Scrub started";
+    return m_page.scrub(notify, maxBytesPerSec);
+}
+
 //===========================================================================
 bool DbBase::onDbProgress(RunMode mode, const DbProgressInfo & info) {
     if (m_backupMode != kRunStarting)
         return true;
 
     if (mode == kRunStopped) {
+        // Checkpoints are blocked only until the WAL has been copied, the
+        // data file is then copied as it was at this point, so the WAL covers
+        // every change in the copy.
+        m_backupLsn = m_wal.checkpointLsn();
+        m_info.totalPages = m_page.backupBegin();
         m_backupMode = kRunRunning;
-        if (m_backer && !m_backer->onDbProgress(m_backupMode, m_info)) {
+        if (!m_info.totalPages) {
+            // Data file always has at least its zero page, so the backup
+            // failed to start.
+            m_backupMode = kRunStopping;
+            m_backupFiles.clear();
+        } else if (m_backer
+            && !m_backer->onDbProgress(m_backupMode, m_info)
+        ) {
+            m_backupMode = kRunStopping;
             m_backupFiles.clear();
         }
         backupNextFile();
@@ -313,10 +840,92 @@ void DbBase::backupNextFile() {
             return;
         }
         logMsgError() << "Create failed, " << dst;
+        m_backupMode = kRunStopping;
         m_backupFiles.clear();
     }
 
+    // The WAL has been copied, checkpoints can continue while the data file
+    // is.
     blockCheckpoint(this, false);
+    if (m_backupMode == kRunStopping)
+        return backupEnd();
+    taskPush(backupQueue(), &m_backupDataTask);
+}
+
+//===========================================================================
+// Copies the data file, as it was when the backup began. Or, for incremental
+// backups, saves only the pages changed since the base LSN to the delta file.
+void DbBase::backupData() {
+    auto pageSize = m_page.pageSize();
+    if (!m_backupIncremental) {
+        if (!m_dstFile.open(m_backupDataFile, FileAppendStream::kTrunc)) {
+            logMsgError() << "Create failed, " << m_backupDataFile;
+            m_backupMode = kRunStopping;
+            return backupEnd();
+        }
+        auto bytes = m_info.totalPages * pageSize;
+        if (m_info.totalBytes == size_t(-1)) {
+            m_info.totalBytes = bytes;
+        } else {
+            m_info.totalBytes += bytes;
+        }
+    }
+
+    auto maxPages = max<size_t>(kBackupBatchBytes / pageSize, 1);
+    auto buf = make_unique<char[]>(maxPages * pageSize);
+    while (auto bytes = m_page.backupRead(buf.get(), maxPages * pageSize)) {
+        auto count = bytes / pageSize;
+        if (!m_backupIncremental) {
+            m_dstFile.append({buf.get(), bytes});
+            m_info.bytes += bytes;
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                auto ptr = buf.get() + i * pageSize;
+                auto hdr = (const DbPageHeader *) ptr;
+                if (hdr->lsn < m_backupBaseLsn)
+                    continue;
+                auto pgno = pgno_t(m_info.pages + i);
+                m_deltaFile.append({(const char *) &pgno, sizeof pgno});
+                m_deltaFile.append({ptr, pageSize});
+                m_backupEntries += 1;
+            }
+        }
+        m_info.pages += count;
+        if (m_backer && !m_backer->onDbProgress(m_backupMode, m_info)) {
+            m_backupMode = kRunStopping;
+            break;
+        }
+    }
+    if (m_backupMode != kRunStopping && m_info.pages != m_info.totalPages) {
+        logMsgError() << "Read failed, " << filePath(m_page.dataFile());
+        m_backupMode = kRunStopping;
+    }
+    if (!m_backupIncremental) {
+        m_dstFile.close();
+        if (m_backupMode != kRunStopping)
+            m_info.files += 1;
+    }
+    backupEnd();
+}
+
+//===========================================================================
+// Finishes the backup, ending the delta file with its trailer if the backup
+// is complete.
+void DbBase::backupEnd() {
+    m_page.backupEnd();
+    if (m_backupMode != kRunStopping) {
+        BackupTrailer trailer = {};
+        trailer.signature = kBackupSig;
+        trailer.baseLsn = m_backupBaseLsn;
+        trailer.lsn = m_backupLsn;
+        trailer.numPages = m_info.totalPages;
+        trailer.numEntries = m_backupEntries;
+        trailer.pageSize = (uint32_t) m_page.pageSize();
+        trailer.incremental = m_backupIncremental;
+        m_deltaFile.append({(const char *) &trailer, sizeof trailer});
+        m_info.files += 1;
+    }
+    m_deltaFile.close();
     if (m_backer)
         m_backer->onDbProgress(kRunStopped, m_info);
     m_backupMode = kRunStopped;
@@ -345,6 +954,99 @@ bool DbBase::onFileRead(size_t * bytesUsed, const FileReadData & data) {
 }
 
 
+/****************************************************************************
+*
+*   Compaction
+*
+***/
+
+//===========================================================================
+static TaskQueueHandle compactQueue() {
+    static TaskQueueHandle s_hq = taskCreateQueue("Compact", 1);
+    return s_hq;
+}
+
+//===========================================================================
+bool DbBase::compact(IDbProgressNotify * notify) {
+    {
+        scoped_lock lk{m_compactMut};
+        if (m_compactMode != kRunStopped)
+            return false;
+        m_compactMode = kRunRunning;
+        m_compacter = notify;
+    }
+    if (m_verbose)
+        logMsgInfo() << "Compaction started";
+    taskPush(compactQueue(), this);
+    return true;
+}
+
+//===========================================================================
+// Reports progress, returns false if compaction should stop.
+bool DbBase::compactProgress(const DbProgressInfo & info) {
+    auto keepGoing = !m_compacter
+        || m_compacter->onDbProgress(kRunRunning, info);
+    scoped_lock lk{m_compactMut};
+    if (!keepGoing)
+        m_compactMode = kRunStopping;
+    return m_compactMode == kRunRunning;
+}
+
+//===========================================================================
+void DbBase::onTask() {
+    DbProgressInfo info;
+    UnsignedSet ids;
+    {
+        DbTxn txn{m_wal, m_page, m_data.metricRootsInstance()};
+        info.totalPages = m_data.compactBegin(&ids, txn);
+    }
+    info.totalMetrics = ids.size();
+    auto keepGoing = compactProgress(info);
+
+    // Pages are moved by requests on the queues of the metrics they belong
+    // to, so the moves are serialized with other updates to the metrics.
+    for (auto && id : ids) {
+        if (!keepGoing)
+            break;
+        DbReq req;
+        req.type = kCompactMetric;
+        transact(id, move(req));
+        info.metrics += 1;
+        keepGoing = compactProgress(info);
+    }
+
+    // Truncate the end of the file, once its newly freed pages have been
+    // saved and checkpointed.
+    auto giveUp = timeNow() + kCompactMaxWait;
+    while (keepGoing) {
+        DbTxn txn{m_wal, m_page, m_data.metricRootsInstance()};
+        auto left = m_data.compactTruncate(txn);
+        auto freePages = txn.commit();
+        m_data.publishFreePages(freePages);
+        info.pages = info.totalPages > left ? info.totalPages - left : 0;
+        keepGoing = compactProgress(info);
+        if (!left || timeNow() >= giveUp)
+            break;
+        m_wal.checkpoint();
+        unique_lock lk{m_compactMut};
+        m_compactCv.wait_for(lk, kCompactRetryInterval, [&]() {
+            return m_compactMode != kRunRunning;
+        });
+        keepGoing = m_compactMode == kRunRunning;
+    }
+    m_data.compactEnd();
+    if (m_verbose)
+        logMsgInfo() << "Compaction completed";
+    if (m_compacter)
+        m_compacter->onDbProgress(kRunStopped, info);
+
+    scoped_lock lk{m_compactMut};
+    m_compactMode = kRunStopped;
+    m_compacter = nullptr;
+    m_compactCv.notify_all();
+}
+
+
 /****************************************************************************
 *
 *   Contexts
@@ -387,6 +1089,132 @@ void DbContext::reset(DbHandle f) {
 }
 
 
+/****************************************************************************
+*
+*   DbQueryBuffer
+*
+***/
+
+//===========================================================================
+void DbQueryBuffer::clear() {
+    m_events.clear();
+    m_series.clear();
+    m_values.clear();
+    m_summaries.clear();
+}
+
+//===========================================================================
+void DbQueryBuffer::replay(IDbDataNotify * notify) const {
+    // Series being skipped because the notifier aborted it.
+    bool skip = false;
+    for (auto && ev : m_events) {
+        switch (ev.type) {
+        case kSeriesStart:
+            {
+                auto & ser = m_series[ev.pos];
+                auto info = ser.info;
+                info.target = ser.target;
+                info.name = ser.name;
+                skip = !notify->onDbSeriesStart(info);
+            }
+            break;
+        case kSeriesEnd:
+            if (!skip)
+                notify->onDbSeriesEnd(ev.id);
+            skip = false;
+            break;
+        case kSample:
+            if (!skip) {
+                auto value = m_values[ev.pos];
+                skip = !notify->onDbSample(ev.id, ev.first, value);
+            }
+            break;
+        case kSamples:
+            if (!skip) {
+                auto vals = span(m_values.data() + ev.pos, ev.count);
+                skip = !notify->onDbSamples(ev.id, ev.first, ev.interval, vals);
+            }
+            break;
+        case kSummary:
+            if (!skip)
+                skip = !notify->onDbSummary(ev.id, m_summaries[ev.pos]);
+            break;
+        }
+    }
+}
+
+//===========================================================================
+bool DbQueryBuffer::onDbSeriesStart(const DbSeriesInfo & info) {
+    auto & ser = m_series.emplace_back();
+    if (info.infoEx) {
+        ser.info = static_cast<const DbSeriesInfoEx &>(info);
+    } else {
+        static_cast<DbSeriesInfo &>(ser.info) = info;
+    }
+    ser.target = info.target;
+    ser.name = info.name;
+    ser.info.target = {};
+    ser.info.name = {};
+    m_events.push_back({
+        .type = kSeriesStart,
+        .id = info.id,
+        .pos = m_series.size() - 1,
+    });
+    return true;
+}
+
+//===========================================================================
+void DbQueryBuffer::onDbSeriesEnd(uint32_t id) {
+    m_events.push_back({.type = kSeriesEnd, .id = id});
+}
+
+//===========================================================================
+bool DbQueryBuffer::onDbSample(uint32_t id, TimePoint time, double value) {
+    m_events.push_back({
+        .type = kSample,
+        .id = id,
+        .first = time,
+        .pos = m_values.size(),
+        .count = 1,
+    });
+    m_values.push_back(value);
+    return true;
+}
+
+//===========================================================================
+bool DbQueryBuffer::onDbSamples(
+    uint32_t id,
+    TimePoint first,
+    Duration interval,
+    span<const double> values
+) {
+    m_events.push_back({
+        .type = kSamples,
+        .id = id,
+        .first = first,
+        .interval = interval,
+        .pos = m_values.size(),
+        .count = values.size(),
+    });
+    m_values.insert(m_values.end(), values.begin(), values.end());
+    return true;
+}
+
+//===========================================================================
+bool DbQueryBuffer::onDbSummary(
+    uint32_t id,
+    const DbSampleSummary & summary
+) {
+    m_events.push_back({
+        .type = kSummary,
+        .id = id,
+        .pos = m_summaries.size(),
+    });
+    m_summaries.push_back(summary);
+    return true;
+}
+
+
 /****************************************************************************
 *
 *   Transactions
@@ -394,22 +1222,38 @@ void DbContext::reset(DbHandle f) {
 ***/
 
 //===========================================================================
-void DbBase::apply(uint32_t id, DbReq && req) {
+bool DbBase::apply(uint32_t id, DbReq && req) {
     DbTxn txn{m_wal, m_page, m_data.metricRootsInstance()};
+    bool queued = true;
+    DbQueryBuffer buf;
+    if (req.type == kGetMetric
+        || req.type == kGetSamples
+        || req.type == kGetSummaries
+    ) {
+        // Queries read from a snapshot and, once they've loaded the metric's
+        // position, leave the queue so that updates to the metric don't
+        // have to wait for them to finish. What they report is held until
+        // the snapshot is known to have had every page version they read.
+        txn.beginSnapshot([&]() { queued = !detach(id); });
+    }
     switch (req.type) {
     case kGetMetric:
-        m_data.getMetricInfo(req.notify, txn, id);
+        m_data.getMetricInfo(&buf, txn, id);
         break;
     case kGetSamples:
         m_data.getSamples(
             txn,
-            req.notify,
+            &buf,
             id,
             req.first,
             req.last,
-            req.presamples
+            req.presamples,
+            req.interval
         );
         break;
+    case kGetSummaries:
+        m_data.getSummaries(txn, &buf, id, req.first, req.last);
+        break;
     case kEraseMetric:
         if (m_data.eraseMetric(&req.name, txn, id)) {
             scoped_lock lk{m_indexMut};
@@ -429,16 +1273,68 @@ void DbBase::apply(uint32_t id, DbReq && req) {
             info.retention = req.retention;
             info.interval = req.interval;
             info.creation = req.first;
-            m_data.updateMetric(txn, id, info);
+            info.rollups = req.rollups;
+            if (m_data.updateMetric(txn, id, info)) {
+                // Populated by requests queued behind this one, a part in
+                // each, so that other updates to the metric aren't held up
+                // for the whole of a long retention.
+                DbReq next;
+                next.type = kBackfillRollups;
+                transact(id, move(next));
+            }
         }
         break;
     case kUpdateSample:
         m_data.updateSample(txn, id, req.first, req.value);
         break;
+    case kUpdateSamples:
+        m_data.updateSamples(txn, id, req.samples);
+        break;
+    case kCompactMetric:
+        m_data.compactMetric(txn, id);
+        break;
+    case kBackfillRollups:
+        if (m_data.rollupBackfill(txn, id)) {
+            DbReq next;
+            next.type = kBackfillRollups;
+            transact(id, move(next));
+        }
+        break;
     }
 
     auto freePages = txn.commit();
     m_data.publishFreePages(freePages);
+    if (!txn.snapshot())
+        return queued;
+
+    if (!txn.snapshotMissed()) {
+        buf.replay(req.notify);
+    } else if (req.retries < kMaxQueryRetries) {
+        // Read it again from a newer snapshot, queued behind any updates to
+        // the metric.
+        s_perfQueryRetries += 1;
+        auto next = req;
+        next.retries += 1;
+        transact(id, move(next));
+    } else {
+        queryFailed(req.notify, id);
+    }
+    return queued;
+}
+
+//===========================================================================
+// Removes the request being processed, which must be the only one, from the
+// metric's queue. Returns false, leaving it queued, if other requests are
+// already waiting behind it.
+bool DbBase::detach(uint32_t id) {
+    auto & bucket = m_reqBuckets[id % kRequestBuckets];
+    scoped_lock lk{bucket.mut};
+    auto & reqs = bucket.requests[id];
+    assert(!reqs.empty());
+    if (reqs.size() > 1)
+        return false;
+    bucket.requests.erase(id);
+    return true;
 }
 
 //===========================================================================
@@ -453,7 +1349,13 @@ bool DbBase::transact(uint32_t id, DbReq && req) {
     while (!reqs.empty()) {
         req = move(reqs.front());
         lk.unlock();
-        apply(id, move(req));
+        auto durable = move(req.durable);
+        if (!apply(id, move(req))) {
+            // Request was detached, and the queue along with it.
+            return true;
+        }
+        if (durable)
+            releaseDurable(durable.get());
         lk.lock();
         reqs.pop_front();
     }
@@ -500,6 +1402,12 @@ bool DbBase::insertMetric(uint32_t * out, string_view name) {
 
         // get metric id
         *out = m_leaf.nextId();
+        if (*out > kMaxMetricId) {
+            logMsgError() << "Metric not inserted, out of metric ids, "
+                << name;
+            *out = 0;
+            return false;
+        }
 
         // update indexes
         m_leaf.insert(*out, name);
@@ -529,6 +1437,7 @@ void DbBase::updateMetric(uint32_t id, const DbMetricInfo & info) {
     req.retention = info.retention;
     req.interval = info.interval;
     req.first = info.creation;
+    req.rollups.assign(info.rollups.begin(), info.rollups.end());
     transact(id, move(req));
 }
 
@@ -589,13 +1498,70 @@ void DbBase::updateSample(uint32_t id, TimePoint time, double value) {
     transact(id, move(req));
 }
 
+//===========================================================================
+void DbBase::updateSamples(
+    span<const DbSampleUpdate> samples,
+    ITaskNotify * durable,
+    TaskQueueHandle hq
+) {
+    // The extra reference, released after all the requests have been made,
+    // keeps the task from being queued while some are still to be made.
+    shared_ptr<DbDurableWait> wait;
+    if (durable) {
+        wait = make_shared<DbDurableWait>();
+        wait->pending = 1;
+        wait->task = durable;
+        wait->hq = hq;
+    }
+
+    // Group by metric, keeping the samples of each metric in their original
+    // order, they're grouped by page when applied. Each metric still gets its
+    // own transaction, its updates are serialized by its request queue and
+    // may be applied by whichever thread is draining it, so a transaction
+    // can't be shared with other metrics.
+    vector<const DbSampleUpdate *> sorted;
+    sorted.reserve(samples.size());
+    for (auto && samp : samples)
+        sorted.push_back(&samp);
+    stable_sort(
+        sorted.begin(),
+        sorted.end(),
+        [](auto & a, auto & b) { return a->id < b->id; }
+    );
+
+    for (auto i = sorted.begin(); i != sorted.end();) {
+        auto id = (*i)->id;
+        DbReq req;
+        req.type = kUpdateSamples;
+        for (; i != sorted.end() && (*i)->id == id; ++i)
+            req.samples.push_back({(*i)->time, (*i)->value});
+        if (wait) {
+            wait->pending += 1;
+            req.durable = wait;
+        }
+        transact(id, move(req));
+    }
+    if (wait)
+        releaseDurable(wait.get());
+}
+
+//===========================================================================
+// Called as each request sharing the wait is applied, which may be by
+// another thread if it was queued behind other requests for the metric. The
+// LSN of the last one applied is at or after those of all the others.
+void DbBase::releaseDurable(DbDurableWait * wait) {
+    if (--wait->pending == 0)
+        m_wal.queueTask(wait->task, m_wal.lastLsn(), wait->hq);
+}
+
 //===========================================================================
 bool DbBase::getSamples(
     IDbDataNotify * notify,
     uint32_t id,
     TimePoint first,
     TimePoint last,
-    unsigned presamples
+    unsigned presamples,
+    Duration minInterval
 ) {
     DbReq req;
     req.type = kGetSamples;
@@ -603,6 +1569,105 @@ bool DbBase::getSamples(
     req.first = first;
     req.last = last;
     req.presamples = presamples;
+    req.interval = minInterval;
+    return transact(id, move(req));
+}
+
+//===========================================================================
+// The metrics are all read from the same snapshot, unless it turns out to be
+// missing a page version, with their positions taken from its pages. So,
+// unlike dbGetSamples(), they're not read through their queues and don't wait
+// for updates queued ahead of them.
+void DbBase::getSamplesMulti(
+    IDbDataNotify * notify,
+    const UnsignedSet & ids,
+    TimePoint first,
+    TimePoint last,
+    unsigned presamples,
+    Duration minInterval
+) {
+    auto newSnapshot = [&]() {
+        auto txn = make_unique<DbTxn>(
+            m_wal,
+            m_page,
+            m_data.metricRootsInstance()
+        );
+        txn->beginSnapshot();
+        return txn;
+    };
+    auto txn = newSnapshot();
+
+    // Metrics are read in batches. While one batch is being read the metric
+    // pages of the next are prefetched, and just before it's read the sample
+    // pages it needs are.
+    auto next = ids.begin();
+    auto nextBatch = [&](vector<uint32_t> * out) {
+        out->clear();
+        for (; next != ids.end() && out->size() < kPrefetchMetrics; ++next)
+            out->push_back(*next);
+        m_data.prefetchMetrics(*txn, *out, minInterval);
+    };
+    vector<uint32_t> batch;
+    vector<uint32_t> pending;
+    DbQueryBuffer buf;
+    nextBatch(&pending);
+    while (!pending.empty()) {
+        swap(batch, pending);
+        nextBatch(&pending);
+        m_data.prefetchSamples(
+            *txn,
+            batch,
+            first,
+            last,
+            presamples,
+            minInterval
+        );
+        for (auto && id : batch) {
+            for (unsigned retries = 0;; ++retries) {
+                buf.clear();
+                {
+                    // Copies of the pages read for it are released after.
+                    DbTxn::PinScope pins(*txn);
+                    m_data.getSnapshotSamples(
+                        *txn,
+                        &buf,
+                        id,
+                        first,
+                        last,
+                        presamples,
+                        minInterval
+                    );
+                }
+                if (!txn->snapshotMissed()) {
+                    buf.replay(notify);
+                    break;
+                }
+
+                // The metric, and those after it, are read from a newer
+                // snapshot.
+                txn = newSnapshot();
+                if (retries == kMaxQueryRetries) {
+                    queryFailed(notify, id);
+                    break;
+                }
+                s_perfQueryRetries += 1;
+            }
+        }
+    }
+}
+
+//===========================================================================
+bool DbBase::getSummaries(
+    IDbDataNotify * notify,
+    uint32_t id,
+    TimePoint first,
+    TimePoint last
+) {
+    DbReq req;
+    req.type = kGetSummaries;
+    req.notify = notify;
+    req.first = first;
+    req.last = last;
     return transact(id, move(req));
 }
 
@@ -617,10 +1682,11 @@ bool DbBase::getSamples(
 DbHandle dbOpen(
     string_view name,
     EnumFlags<DbOpenFlags> flags,
-    size_t pageSize
+    size_t pageSize,
+    const DbMapOptions & mapOpts
 ) {
     auto db = make_unique<DbBase>();
-    if (!db->open(name, flags, pageSize))
+    if (!db->open(name, flags, pageSize, mapOpts))
         return DbHandle{};
 
     scoped_lock lk{s_mut};
@@ -645,6 +1711,7 @@ const TokenTable::Token s_sampleTypes[] = {
     { kSampleTypeInt8,      "int8" },
     { kSampleTypeInt16,     "int16" },
     { kSampleTypeInt32,     "int32" },
+    { kSampleTypePacked,    "packed" },
 };
 static_assert(size(s_sampleTypes) == kSampleTypes - 1);
 const TokenTable s_sampleTypeTbl{s_sampleTypes};
@@ -676,7 +1743,97 @@ void dbBlockCheckpoint(IDbProgressNotify * notify, DbHandle h, bool enable) {
 
 //===========================================================================
 bool dbBackup(IDbProgressNotify * notify, DbHandle h, string_view dst) {
-    return db(h)->backup(notify, dst);
+    return db(h)->backup(notify, dst, {});
+}
+
+//===========================================================================
+bool dbBackupIncremental(
+    IDbProgressNotify * notify,
+    DbHandle h,
+    string_view dst,
+    string_view prev
+) {
+    assert(!prev.empty());
+    return db(h)->backup(notify, dst, prev);
+}
+
+//===========================================================================
+bool dbScrub(
+    IDbProgressNotify * notify,
+    DbHandle h,
+    size_t maxBytesPerSec
+) {
+    return db(h)->scrub(notify, maxBytesPerSec);
+}
+
+//===========================================================================
+bool dbCompact(IDbProgressNotify * notify, DbHandle h) {
+    return db(h)->compact(notify);
+}
+
+//===========================================================================
+bool dbRestore(string_view dst, span<const string> backups) {
+    using enum File::OpenMode;
+    if (backups.empty())
+        return false;
+
+    // Verify that the backups form a chain before anything is written.
+    vector<FileHandle> deltas;
+    Finally deltasFin([&]() {
+        for (auto && f : deltas)
+            fileClose(f);
+    });
+    vector<BackupTrailer> trailers;
+    for (auto && stem : backups) {
+        auto path = Path(stem).setExt("tsb");
+        auto & f = deltas.emplace_back();
+        fileOpen(&f, path, fReadOnly | fBlocking | fDenyNone | fSequential);
+        BackupTrailer trailer;
+        if (!f || !loadBackupTrailer(&trailer, f)) {
+            logMsgError() << "Invalid backup, " << path;
+            return false;
+        }
+        if (trailers.empty()
+            ? trailer.incremental
+            : !trailer.incremental
+                || trailer.baseLsn != trailers.back().lsn
+                || trailer.pageSize != trailers.back().pageSize
+        ) {
+            logMsgError() << "Backup out of sequence, " << path;
+            return false;
+        }
+        trailers.push_back(trailer);
+    }
+
+    // Data file from the full backup, updated by each incremental backup, and
+    // the WAL from the last one.
+    auto datafile = Path(dst).setExt("tsd");
+    auto walfile = Path(dst).setExt("tsl");
+    if (!copyBackupFile(datafile, Path(backups.front()).setExt("tsd")))
+        return false;
+    if (trailers.size() > 1) {
+        FileHandle fdata;
+        fileOpen(&fdata, datafile, fReadWrite | fDenyWrite | fBlocking);
+        if (!fdata) {
+            logMsgError() << "Open failed, " << datafile;
+            return false;
+        }
+        Finally fdataFin([&]() { fileClose(fdata); });
+        for (size_t i = 1; i < trailers.size(); ++i) {
+            if (!applyBackupDelta(fdata, deltas[i], trailers[i]))
+                return false;
+        }
+    }
+    if (!copyBackupFile(walfile, Path(backups.back()).setExt("tsl")))
+        return false;
+
+    // A metric index snapshot left by a previous database isn't valid for
+    // the restored one.
+    auto indexfile = Path(dst).setExt("tsi");
+    bool found = false;
+    if (fileExists(&found, indexfile); found)
+        fileRemove(indexfile);
+    return true;
 }
 
 //===========================================================================
@@ -740,6 +1897,16 @@ void dbUpdateSample(
     db(h)->updateSample(id, time, value);
 }
 
+//===========================================================================
+void dbUpdateSamples(
+    DbHandle h,
+    span<const DbSampleUpdate> samples,
+    ITaskNotify * durable,
+    TaskQueueHandle hq
+) {
+    db(h)->updateSamples(samples, durable, hq);
+}
+
 //===========================================================================
 bool dbGetSamples(
     IDbDataNotify * notify,
@@ -747,9 +1914,48 @@ bool dbGetSamples(
     uint32_t id,
     TimePoint first,
     TimePoint last,
-    unsigned presamples
+    unsigned presamples,
+    Duration minInterval
+) {
+    return db(h)->getSamples(
+        notify,
+        id,
+        first,
+        last,
+        presamples,
+        minInterval
+    );
+}
+
+//===========================================================================
+void dbGetSamplesMulti(
+    IDbDataNotify * notify,
+    DbHandle h,
+    const UnsignedSet & ids,
+    TimePoint first,
+    TimePoint last,
+    unsigned presamples,
+    Duration minInterval
+) {
+    db(h)->getSamplesMulti(
+        notify,
+        ids,
+        first,
+        last,
+        presamples,
+        minInterval
+    );
+}
+
+//===========================================================================
+bool dbGetSummaries(
+    IDbDataNotify * notify,
+    DbHandle h,
+    uint32_t id,
+    TimePoint first,
+    TimePoint last
 ) {
-    return db(h)->getSamples(notify, id, first, last, presamples);
+    return db(h)->getSummaries(notify, id, first, last);
 }
 
 
@@ -9,7 +9,10 @@
 #include "core/core.h"
 #include "file/file.h"
 
+#include <cmath>
 #include <limits>
+#include <span>
+#include <string>
 #include <string_view>
 
 // forward declarations
@@ -30,21 +33,84 @@ enum DbOpenFlags : unsigned {
     fDbOpenExcl = 0x04,
     fDbOpenVerbose = 0x08,  // Log database status info messages
     fDbOpenReadOnly = 0x10,
+    // Metric positions are loaded when first used instead of at open, and
+    // those not recently updated are dropped when there are too many loaded.
+    fDbOpenLazyMetrics = 0x20,
+    // Checksums of data pages are verified when they're first read from the
+    // data file, bad pages are logged.
+    fDbOpenVerifyPages = 0x40,
+    // Follow a database that another process has open for update, applying
+    // the updates it logs as they become durable. Implies read only and lazy
+    // metrics, and allows only queries.
+    fDbOpenFollow = 0x80,
 };
+
+// Expected pattern of access to pages, used as a hint to the OS.
+enum DbMapAccess : int8_t {
+    // Not given, leaves the hint unchanged, or the default when opening.
+    kMapAccessUnset = 0,
+    kMapAccessDefault = 1,
+    kMapAccessRandom = 2,
+    kMapAccessSequential = 3,
+};
+
+// How the data and work files are memory mapped. Zero values use defaults.
+// The populate, huge page, and access hints are ignored on platforms without
+// support for them.
+struct DbMapOptions {
+    // Size of each view that's added as the files grow, rounded up to a
+    // multiple of the page size and of fileViewAlignment().
+    size_t viewSize;
+
+    // Fault in the existing pages of the files while opening them.
+    bool populate;
+
+    // Ask that the work file be backed by transparent huge pages.
+    bool hugePages;
+
+    DbMapAccess dataAccess;
+    DbMapAccess workAccess;
+};
+
 // 'pageSize' is only used if new files are being created, use 0 for the same
 // size as system memory pages.
 DbHandle dbOpen(
     std::string_view path,
     Dim::EnumFlags<DbOpenFlags> flags = {},
-    size_t pageSize = 0
+    size_t pageSize = 0,
+    const DbMapOptions & mapOpts = {}
 );
 
 void dbClose(DbHandle h);
 
+// When partially filled WAL pages are written, and therefore how long it
+// takes for updates to become durable.
+enum DbWalFlush : int8_t {
+    kWalFlushDefault = 0,
+    // Written as soon as no other write of the page is in progress, records
+    // added during a write are grouped into the next one.
+    kWalFlushLowLatency = 1,
+    // Written when the unwritten part reaches walFlushBytes, or after
+    // walFlushLatency if that happens first.
+    kWalFlushThroughput = 2,
+    // Written in time for records to be durable within walFlushLatency of
+    // being added, allowing for how long writes have been taking.
+    kWalFlushFixedLatency = 3,
+};
+
 // Setting a parameter to zero causes that specific parameter to be unchanged.
 struct DbConfig {
     Dim::Duration checkpointMaxInterval;
     size_t checkpointMaxData;
+    // Defaults to fixed latency of 500ms
+    DbWalFlush walFlush;
+    Dim::Duration walFlushLatency;
+    size_t walFlushBytes;
+    // Only used with fDbOpenLazyMetrics
+    size_t maxLoadedMetrics;
+    // Replaces the access hints given to dbOpen
+    DbMapAccess dataAccess;
+    DbMapAccess workAccess;
 };
 void dbConfigure(DbHandle h, const DbConfig & conf);
 
@@ -55,6 +121,11 @@ enum DbSampleType : int8_t {
     kSampleTypeInt8    = 3,
     kSampleTypeInt16   = 4,
     kSampleTypeInt32   = 5,
+
+    // Float64 values stored as a compressed stream (see DbPack), pages hold
+    // more samples but may spill over into additional pages.
+    kSampleTypePacked  = 6,
+
     kSampleTypes,
 };
 const char * toString(DbSampleType type, const char def[] = nullptr);
@@ -116,18 +187,32 @@ bool dbGetMetricInfo(
 );
 
 // Returns true if inserted, false if it already existed, sets out either way.
+// If there are no more metric ids out is set to 0, which is never the id of a
+// metric.
 bool dbInsertMetric(uint32_t * out, DbHandle h, std::string_view name);
 
 void dbEraseMetric(DbHandle h, uint32_t id);
 
+// Lower resolution archive of a metric's samples, each of its samples is the
+// average of the metric's samples within its interval.
+struct DbMetricRollup {
+    Dim::Duration retention{};
+    Dim::Duration interval{};
+};
 struct DbMetricInfo {
     std::string_view name;
     DbSampleType type{kSampleTypeInvalid};
     Dim::Duration retention{};
     Dim::Duration interval{};
     Dim::TimePoint creation;
+
+    // Intervals must be increasing, each a multiple of the one before it and
+    // of the metric's interval. Existing rollups are kept when empty, a single
+    // rollup without an interval removes them.
+    std::span<const DbMetricRollup> rollups;
 };
-// Removes all existing data when type, retention, or interval are changed.
+// Removes all existing data when type, retention, or interval are changed,
+// and the data of rollups that are changed.
 void dbUpdateMetric(
     DbHandle h,
     uint32_t id,
@@ -156,6 +241,24 @@ void dbUpdateSample(
     double value
 );
 
+struct DbSampleUpdate {
+    uint32_t id;
+    Dim::TimePoint time;
+    double value;
+};
+// Same as calling dbUpdateSample for each of the samples, but the samples of
+// each metric are applied together in a single transaction, in time order.
+// Updates to the same sample of a metric are applied in the order given.
+//
+// If 'durable' is given it's queued to 'hq' (defaults to the compute queue)
+// once all of the updates are durable, which may be before this returns.
+void dbUpdateSamples(
+    DbHandle h,
+    std::span<const DbSampleUpdate> samples,
+    Dim::ITaskNotify * durable = nullptr,
+    Dim::TaskQueueHandle hq = {}
+);
+
 struct DbSeriesInfo {
     bool infoEx{false};
     DbSampleType type{kSampleTypeInvalid};
@@ -172,6 +275,18 @@ struct DbSeriesInfoEx : DbSeriesInfo {
     Dim::Duration retention{};
     Dim::TimePoint creation;
 };
+// Aggregates of the samples within a time range, min, max, firstValue, and
+// lastValue are undefined when there are no samples.
+struct DbSampleSummary {
+    Dim::TimePoint first;
+    Dim::TimePoint last; // time of first interval after the end
+    unsigned count{0};
+    double sum{0};
+    double min{0};
+    double max{0};
+    double firstValue{0};
+    double lastValue{0};
+};
 struct IDbDataNotify {
     virtual ~IDbDataNotify() = default;
 
@@ -190,15 +305,72 @@ struct IDbDataNotify {
     ) {
         return false;
     }
+
+    // Called with runs of samples at consecutive intervals, with NANs for
+    // those that are missing, instead of onDbSample for each. The default
+    // forwards each sample that isn't NAN to onDbSample.
+    virtual bool onDbSamples(
+        uint32_t id,
+        Dim::TimePoint first,
+        Dim::Duration interval,
+        std::span<const double> values
+    ) {
+        for (auto && value : values) {
+            if (!std::isnan(value) && !onDbSample(id, first, value))
+                return false;
+            first += interval;
+        }
+        return true;
+    }
+
+    // Called by dbGetSummaries() for each sample page with samples in the
+    // range, return false to abort the enum, otherwise it continues to the
+    // next page.
+    virtual bool onDbSummary(
+        uint32_t id,
+        const DbSampleSummary & summary
+    ) {
+        return false;
+    }
 };
 // Returns true if it completed synchronously, false if the request was queued.
+//
+// If minInterval is set the samples may come from the coarsest of the metric's
+// rollups with an interval no greater than it that covers the range.
 bool dbGetSamples(
     IDbDataNotify * notify,
     DbHandle h,
     uint32_t id,
     Dim::TimePoint first = {},
     Dim::TimePoint last = Dim::TimePoint::max(),
-    unsigned presamples = 0
+    unsigned presamples = 0,
+    Dim::Duration minInterval = {}
+);
+
+// Same as calling dbGetSamples() for each of the metrics, except that it
+// returns after they've all been reported, in order, and their pages are read
+// ahead of when they're needed. The metrics are read from the same snapshot,
+// without waiting for updates queued to them that it doesn't include.
+void dbGetSamplesMulti(
+    IDbDataNotify * notify,
+    DbHandle h,
+    const Dim::UnsignedSet & ids,
+    Dim::TimePoint first = {},
+    Dim::TimePoint last = Dim::TimePoint::max(),
+    unsigned presamples = 0,
+    Dim::Duration minInterval = {}
+);
+
+// Reports a summary of the samples of each page in the range, pages at the
+// ends of the range that are only partly within it are summarized from just
+// the samples that are. Returns true if it completed synchronously, false if
+// the request was queued.
+bool dbGetSummaries(
+    IDbDataNotify * notify,
+    DbHandle h,
+    uint32_t id,
+    Dim::TimePoint first = {},
+    Dim::TimePoint last = Dim::TimePoint::max()
 );
 
 
@@ -217,6 +389,9 @@ struct DbProgressInfo {
     size_t totalBytes{(size_t) -1};
     size_t files{0};
     size_t totalFiles{(size_t) -1};
+    size_t pages{0};
+    size_t totalPages{(size_t) -1};
+    size_t badPages{0};
 };
 struct IDbProgressNotify {
     virtual ~IDbProgressNotify() = default;
@@ -226,9 +401,44 @@ struct IDbProgressNotify {
     ) = 0;
 };
 
+// Copies the data file and WAL to files named after 'dst', along with a small
+// .tsb file that incremental backups can follow. Checkpoints are blocked only
+// while the WAL is copied, the data file is copied as it was at that time.
 // Returns false if backup is already running.
 bool dbBackup(IDbProgressNotify * notify, DbHandle h, std::string_view dst);
 
+// Saves only the data pages changed since the full or incremental backup at
+// 'prev' to 'dst' (.tsb), along with a copy of the WAL. Returns false if
+// backup is already running or 'prev' isn't a complete backup.
+bool dbBackupIncremental(
+    IDbProgressNotify * notify,
+    DbHandle h,
+    std::string_view dst,
+    std::string_view prev
+);
+
+// Recreates the database at 'dst' from a full backup followed by the
+// incremental backups made after it, in the order they were made. Returns
+// false, after logging the reason, if they aren't a complete chain. The
+// database must not be open.
+bool dbRestore(std::string_view dst, std::span<const std::string> backups);
+
+// Reads every page of the data file in the background, at no more than the
+// rate (0 for default), and verifies its checksum. Bad pages are logged and
+// counted in the progress info. Returns false if a scrub is already running.
+bool dbScrub(
+    IDbProgressNotify * notify,
+    DbHandle h,
+    size_t maxBytesPerSec = 0
+);
+
+// Moves pages from the end of the data file into free pages nearer its start
+// and then, once the moves are safely checkpointed, truncates the no longer
+// used end of the data and work files. Runs in the background, progress is
+// reported as metrics whose pages were moved and pages removed. Returns false
+// if a compaction is already running.
+bool dbCompact(IDbProgressNotify * notify, DbHandle h);
+
 void dbBlockCheckpoint(IDbProgressNotify * notify, DbHandle h, bool enable);
 
 
@@ -292,6 +502,7 @@ enum class DbPageType : int32_t {
     kMetric = 'm',
     kRadix = 'r',
     kSample = 's',
+    kSampleRuns = 'u',
     kTrie = 't',
     kBitmap = 'b',
 };
@@ -9,6 +9,16 @@ using namespace std;
 using namespace Dim;
 
 
+/****************************************************************************
+*
+*   Tuning parameters
+*
+***/
+
+// Number of pages reserved at a time for the exclusive use of a metric.
+const unsigned kExtentPages = 16;
+
+
 /****************************************************************************
 *
 *   Private
@@ -20,7 +30,12 @@ constexpr auto kDefaultRootStoreRoot = (pgno_t) 1;
 constexpr auto kRootRootId = 1;
 constexpr auto kRootNameRootId = 2;
 
-const auto kDataFileSig = "66b1e542-541c-4c52-9f61-0cb805980075"_Guid;
+const auto kDataFileSig = "024d3b02-ec30-43e5-a2cc-f9b432277b9a"_Guid;
+
+// Data files from before sample pages had summaries, they're still opened and
+// updated, with their samples pages kept as they were.
+const auto kDataFileSigNoSummaries =
+    "66b1e542-541c-4c52-9f61-0cb805980075"_Guid;
 
 #pragma pack(push, 1)
 
@@ -51,6 +66,7 @@ struct DbData::FreePage {
 static auto & s_perfPages = uperf("db.data pages (total)");
 static auto & s_perfFreePages = uperf("db.data pages (free)");
 static auto & s_perfDepPages = uperf("db.data pages (deprecated)");
+static auto & s_perfMovedPages = uperf("db.data pages moved");
 
 
 /****************************************************************************
@@ -347,8 +363,11 @@ static size_t queryPageSize(FileHandle f) {
         return 0;
     if (zp.hdr.type != zp.kPageType)
         return 0;
-    if (zp.signature != kDataFileSig)
+    if (zp.signature != kDataFileSig
+        && zp.signature != kDataFileSigNoSummaries
+    ) {
         return 0;
+    }
     return zp.pageSize;
 }
 
@@ -369,14 +388,26 @@ DbData::DbData() {
 //===========================================================================
 DbData::~DbData () {
     metricClearCounters();
+    for (auto && pos : m_rollupPos)
+        delete pos.load();
     s_perfPages -= (unsigned) m_numPages;
     s_perfFreePages -= (unsigned) m_numFree;
 }
 
 //===========================================================================
-void DbData::openForApply(size_t pageSize, EnumFlags<DbOpenFlags> flags) {
+void DbData::openForApply(
+    size_t pageSize,
+    EnumFlags<DbOpenFlags> flags,
+    const DbPageHeader * zeroPage
+) {
     m_verbose = flags.any(fDbOpenVerbose);
     m_pageSize = pageSize;
+
+    // New data files, whose zero page hasn't been written yet, get the
+    // current layout.
+    auto zp = reinterpret_cast<const ZeroPage *>(zeroPage);
+    m_pageSummaries = zp->hdr.type != zp->kPageType
+        || zp->signature != kDataFileSigNoSummaries;
 }
 
 //===========================================================================
@@ -384,11 +415,14 @@ bool DbData::openForUpdate(
     DbTxn & txn,
     IDbDataNotify * notify,
     string_view name,
-    EnumFlags<DbOpenFlags> flags
+    EnumFlags<DbOpenFlags> flags,
+    string_view indexName,
+    Lsn lsn
 ) {
     assert(m_pageSize);
     m_verbose = flags.any(fDbOpenVerbose);
     m_readOnly = flags.any(fDbOpenReadOnly);
+    m_lazyPos = flags.any(fDbOpenLazyMetrics);
 
     auto zp = txn.pin<ZeroPage>(kZeroPageNum);
     if (zp->hdr.type == DbPageType::kInvalid) {
@@ -396,7 +430,9 @@ bool DbData::openForUpdate(
         zp = txn.pin<ZeroPage>(kZeroPageNum);
     }
 
-    if (zp->signature != kDataFileSig) {
+    if (zp->signature
+        != (m_pageSummaries ? kDataFileSig : kDataFileSigNoSummaries)
+    ) {
         logMsgError() << "Bad signature, " << name;
         return false;
     }
@@ -429,14 +465,29 @@ bool DbData::openForUpdate(
     );
     m_metricRoots.load()->name = nameRoot;
 
-    if (m_verbose)
-        logMsgInfo() << "Build metric index";
-    if (!loadMetrics(txn, notify))
+    bool loaded;
+    if (!loadMetricIndex(&loaded, notify, indexName, lsn))
         return false;
+    if (!loaded) {
+        if (m_verbose)
+            logMsgInfo() << "Build metric index";
+        if (!loadMetrics(txn, notify))
+            return false;
+    }
 
     return true;
 }
 
+//===========================================================================
+void DbData::configure(const DbConfig & conf) {
+    if (conf.maxLoadedMetrics) {
+        unique_lock lk{m_mposMut};
+        m_maxLoadedPos = conf.maxLoadedMetrics;
+        if (m_lazyPos && m_numLoaded > m_maxLoadedPos)
+            evictMetricPos_LK();
+    }
+}
+
 //===========================================================================
 DbStats DbData::queryStats() const {
     DbStats s;
@@ -763,6 +814,8 @@ pgno_t DbData::allocPgno(DbTxn & txn) {
         pgno = (pgno_t) m_numPages;
     }
     if (pgno >= m_numPages) {
+        // Pages in extents are always inside the file, so any free pages past
+        // the end are contiguous with it.
         assert(pgno == m_numPages);
         // This is a new page at the end of the file, either previously
         // untracked or tracked as a "free" page. See the description in
@@ -792,14 +845,121 @@ pgno_t DbData::allocPgno(DbTxn & txn) {
     // Return with the newly allocated page pinned.
     [[maybe_unused]] auto p = txn.pin<DbPageHeader>(pgno);
     assert(grew && p->type == DbPageType::kInvalid
-        || !grew && p->type == DbPageType::kFree
+        || !grew && (p->type == DbPageType::kFree
+            || p->type == DbPageType::kInvalid)
     );
     pins.keep(pgno);
     return pgno;
 }
 
 //===========================================================================
-void DbData::freePage(DbTxn & txn, pgno_t pgno) {
+pgno_t DbData::allocMetricPgno(DbTxn & txn, uint32_t id) {
+    scoped_lock lk{m_pageMut};
+    auto i = m_extents.find(id);
+    if (i == m_extents.end()) {
+        size_t count = 0;
+        {
+            DbTxn::PinScope pins(txn);
+            count = min<size_t>(metricRingPages(txn, id), kExtentPages);
+        }
+        if (count <= 1) {
+            // Not worth reserving pages for, yet.
+            return allocPgno(txn);
+        }
+        i = m_extents.emplace(id, UnsignedSet{}).first;
+        DbTxn::PinScope pins(txn);
+        reserveExtent_LK(txn, &i->second, count);
+    }
+
+    DbTxn::PinScope pins(txn);
+    auto pgno = (pgno_t) i->second.pop_front();
+    assert(pgno < m_numPages);
+    if (!i->second) {
+        // Only metrics with unused reserved pages are tracked.
+        m_extents.erase(i);
+    }
+
+    // Remove from free page index, which may recursively allocate (and free)
+    // other pages, but never from an extent.
+    [[maybe_unused]] bool updated =
+        bitAssign(txn, m_freeRoot, 0, pgno, pgno + 1, false);
+    assert(updated);
+
+    // Return with the newly allocated page pinned.
+    [[maybe_unused]] auto p = txn.pin<DbPageHeader>(pgno);
+    assert(p->type == DbPageType::kFree || p->type == DbPageType::kInvalid);
+    pins.keep(pgno);
+    return pgno;
+}
+
+//===========================================================================
+// Reserves the first run of free pages that's long enough, or, if there
+// isn't one, grows the file by a new run of free pages.
+void DbData::reserveExtent_LK(DbTxn & txn, UnsignedSet * out, size_t count) {
+    assert(!*out && count);
+    auto first = (pgno_t) m_numPages;
+    for (auto i = m_freePages.begin(); i != m_freePages.end();) {
+        auto last = *m_freePages.lastContiguous(i);
+        if (last - *i + 1 >= count) {
+            // While compacting, runs that reach past the compaction limit
+            // are left alone.
+            auto limit = m_compactLimit.load();
+            if (!limit || *i + count <= limit) {
+                first = (pgno_t) *i;
+                break;
+            }
+        }
+        i = m_freePages.lowerBound(last + 1);
+    }
+    auto last = first + count;
+    out->insert(first, (unsigned) count);
+
+    // Take the pages out of the general pool of free pages.
+    if (auto num = m_freePages.count(first, (unsigned) count)) {
+        m_freePages.erase(*out);
+        m_numFree -= num;
+        s_perfFreePages -= (unsigned) num;
+    }
+
+    // Keep all reserved pages inside the file, so other allocations can still
+    // only grow it with the page at the very end.
+    auto grow = m_numPages;
+    while (m_numPages < last) {
+        txn.growToFit((pgno_t) m_numPages);
+        m_numPages += 1;
+        s_perfPages += 1;
+    }
+
+    // Pages added to the end of the file may not be in the free page index
+    // yet, reassigning any that already are leaves them unchanged. Updated
+    // one bitmap page at a time, since each may need to be allocated.
+    if (grow < last) {
+        auto bpp = bitsPerPage();
+        for (auto pos = max<size_t>(grow, first); pos < last;) {
+            auto next = min<size_t>(last, (pos / bpp + 1) * bpp);
+            bitAssign(txn, m_freeRoot, 0, pos, next, true);
+            pos = next;
+        }
+    }
+}
+
+//===========================================================================
+// Return unused pages reserved for a metric, that's being removed, to the
+// general pool of free pages.
+void DbData::releaseExtent_LK(uint32_t id) {
+    auto i = m_extents.find(id);
+    if (i == m_extents.end())
+        return;
+    if (auto num = i->second.count()) {
+        m_freePages.insert(i->second);
+        m_numFree += num;
+        s_perfFreePages += (unsigned) num;
+    }
+    m_extents.erase(i);
+}
+
+//===========================================================================
+void DbData::freePage(DbTxn & txn, pgno_t pgno, bool destruct) {
     scoped_lock lk{m_pageMut};
     DbTxn::PinScope pins(txn);
 
@@ -808,13 +968,24 @@ void DbData::freePage(DbTxn & txn, pgno_t pgno) {
     auto type = p->type;
     switch (type) {
     case DbPageType::kMetric:
-        metricDestructPage(txn, pgno);
+        if (destruct)
+            metricDestructPage(txn, pgno);
         break;
     case DbPageType::kRadix:
-        radixDestructPage(txn, pgno);
+        if (destruct)
+            radixDestructPage(txn, pgno);
         break;
-    case DbPageType::kBitmap:
     case DbPageType::kSample:
+        if (destruct)
+            sampleDestructPage(txn, pgno);
+        break;
+    case DbPageType::kSampleRuns:
+        // Shared by the radix entries of several sample pages, only freed
+        // when the last of them is released.
+        if (destruct && sampleRunsRelease(txn, pgno))
+            return;
+        break;
+    case DbPageType::kBitmap:
         break;
     case DbPageType::kTrie:
         // Trie pages aren't destroyed recursively because pages may be deleted
@@ -910,6 +1081,124 @@ void DbData::freeDeprecatedPage(DbTxn & txn, pgno_t pgno) {
 }
 
 
+/****************************************************************************
+*
+*   Compaction
+*
+***/
+
+//===========================================================================
+// Sets the compaction limit and returns the pages at or after it that aren't
+// free. Unused pages of extents past the limit are returned to the general
+// pool of free pages, from which they won't be reused while there are free
+// pages before it.
+pgno_t DbData::compactLimit(UnsignedSet * tail, pgno_t minPages) {
+    scoped_lock lk{m_pageMut};
+    auto numFree = m_freePages.count(0, m_numPages);
+    for (auto && [id, ext] : m_extents)
+        numFree += ext.count();
+    // No pages are moved out of the part of the file that can't be truncated.
+    auto limit = (pgno_t) max<size_t>(m_numPages - numFree, 1);
+    limit = max(limit, minPages);
+    m_compactLimit = limit;
+
+    tail->clear();
+    if (limit >= m_numPages)
+        return limit;
+    tail->insert(limit, unsigned(m_numPages - limit));
+    for (auto && [id, ext] : m_extents) {
+        UnsignedSet pages = ext;
+        pages.intersect(*tail);
+        if (auto num = pages.count()) {
+            ext.erase(pages);
+            m_freePages.insert(pages);
+            m_numFree += num;
+            s_perfFreePages += (unsigned) num;
+        }
+    }
+    tail->erase(m_freePages);
+    return limit;
+}
+
+//===========================================================================
+// Raises the limit to just after a page that compaction can't move.
+void DbData::compactRaiseLimit(pgno_t limit) {
+    scoped_lock lk{m_pageMut};
+    if (limit > m_compactLimit)
+        m_compactLimit = limit;
+}
+
+//===========================================================================
+// Copies the page to the first free page and frees the original, but not
+// the pages it references. Returns the page it was copied to, or 0 if there
+// are no free pages before the compaction limit left to copy it to.
+pgno_t DbData::compactMovePage(DbTxn & txn, pgno_t pgno) {
+    scoped_lock lk{m_pageMut};
+    DbTxn::PinScope pins(txn);
+
+    if (!m_freePages || m_freePages.front() >= m_compactLimit)
+        return {};
+    auto npno = allocPgno(txn);
+    assert(npno < pgno);
+    auto p = txn.pin<DbPageHeader>(pgno);
+    txn.walFullPageInit(
+        npno,
+        p->type,
+        p->id,
+        {reinterpret_cast<const uint8_t *>(p + 1), m_pageSize - sizeof *p}
+    );
+    freePage(txn, pgno, false);
+    s_perfMovedPages += 1;
+    return npno;
+}
+
+//===========================================================================
+size_t DbData::compactTruncate(DbTxn & txn) {
+    scoped_lock lk{m_pageMut};
+    auto limit = m_compactLimit.load();
+    assert(limit);
+    if (limit >= m_numPages)
+        return 0;
+
+    // Truncate the run of free pages at the end of the file, as far as the
+    // page cache allows.
+    auto i = m_freePages.find(unsigned(m_numPages - 1));
+    if (!i)
+        return m_numPages - limit;
+    auto first = max((pgno_t) *i.firstContiguous(), limit);
+    auto count = txn.truncate(first);
+    if (count >= m_numPages)
+        return m_numPages - limit;
+
+    // Free page entries past the new end, including any already past the old
+    // end, are removed from the free page index. Updated one bitmap page at a
+    // time, removing the last entry of a bitmap page frees it.
+    auto last = *m_freePages.lastContiguous(i) + 1;
+    auto num = last - count;
+    m_freePages.erase((unsigned) count, num);
+    m_numFree -= num;
+    s_perfFreePages -= num;
+    auto trimmed = unsigned(m_numPages - count);
+    s_perfPages -= trimmed;
+    m_numPages = count;
+    auto bpp = bitsPerPage();
+    for (size_t pos = count; pos < last;) {
+        auto next = min<size_t>(last, (pos / bpp + 1) * bpp);
+        bitAssign(txn, m_freeRoot, 0, pos, next, false);
+        pos = next;
+    }
+    if (m_verbose)
+        logMsgInfo() << "Truncated " << trimmed << " free pages";
+    return limit >= m_numPages ? 0 : m_numPages - limit;
+}
+
+//===========================================================================
+void DbData::compactEnd() {
+    scoped_lock lk{m_pageMut};
+    m_compactLimit = {};
+}
+
+
 /****************************************************************************
 *
 *   Trie indexes
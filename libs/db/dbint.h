@@ -19,6 +19,22 @@ static_assert(kDefaultPageSize % kMinPageSize == 0);
 
 constexpr unsigned kMaxActiveRootUpdates = 4;
 
+// Rollups are stored as metrics whose ids have the rollup's level, starting
+// at 1 for the finest, in the high bits of the metric's id. Metrics must
+// therefore have ids no greater than kMaxMetricId.
+constexpr unsigned kRollupLevelBits = 3;
+constexpr uint32_t kMaxMetricId = (1u << (32 - kRollupLevelBits)) - 1;
+constexpr unsigned kMaxRollups = (1u << kRollupLevelBits) - 1;
+
+// Metric positions are kept in segments of 2^bits entries, enough segments
+// to cover all metric ids. Rollups have the same, one set per level.
+constexpr unsigned kMetricPosSegmentBits = 14;
+constexpr unsigned kMaxMetricPosSegments = 1u << 15;
+
+// Metric positions kept loaded, when metrics are loaded lazily, before idle
+// ones are evicted.
+constexpr size_t kDefaultMaxLoadedMetrics = 1'000'000;
+
 
 /****************************************************************************
 *
@@ -49,9 +65,28 @@ class DbFileView {
 public:
     ~DbFileView();
 
-    bool open(Dim::FileHandle file, size_t viewSize, size_t pageSize);
+    // Only the populate and huge page options are used, the view size is
+    // given separately and access hints are set with advise.
+    bool open(
+        Dim::FileHandle file,
+        size_t viewSize,
+        size_t pageSize,
+        const DbMapOptions & opts = {}
+    );
     void close();
+    void advise(DbMapAccess access);
+
+    // Not thread safe with respect to other calls to growToFit, but pointers
+    // to pages that were already in the view may be safely retrieved while
+    // it's growing.
     void growToFit(pgno_t pgno);
+    // Shrinks the file to the number of pages, but never to less than the
+    // minimum size of the first view, leaving the views mapped. Pages past the
+    // new end must not be used until they're regrown. Returns the new number
+    // of pages, or npos if the file can't be shrunk.
+    pgno_t truncate(pgno_t count);
+    // Fewest pages the file can be truncated to, npos if it can't be.
+    pgno_t minPages() const;
 
     const void * rptr(pgno_t pgno) const;
     size_t pageSize() const { return m_pageSize; }
@@ -66,14 +101,28 @@ protected:
         : Dim::File::View::kReadOnly;
     size_t minFirstSize() const;
     Pointer ptr(pgno_t pgno) const;
+    void adviseView(Pointer view, size_t len) const;
 
 private:
     Dim::FileHandle m_file;
     size_t m_firstViewSize = 0;
     Pointer m_view = nullptr;
-    std::vector<Pointer> m_views;
+
+    // Additional views, in a table that's replaced with a larger copy when
+    // full. Replaced tables are kept until close since lookups, which don't
+    // lock, may still be using them.
+    std::atomic<Pointer *> m_views;
+    std::atomic<size_t> m_numViews;
+    size_t m_maxViews = 0;
+    std::vector<std::unique_ptr<Pointer[]>> m_viewTables;
+
     size_t m_viewSize = 0;
     size_t m_pageSize = 0;
+    bool m_hugePages = false;
+    std::atomic<DbMapAccess> m_access = kMapAccessDefault;
+
+    // Size of the file, if it has been truncated to less than its views.
+    uint64_t m_truncSize = 0;
 };
 
 class DbReadView : public DbFileView<false>
@@ -101,18 +150,55 @@ public:
         std::string_view workfile,
         size_t pageSize,
         size_t walPageSize,
-        Dim::EnumFlags<DbOpenFlags> flags
+        Dim::EnumFlags<DbOpenFlags> flags,
+        const DbMapOptions & mapOpts = {}
     );
     void close();
     DbConfig configure(const DbConfig & conf);
     void growToFit(pgno_t pgno);
+    // Removes pages, at or after the first, from the end of the data file,
+    // stopping at any that are still in use or that recovery might still
+    // redo. Also removes free pages from the end of the work file. Returns
+    // the new number of data pages.
+    pgno_t truncate(pgno_t first);
+    pgno_t minPages() const { return m_vdata.minPages(); }
 
     // Pins page in cache (if it was already cached) with a read pin, and
     // returns a pointer to it. Read pins prevent cached pages from being freed
-    // by saveWork().
+    // by saveWork(). Pages that aren't in the cache are pinned and unpinned
+    // without locking.
     const void * rptr(Lsn lsn, pgno_t pgno, bool withPin);
     void unpin(const Dim::UnsignedSet & pages);
 
+    // Starts background reads of untracked pages that are about to be used,
+    // so they're already in the OS cache when they are. Only a hint, pages are
+    // skipped if too many reads are already in progress.
+    void prefetch(const Dim::UnsignedSet & pages);
+
+    // Snapshot reads see pages as they were at the snapshot's LSN. While any
+    // snapshot is open, updates keep a copy of the version of the page they
+    // replace for as long as a snapshot might still need it. Returns the LSN
+    // of the new snapshot, that of the newest update to have been applied,
+    // or to have started being applied, to any page.
+    Lsn beginSnapshot();
+    void endSnapshot(Lsn lsn);
+    // Copies into "out" the version of the page that was current as of the
+    // LSN, which must be that of an open snapshot. Returns false, after
+    // copying the current version instead, if that version wasn't kept. When
+    // following, also returns false if the data file page stays torn after
+    // rereading it, or the writer has saved it with newer updates. Never
+    // waits for updates to be followed.
+    bool readSnapshot(void * out, Lsn lsn, pgno_t pgno);
+
+    // Backups read the data file as it was when they began, while pages
+    // continue to be written to it. Returns the number of pages to be read,
+    // or 0 if the backup couldn't be started.
+    size_t backupBegin();
+    // Reads the next pages, up to bytes worth, returns the number of bytes
+    // read or 0 when there are no more.
+    size_t backupRead(char * buf, size_t bytes);
+    void backupEnd();
+
     size_t pageSize() const { return m_pageSize; }
     size_t viewSize() const { return m_vwork.viewSize(); }
     size_t size() const { return m_pages.size(); }
@@ -120,17 +206,43 @@ public:
     Dim::FileHandle dataFile() const { return m_fdata; }
     bool newFiles() const { return m_newFiles; }
 
+    // Starts verifying the checksums of all data file pages, in the
+    // background, returns false if it's already running.
+    bool scrub(IDbProgressNotify * notify, size_t maxBytesPerSec);
+
+    // With fDbOpenFollow, maps pages added to the data file by the writer
+    // and releases the work copies of pages it has since saved.
+    void followDataFile();
+    // With fDbOpenFollow, called before followed updates are applied to the
+    // page. If it's only in the data file, where the writer may be saving
+    // it, it's copied and verified, and reread while torn, and the copy is
+    // made the work page to update. Returns false if it stays torn.
+    bool followPage(pgno_t pgno);
+
 private:
     struct WorkPageInfo;
+    class PrefetchTask;
+    class ScrubTask;
+
+    const DbPageHeader * dataPage(pgno_t pgno) const;
+    bool verifyPage(const DbPageHeader * hdr) const;
+    bool recheckPage(pgno_t pgno, void * buf);
 
     bool openData(std::string_view datafile);
     bool openWork(std::string_view workfile);
-    void writePageWait(DbPageHeader * hdr);
+    void writePagesWait(std::vector<DbPageHeader *> & pages);
+    void backupKeepPages(const std::vector<DbPageHeader *> & pages);
     void freePage_LK(DbPageHeader * hdr);
     DbPageHeader * dupPage_LK(const DbPageHeader * hdr);
     WorkPageInfo * dirtyPage_LK(pgno_t pgno, Lsn lsn);
     WorkPageInfo * allocWorkInfo_LK();
     void freeWorkInfo_LK(WorkPageInfo * pi);
+    void resizePages_LK(size_t count);
+    std::atomic<uint32_t> & pinState(pgno_t pgno);
+    bool unpin(pgno_t pgno);
+    void notifyUnpinned();
+    void keepOldPage_LK(pgno_t pgno, Lsn lsn);
+    void removeOldPages_LK();
 
     // Inherited by DbWal::IPageNotify
     void * onWalGetPtrForUpdate(
@@ -144,6 +256,7 @@ private:
         Lsn lsn,
         LocalTxn txn
     ) override;
+    void onWalRedoComplete() override;
     void onWalDurable(Lsn lsn, size_t bytes) override;
     Lsn onWalCheckpointPages(Lsn lsn) override;
 
@@ -160,6 +273,7 @@ private:
     size_t m_pageSize = 0;
     size_t m_walPageSize = 0;
     Dim::EnumFlags<DbOpenFlags> m_flags;
+    DbMapOptions m_mapOpts = {};
     bool m_newFiles = false; // did the open create new data files?
 
     // Configuration settings, these provide a soft cap that triggers the
@@ -168,11 +282,29 @@ private:
     Dim::Duration m_maxWalAge = {};
     size_t m_maxWalBytes = 0;
 
+    // Backup reading the data file, pages that are written before it reads
+    // them have their original contents kept, in a temp file, until it does.
+    struct BackupPage {
+        uint64_t offset; // position in m_fbackup
+        bool ready; // has the original been copied to m_fbackup?
+    };
+    std::mutex m_backupMut;
+    std::condition_variable m_backupCv;
+    bool m_backupActive = false;
+    pgno_t m_backupPos = {}; // next page to be read
+    pgno_t m_backupKeepFrom = {}; // first page not yet read, or being read
+    pgno_t m_backupEnd = {};
+    Dim::FileHandle m_fbackup;
+    uint64_t m_backupFileEnd = 0;
+    std::vector<uint64_t> m_backupFree; // released offsets in m_fbackup
+    std::unordered_map<pgno_t, BackupPage> m_backupPages;
 
     mutable std::mutex m_workMut;
     std::condition_variable m_workCv;
 
     bool m_saveInProgress = false; // is saveWork() task running?
+    unsigned m_prefetches = 0; // prefetch reads in progress
+    ScrubTask * m_scrub = nullptr; // scrub in progress
 
     struct WorkPageInfoBase {
         DbPageHeader * hdr;
@@ -180,15 +312,6 @@ private:
         Lsn firstLsn; // LSN at which page became dirty
         pgno_t pgno;
         Dim::EnumFlags<DbPageFlags> flags;
-
-        // Pins tell the page save algorithm when it is unsafe to save or free
-        // work pages.
-        //
-        // Page is being accessed, must not be freed, but may be saved.
-        unsigned readPins;
-        // Request to update page has been made (and granted if readPins == 1).
-        // If granted, may be internally inconsistent, and must not be saved.
-        bool writePin;
     };
     // Info about work pages that have been modified in memory but not yet
     // written to disk.
@@ -198,6 +321,27 @@ private:
     // therefore also be unmodified pages).
     std::vector<WorkPageInfo *> m_pages;
 
+    // Pin state of every data page, a count of read pins plus flags for
+    // pending or granted write pins and whether the page is tracked (has an
+    // entry in m_pages). Pins tell the page save algorithm when it is unsafe
+    // to save or free work pages. Allocated in chunks that, once added, never
+    // move so they can be used without holding m_workMut.
+    std::vector<std::unique_ptr<std::atomic<uint32_t>[]>> m_pinStates;
+
+    // LSNs of open snapshots.
+    std::multiset<Lsn> m_snapshots;
+    // LSN of the newest update to have been applied, or to have started being
+    // applied, to any page. New snapshots are taken at it.
+    Lsn m_updateLsn = {};
+    // Old versions of pages, kept for open snapshots, by page number. Each is
+    // the version seen by snapshots at LSNs from its own LSN up to, but not
+    // including, the LSN of the update that replaced it.
+    struct OldPageInfo {
+        DbPageHeader * hdr;
+        Lsn nextLsn;
+    };
+    std::multimap<pgno_t, OldPageInfo> m_oldPages;
+
     // Unused page info structs waiting to be recycled.
     Dim::List<WorkPageInfo> m_freeInfos;
     // List of all dirty pages in order of when they became dirty as measured
@@ -215,10 +359,10 @@ private:
     // Number of pages, dirty or clean, that first became dirty within the last
     // max WAL age. Which means that their repayment term hasn't fully matured.
     size_t m_pageBonds = 0;
-    // Info about pages from the data file that are unchanged and have not been
-    // copied to work pages. Used to track pins (that block modification) on
-    // pages that are being referenced.
-    Dim::List<WorkPageInfo> m_referencePages;
+
+    // Start of the WAL redone by recovery, as of the last durable checkpoint.
+    // Pages last changed before it no longer have WAL that would be redone.
+    Lsn m_checkpointLsn = {};
 
     // The LSN up to which all data can be safely recovered. All WAL for any
     // transaction, that has not been rolled back and includes logs from this or
@@ -246,6 +390,10 @@ private:
 
     DbReadView m_vdata;
     Dim::FileHandle m_fdata;
+    // Pages in the data file, when following. Pages after them are read as
+    // blank from the zero page, since they aren't in the file to be mapped.
+    std::atomic<size_t> m_dataPages = 0;
+    std::unique_ptr<char[]> m_zeroPage;
     DbWriteView m_vwork;
     Dim::FileHandle m_fwork;
     size_t m_workPages = 0;
@@ -294,6 +442,19 @@ public:
     DbRootSet & roots() const { return *m_roots; }
     Lsx getLsx() const;
 
+    // Makes this a read only snapshot transaction, pages are then read as they
+    // were when it began without blocking, or being blocked by, concurrent
+    // updates. The optional function is called by detachSnapshot().
+    void beginSnapshot(std::function<void()> onDetach = {});
+    // Called by the reader once it has whatever in memory state (e.g. cached
+    // metric positions) must be consistent with the snapshot, after which
+    // the caller may allow updates to proceed.
+    void detachSnapshot();
+    bool snapshot() const { return m_snapshot; }
+    // True if the version of a page that the snapshot should see was missing,
+    // so what was read from it may be inconsistent.
+    bool snapshotMissed() const { return m_snapshotMissed; }
+
     // Returns pages that have been freed.
     Dim::UnsignedSet commit();
 
@@ -301,6 +462,9 @@ public:
     size_t numPages() const { return m_page.size(); }
     template<typename T> const T * pin(pgno_t pgno);
     void growToFit(pgno_t pgno) { m_page.growToFit(pgno); }
+    pgno_t truncate(pgno_t first) { return m_page.truncate(first); }
+    pgno_t minPages() const { return m_page.minPages(); }
+    void prefetch(const Dim::UnsignedSet & pages) { m_page.prefetch(pages); }
     const Dim::UnsignedSet & freePages() const { return m_freePages; }
 
     void walZeroInit(pgno_t pgno);
@@ -316,7 +480,7 @@ public:
         pgno_t pgno,
         DbPageType type,
         uint32_t id,
-        std::span<uint8_t> data
+        std::span<const uint8_t> data
     );
 
     void walRadixInit(
@@ -358,6 +522,7 @@ public:
         Dim::Duration retention,
         Dim::Duration interval
     );
+    void walMetricUpdateBackfill(pgno_t pgno, Dim::TimePoint backfill);
     void walMetricClearSamples(pgno_t pgno);
     void walMetricUpdateSamplesTxn(pgno_t pgno, size_t refSample);
     void walMetricUpdateSamples(
@@ -396,6 +561,38 @@ public:
         bool updateLast
     );
     void walSampleUpdateTime(pgno_t pgno, Dim::TimePoint pageTime);
+    void walSampleUpdateRange(
+        pgno_t pgno,
+        size_t firstSample,
+        std::span<const uint8_t> values,
+        bool updateLast
+    );
+    void walSamplePackInit(
+        pgno_t pgno,
+        uint32_t id,
+        Dim::TimePoint pageTime,
+        Dim::Duration interval,
+        size_t lastSample,
+        double fill = NAN
+    );
+    void walSamplePackAppendTxn(pgno_t pgno, size_t pos, double value);
+    void walSamplePackAppend(pgno_t pgno, size_t pos, double value);
+    void walSamplePackUpdate(pgno_t pgno, size_t pos, double value);
+    void walSamplePackLink(pgno_t pgno, pgno_t overflow);
+    void walSampleRunsInit(pgno_t pgno, uint32_t id);
+    void walSampleRunsAdd(
+        pgno_t pgno,
+        size_t pagePos,
+        Dim::TimePoint pageTime,
+        std::span<const uint8_t> runs
+    );
+    void walSampleRunsRelease(pgno_t pgno);
+    void walSampleRunsUpdate(
+        pgno_t pgno,
+        size_t pagePos,
+        std::span<const uint8_t> runs
+    );
+    void walSampleRunsRemove(pgno_t pgno, size_t pagePos);
 
 private:
     template<typename T>
@@ -411,6 +608,7 @@ private:
     );
     void wal(DbWal::Record * rec, size_t bytes);
     void unpinAll();
+    const void * pinSnapshot(pgno_t pgno, bool withPin);
 
     DbWal & m_wal;
     DbPage & m_page;
@@ -419,6 +617,14 @@ private:
     mutable Dim::UnsignedSet m_pinnedPages;
     Dim::UnsignedSet m_freePages;
     std::shared_ptr<DbRootSet> m_roots;
+
+    bool m_snapshot = false;
+    Lsn m_snapshotLsn = {};
+    bool m_snapshotMissed = false;
+    std::function<void()> m_onDetach;
+    // Copies of pages pinned by the snapshot, and spares to be reused.
+    std::unordered_map<pgno_t, std::string> m_snapshotPages;
+    std::vector<std::string> m_sparePages;
 };
 
 //===========================================================================
@@ -426,7 +632,9 @@ template<typename T>
 const T * DbTxn::pin(pgno_t pgno) {
     auto lsn = DbWal::getLsn(m_txn);
     auto withPin = m_pinnedPages.insert(pgno);
-    auto ptr = static_cast<const T *>(m_page.rptr(lsn, pgno, withPin));
+    auto ptr = static_cast<const T *>(m_snapshot
+        ? pinSnapshot(pgno, withPin)
+        : m_page.rptr(lsn, pgno, withPin));
     if constexpr (!std::is_same_v<T, DbPageHeader>) {
         // Must start with and be layout compatible with DbPageHeader.
         assert((std::is_same_v<decltype(ptr->hdr), DbPageHeader>));
@@ -611,6 +819,7 @@ public:
     struct BitmapPage;
     struct MetricPage;
     struct SamplePage;
+    struct SampleRunsPage;
     struct TriePage;
 
     struct RadixData {
@@ -635,6 +844,59 @@ public:
         pgno_t lastPage; // page with most recent samples
         uint16_t pageLastSample; // position of last sample on last page
         DbSampleType sampleType;
+        // Old page changed by the latest update to a sample before the last
+        // page, it's run length encoded once updates move on from it.
+        pgno_t changedPage;
+    };
+
+    // Positions by metric id, in segments that are allocated as needed and
+    // never moved or freed until destruction, so reads don't lock. Each slot
+    // has a sequence number that is odd while it's being written, readers
+    // retry if it changed while they were reading. Writers make it odd with
+    // compare and swap, so they exclude each other.
+    //
+    // A position is complete if it has an interval, lazily loaded positions
+    // that aren't loaded have only their info page. Setting a position also
+    // marks it as used.
+    class MetricPosArray : Dim::NoCopy {
+    public:
+        ~MetricPosArray();
+        MetricPosition get(uint32_t id) const;
+        void set(uint32_t id, const MetricPosition & mi);
+        // Sets the position only if it's complete, returns false if not.
+        bool update(uint32_t id, const MetricPosition & mi);
+        // Sets the position only if it's still "from", returns false if it
+        // has changed.
+        bool replace(
+            uint32_t id,
+            const MetricPosition & from,
+            const MetricPosition & to
+        );
+        // If the position is marked as used, clears the mark and returns
+        // false. Otherwise reduces it to only its info page.
+        bool evict(uint32_t id);
+        // Ids covered by the allocated segments, all ids with positions are
+        // less than this.
+        size_t size() const;
+
+    private:
+        struct Slot {
+            std::atomic<uint32_t> seq;
+            std::atomic<uint64_t> data[4];
+        };
+        using SlotData = uint64_t[std::extent_v<decltype(Slot::data)>];
+        static void encode(SlotData & data, const MetricPosition & mi);
+        static MetricPosition decode(const SlotData & data);
+        static uint32_t lock(Slot & slot);
+        static void unlock(Slot & slot, uint32_t seq);
+        static void read(SlotData & data, const Slot & slot);
+        static void write(Slot & slot, const SlotData & data);
+        Slot * slot(uint32_t id) const;
+        Slot & allocSlot(uint32_t id);
+
+        std::atomic<Slot *> m_segs[kMaxMetricPosSegments] = {};
+        std::atomic<size_t> m_numSegs;
+        std::mutex m_allocMut;
     };
 
 public:
@@ -655,17 +917,34 @@ public:
     ~DbData();
 
     // Allows updates from DbWal to be applied, pageSize *MUST* match page size
-    // of existing data file.
-    void openForApply(size_t pageSize, Dim::EnumFlags<DbOpenFlags> flags);
+    // of existing data file. The zero page, as it is in the data file, sets
+    // the layout of the sample pages the updates are applied to.
+    void openForApply(
+        size_t pageSize,
+        Dim::EnumFlags<DbOpenFlags> flags,
+        const DbPageHeader * zeroPage
+    );
 
     // Allows metrics and samples to be updated and queried. Must already be
     // open for apply.
+    // The metric index snapshot, if it's from the same LSN, is used instead
+    // of loading the metrics from their pages.
     bool openForUpdate(
         DbTxn & txn,
         IDbDataNotify * notify,
         std::string_view name,
-        Dim::EnumFlags<DbOpenFlags> flags
+        Dim::EnumFlags<DbOpenFlags> flags,
+        std::string_view indexName,
+        Lsn lsn
+    );
+    // Saves metric index snapshot, as of the LSN, with names from the index.
+    void saveMetricIndex(
+        DbTxn & txn,
+        std::string_view path,
+        Lsn lsn,
+        const DbIndex & names
     );
+    void configure(const DbConfig & conf);
     DbStats queryStats() const;
     void publishFreePages(const Dim::UnsignedSet & freePages);
 
@@ -673,28 +952,102 @@ public:
 
     void insertMetric(DbTxn & txn, uint32_t id, std::string_view name);
     bool eraseMetric(std::string * outName, DbTxn & txn, uint32_t id);
-    void updateMetric(
+    // Returns true if rollups were added that must then be populated, in
+    // later transactions, with rollupBackfill().
+    bool updateMetric(
         DbTxn & txn,
         uint32_t id,
         const DbMetricInfo & info
     );
+    // Populates the next part of the metric's new rollups, from the position
+    // saved on its finest rollup, and advances it. Returns false once there's
+    // nothing left.
+    bool rollupBackfill(DbTxn & txn, uint32_t id);
+    // Metrics whose rollups were still being backfilled.
+    std::vector<uint32_t> rollupBackfills(DbTxn & txn);
     void getMetricInfo(IDbDataNotify * notify, DbTxn & txn, uint32_t id);
 
+    // Metric that owns the page, or 0 if it isn't part of one.
+    static uint32_t followOwner(const DbPageHeader & hdr);
+    // Updates metric positions after followed updates to the pages, given
+    // with the metrics that owned them before the updates. Returns ids of the
+    // metrics that were removed, and the info pages of metrics that are new
+    // and must be loaded with followMetric(), after the removed ones are
+    // dropped from the name index.
+    std::vector<uint32_t> followPages(
+        DbTxn & txn,
+        std::vector<pgno_t> * newMetrics,
+        const std::unordered_map<pgno_t, uint32_t> & pages
+    );
+    bool followMetric(DbTxn & txn, IDbDataNotify * notify, pgno_t pgno);
+
     void updateSample(
         DbTxn & txn,
         uint32_t id,
         Dim::TimePoint time,
         double value
     );
+    void updateSamples(
+        DbTxn & txn,
+        uint32_t id,
+        std::span<const DbSample> samples
+    );
     void getSamples(
         DbTxn & txn,
         IDbDataNotify * notify,
         uint32_t id,
         Dim::TimePoint first,
         Dim::TimePoint last,
-        unsigned presamples
+        unsigned presamples,
+        Dim::Duration minInterval = {}
+    );
+    // Like getSamples(), but with the positions of the metric and its rollups
+    // found from the snapshot's pages instead of from memory. So it doesn't
+    // need to be on the metric's queue, and many metrics can be read from
+    // the same snapshot.
+    void getSnapshotSamples(
+        DbTxn & txn,
+        IDbDataNotify * notify,
+        uint32_t id,
+        Dim::TimePoint first,
+        Dim::TimePoint last,
+        unsigned presamples,
+        Dim::Duration minInterval
+    );
+    // Start reading, ahead of getSamples(), pages the metrics are likely to
+    // need. The transaction of prefetchSamples() must be a snapshot.
+    void prefetchMetrics(
+        DbTxn & txn,
+        std::span<const uint32_t> ids,
+        Dim::Duration minInterval
+    );
+    void prefetchSamples(
+        DbTxn & txn,
+        std::span<const uint32_t> ids,
+        Dim::TimePoint first,
+        Dim::TimePoint last,
+        unsigned presamples,
+        Dim::Duration minInterval
+    );
+    void getSummaries(
+        DbTxn & txn,
+        IDbDataNotify * notify,
+        uint32_t id,
+        Dim::TimePoint first,
+        Dim::TimePoint last
     );
 
+    // Compaction moves pages at or after a limit, the size the file would be
+    // if all free pages were at its end, to free pages before it. Begin finds
+    // the metrics with pages to move, moves are made for each metric, and
+    // then truncate removes what it can of the now free end of the file. It
+    // can be retried until no pages past the limit are left, returned is the
+    // number that are.
+    size_t compactBegin(Dim::UnsignedSet * ids, DbTxn & txn);
+    void compactMetric(DbTxn & txn, uint32_t id);
+    size_t compactTruncate(DbTxn & txn);
+    void compactEnd();
+
     // Inherited via IApplyNotify
     void onWalApplyCheckpoint(Lsn lsn, Lsn startLsn) override;
     void onWalApplyBeginTxn(Lsn lsn, LocalTxn localTxn) override;
@@ -760,6 +1113,10 @@ public:
         Dim::Duration retention,
         Dim::Duration interval
     ) override;
+    void onWalApplyMetricUpdateBackfill(
+        void * ptr,
+        Dim::TimePoint backfill
+    ) override;
     void onWalApplyMetricClearSamples(void * ptr);
     void onWalApplyMetricUpdateSamples(
         void * ptr,
@@ -787,6 +1144,45 @@ public:
         void * ptr,
         Dim::TimePoint pageTime
     ) override;
+    void onWalApplySampleUpdateRange(
+        void * ptr,
+        size_t firstPos,
+        std::span<const uint8_t> values,
+        bool updateLast
+    ) override;
+    void onWalApplySamplePackInit(
+        void * ptr,
+        uint32_t id,
+        Dim::TimePoint pageTime,
+        Dim::Duration interval,
+        size_t lastSample,
+        double fill
+    ) override;
+    void onWalApplySamplePackAppend(
+        void * ptr,
+        size_t pos,
+        double value
+    ) override;
+    void onWalApplySamplePackUpdate(
+        void * ptr,
+        size_t pos,
+        double value
+    ) override;
+    void onWalApplySamplePackLink(void * ptr, pgno_t overflow) override;
+    void onWalApplySampleRunsInit(void * ptr, uint32_t id) override;
+    void onWalApplySampleRunsAdd(
+        void * ptr,
+        size_t pagePos,
+        Dim::TimePoint pageTime,
+        std::span<const uint8_t> runs
+    ) override;
+    void onWalApplySampleRunsRelease(void * ptr) override;
+    void onWalApplySampleRunsUpdate(
+        void * ptr,
+        size_t pagePos,
+        std::span<const uint8_t> runs
+    ) override;
+    void onWalApplySampleRunsRemove(void * ptr, size_t pagePos) override;
 
 private:
     friend DbPageHeap;
@@ -806,17 +1202,82 @@ private:
         IDbDataNotify * notify,
         pgno_t pgno
     );
+    bool loadMetric(
+        IDbDataNotify * notify,
+        uint32_t id,
+        std::string_view name,
+        Dim::Duration retention,
+        const MetricPosition & mi
+    );
     bool loadMetrics(DbTxn & txn, IDbDataNotify * notify);
+    bool loadMetricIndex(
+        bool * loaded,
+        IDbDataNotify * notify,
+        std::string_view path,
+        Lsn lsn
+    );
     void metricDestructPage(DbTxn & txn, pgno_t pgno);
     void metricClearCounters();
 
+    // Rollups are kept as hidden metrics, in the id index but not the name
+    // index, whose ids are the metric's id with the rollup level added.
+    bool rollupConfigure(
+        DbTxn & txn,
+        uint32_t id,
+        std::span<const DbMetricRollup> rollups,
+        bool reset
+    );
+    void rollupInsert(
+        DbTxn & txn,
+        uint32_t id,
+        unsigned level,
+        const DbMetricRollup & rollup
+    );
+    void rollupErase(DbTxn & txn, uint32_t id, unsigned level);
+    void rollupUpdate(
+        DbTxn & txn,
+        uint32_t id,
+        Dim::TimePoint first,
+        Dim::TimePoint last,
+        Dim::TimePoint prevLast
+    );
+    // With fromPages, the rollups' metric pages are found from the index of
+    // them in the snapshot instead of from their in memory positions.
+    uint32_t rollupFind(
+        DbTxn & txn,
+        uint32_t id,
+        Dim::TimePoint first,
+        Dim::Duration minInterval,
+        bool fromPages
+    );
+
     bool loadFreePages(DbTxn & txn);
     bool loadDeprecatedPages(DbTxn & txn);
     pgno_t allocPgno(DbTxn & txn);
-    void freePage(DbTxn & txn, pgno_t pgno);
+    // Allocates from the metric's extent, a run of pages reserved so that its
+    // pages are kept near each other in the file. Metrics don't reserve one
+    // until they need a second sample page, and then no bigger than their
+    // ring of sample pages.
+    pgno_t allocMetricPgno(DbTxn & txn, uint32_t id);
+    void reserveExtent_LK(DbTxn & txn, Dim::UnsignedSet * out, size_t count);
+    void releaseExtent_LK(uint32_t id);
+    // If destruct is false, pages referenced by the page aren't also freed.
+    void freePage(DbTxn & txn, pgno_t pgno, bool destruct = true);
     void deprecatePage(DbTxn & txn, pgno_t pgno);
     void freeDeprecatedPage(DbTxn & txn, pgno_t pgno);
 
+    pgno_t compactLimit(Dim::UnsignedSet * tail, pgno_t minPages);
+    void compactRaiseLimit(pgno_t limit);
+    void compactRadix(
+        DbTxn & txn,
+        MetricPosition * mi,
+        std::unordered_map<pgno_t, pgno_t> * moved,
+        pgno_t root,
+        pgno_t limit
+    );
+    void compactSampleChain(DbTxn & txn, pgno_t spno, pgno_t limit);
+    pgno_t compactMovePage(DbTxn & txn, pgno_t pgno);
+
     size_t radixPageEntries(
         int * ents,
         size_t maxEnts,
@@ -892,6 +1353,12 @@ private:
         const std::vector<std::string> & keys
     );
 
+    void sampleUpdate(
+        DbTxn & txn,
+        uint32_t id,
+        Dim::TimePoint time,
+        double value
+    );
     pgno_t sampleMakePhysical(
         DbTxn & txn,
         uint32_t id,
@@ -902,20 +1369,106 @@ private:
         pgno_t vpage = {}
     );
     bool sampleTryMakeVirtual(DbTxn & txn, MetricPosition & mi, pgno_t spno);
+    bool sampleTryMakeRuns(
+        DbTxn & txn,
+        uint32_t id,
+        const MetricPosition & mi,
+        pgno_t spno
+    );
+    bool sampleRunsUpdate(
+        DbTxn & txn,
+        const MetricPosition & mi,
+        size_t sppos,
+        pgno_t rpno,
+        size_t pos,
+        double value
+    );
+    void sampleRunsRemove(DbTxn & txn, pgno_t rpno, size_t sppos);
+    void sampleRunsCompact(DbTxn & txn, pgno_t root, pgno_t rpno);
+    bool sampleRunsRelease(DbTxn & txn, pgno_t pgno);
+    void sampleDestructPage(DbTxn & txn, pgno_t pgno);
+    size_t sampleUpdateRange(
+        DbTxn & txn,
+        uint32_t id,
+        std::span<const DbSample> samples
+    );
+    void sampleRead(
+        DbTxn & txn,
+        IDbDataNotify * notify,
+        uint32_t id,
+        const MetricPosition & mi,
+        Dim::TimePoint first,
+        Dim::TimePoint last,
+        unsigned presamples
+    );
+    void samplePages(
+        Dim::UnsignedSet * out,
+        DbTxn & txn,
+        const MetricPosition & mi,
+        Dim::TimePoint first,
+        Dim::TimePoint last,
+        unsigned presamples
+    );
     size_t samplesPerPage(DbSampleType type) const;
+    // Returns the number of pages in the ring of sample pages of the metric,
+    // or 0 if it doesn't have a sample page yet.
+    size_t metricRingPages(DbTxn & txn, uint32_t id);
+    size_t sampleRingPages(
+        DbSampleType type,
+        Dim::Duration retention,
+        Dim::Duration interval
+    ) const;
+
+    // Packed sample pages
+    size_t packedCapacity() const;
+    pgno_t samplePackFind(
+        double * value,
+        DbTxn & txn,
+        pgno_t spno,
+        Dim::TimePoint time
+    );
+    pgno_t samplePackPut(DbTxn & txn, pgno_t pgno, size_t pos, double value);
+    void samplePackAppend(DbTxn & txn, pgno_t spno, size_t pos, double value);
+    void samplePackUpdate(DbTxn & txn, pgno_t pgno, size_t pos, double value);
 
+    // Positions that aren't loaded, when metrics are loaded lazily, have
+    // only their info page.
     MetricPosition getMetricPos(uint32_t id) const;
+    // Loads the position first, if it isn't already.
+    MetricPosition getMetricPos(DbTxn & txn, uint32_t id);
     void setMetricPos(uint32_t id, const MetricPosition & mi);
+    // Sets the position of a metric whose info page has moved.
+    void moveMetricPos(uint32_t id, const MetricPosition & mi);
+    // Sets the position only if it's still "from", returns false if it has
+    // changed.
+    bool replaceMetricPos(
+        uint32_t id,
+        const MetricPosition & from,
+        const MetricPosition & to
+    );
+    // Sets the position of a lazily loaded metric, keeping track of which
+    // are loaded.
+    void storeMetricPos_LK(uint32_t id, const MetricPosition & mi);
+    void evictMetricPos_LK();
+    const MetricPosArray * rollupPos(unsigned level) const;
+    MetricPosArray & allocRollupPos(unsigned level);
     MetricPosition loadMetricPos(DbTxn & txn, uint32_t id);
+    // Position as of the snapshot, found from its pages.
+    MetricPosition snapshotMetricPos(DbTxn & txn, uint32_t id);
     MetricPosition loadMetricPos(
         DbTxn & txn,
         uint32_t id,
         Dim::TimePoint time
     );
+    // Time of the metric's last sample, or empty if it has none.
+    Dim::TimePoint metricLastTime(DbTxn & txn, uint32_t id);
 
     bool m_verbose = false;
     bool m_readOnly = false;
     bool m_newFile = false;
+    // Pages of fixed size samples end with a summary of their samples,
+    // except in data files made before they did.
+    bool m_pageSummaries = true;
 
     size_t m_pageSize = 0;
     pgno_t m_rootRoot = pgno_t::npos;
@@ -936,15 +1489,38 @@ private:
     std::unordered_map<std::string, unsigned> m_rootIdByName;
     std::atomic<std::shared_ptr<DbRootSet>> m_metricRoots;
 
+    // Guards the metric count, and the loading and unloading of lazily
+    // loaded positions. Reads and updates of positions don't need it.
     mutable std::shared_mutex m_mposMut;
-    std::vector<MetricPosition> m_metricPos;
+    MetricPosArray m_metricPos;
+    // Positions of rollups, by level, allocated when first needed.
+    std::atomic<MetricPosArray *> m_rollupPos[kMaxRollups] = {};
     unsigned m_numMetrics = 0;
 
+    // When metrics are loaded lazily, m_metricPos has the complete positions
+    // of those that are loaded, and only the info page of the rest. Loaded
+    // positions are marked as used when they're set, which spares them from
+    // being evicted when the clock hand next passes them. The ring may also
+    // have ids that have since been unloaded, they're dropped as the hand
+    // passes. Ids are in the ring at most once.
+    bool m_lazyPos = false;
+    std::vector<uint32_t> m_evictRing;
+    Dim::UnsignedSet m_evictIds; // ids in m_evictRing
+    size_t m_evictHand = 0;
+    size_t m_numLoaded = 0;
+    size_t m_maxLoadedPos = kDefaultMaxLoadedMetrics;
+
     mutable std::recursive_mutex m_pageMut;
     size_t m_numPages = 0;
     Dim::UnsignedSet m_freePages;
     size_t m_numFree = 0;
     Dim::UnsignedSet m_deprecatedPages;
+    // Unused pages of extents reserved for metrics, by metric id. They are
+    // free in the free page index, but not in m_freePages.
+    std::unordered_map<uint32_t, Dim::UnsignedSet> m_extents;
+    // Pages at or after this are being moved by compaction, zero if there's
+    // no compaction in progress.
+    std::atomic<pgno_t> m_compactLimit = {};
 
     // Used to manage the index at m_metricStoreRoot.
     mutable std::mutex m_mndxMut;
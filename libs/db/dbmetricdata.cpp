@@ -23,6 +23,21 @@ static_assert(kDefaultRetention >= kDefaultInterval);
 const unsigned kMaxMetricNameLen = 128;
 static_assert(kMaxMetricNameLen <= numeric_limits<unsigned char>::max());
 
+// Average number of bits per sample that packed sample pages are sized for.
+// Pages of series that don't compress this well spill over into additional
+// pages chained to the first.
+const unsigned kPackedSampleBits = 8;
+
+// Full pages of fixed size samples are only run length encoded if at least
+// this many pages with as many runs would fit on a page of runs.
+const unsigned kMinPagesPerRunsPage = 4;
+
+const unsigned kRollupIdShift = 32 - kRollupLevelBits;
+
+// Buckets of the finest rollup populated per transaction when rollups are
+// added to a metric that already has samples.
+const unsigned kRollupBackfillBuckets = 64;
+
 
 /****************************************************************************
 *
@@ -33,6 +48,10 @@ static_assert(kMaxMetricNameLen <= numeric_limits<unsigned char>::max());
 struct DbData::MetricPage {
     static const auto kPageType = DbPageType::kMetric;
     DbPageHeader hdr;
+
+    // For the finest rollup of a metric, the time its backfill from the
+    // metric's samples continues at, empty if there's none in progress.
+    // Rollups otherwise have no use for a creation time.
     TimePoint creation;
     Duration interval;
     Duration retention;
@@ -72,6 +91,97 @@ struct DbData::SamplePage {
     } samples;
 };
 
+// Samples of kSampleTypePacked pages, located at SamplePage::samples
+struct PackedSamples {
+    Duration interval;
+
+    // Next page of samples, all of which come after the samples on this page,
+    // or 0 if this is the last page of the chain.
+    pgno_t overflow;
+
+    uint16_t used;      // bytes of data used
+    uint8_t unusedBits; // unused low bits of last byte
+
+    // State after the last sample, allows more to be added without having to
+    // unpack the existing ones.
+    DbPackState state;
+
+    // EXTENDS BEYOND END OF STRUCT
+    unsigned char data[1];
+};
+
+#pragma pack(push, 1)
+
+// Run of equal samples, up to the first position of the next run or the end
+// of the page.
+struct SampleRun {
+    uint16_t firstPos;
+    double value;
+};
+
+// Samples of a page of fixed size samples as runs, the first of which starts
+// at position 0. Located in the data of a SampleRunsPage, which has at most
+// one for each position.
+struct SampleRunsEntry {
+    TimePoint pageTime;
+    uint32_t pagePos; // position of the page in the ring of the metric
+    uint16_t numRuns;
+
+    // EXTENDS BEYOND END OF STRUCT
+    SampleRun runs[1];
+};
+
+#pragma pack(pop)
+
+// Run length encoded samples of full pages of fixed size samples, other than
+// the tip page, of a metric. Referenced by the radix entries of each of those
+// pages. Entries are packed at the start of the data, and their offsets, in
+// order of position, at the end of the page.
+struct DbData::SampleRunsPage {
+    static const auto kPageType = DbPageType::kSampleRuns;
+    DbPageHeader hdr;
+
+    // Number of radix entries referencing the page. Entries are removed when
+    // their references are released, except by the erasing of ranges of the
+    // ring, so there may also be entries of positions that no longer refer to
+    // it. They're removed when the page runs out of room.
+    uint16_t refs;
+    uint16_t used; // bytes of data used by entries
+    uint16_t numEntries;
+
+    // EXTENDS BEYOND END OF STRUCT
+    unsigned char data[1];
+};
+
+// Summary of the samples of a page of fixed size samples, located at the end
+// of the page. For the tip page of a ring buffer only the samples up to its
+// pageLastSample are included.
+struct PageSummary {
+    unsigned count;
+    double sum;
+    double min;
+    double max;
+    double firstValue;
+    double lastValue;
+};
+
+namespace {
+
+// Summarizes the samples reported to it.
+struct SampleSummarizer : IDbDataNotify {
+    DbSampleSummary summary;
+
+    bool onDbSample(uint32_t id, TimePoint time, double value) override;
+    bool onDbSamples(
+        uint32_t id,
+        TimePoint first,
+        Duration interval,
+        span<const double> values
+    ) override;
+};
+
+} // namespace
+
 
 /****************************************************************************
 *
@@ -80,6 +190,9 @@ struct DbData::SamplePage {
 ***/
 
 static auto & s_perfCount = uperf("db.metrics (total)");
+static auto & s_perfLoaded = uperf("db.metrics (loaded)");
+static auto & s_perfLoads = uperf("db.metrics loaded");
+static auto & s_perfEvicts = uperf("db.metrics evicted");
 
 static auto & s_perfAncient = uperf("db.samples ignored (old)");
 static auto & s_perfDup = uperf("db.samples ignored (dup)");
@@ -93,6 +206,18 @@ static auto & s_perfAdd = uperf("db.samples added");
 *
 ***/
 
+//===========================================================================
+static uint32_t rollupId(uint32_t id, unsigned level) {
+    assert(level && level <= kMaxRollups);
+    return id | level << kRollupIdShift;
+}
+
+//===========================================================================
+// Returns 0 if the id isn't the id of a rollup.
+static unsigned rollupLevel(uint32_t id) {
+    return id >> kRollupIdShift;
+}
+
 //===========================================================================
 constexpr uint32_t pagesPerSegment(size_t pageSize) {
     static_assert(CHAR_BIT == 8);
@@ -117,6 +242,7 @@ constexpr pair<pgno_t, size_t> segmentPage(pgno_t pgno, size_t pageSize) {
 constexpr size_t sampleTypeSize(DbSampleType type) {
     switch (type) {
     case kSampleTypeInvalid:
+    case kSampleTypePacked: // variable sized
     case kSampleTypes:
         break;
     case kSampleTypeFloat32: return sizeof(float);
@@ -130,9 +256,193 @@ constexpr size_t sampleTypeSize(DbSampleType type) {
 }
 
 //===========================================================================
-constexpr size_t samplesPerPage(DbSampleType type, size_t pageSize) {
-    return (pageSize - offsetof(DbData::SamplePage, samples))
-        / sampleTypeSize(type);
+constexpr size_t packedCapacity(size_t pageSize) {
+    return pageSize - offsetof(DbData::SamplePage, samples)
+        - offsetof(PackedSamples, data);
+}
+
+//===========================================================================
+constexpr size_t samplesPerPage(
+    DbSampleType type,
+    size_t pageSize,
+    bool pageSummaries
+) {
+    if (type == kSampleTypePacked) {
+        auto count = packedCapacity(pageSize) * CHAR_BIT / kPackedSampleBits;
+        return min(count, (size_t) numeric_limits<uint16_t>::max());
+    }
+    return (pageSize
+            - offsetof(DbData::SamplePage, samples)
+            - (pageSummaries ? sizeof(PageSummary) : 0)
+        ) / sampleTypeSize(type);
+}
+
+//===========================================================================
+static PageSummary * pageSummary(DbData::SamplePage * sp, size_t pageSize) {
+    assert(sp->sampleType != kSampleTypePacked);
+    auto ptr = (char *) sp + pageSize - sizeof(PageSummary);
+    return reinterpret_cast<PageSummary *>(ptr);
+}
+
+//===========================================================================
+static const PageSummary * pageSummary(
+    const DbData::SamplePage * sp,
+    size_t pageSize
+) {
+    return pageSummary(const_cast<DbData::SamplePage *>(sp), pageSize);
+}
+
+//===========================================================================
+// Adds sample, which must come after those already included, to either a
+// PageSummary or DbSampleSummary.
+template<typename T>
+static void addSummarySample(T * out, double value) {
+    if (isnan(value))
+        return;
+    if (!out->count++) {
+        out->sum = 0;
+        out->min = out->max = out->firstValue = value;
+    } else if (value < out->min) {
+        out->min = value;
+    } else if (value > out->max) {
+        out->max = value;
+    }
+    out->sum += value;
+    out->lastValue = value;
+}
+
+//===========================================================================
+static PackedSamples * packedSamples(DbData::SamplePage * sp) {
+    assert(sp->sampleType == kSampleTypePacked);
+    return reinterpret_cast<PackedSamples *>(&sp->samples);
+}
+
+//===========================================================================
+static const PackedSamples * packedSamples(const DbData::SamplePage * sp) {
+    assert(sp->sampleType == kSampleTypePacked);
+    return reinterpret_cast<const PackedSamples *>(&sp->samples);
+}
+
+//===========================================================================
+static DbUnpackIter unpackSamples(const PackedSamples * ps) {
+    return DbUnpackIter(ps->data, ps->used, ps->unusedBits);
+}
+
+//===========================================================================
+static vector<DbSample> unpackSampleList(const PackedSamples * ps) {
+    vector<DbSample> out;
+    for (auto it = unpackSamples(ps); it; ++it)
+        out.push_back(*it);
+    return out;
+}
+
+//===========================================================================
+// Returns false, leaving the page unchanged, if the sample doesn't fit.
+static bool packSample(
+    PackedSamples * ps,
+    size_t capacity,
+    TimePoint time,
+    double value
+) {
+    // A failed put may have already written some bits of the sample into the
+    // partially used last byte.
+    auto partial = ps->used ? ps->data[ps->used - 1] : 0;
+    DbPack pack(
+        ps->data + ps->used,
+        capacity - ps->used,
+        ps->unusedBits,
+        ps->state
+    );
+    if (!pack.put(time, value)) {
+        if (ps->used)
+            ps->data[ps->used - 1] = partial;
+        return false;
+    }
+    ps->used = (uint16_t) (ps->used + pack.size());
+    ps->unusedBits = pack.unusedBits();
+    ps->state = pack.state();
+    return true;
+}
+
+//===========================================================================
+// Replaces the samples on the page with as many from the list as fit, returns
+// the number that were packed.
+static size_t packSamples(
+    PackedSamples * ps,
+    size_t capacity,
+    const vector<DbSample> & samples
+) {
+    ps->used = 0;
+    ps->unusedBits = 0;
+    ps->state = {};
+    for (size_t i = 0; i < samples.size(); ++i) {
+        if (!packSample(ps, capacity, samples[i].time, samples[i].value))
+            return i;
+    }
+    return samples.size();
+}
+
+//===========================================================================
+// Sets (or removes, if value is NAN) the sample with the time.
+static void updateSampleList(
+    vector<DbSample> * samples,
+    TimePoint time,
+    double value
+) {
+    auto i = lower_bound(
+        samples->begin(),
+        samples->end(),
+        time,
+        [](auto & a, auto & b) { return a.time < b; }
+    );
+    if (i != samples->end() && i->time == time) {
+        if (isnan(value)) {
+            samples->erase(i);
+        } else {
+            i->value = value;
+        }
+    } else if (!isnan(value)) {
+        samples->insert(i, {time, value});
+    }
+}
+
+//===========================================================================
+static bool packedFits(
+    const PackedSamples * ps,
+    size_t capacity,
+    TimePoint time,
+    double value
+) {
+    // Pack into a scratch copy of the end of the page, which only needs room
+    // for the partially used last byte and the largest possible sample (152
+    // bits).
+    unsigned char tmp[24];
+    tmp[0] = ps->used ? ps->data[ps->used - 1] : 0;
+    DbPack pack(
+        tmp + 1,
+        min(capacity - ps->used, size(tmp) - 1),
+        ps->unusedBits,
+        ps->state
+    );
+    return pack.put(time, value);
+}
+
+//===========================================================================
+bool SampleSummarizer::onDbSample(uint32_t id, TimePoint time, double value) {
+    addSummarySample(&summary, value);
+    return true;
+}
+
+//===========================================================================
+bool SampleSummarizer::onDbSamples(
+    uint32_t id,
+    TimePoint first,
+    Duration interval,
+    span<const double> values
+) {
+    for (auto && value : values)
+        addSummarySample(&summary, value);
+    return true;
 }
 
 //===========================================================================
@@ -158,25 +468,395 @@ static void noSamples(
 }
 
 
+/****************************************************************************
+*
+*   DbData::MetricPosArray
+*
+***/
+
+static_assert((1ull << kRollupIdShift)
+    <= (uint64_t) kMaxMetricPosSegments << kMetricPosSegmentBits);
+
+// Set in the last word of a position while it's marked as used.
+const uint64_t kMetricPosUsed = 1ull << 24;
+
+//===========================================================================
+DbData::MetricPosArray::~MetricPosArray() {
+    for (auto && seg : m_segs)
+        delete[] seg.load();
+}
+
+//===========================================================================
+// static
+void DbData::MetricPosArray::encode(
+    SlotData & data,
+    const MetricPosition & mi
+) {
+    data[0] = (uint64_t) mi.interval.count();
+    data[1] = (uint64_t) mi.pageFirstTime.time_since_epoch().count();
+    data[2] = (uint64_t) mi.infoPage | (uint64_t) mi.lastPage << 32;
+    data[3] = mi.pageLastSample
+        | (uint64_t) (uint8_t) mi.sampleType << 16
+        | (uint64_t) mi.changedPage << 32;
+}
+
+//===========================================================================
+// static
+DbData::MetricPosition DbData::MetricPosArray::decode(const SlotData & data) {
+    MetricPosition mi;
+    mi.interval = Duration{(int64_t) data[0]};
+    mi.pageFirstTime = TimePoint{Duration{(int64_t) data[1]}};
+    mi.infoPage = (pgno_t) (uint32_t) data[2];
+    mi.lastPage = (pgno_t) (data[2] >> 32);
+    mi.pageLastSample = (uint16_t) data[3];
+    mi.sampleType = (DbSampleType) (int8_t) (data[3] >> 16);
+    mi.changedPage = (pgno_t) (data[3] >> 32);
+    return mi;
+}
+
+//===========================================================================
+// static
+uint32_t DbData::MetricPosArray::lock(Slot & slot) {
+    for (;;) {
+        auto seq = slot.seq.load(memory_order_relaxed);
+        if (seq % 2 == 0
+            && slot.seq.compare_exchange_weak(
+                seq,
+                seq + 1,
+                memory_order_acquire,
+                memory_order_relaxed
+            )
+        ) {
+            atomic_thread_fence(memory_order_release);
+            return seq;
+        }
+        this_thread::yield();
+    }
+}
+
+//===========================================================================
+// static
+void DbData::MetricPosArray::unlock(Slot & slot, uint32_t seq) {
+    slot.seq.store(seq + 2, memory_order_release);
+}
+
+//===========================================================================
+// static
+// Reads the slot while it's locked by the caller.
+void DbData::MetricPosArray::read(SlotData & data, const Slot & slot) {
+    for (unsigned i = 0; i < std::size(data); ++i)
+        data[i] = slot.data[i].load(memory_order_relaxed);
+}
+
+//===========================================================================
+// static
+// Writes the slot while it's locked by the caller.
+void DbData::MetricPosArray::write(Slot & slot, const SlotData & data) {
+    for (unsigned i = 0; i < std::size(data); ++i)
+        slot.data[i].store(data[i], memory_order_relaxed);
+}
+
+//===========================================================================
+DbData::MetricPosArray::Slot * DbData::MetricPosArray::slot(
+    uint32_t id
+) const {
+    auto seg = m_segs[id >> kMetricPosSegmentBits].load(memory_order_acquire);
+    if (!seg)
+        return nullptr;
+    return seg + (id & ((1u << kMetricPosSegmentBits) - 1));
+}
+
+//===========================================================================
+DbData::MetricPosArray::Slot & DbData::MetricPosArray::allocSlot(
+    uint32_t id
+) {
+    auto & segp = m_segs[id >> kMetricPosSegmentBits];
+    auto seg = segp.load(memory_order_acquire);
+    if (!seg) {
+        scoped_lock lk{m_allocMut};
+        seg = segp.load(memory_order_relaxed);
+        if (!seg) {
+            seg = new Slot[1u << kMetricPosSegmentBits]{};
+            segp.store(seg, memory_order_release);
+            auto num = (id >> kMetricPosSegmentBits) + 1;
+            if (num > m_numSegs.load(memory_order_relaxed))
+                m_numSegs.store(num, memory_order_relaxed);
+        }
+    }
+    return seg[id & ((1u << kMetricPosSegmentBits) - 1)];
+}
+
+//===========================================================================
+DbData::MetricPosition DbData::MetricPosArray::get(uint32_t id) const {
+    auto slot = this->slot(id);
+    if (!slot)
+        return {};
+    SlotData data;
+    for (;;) {
+        auto seq = slot->seq.load(memory_order_acquire);
+        if (seq % 2 == 0) {
+            read(data, *slot);
+            atomic_thread_fence(memory_order_acquire);
+            if (slot->seq.load(memory_order_relaxed) == seq)
+                break;
+        }
+        this_thread::yield();
+    }
+    return decode(data);
+}
+
+//===========================================================================
+void DbData::MetricPosArray::set(uint32_t id, const MetricPosition & mi) {
+    auto & slot = allocSlot(id);
+    SlotData data;
+    encode(data, mi);
+    data[3] |= kMetricPosUsed;
+    auto seq = lock(slot);
+    write(slot, data);
+    unlock(slot, seq);
+}
+
+//===========================================================================
+bool DbData::MetricPosArray::update(uint32_t id, const MetricPosition & mi) {
+    auto slot = this->slot(id);
+    if (!slot)
+        return false;
+    SlotData data;
+    encode(data, mi);
+    data[3] |= kMetricPosUsed;
+    auto seq = lock(*slot);
+    auto complete = slot->data[0].load(memory_order_relaxed) != 0;
+    if (complete)
+        write(*slot, data);
+    unlock(*slot, seq);
+    return complete;
+}
+
+//===========================================================================
+bool DbData::MetricPosArray::replace(
+    uint32_t id,
+    const MetricPosition & from,
+    const MetricPosition & to
+) {
+    auto slot = this->slot(id);
+    if (!slot)
+        return false;
+    SlotData expected, data, cur;
+    encode(expected, from);
+    encode(data, to);
+    data[3] |= kMetricPosUsed;
+    auto seq = lock(*slot);
+    read(cur, *slot);
+    cur[3] &= ~kMetricPosUsed;
+    auto same = ranges::equal(cur, expected);
+    if (same)
+        write(*slot, data);
+    unlock(*slot, seq);
+    return same;
+}
+
+//===========================================================================
+bool DbData::MetricPosArray::evict(uint32_t id) {
+    auto slot = this->slot(id);
+    if (!slot)
+        return true;
+    SlotData data;
+    auto seq = lock(*slot);
+    read(data, *slot);
+    auto used = (data[3] & kMetricPosUsed) != 0;
+    if (used) {
+        data[3] &= ~kMetricPosUsed;
+    } else {
+        MetricPosition mi = {};
+        mi.infoPage = (pgno_t) (uint32_t) data[2];
+        encode(data, mi);
+    }
+    write(*slot, data);
+    unlock(*slot, seq);
+    return !used;
+}
+
+//===========================================================================
+size_t DbData::MetricPosArray::size() const {
+    return m_numSegs.load(memory_order_relaxed) << kMetricPosSegmentBits;
+}
+
+
 /****************************************************************************
 *
 *   DbData
 *
 ***/
 
+//===========================================================================
+const DbData::MetricPosArray * DbData::rollupPos(unsigned level) const {
+    assert(level && level <= kMaxRollups);
+    return m_rollupPos[level - 1].load(memory_order_acquire);
+}
+
+//===========================================================================
+DbData::MetricPosArray & DbData::allocRollupPos(unsigned level) {
+    assert(level && level <= kMaxRollups);
+    auto & posp = m_rollupPos[level - 1];
+    if (auto pos = posp.load(memory_order_acquire))
+        return *pos;
+    unique_lock lk{m_mposMut};
+    auto pos = posp.load(memory_order_relaxed);
+    if (!pos) {
+        pos = new MetricPosArray;
+        posp.store(pos, memory_order_release);
+    }
+    return *pos;
+}
+
 //===========================================================================
 DbData::MetricPosition DbData::getMetricPos(uint32_t id) const {
-    shared_lock lk{m_mposMut};
-    if (id >= m_metricPos.size())
-        return {};
-    return m_metricPos[id];
+    if (auto level = rollupLevel(id)) {
+        auto pos = rollupPos(level);
+        return pos ? pos->get(id & kMaxMetricId) : MetricPosition{};
+    }
+    // Positions of lazily loaded metrics that aren't loaded have only their
+    // info page, the zero interval marks them as incomplete.
+    return m_metricPos.get(id);
+}
+
+//===========================================================================
+DbData::MetricPosition DbData::getMetricPos(DbTxn & txn, uint32_t id) {
+    for (;;) {
+        auto mi = getMetricPos(id);
+        if (!m_lazyPos
+            || rollupLevel(id)
+            || !mi.infoPage
+            || mi.interval.count()
+        ) {
+            return mi;
+        }
+
+        // Load from the metric page, leaving the details of the last sample
+        // page to loadMetricPos.
+        auto from = mi;
+        auto mp = txn.pin<MetricPage>(mi.infoPage);
+        mi.interval = mp->interval;
+        mi.sampleType = mp->sampleType;
+        if (empty(mp->lastPageFirstTime)
+            || !radixFind(txn, &mi.lastPage, mi.infoPage, mp->lastPagePos)
+        ) {
+            mi.lastPage = {};
+        }
+        s_perfLoads += 1;
+        // Unless it was loaded, or the metric erased, while this was.
+        if (replaceMetricPos(id, from, mi))
+            return mi;
+    }
 }
 
 //===========================================================================
 void DbData::setMetricPos(uint32_t id, const MetricPosition & mi) {
-    shared_lock lk{m_mposMut};
-    assert(id < m_metricPos.size());
-    m_metricPos[id] = mi;
+    if (auto level = rollupLevel(id)) {
+        allocRollupPos(level).set(id & kMaxMetricId, mi);
+        return;
+    }
+    if (!m_lazyPos) {
+        assert(m_metricPos.get(id).infoPage == mi.infoPage);
+        m_metricPos.set(id, mi);
+        return;
+    }
+
+    // Updating a loaded position doesn't lock, loading it (again, if it was
+    // evicted) does.
+    if (m_metricPos.update(id, mi))
+        return;
+    unique_lock lk{m_mposMut};
+    if (m_metricPos.get(id).infoPage != mi.infoPage) {
+        // Metric was erased or moved, by followed updates, while its
+        // position was being loaded.
+        assert(m_readOnly);
+        return;
+    }
+    storeMetricPos_LK(id, mi);
+}
+
+//===========================================================================
+void DbData::moveMetricPos(uint32_t id, const MetricPosition & mi) {
+    if (auto level = rollupLevel(id)) {
+        allocRollupPos(level).set(id & kMaxMetricId, mi);
+    } else if (m_lazyPos) {
+        unique_lock lk{m_mposMut};
+        storeMetricPos_LK(id, mi);
+    } else {
+        m_metricPos.set(id, mi);
+    }
+}
+
+//===========================================================================
+bool DbData::replaceMetricPos(
+    uint32_t id,
+    const MetricPosition & from,
+    const MetricPosition & to
+) {
+    if (auto level = rollupLevel(id))
+        return allocRollupPos(level).replace(id & kMaxMetricId, from, to);
+    if (!m_lazyPos || (from.interval.count() && to.interval.count()))
+        return m_metricPos.replace(id, from, to);
+
+    unique_lock lk{m_mposMut};
+    if (!m_metricPos.replace(id, from, from))
+        return false;
+    storeMetricPos_LK(id, to);
+    return true;
+}
+
+//===========================================================================
+// Positions are only loaded and unloaded while holding the exclusive lock,
+// so whether it was loaded before is known.
+void DbData::storeMetricPos_LK(uint32_t id, const MetricPosition & mi) {
+    assert(m_lazyPos && !rollupLevel(id));
+    auto loaded = m_metricPos.get(id).interval.count() != 0;
+    m_metricPos.set(id, mi);
+    if (!mi.interval.count()) {
+        if (loaded) {
+            m_numLoaded -= 1;
+            s_perfLoaded -= 1;
+        }
+        return;
+    }
+    if (loaded)
+        return;
+    m_numLoaded += 1;
+    s_perfLoaded += 1;
+    if (m_evictIds.insert(id))
+        m_evictRing.push_back(id);
+    if (m_numLoaded > m_maxLoadedPos)
+        evictMetricPos_LK();
+}
+
+//===========================================================================
+// Clock, or second chance, eviction. The hand advances only as far as it
+// takes to get back within the limit, usually a single position per load.
+// Positions that have been set since the hand last passed are spared but
+// lose their used mark.
+void DbData::evictMetricPos_LK() {
+    assert(m_lazyPos);
+    while (m_numLoaded > m_maxLoadedPos) {
+        assert(!m_evictRing.empty());
+        if (m_evictHand >= m_evictRing.size())
+            m_evictHand = 0;
+        auto id = m_evictRing[m_evictHand];
+        if (m_metricPos.get(id).interval.count()) {
+            if (!m_metricPos.evict(id)) {
+                m_evictHand += 1;
+                continue;
+            }
+            m_numLoaded -= 1;
+            s_perfLoaded -= 1;
+            s_perfEvicts += 1;
+        }
+        // Replace with the id at the end of the ring, which the hand then
+        // looks at next.
+        m_evictIds.erase(id);
+        m_evictRing[m_evictHand] = m_evictRing.back();
+        m_evictRing.pop_back();
+    }
 }
 
 
@@ -189,6 +869,7 @@ void DbData::setMetricPos(uint32_t id, const MetricPosition & mi) {
 //===========================================================================
 void DbData::metricClearCounters() {
     s_perfCount -= m_numMetrics;
+    s_perfLoaded -= (unsigned) m_numLoaded;
 }
 
 //===========================================================================
@@ -207,8 +888,18 @@ void DbData::metricDestructPage(DbTxn & txn, pgno_t pgno) {
     auto mp = txn.pin<MetricPage>(pgno);
     radixDestruct(txn, mp->hdr);
 
+    releaseExtent_LK(mp->hdr.id);
+
+    if (rollupLevel(mp->hdr.id)) {
+        setMetricPos(mp->hdr.id, {});
+        return;
+    }
     unique_lock lk{m_mposMut};
-    m_metricPos[mp->hdr.id] = {};
+    if (m_lazyPos) {
+        storeMetricPos_LK(mp->hdr.id, {});
+    } else {
+        m_metricPos.set(mp->hdr.id, {});
+    }
     m_numMetrics -= 1;
     s_perfCount -= 1;
 }
@@ -221,32 +912,58 @@ bool DbData::loadMetric(DbTxn & txn, IDbDataNotify * notify, pgno_t pgno) {
             << (unsigned) mp->hdr.type;
         return false;
     }
-    if (notify) {
-        DbSeriesInfo info;
-        info.id = mp->hdr.id;
-        info.name = mp->name;
-        info.type = mp->sampleType;
-        info.last = info.first + mp->retention;
-        info.interval = mp->interval;
-        if (!notify->onDbSeriesStart(info))
-            return false;
-    }
-    pgno_t lastPage;
-    if (!radixFind(txn, &lastPage, pgno, mp->lastPagePos)
+    // With lazy loading the last page of metrics, but not of rollups, is
+    // found when the metric is first used.
+    pgno_t lastPage = {};
+    if ((!m_lazyPos || rollupLevel(mp->hdr.id))
+        && !radixFind(txn, &lastPage, pgno, mp->lastPagePos)
         && !empty(mp->lastPageFirstTime)
     ) {
         return false;
     }
-    if (appStopping())
-        return false;
 
-    if (m_metricPos.size() <= mp->hdr.id)
-        m_metricPos.resize(mp->hdr.id + 1);
-    auto & mi = m_metricPos[mp->hdr.id];
+    MetricPosition mi = {};
     mi.infoPage = pgno;
     mi.interval = mp->interval;
     mi.lastPage = lastPage;
     mi.sampleType = mp->sampleType;
+    return loadMetric(notify, mp->hdr.id, mp->name, mp->retention, mi);
+}
+
+//===========================================================================
+bool DbData::loadMetric(
+    IDbDataNotify * notify,
+    uint32_t id,
+    string_view name,
+    Duration retention,
+    const MetricPosition & mi
+) {
+    if (rollupLevel(id)) {
+        setMetricPos(id, mi);
+        return true;
+    }
+    if (notify) {
+        DbSeriesInfo info;
+        info.id = id;
+        info.name = name;
+        info.type = mi.sampleType;
+        info.last = info.first + retention;
+        info.interval = mi.interval;
+        if (!notify->onDbSeriesStart(info))
+            return false;
+    }
+    if (appStopping())
+        return false;
+
+    // Also loaded, when following, while queries are running.
+    unique_lock lk{m_mposMut};
+    if (m_lazyPos) {
+        MetricPosition info = {};
+        info.infoPage = mi.infoPage;
+        storeMetricPos_LK(id, info);
+    } else {
+        m_metricPos.set(id, mi);
+    }
 
     s_perfCount += 1;
     m_numMetrics += 1;
@@ -264,15 +981,285 @@ bool DbData::loadMetrics(DbTxn & txn, IDbDataNotify * notify) {
     );
 }
 
+//===========================================================================
+// static
+uint32_t DbData::followOwner(const DbPageHeader & hdr) {
+    switch (hdr.type) {
+    case DbPageType::kMetric:
+    case DbPageType::kRadix:
+    case DbPageType::kSample:
+    case DbPageType::kSampleRuns:
+        // Radix pages of other indexes have no id.
+        return hdr.id;
+    default:
+        return 0;
+    }
+}
+
+//===========================================================================
+vector<uint32_t> DbData::followPages(
+    DbTxn & txn,
+    vector<pgno_t> * newMetrics,
+    const unordered_map<pgno_t, uint32_t> & pages
+) {
+    assert(m_lazyPos);
+    // Metrics that owned the pages, before or after the updates, and the
+    // info pages that now exist.
+    unordered_set<uint32_t> ids;
+    unordered_map<uint32_t, pgno_t> infoPages;
+    for (auto && [pgno, owner] : pages) {
+        if (owner)
+            ids.insert(owner);
+        auto hdr = txn.pin<DbPageHeader>(pgno);
+        if (auto id = followOwner(*hdr)) {
+            ids.insert(id);
+            if (hdr->type == DbPageType::kMetric)
+                infoPages[id] = pgno;
+        }
+    }
+
+    vector<uint32_t> erased;
+    for (auto && id : ids) {
+        auto mi = getMetricPos(id);
+        if (mi.infoPage) {
+            auto hdr = txn.pin<DbPageHeader>(mi.infoPage);
+            if (hdr->type == DbPageType::kMetric && hdr->id == id) {
+                // Still there, reload the position when it's next used.
+                if (rollupLevel(id)) {
+                    loadMetric(txn, nullptr, mi.infoPage);
+                } else {
+                    MetricPosition info = {};
+                    info.infoPage = mi.infoPage;
+                    unique_lock lk{m_mposMut};
+                    storeMetricPos_LK(id, info);
+                }
+                continue;
+            }
+
+            // Erased, or moved to a new info page, remove it.
+            if (rollupLevel(id)) {
+                setMetricPos(id, {});
+            } else {
+                unique_lock lk{m_mposMut};
+                storeMetricPos_LK(id, {});
+                m_numMetrics -= 1;
+                s_perfCount -= 1;
+                erased.push_back(id);
+            }
+        }
+        if (auto i = infoPages.find(id); i != infoPages.end())
+            newMetrics->push_back(i->second);
+    }
+    return erased;
+}
+
+//===========================================================================
+bool DbData::followMetric(DbTxn & txn, IDbDataNotify * notify, pgno_t pgno) {
+    return loadMetric(txn, notify, pgno);
+}
+
+
+/****************************************************************************
+*
+*   Metric index snapshot
+*
+*   Metric positions, with the metric names, saved to a side file when the
+*   database is closed. When the next open finds that nothing has been logged
+*   since then, they're loaded from it instead of from every metric page.
+*
+***/
+
+namespace {
+
+const Guid kMetricIndexSig = "dd92afa1-ec59-40a3-ad63-77a6e76003bc"_Guid;
+
+#pragma pack(push, 1)
+
+struct MetricIndexEntry {
+    uint32_t id;
+    pgno_t infoPage;
+    pgno_t lastPage;
+    Duration interval;
+    Duration retention;
+    TimePoint pageFirstTime;
+    uint16_t pageLastSample;
+    DbSampleType sampleType;
+    uint8_t nameLen;
+
+    // EXTENDS BEYOND END OF STRUCT
+    // char name[nameLen];
+};
+
+// Written after the entries, so a partly written file is never mistaken for
+// a complete one.
+struct MetricIndexTrailer {
+    Guid signature;
+    Lsn lsn;
+    uint64_t numPages;
+    uint32_t pageSize;
+    uint32_t numEntries;
+
+    // Written with lazily loaded metrics, only the info pages of metrics
+    // (but not of rollups) are complete.
+    uint8_t lazy;
+};
+
+#pragma pack(pop)
+
+} // namespace
+
+//===========================================================================
+void DbData::saveMetricIndex(
+    DbTxn & txn,
+    string_view path,
+    Lsn lsn,
+    const DbIndex & names
+) {
+    FileAppendStream out(100, 2, envMemoryConfig().pageSize);
+    if (!out.open(path, FileAppendStream::kTrunc)) {
+        logMsgError() << "Create failed, " << path;
+        return;
+    }
+
+    MetricIndexTrailer trailer = {};
+    trailer.signature = kMetricIndexSig;
+    trailer.lsn = lsn;
+    trailer.numPages = m_numPages;
+    trailer.pageSize = (uint32_t) m_pageSize;
+    auto write = [&](uint32_t id, const MetricPosition & mi, string_view name) {
+        auto mp = txn.pin<MetricPage>(mi.infoPage);
+        MetricIndexEntry ent = {};
+        ent.id = id;
+        ent.infoPage = mi.infoPage;
+        ent.lastPage = mi.lastPage;
+        ent.interval = mp->interval;
+        ent.retention = mp->retention;
+        ent.pageFirstTime = mi.pageFirstTime;
+        ent.pageLastSample = mi.pageLastSample;
+        ent.sampleType = mp->sampleType;
+        ent.nameLen = (uint8_t) name.size();
+        out.append({(const char *) &ent, sizeof ent});
+        out.append(name);
+        trailer.numEntries += 1;
+    };
+
+    trailer.lazy = m_lazyPos;
+    auto numIds = m_metricPos.size();
+    for (uint32_t id = 0; id < numIds; ++id) {
+        auto mi = m_metricPos.get(id);
+        if (!mi.infoPage)
+            continue;
+        auto name = names.name(id);
+        if (!name) {
+            // Leave the file without a trailer, so it won't be used.
+            logMsgError() << "Metric index snapshot missing name, id " << id;
+            return;
+        }
+        DbTxn::PinScope pins(txn);
+        write(id, mi, name);
+    }
+    for (unsigned level = 1; level <= kMaxRollups; ++level) {
+        auto pos = rollupPos(level);
+        if (!pos)
+            continue;
+        numIds = pos->size();
+        for (uint32_t id = 0; id < numIds; ++id) {
+            auto mi = pos->get(id);
+            if (!mi.infoPage)
+                continue;
+            DbTxn::PinScope pins(txn);
+            write(rollupId(id, level), mi, {});
+        }
+    }
+    out.append({(const char *) &trailer, sizeof trailer});
+    out.close();
+}
+
+//===========================================================================
+// Sets loaded to false, having loaded nothing, if the snapshot is missing or
+// doesn't match the database as of the LSN.
+bool DbData::loadMetricIndex(
+    bool * loaded,
+    IDbDataNotify * notify,
+    string_view path,
+    Lsn lsn
+) {
+    *loaded = false;
+    if (m_newFile)
+        return true;
+    using enum File::OpenMode;
+    FileHandle f;
+    if (fileOpen(&f, path, fReadOnly | fBlocking | fDenyNone | fSequential))
+        return true;
+    Finally fin([&]() { fileClose(f); });
+    uint64_t len = 0;
+    if (fileSize(&len, f) || len < sizeof(MetricIndexTrailer))
+        return true;
+    string buf(len, '\0');
+    uint64_t bytes = 0;
+    if (fileReadWait(&bytes, buf.data(), len, f, 0); bytes != len)
+        return true;
+
+    MetricIndexTrailer trailer;
+    auto eptr = buf.data() + len - sizeof trailer;
+    memcpy(&trailer, eptr, sizeof trailer);
+    if (trailer.signature != kMetricIndexSig
+        || trailer.lsn != lsn
+        || trailer.numPages != m_numPages
+        || trailer.pageSize != m_pageSize
+        || trailer.lazy && !m_lazyPos
+    ) {
+        return true;
+    }
+
+    // Validate the entries before any are loaded.
+    vector<const char *> ents;
+    ents.reserve(trailer.numEntries);
+    for (auto ptr = buf.data(); ptr < eptr; ) {
+        MetricIndexEntry ent;
+        if (eptr - ptr < (ptrdiff_t) sizeof ent)
+            return true;
+        memcpy(&ent, ptr, sizeof ent);
+        if (!ent.infoPage || ent.infoPage >= m_numPages)
+            return true;
+        ents.push_back(ptr);
+        ptr += sizeof ent + ent.nameLen;
+        if (ptr > eptr)
+            return true;
+    }
+    if (ents.size() != trailer.numEntries)
+        return true;
+
+    if (m_verbose)
+        logMsgInfo() << "Load metric index snapshot";
+    *loaded = true;
+    for (auto && ptr : ents) {
+        MetricIndexEntry ent;
+        memcpy(&ent, ptr, sizeof ent);
+        MetricPosition mi = {};
+        mi.interval = ent.interval;
+        mi.pageFirstTime = ent.pageFirstTime;
+        mi.infoPage = ent.infoPage;
+        mi.lastPage = ent.lastPage;
+        mi.pageLastSample = ent.pageLastSample;
+        mi.sampleType = ent.sampleType;
+        auto name = string_view(ptr + sizeof ent, ent.nameLen);
+        if (!loadMetric(notify, ent.id, name, ent.retention, mi))
+            return false;
+    }
+    return true;
+}
+
 //===========================================================================
 void DbData::insertMetric(DbTxn & txn, uint32_t id, string_view name) {
     assert(!name.empty());
+    assert(!rollupLevel(id) && "Metric id overlaps rollup ids");
     auto nameLen = metricNameSize(m_pageSize);
     if (name.size() >= nameLen)
         name = name.substr(0, nameLen - 1);
 
     // set info page
-    auto pgno = allocPgno(txn);
+    auto pgno = allocMetricPgno(txn, id);
     txn.walMetricInit(
         pgno,
         id,
@@ -310,19 +1297,13 @@ if constexpr (1) {
     mi.interval = mp->interval;
     mi.sampleType = mp->sampleType;
 
-    shared_lock lk{m_mposMut};
-    if (id >= m_metricPos.size()) {
-        lk.unlock();
-        {
-            unique_lock lk{m_mposMut};
-            if (id >= m_metricPos.size())
-                m_metricPos.resize(id + 1);
-        }
-        lk.lock();
+    assert(!m_metricPos.get(id).infoPage);
+    unique_lock lk{m_mposMut};
+    if (m_lazyPos) {
+        storeMetricPos_LK(id, mi);
+    } else {
+        m_metricPos.set(id, mi);
     }
-
-    assert(!m_metricPos[id].infoPage);
-    m_metricPos[id] = mi;
     m_numMetrics += 1;
 }
 
@@ -355,6 +1336,13 @@ void DbData::onWalApplyMetricInit(
     rd->numPages = entriesPerMetricPage(m_pageSize);
 }
 
+//===========================================================================
+void DbData::onWalApplyMetricUpdateBackfill(void * ptr, TimePoint backfill) {
+    auto mp = static_cast<MetricPage *>(ptr);
+    assert(mp->hdr.type == mp->kPageType);
+    mp->creation = backfill;
+}
+
 //===========================================================================
 bool DbData::eraseMetric(string * name, DbTxn & txn, uint32_t id) {
     auto mi = getMetricPos(id);
@@ -364,6 +1352,8 @@ bool DbData::eraseMetric(string * name, DbTxn & txn, uint32_t id) {
     *name = txn.pin<MetricPage>(mi.infoPage)->name;
 
     // update id index
+    for (auto level = kMaxRollups; level; --level)
+        rollupErase(txn, id, level);
     {
         scoped_lock lk{m_mndxMut};
         DbTxn::PinScope pins(txn);
@@ -381,7 +1371,7 @@ if constexpr (1) {
 }
 
 //===========================================================================
-void DbData::updateMetric(
+bool DbData::updateMetric(
     DbTxn & txn,
     uint32_t id,
     const DbMetricInfo & from
@@ -391,39 +1381,39 @@ void DbData::updateMetric(
 
     auto mi = getMetricPos(id);
     if (!mi.infoPage)
-        return;
+        return false;
     auto mp = txn.pin<MetricPage>(mi.infoPage);
     DbMetricInfo info = {};
     info.retention = from.retention.count() ? from.retention : mp->retention;
     info.interval = from.interval.count() ? from.interval : mp->interval;
     info.type = from.type ? from.type : mp->sampleType;
     info.creation = !empty(from.creation) ? from.creation : mp->creation;
-    if (mp->retention == info.retention
-        && mp->interval == info.interval
-        && mp->sampleType == info.type
-        && mp->creation == info.creation
-    ) {
-        return;
-    }
-
-    // Remove all existing samples
-    radixDestruct(txn, mp->hdr);
-    txn.walMetricUpdate(
-        mi.infoPage,
-        info.creation,
-        info.type,
-        info.retention,
-        info.interval
-    );
+    auto changed = mp->retention != info.retention
+        || mp->interval != info.interval
+        || mp->sampleType != info.type
+        || mp->creation != info.creation;
+    if (changed) {
+        // Remove all existing samples
+        radixDestruct(txn, mp->hdr);
+        txn.walMetricUpdate(
+            mi.infoPage,
+            info.creation,
+            info.type,
+            info.retention,
+            info.interval
+        );
 
-    // Reset in memory references
-    mi.interval = info.interval;
-    mi.sampleType = info.type;
-    mi.lastPage = {};
-    mi.pageFirstTime = {};
-    mi.pageLastSample = 0;
-    shared_lock lk{m_mposMut};
-    m_metricPos[id] = mi;
+        // Reset in memory references
+        mi.interval = info.interval;
+        mi.sampleType = info.type;
+        mi.lastPage = {};
+        mi.pageFirstTime = {};
+        mi.pageLastSample = 0;
+        setMetricPos(id, mi);
+    }
+    if (changed || !from.rollups.empty())
+        return rollupConfigure(txn, id, from.rollups, changed);
+    return false;
 }
 
 //===========================================================================
@@ -481,7 +1471,40 @@ void DbData::onWalApplyMetricUpdate(
 
 //===========================================================================
 size_t DbData::samplesPerPage(DbSampleType type) const {
-    return ::samplesPerPage(type, m_pageSize);
+    return ::samplesPerPage(type, m_pageSize, m_pageSummaries);
+}
+
+//===========================================================================
+size_t DbData::packedCapacity() const {
+    return ::packedCapacity(m_pageSize);
+}
+
+//===========================================================================
+size_t DbData::metricRingPages(DbTxn & txn, uint32_t id) {
+    auto mi = getMetricPos(id);
+    if (!mi.infoPage || !mi.lastPage)
+        return 0;
+    auto mp = txn.pin<MetricPage>(mi.infoPage);
+    return sampleRingPages(mi.sampleType, mp->retention, mp->interval);
+}
+
+//===========================================================================
+// Number of sample pages in the metric's ring buffer.
+size_t DbData::sampleRingPages(
+    DbSampleType type,
+    Duration retention,
+    Duration interval
+) const {
+    auto spp = samplesPerPage(type);
+    auto numSamples = retention / interval;
+    auto numPages = (numSamples - 1) / spp + 1;
+
+    // Packed pages are cleared when reused instead of keeping their samples
+    // from the previous trip around the ring, so one more page is needed to
+    // cover the full retention.
+    if (type == kSampleTypePacked)
+        numPages += 1;
+    return numPages;
 }
 
 //===========================================================================
@@ -519,18 +1542,239 @@ static double getSample(const DbData::SamplePage * sp, size_t pos) {
         return getSample(sp->samples.i16 + pos);
     case kSampleTypeInt32:
         return getSample(sp->samples.i32 + pos);
+    case kSampleTypePacked:
+        assert(!"Packed samples aren't addressable by position");
+        return NAN;
     default:
         assert(!"Unknown sample type");
         return NAN;
     }
 }
 
+//===========================================================================
+// Kept as a simple loop, without branches outside of getSample, so that the
+// conversion can be vectorized.
+template<typename T>
+static void getSamples(double * out, const T * samples, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        out[i] = getSample(samples + i);
+}
+
+//===========================================================================
+static void getSamples(
+    double * out,
+    const DbData::SamplePage * sp,
+    size_t pos,
+    size_t count
+) {
+    switch (sp->sampleType) {
+    case kSampleTypeFloat32:
+        return getSamples(out, sp->samples.f32 + pos, count);
+    case kSampleTypeFloat64:
+        return getSamples(out, sp->samples.f64 + pos, count);
+    case kSampleTypeInt8:
+        return getSamples(out, sp->samples.i8 + pos, count);
+    case kSampleTypeInt16:
+        return getSamples(out, sp->samples.i16 + pos, count);
+    case kSampleTypeInt32:
+        return getSamples(out, sp->samples.i32 + pos, count);
+    case kSampleTypePacked:
+        assert(!"Packed samples aren't addressable by position");
+        break;
+    default:
+        assert(!"Unknown sample type");
+        break;
+    }
+    fill_n(out, count, NAN);
+}
+
+//===========================================================================
+constexpr size_t runsCapacity(size_t pageSize) {
+    return pageSize - offsetof(DbData::SampleRunsPage, data);
+}
+
+//===========================================================================
+constexpr size_t runsEntrySize(size_t numRuns) {
+    return offsetof(SampleRunsEntry, runs) + numRuns * sizeof(SampleRun);
+}
+
+//===========================================================================
+// Returns the samples of the page of fixed size samples as runs.
+static vector<SampleRun> sampleRuns(
+    const DbData::SamplePage * sp,
+    size_t spp
+) {
+    vector<SampleRun> out;
+    for (size_t i = 0; i < spp; ++i) {
+        auto value = getSample(sp, i);
+        if (!out.empty()) {
+            double prev = out.back().value;
+            if (value == prev || isnan(value) && isnan(prev))
+                continue;
+        }
+        out.push_back({(uint16_t) i, value});
+    }
+    return out;
+}
+
+//===========================================================================
+// Offsets of the entries, in order of position.
+static uint16_t * runsSlots(DbData::SampleRunsPage * rp, size_t pageSize) {
+    return reinterpret_cast<uint16_t *>((char *) rp + pageSize)
+        - rp->numEntries;
+}
+
+//===========================================================================
+static const uint16_t * runsSlots(
+    const DbData::SampleRunsPage * rp,
+    size_t pageSize
+) {
+    return runsSlots(const_cast<DbData::SampleRunsPage *>(rp), pageSize);
+}
+
+//===========================================================================
+static const SampleRunsEntry * runsEntry(
+    const DbData::SampleRunsPage * rp,
+    size_t off
+) {
+    return reinterpret_cast<const SampleRunsEntry *>(rp->data + off);
+}
+
+//===========================================================================
+// Bytes not used by either the entries or their offsets.
+static size_t runsFree(const DbData::SampleRunsPage * rp, size_t pageSize) {
+    return runsCapacity(pageSize)
+        - rp->used
+        - rp->numEntries * sizeof(uint16_t);
+}
+
+//===========================================================================
+// Returns the index of the offset of the first entry that isn't for a
+// position before pagePos.
+static size_t runsLowerBound(
+    const DbData::SampleRunsPage * rp,
+    size_t pageSize,
+    size_t pagePos
+) {
+    auto slots = runsSlots(rp, pageSize);
+    auto i = lower_bound(
+        slots,
+        slots + rp->numEntries,
+        pagePos,
+        [rp](uint16_t off, size_t pos) {
+            return runsEntry(rp, off)->pagePos < pos;
+        }
+    );
+    return i - slots;
+}
+
+//===========================================================================
+// Returns the entry for the page at the position of the ring, or null if
+// there isn't one.
+static const SampleRunsEntry * findRuns(
+    const DbData::SampleRunsPage * rp,
+    size_t pageSize,
+    size_t pagePos
+) {
+    auto i = runsLowerBound(rp, pageSize, pagePos);
+    if (i == rp->numEntries)
+        return nullptr;
+    auto ent = runsEntry(rp, runsSlots(rp, pageSize)[i]);
+    return ent->pagePos == pagePos ? ent : nullptr;
+}
+
+//===========================================================================
+// Resizes the entry of the offset at the index, moving the entries after it,
+// and returns it.
+static SampleRunsEntry * resizeRuns(
+    DbData::SampleRunsPage * rp,
+    size_t pageSize,
+    size_t index,
+    size_t bytes
+) {
+    auto slots = runsSlots(rp, pageSize);
+    auto off = slots[index];
+    auto ent = reinterpret_cast<SampleRunsEntry *>(rp->data + off);
+    auto oldBytes = runsEntrySize(ent->numRuns);
+    assert(bytes <= oldBytes + runsFree(rp, pageSize));
+    auto next = off + oldBytes;
+    memmove(rp->data + off + bytes, rp->data + next, rp->used - next);
+    for (unsigned i = 0; i < rp->numEntries; ++i) {
+        if (slots[i] > off)
+            slots[i] = (uint16_t) (slots[i] - oldBytes + bytes);
+    }
+    rp->used = (uint16_t) (rp->used - oldBytes + bytes);
+    return ent;
+}
+
+//===========================================================================
+// Returns position one past the last sample of the run.
+static size_t runEnd(const SampleRunsEntry * ent, size_t run, size_t spp) {
+    return run + 1 < ent->numRuns ? ent->runs[run + 1].firstPos : spp;
+}
+
+//===========================================================================
+static void getSamples(
+    double * out,
+    const SampleRunsEntry * ent,
+    size_t spp,
+    size_t pos,
+    size_t count
+) {
+    auto last = pos + count;
+    for (size_t i = 0; i < ent->numRuns && pos < last; ++i) {
+        auto num = min(runEnd(ent, i, spp), last);
+        if (num <= pos)
+            continue;
+        num -= pos;
+        fill_n(out, num, (double) ent->runs[i].value);
+        out += num;
+        pos += num;
+    }
+    assert(pos == last);
+}
+
+//===========================================================================
+// Adds the samples of the runs, in [pos, lastPos), to the summary.
+static void addSummaryRuns(
+    DbSampleSummary * out,
+    const SampleRunsEntry * ent,
+    size_t spp,
+    size_t pos,
+    size_t lastPos
+) {
+    for (size_t i = 0; i < ent->numRuns; ++i) {
+        auto first = max((size_t) ent->runs[i].firstPos, pos);
+        auto last = min(runEnd(ent, i, spp), lastPos);
+        double value = ent->runs[i].value;
+        if (first >= last || isnan(value))
+            continue;
+        // The first sample of the run maintains the min, max, and first and
+        // last values, the rest only add to the count and sum.
+        addSummarySample(out, value);
+        auto num = last - first - 1;
+        out->count += (unsigned) num;
+        out->sum += value * num;
+    }
+}
+
+//===========================================================================
+// Returns true if the page is a page of sample runs, rather than a virtual
+// or physical sample page.
+static bool isRunsPage(DbTxn & txn, pgno_t pgno) {
+    return pgno
+        && pgno <= kMaxPageNum
+        && txn.pin<DbPageHeader>(pgno)->type == DbPageType::kSampleRuns;
+}
+
 //===========================================================================
 DbData::MetricPosition DbData::loadMetricPos(DbTxn & txn, uint32_t id) {
-    auto mi = getMetricPos(id);
+    auto mi = getMetricPos(txn, id);
 
-    // Update metric info from sample page if it has no page data.
-    if (mi.infoPage && mi.lastPage && empty(mi.pageFirstTime)) {
+    // Update metric info from sample page if it has no page data. Unless it
+    // was updated, or evicted, while this was.
+    while (mi.infoPage && mi.lastPage && empty(mi.pageFirstTime)) {
+        auto from = mi;
         if (mi.lastPage > kMaxPageNum) {
             auto mp = txn.pin<MetricPage>(mi.infoPage);
             mi.pageFirstTime = mp->lastPageFirstTime;
@@ -540,7 +1784,39 @@ DbData::MetricPosition DbData::loadMetricPos(DbTxn & txn, uint32_t id) {
             mi.pageFirstTime = sp->pageFirstTime;
             mi.pageLastSample = sp->pageLastSample;
         }
-        setMetricPos(id, mi);
+        if (replaceMetricPos(id, from, mi))
+            break;
+        mi = getMetricPos(txn, id);
+    }
+    // The position is consistent with the snapshot, if there is one, so
+    // updates can now proceed without affecting what it sees.
+    txn.detachSnapshot();
+    return mi;
+}
+
+//===========================================================================
+DbData::MetricPosition DbData::snapshotMetricPos(DbTxn & txn, uint32_t id) {
+    assert(txn.snapshot());
+    MetricPosition mi = {};
+    if (!radixFind(txn, &mi.infoPage, m_metricRoot, id))
+        return {};
+    auto mp = txn.pin<MetricPage>(mi.infoPage);
+    if (mp->hdr.type != mp->kPageType || mp->hdr.id != id)
+        return {};
+    mi.interval = mp->interval;
+    mi.sampleType = mp->sampleType;
+    if (empty(mp->lastPageFirstTime)
+        || !radixFind(txn, &mi.lastPage, mi.infoPage, mp->lastPagePos)
+    ) {
+        return mi;
+    }
+    if (mi.lastPage > kMaxPageNum) {
+        mi.pageFirstTime = mp->lastPageFirstTime;
+        mi.pageLastSample = mp->lastPageSample;
+    } else {
+        auto sp = txn.pin<SamplePage>(mi.lastPage);
+        mi.pageFirstTime = sp->pageFirstTime;
+        mi.pageLastSample = sp->pageLastSample;
     }
     return mi;
 }
@@ -563,8 +1839,12 @@ DbData::MetricPosition DbData::loadMetricPos(
 
     auto lastSample = (uint16_t) (id % samplesPerPage(mi.sampleType));
     auto pageTime = time - lastSample * mi.interval;
-    auto spno = allocPgno(txn);
-    txn.walSampleInit(spno, id, mi.sampleType, pageTime, lastSample);
+    auto spno = allocMetricPgno(txn, id);
+    if (mi.sampleType == kSampleTypePacked) {
+        txn.walSamplePackInit(spno, id, pageTime, mi.interval, lastSample);
+    } else {
+        txn.walSampleInit(spno, id, mi.sampleType, pageTime, lastSample);
+    }
     [[maybe_unused]] auto mp = txn.pin<MetricPage>(mi.infoPage);
     txn.walMetricUpdateSamples(mi.infoPage, 0, pageTime, (size_t) -1, spno);
 
@@ -575,6 +1855,14 @@ DbData::MetricPosition DbData::loadMetricPos(
     return mi;
 }
 
+//===========================================================================
+TimePoint DbData::metricLastTime(DbTxn & txn, uint32_t id) {
+    auto mi = loadMetricPos(txn, id);
+    if (!mi.lastPage)
+        return {};
+    return mi.pageFirstTime + mi.pageLastSample * mi.interval;
+}
+
 //===========================================================================
 void DbData::onWalApplyMetricClearSamples(void * ptr) {
     auto mp = static_cast<MetricPage *>(ptr);
@@ -616,10 +1904,22 @@ void DbData::updateSample(
     TimePoint time,
     double value
 ) {
-    assert(!empty(time));
-    const auto kInvalidPos = (size_t) -1;
+    auto prevLast = metricLastTime(txn, id);
+    sampleUpdate(txn, id, time, value);
+    rollupUpdate(txn, id, time, time, prevLast);
+}
 
-    // ensure all info about the last page is loaded, the expectation is that
+//===========================================================================
+void DbData::sampleUpdate(
+    DbTxn & txn,
+    uint32_t id,
+    TimePoint time,
+    double value
+) {
+    assert(!empty(time));
+    const auto kInvalidPos = (size_t) -1;
+
+    // ensure all info about the last page is loaded, the expectation is that
     // almost all updates are to the last page.
     auto mi = loadMetricPos(txn, id, time);
     if (!mi.infoPage)
@@ -654,15 +1954,17 @@ void DbData::updateSample(
                 return;
             }
 
-            auto numSamples = mp->retention / mi.interval;
-            auto numPages = (numSamples - 1) / spp + 1;
+            auto numPages =
+                sampleRingPages(mi.sampleType, mp->retention, mi.interval);
             auto poff = (mi.pageFirstTime - time + pageInterval - mi.interval)
                 / pageInterval;
             pageTime = mi.pageFirstTime - poff * pageInterval;
             sppos = (mp->lastPagePos + numPages - poff) % numPages;
             if (sppos == mp->lastPagePos) {
                 // Still on the tip page of the ring buffer, but in the old
-                // samples section.
+                // samples section. Never happens with packed pages, since
+                // their ring has an extra page.
+                assert(mi.sampleType != kSampleTypePacked);
                 sppos = kInvalidPos;
                 ent = (time - pageTime) / mi.interval;
             } else {
@@ -715,6 +2017,22 @@ void DbData::updateSample(
                     spno
                 );
             }
+        } else if (isRunsPage(txn, spno)) {
+            // Only old pages are run length encoded. They're updated in
+            // place, unless the runs no longer fit.
+            assert(sppos != kInvalidPos);
+            auto pos = (size_t) ((time - pageTime) / mi.interval);
+            if (sampleRunsUpdate(txn, mi, sppos, spno, pos, value))
+                return;
+            spno = sampleMakePhysical(
+                txn,
+                id,
+                mi,
+                sppos,
+                pageTime,
+                spp - 1,
+                spno
+            );
         }
         auto sp = txn.pin<SamplePage>(spno);
         if (ent == kInvalidPos) {
@@ -722,7 +2040,14 @@ void DbData::updateSample(
             ent = (time - sp->pageFirstTime) / mi.interval;
         }
         assert(ent < (unsigned) spp);
-        auto ref = getSample(sp, ent);
+        double ref;
+        auto pgno = spno;
+        if (mi.sampleType == kSampleTypePacked) {
+            auto time = sp->pageFirstTime + ent * mi.interval;
+            pgno = samplePackFind(&ref, txn, spno, time);
+        } else {
+            ref = getSample(sp, ent);
+        }
         if (ref == value) {
             s_perfDup += 1;
         } else {
@@ -735,9 +2060,21 @@ void DbData::updateSample(
             } else {
                 s_perfChange += 1;
             }
-            txn.walSampleUpdateTxn(spno, ent, value, false);
-            if (sampleTryMakeVirtual(txn, mi, spno))
+            if (mi.sampleType == kSampleTypePacked) {
+                samplePackUpdate(txn, pgno, ent, value);
+            } else {
+                txn.walSampleUpdateTxn(spno, ent, value, false);
+            }
+            if (sampleTryMakeVirtual(txn, mi, spno)) {
+                setMetricPos(id, mi);
+            } else if (mi.changedPage != spno) {
+                // Old pages are encoded once updates move on from them,
+                // instead of after every change.
+                auto prev = mi.changedPage;
+                mi.changedPage = spno;
                 setMetricPos(id, mi);
+                sampleTryMakeRuns(txn, id, mi, prev);
+            }
         }
         return;
     }
@@ -758,7 +2095,7 @@ void DbData::updateSample(
             mi.pageFirstTime = {};
             mi.pageLastSample = 0;
             setMetricPos(id, mi);
-            updateSample(txn, id, time, value);
+            sampleUpdate(txn, id, time, value);
             return;
         }
     }
@@ -789,7 +2126,14 @@ void DbData::updateSample(
         [[maybe_unused]] auto sp = txn.pin<SamplePage>(mi.lastPage);
         assert(mi.pageFirstTime == sp->pageFirstTime);
         assert(mi.pageLastSample == sp->pageLastSample);
-        if (ent == mi.pageLastSample + 1) {
+        if (mi.sampleType == kSampleTypePacked) {
+            // Missing samples between the previous last and this one are
+            // implicit, they're simply not in the packed stream.
+            samplePackAppend(txn, mi.lastPage, ent, value);
+            mi.pageLastSample = ent;
+            if (ent == spp - 1)
+                sampleTryMakeVirtual(txn, mi, mi.lastPage);
+        } else if (ent == mi.pageLastSample + 1) {
             txn.walSampleUpdateTxn(mi.lastPage, ent, value, true);
             mi.pageLastSample = ent;
             if (ent == spp - 1)
@@ -810,7 +2154,17 @@ void DbData::updateSample(
 
     if (mi.lastPage <= kMaxPageNum) {
         [[maybe_unused]] auto sp = txn.pin<SamplePage>(mi.lastPage);
-        txn.walSampleUpdate(mi.lastPage, mi.pageLastSample + 1, spp, NAN, true);
+        if (mi.sampleType == kSampleTypePacked) {
+            samplePackAppend(txn, mi.lastPage, spp, NAN);
+        } else {
+            txn.walSampleUpdate(
+                mi.lastPage,
+                mi.pageLastSample + 1,
+                spp,
+                NAN,
+                true
+            );
+        }
     } else {
         if (mi.pageLastSample + 1 < spp) {
             auto mp = txn.pin<MetricPage>(mi.infoPage);
@@ -823,13 +2177,17 @@ void DbData::updateSample(
                 mi.pageLastSample,
                 mi.lastPage
             );
-            txn.walSampleUpdate(
-                mi.lastPage,
-                mi.pageLastSample + 1,
-                spp,
-                NAN,
-                true
-            );
+            if (mi.sampleType == kSampleTypePacked) {
+                samplePackAppend(txn, mi.lastPage, spp, NAN);
+            } else {
+                txn.walSampleUpdate(
+                    mi.lastPage,
+                    mi.pageLastSample + 1,
+                    spp,
+                    NAN,
+                    true
+                );
+            }
         }
     }
     mi.pageLastSample = (uint16_t) spp;
@@ -840,8 +2198,8 @@ void DbData::updateSample(
     // delete pages between last page and the one the sample is on
     auto num = (time - endPageTime) / pageInterval;
     auto mp = txn.pin<MetricPage>(mi.infoPage);
-    auto numSamples = mp->retention / mp->interval;
-    auto numPages = (numSamples - 1) / spp + 1;
+    auto numPages =
+        sampleRingPages(mi.sampleType, mp->retention, mp->interval);
     auto first = (mp->lastPagePos + 1) % numPages;
     auto last = first + num;
     if (num) {
@@ -858,9 +2216,21 @@ void DbData::updateSample(
     // update reference to last sample page
     pgno_t lastPage;
     if (radixFind(txn, &lastPage, mi.infoPage, last)
-        && lastPage <= kMaxPageNum
+        && isRunsPage(txn, lastPage)
     ) {
+        // Samples from its previous trip around the ring are past the new
+        // last sample, so it's replaced by a fresh page, as virtual pages
+        // are, rather than expanded.
+        sampleRunsRemove(txn, lastPage, last);
+        lastPage = {};
+    }
+    if (lastPage && lastPage <= kMaxPageNum) {
         [[maybe_unused]] auto sp = txn.pin<SamplePage>(lastPage);
+        if (mi.sampleType == kSampleTypePacked) {
+            // Reused packed pages start over empty, release any overflow
+            // pages they had.
+            sampleDestructPage(txn, lastPage);
+        }
         txn.walSampleUpdateTime(lastPage, endPageTime);
     } else {
         lastPage = sampleMakePhysical(
@@ -881,13 +2251,22 @@ void DbData::updateSample(
         {}
     );
 
+    auto prevPage = mi.lastPage;
+    auto changedPage = mi.changedPage;
     mi.lastPage = lastPage;
     mi.pageFirstTime = endPageTime;
     mi.pageLastSample = 0;
+    mi.changedPage = {};
     setMetricPos(id, mi);
 
+    // The previous last page is full and no longer the tip of the ring, so
+    // it may now be run length encoded. As may the old page last changed,
+    // now that updates have moved on.
+    sampleTryMakeRuns(txn, id, mi, prevPage);
+    sampleTryMakeRuns(txn, id, mi, changedPage);
+
     // write sample to new last page
-    updateSample(txn, id, time, value);
+    sampleUpdate(txn, id, time, value);
 }
 
 //===========================================================================
@@ -927,6 +2306,9 @@ static void setSample(DbData::SamplePage * sp, size_t pos, double value) {
         return setSample(sp->samples.i16 + pos, value);
     case kSampleTypeInt32:
         return setSample(sp->samples.i32 + pos, value);
+    case kSampleTypePacked:
+        assert(!"Packed samples aren't addressable by position");
+        break;
     default:
         assert(!"unknown sample type");
     }
@@ -972,6 +2354,121 @@ static void setSamples(
 }
 
 //===========================================================================
+static void setSamples(
+    DbData::SamplePage * sp,
+    const SampleRunsEntry * ent,
+    size_t spp
+) {
+    for (size_t i = 0; i < ent->numRuns; ++i) {
+        auto & run = ent->runs[i];
+        setSamples(sp, run.firstPos, runEnd(ent, i, spp), run.value);
+    }
+}
+
+//===========================================================================
+void DbData::updateSamples(
+    DbTxn & txn,
+    uint32_t id,
+    span<const DbSample> samples
+) {
+    if (samples.empty())
+        return;
+    auto mi = loadMetricPos(txn, id);
+    if (!mi.infoPage)
+        return;
+
+    // Apply in time order, so the samples on each page are applied together
+    // and runs appended to the tip page share a single WAL record. Updates of
+    // the same sample keep their order.
+    vector<DbSample> sorted(samples.begin(), samples.end());
+    stable_sort(sorted.begin(), sorted.end(), [&](auto & a, auto & b) {
+        auto at = a.time - a.time.time_since_epoch() % mi.interval;
+        auto bt = b.time - b.time.time_since_epoch() % mi.interval;
+        return at < bt;
+    });
+    samples = sorted;
+    auto first = samples.front().time;
+    auto last = samples.back().time;
+    auto prevLast = metricLastTime(txn, id);
+
+    while (!samples.empty()) {
+        // Release pins as we go, a batch may touch many more pages than a
+        // single update.
+        DbTxn::PinScope pins(txn);
+        if (auto num = sampleUpdateRange(txn, id, samples)) {
+            samples = samples.subspan(num);
+        } else {
+            sampleUpdate(txn, id, samples[0].time, samples[0].value);
+            samples = samples.subspan(1);
+        }
+    }
+    rollupUpdate(txn, id, first, last, prevLast);
+}
+
+//===========================================================================
+// Appends the leading run of samples that extend the tip page, if it's a
+// physical page of fixed size samples, with a single WAL record. Returns the
+// number of samples appended, or 0 if there weren't at least two of them.
+size_t DbData::sampleUpdateRange(
+    DbTxn & txn,
+    uint32_t id,
+    span<const DbSample> samples
+) {
+    auto mi = loadMetricPos(txn, id);
+    if (!mi.infoPage
+        || !mi.lastPage
+        || mi.lastPage > kMaxPageNum
+        || mi.sampleType == kSampleTypePacked
+    ) {
+        return 0;
+    }
+
+    auto spp = samplesPerPage(mi.sampleType);
+    auto lastSampleTime = mi.pageFirstTime + mi.pageLastSample * mi.interval;
+    auto endPageTime = mi.pageFirstTime + spp * mi.interval;
+
+    // Set the values, and NANs for any skipped positions, in a scratch page
+    // from which they're copied into the WAL record.
+    string buf(m_pageSize, 0);
+    auto tmp = reinterpret_cast<SamplePage *>(buf.data());
+    tmp->sampleType = mi.sampleType;
+    auto first = mi.pageLastSample + 1u;
+    auto last = first; // one past last position set
+    size_t num = 0;
+    for (auto && samp : samples) {
+        auto time = samp.time - samp.time.time_since_epoch() % mi.interval;
+        if (time <= lastSampleTime || time >= endPageTime)
+            break;
+        auto ent = (size_t) ((time - mi.pageFirstTime) / mi.interval);
+        for (; last < ent; ++last)
+            setSample(tmp, last - first, NAN);
+        setSample(tmp, ent - first, samp.value);
+        last = ent + 1;
+        lastSampleTime = time;
+        num += 1;
+    }
+    if (num < 2) {
+        // Single samples have more compact WAL records of their own.
+        return 0;
+    }
+
+    s_perfAdd += num;
+    auto values = span<const uint8_t>(
+        (const uint8_t *) &tmp->samples,
+        (last - first) * sampleTypeSize(mi.sampleType)
+    );
+    [[maybe_unused]] auto sp = txn.pin<SamplePage>(mi.lastPage);
+    txn.walSampleUpdateRange(mi.lastPage, first, values, true);
+    mi.pageLastSample = (uint16_t) (last - 1);
+    if (last == spp)
+        sampleTryMakeVirtual(txn, mi, mi.lastPage);
+    setMetricPos(id, mi);
+    return num;
+}
+
+//===========================================================================
+// Replaces the virtual page, or page of sample runs, or missing page if vpage
+// is 0, at the position with a physical page with the same samples.
 pgno_t DbData::sampleMakePhysical(
     DbTxn & txn,
     uint32_t id,
@@ -982,20 +2479,51 @@ pgno_t DbData::sampleMakePhysical(
     pgno_t vpage
 ) {
     auto fill = (double) NAN;
-    if (vpage) {
+    if (vpage > kMaxPageNum) {
         fill = getSample(&vpage);
         assert(!isnan(fill));
     }
-    auto spno = allocPgno(txn);
-    txn.walSampleInit(
-        spno,
-        id,
-        mi.sampleType,
-        pageTime,
-        lastSample,
-        fill
-    );
+    auto spno = allocMetricPgno(txn, id);
+    if (mi.sampleType == kSampleTypePacked) {
+        txn.walSamplePackInit(
+            spno,
+            id,
+            pageTime,
+            mi.interval,
+            lastSample,
+            fill
+        );
+    } else {
+        txn.walSampleInit(
+            spno,
+            id,
+            mi.sampleType,
+            pageTime,
+            lastSample,
+            fill
+        );
+    }
+    if (vpage && vpage <= kMaxPageNum) {
+        // Page of sample runs, expanded into a scratch page from which the
+        // samples are copied into the WAL record.
+        assert(mi.sampleType != kSampleTypePacked);
+        auto spp = samplesPerPage(mi.sampleType);
+        auto rp = txn.pin<SampleRunsPage>(vpage);
+        auto runs = findRuns(rp, m_pageSize, sppos);
+        assert(runs);
+        string buf(m_pageSize, 0);
+        auto tmp = reinterpret_cast<SamplePage *>(buf.data());
+        tmp->sampleType = mi.sampleType;
+        setSamples(tmp, runs, spp);
+        auto bytes = span<const uint8_t>(
+            (const uint8_t *) &tmp->samples,
+            spp * sampleTypeSize(mi.sampleType)
+        );
+        txn.walSampleUpdateRange(spno, 0, bytes, false);
+    }
     radixSwapValue(txn, mi.infoPage, sppos, spno);
+    if (vpage && vpage <= kMaxPageNum)
+        sampleRunsRemove(txn, vpage, sppos);
     return spno;
 }
 
@@ -1006,18 +2534,39 @@ bool DbData::sampleTryMakeVirtual(
     pgno_t spno
 ) {
     auto sp = txn.pin<SamplePage>(spno);
-    auto value = getSample(sp, 0);
-    if (isnan(value))
-        return false;
+    auto spp = samplesPerPage(mi.sampleType);
+    double value = NAN;
+    if (mi.sampleType == kSampleTypePacked) {
+        // Every position must have a sample and they must all be the same.
+        size_t count = 0;
+        for (auto pgno = spno; pgno; ) {
+            auto ps = packedSamples(txn.pin<SamplePage>(pgno));
+            for (auto it = unpackSamples(ps); it; ++it) {
+                if (!count++) {
+                    value = it->value;
+                } else if (value != it->value) {
+                    return false;
+                }
+            }
+            pgno = ps->overflow;
+        }
+        if (count != spp)
+            return false;
+    } else {
+        value = getSample(sp, 0);
+        if (isnan(value))
+            return false;
+    }
     pgno_t vpage;
     setSample(&vpage, value);
     if (value != getSample(&vpage))
         return false;
 
-    auto spp = samplesPerPage(mi.sampleType);
-    for (auto i = 1; i < spp; ++i) {
-        if (value != getSample(sp, i))
-            return false;
+    if (mi.sampleType != kSampleTypePacked) {
+        for (auto i = 1; i < spp; ++i) {
+            if (value != getSample(sp, i))
+                return false;
+        }
     }
 
     auto mp = txn.pin<MetricPage>(mi.infoPage);
@@ -1029,8 +2578,8 @@ bool DbData::sampleTryMakeVirtual(
         mi.lastPage = vpage;
     } else {
         auto pageInterval = spp * mi.interval;
-        auto numSamples = mp->retention / mp->interval;
-        auto numPages = (numSamples - 1) / spp + 1;
+        auto numPages =
+            sampleRingPages(mi.sampleType, mp->retention, mp->interval);
         auto sptime = sp->pageFirstTime;
         auto poff = (mi.pageFirstTime - sptime + pageInterval - mi.interval)
             / pageInterval;
@@ -1041,6 +2590,411 @@ bool DbData::sampleTryMakeVirtual(
     return true;
 }
 
+//===========================================================================
+// Replaces the full page of fixed size samples, if it's not the tip page and
+// its samples are few enough runs, with an entry on a page of sample runs.
+// The page of runs of the previous position is shared if there's room.
+bool DbData::sampleTryMakeRuns(
+    DbTxn & txn,
+    uint32_t id,
+    const DbData::MetricPosition & mi,
+    pgno_t spno
+) {
+    if (!spno
+        || spno > kMaxPageNum
+        || spno == mi.lastPage
+        || mi.sampleType == kSampleTypePacked
+    ) {
+        return false;
+    }
+    // Pages remembered as changed may have since been freed or reused.
+    auto hdr = txn.pin<DbPageHeader>(spno);
+    if (hdr->type != DbPageType::kSample || hdr->id != id)
+        return false;
+    auto sp = txn.pin<SamplePage>(spno);
+    auto spp = samplesPerPage(mi.sampleType);
+    auto mp = txn.pin<MetricPage>(mi.infoPage);
+    auto pageInterval = spp * mi.interval;
+    auto numPages = sampleRingPages(mi.sampleType, mp->retention, mp->interval);
+    auto sptime = sp->pageFirstTime;
+    auto poff = (mi.pageFirstTime - sptime + pageInterval - mi.interval)
+        / pageInterval;
+    if (poff <= 0 || (size_t) poff >= numPages)
+        return false;
+    auto sppos = (mp->lastPagePos + numPages - poff) % numPages;
+    pgno_t pgno;
+    if (!radixFind(txn, &pgno, mi.infoPage, sppos) || pgno != spno)
+        return false;
+
+    auto runs = sampleRuns(sp, spp);
+    auto bytes = runsEntrySize(runs.size());
+    if (bytes * kMinPagesPerRunsPage > runsCapacity(m_pageSize))
+        return false;
+
+    // An entry already there for the position is left from before it was
+    // expanded, and is removed along with any others that are stale if
+    // that's what it takes to make room.
+    pgno_t rpno;
+    auto fits = [&]() {
+        auto rp = txn.pin<SampleRunsPage>(rpno);
+        return !findRuns(rp, m_pageSize, sppos)
+            && bytes + sizeof(uint16_t) <= runsFree(rp, m_pageSize);
+    };
+    auto prev = (sppos + numPages - 1) % numPages;
+    if (!radixFind(txn, &rpno, mi.infoPage, prev) || !isRunsPage(txn, rpno)) {
+        rpno = {};
+    } else if (!fits()) {
+        sampleRunsCompact(txn, mi.infoPage, rpno);
+        if (!fits())
+            rpno = {};
+    }
+    if (!rpno) {
+        rpno = allocMetricPgno(txn, id);
+        txn.walSampleRunsInit(rpno, id);
+    }
+    txn.walSampleRunsAdd(
+        rpno,
+        sppos,
+        sptime,
+        span((const uint8_t *) runs.data(), runs.size() * sizeof(SampleRun))
+    );
+    radixSwapValue(txn, mi.infoPage, sppos, rpno);
+    freePage(txn, spno);
+    return true;
+}
+
+//===========================================================================
+// Changes the sample of the page of sample runs, rewriting its entry in
+// place, or replacing it with a virtual page if they become a single run.
+// Returns false, having changed nothing, if the runs no longer fit and the
+// page must be expanded instead.
+bool DbData::sampleRunsUpdate(
+    DbTxn & txn,
+    const DbData::MetricPosition & mi,
+    size_t sppos,
+    pgno_t rpno,
+    size_t pos,
+    double value
+) {
+    auto spp = samplesPerPage(mi.sampleType);
+    auto ent = findRuns(txn.pin<SampleRunsPage>(rpno), m_pageSize, sppos);
+    assert(ent);
+    double ref;
+    ::getSamples(&ref, ent, spp, pos, 1);
+    if (ref == value || isnan(ref) && isnan(value)) {
+        s_perfDup += 1;
+        return true;
+    }
+    auto & perfUpdated = isnan(ref) ? s_perfAdd : s_perfChange;
+
+    // Runs of the changed samples, as they would be stored on a physical
+    // page.
+    string buf(m_pageSize, 0);
+    auto tmp = reinterpret_cast<SamplePage *>(buf.data());
+    tmp->sampleType = mi.sampleType;
+    setSamples(tmp, ent, spp);
+    setSample(tmp, pos, value);
+    auto runs = sampleRuns(tmp, spp);
+    if (runs.size() == 1 && !isnan(runs[0].value)) {
+        pgno_t vpage;
+        setSample(&vpage, runs[0].value);
+        if (getSample(&vpage) == runs[0].value) {
+            perfUpdated += 1;
+            radixSwapValue(txn, mi.infoPage, sppos, vpage);
+            sampleRunsRemove(txn, rpno, sppos);
+            return true;
+        }
+    }
+
+    auto bytes = runsEntrySize(runs.size());
+    if (bytes * kMinPagesPerRunsPage > runsCapacity(m_pageSize))
+        return false;
+    auto fits = [&]() {
+        auto rp = txn.pin<SampleRunsPage>(rpno);
+        auto cur = findRuns(rp, m_pageSize, sppos);
+        return bytes <= runsEntrySize(cur->numRuns) + runsFree(rp, m_pageSize);
+    };
+    if (!fits()) {
+        sampleRunsCompact(txn, mi.infoPage, rpno);
+        if (!fits())
+            return false;
+    }
+    perfUpdated += 1;
+    txn.walSampleRunsUpdate(
+        rpno,
+        sppos,
+        span((const uint8_t *) runs.data(), runs.size() * sizeof(SampleRun))
+    );
+    return true;
+}
+
+//===========================================================================
+// Releases the position's reference to the page of sample runs, removing its
+// entry unless the page is freed along with it.
+void DbData::sampleRunsRemove(DbTxn & txn, pgno_t rpno, size_t sppos) {
+    if (txn.pin<SampleRunsPage>(rpno)->refs > 1)
+        txn.walSampleRunsRemove(rpno, sppos);
+    freePage(txn, rpno);
+}
+
+//===========================================================================
+// Removes the entries of the page of sample runs for positions that no
+// longer reference it.
+void DbData::sampleRunsCompact(DbTxn & txn, pgno_t root, pgno_t rpno) {
+    vector<size_t> stale;
+    auto rp = txn.pin<SampleRunsPage>(rpno);
+    auto slots = runsSlots(rp, m_pageSize);
+    for (unsigned i = 0; i < rp->numEntries; ++i) {
+        auto pos = runsEntry(rp, slots[i])->pagePos;
+        pgno_t pgno;
+        if (!radixFind(txn, &pgno, root, pos) || pgno != rpno)
+            stale.push_back(pos);
+    }
+    for (auto && pos : stale)
+        txn.walSampleRunsRemove(rpno, pos);
+}
+
+//===========================================================================
+// Releases a reference to the page of sample runs. Returns false, without
+// releasing it, if it's the last reference and the page should be freed.
+bool DbData::sampleRunsRelease(DbTxn & txn, pgno_t pgno) {
+    auto rp = txn.pin<SampleRunsPage>(pgno);
+    if (rp->refs <= 1)
+        return false;
+    txn.walSampleRunsRelease(pgno);
+    return true;
+}
+
+//===========================================================================
+void DbData::sampleDestructPage(DbTxn & txn, pgno_t pgno) {
+    auto sp = txn.pin<SamplePage>(pgno);
+    if (sp->sampleType == kSampleTypePacked) {
+        // Freeing the next page in the chain frees the rest.
+        if (auto overflow = packedSamples(sp)->overflow)
+            freePage(txn, overflow);
+    }
+}
+
+//===========================================================================
+// Returns the page, of the chain of packed pages starting at spno, that has
+// (or would have) the sample at the time. Also sets value to the current
+// value of the sample, NAN if there isn't one.
+pgno_t DbData::samplePackFind(
+    double * value,
+    DbTxn & txn,
+    pgno_t spno,
+    TimePoint time
+) {
+    auto pgno = spno;
+    auto ps = packedSamples(txn.pin<SamplePage>(pgno));
+    for (auto next = ps->overflow; next; ) {
+        auto nps = packedSamples(txn.pin<SamplePage>(next));
+        if (auto it = unpackSamples(nps)) {
+            if (it->time > time)
+                break;
+            pgno = next;
+            ps = nps;
+        }
+        next = nps->overflow;
+    }
+
+    *value = NAN;
+    for (auto it = unpackSamples(ps); it; ++it) {
+        if (it->time >= time) {
+            if (it->time == time)
+                *value = it->value;
+            break;
+        }
+    }
+    return pgno;
+}
+
+//===========================================================================
+// Adds the sample to the end of the packed page or, if it doesn't fit, to a
+// new page inserted after it in the chain. Returns the page it was added to.
+pgno_t DbData::samplePackPut(
+    DbTxn & txn,
+    pgno_t pgno,
+    size_t pos,
+    double value
+) {
+    auto sp = txn.pin<SamplePage>(pgno);
+    auto ps = packedSamples(sp);
+    auto time = sp->pageFirstTime + pos * ps->interval;
+    if (packedFits(ps, packedCapacity(), time, value)) {
+        txn.walSamplePackAppend(pgno, pos, value);
+        return pgno;
+    }
+
+    auto id = sp->hdr.id;
+    auto pageTime = sp->pageFirstTime;
+    auto interval = ps->interval;
+    auto overflow = ps->overflow;
+    auto npno = allocMetricPgno(txn, id);
+    txn.walSamplePackInit(npno, id, pageTime, interval, 0);
+    if (overflow)
+        txn.walSamplePackLink(npno, overflow);
+    txn.walSamplePackLink(pgno, npno);
+    txn.walSamplePackAppend(npno, pos, value);
+    return npno;
+}
+
+//===========================================================================
+// Adds the sample, which must come after all existing samples, to the chain
+// of packed pages starting at the tip page and makes its position the last
+// sample of the tip page.
+void DbData::samplePackAppend(
+    DbTxn & txn,
+    pgno_t spno,
+    size_t pos,
+    double value
+) {
+    auto sp = txn.pin<SamplePage>(spno);
+    auto ps = packedSamples(sp);
+    if (isnan(value)
+        || !ps->overflow && packedFits(
+            ps,
+            packedCapacity(),
+            sp->pageFirstTime + pos * ps->interval,
+            value
+        )
+    ) {
+        // Either there's no sample to add or it fits on the tip page, both
+        // are done with a single WAL record.
+        txn.walSamplePackAppendTxn(spno, pos, value);
+        return;
+    }
+
+    auto pgno = spno;
+    while (ps->overflow) {
+        pgno = ps->overflow;
+        ps = packedSamples(txn.pin<SamplePage>(pgno));
+    }
+    samplePackPut(txn, pgno, pos, value);
+    txn.walSamplePackAppend(spno, pos, NAN);
+}
+
+//===========================================================================
+// Sets (or removes, if value is NAN) the sample at the position of the packed
+// page. Samples that no longer fit are moved to a new page inserted after it
+// in the chain.
+void DbData::samplePackUpdate(
+    DbTxn & txn,
+    pgno_t pgno,
+    size_t pos,
+    double value
+) {
+    auto sp = txn.pin<SamplePage>(pgno);
+    auto ps = packedSamples(sp);
+    auto pageTime = sp->pageFirstTime;
+    auto interval = ps->interval;
+    auto samples = unpackSampleList(ps);
+    updateSampleList(&samples, pageTime + pos * interval, value);
+
+    // Repack into a scratch page, the same way the WAL record will be
+    // applied, to find out how many still fit.
+    string buf(m_pageSize, 0);
+    auto tmp = reinterpret_cast<PackedSamples *>(buf.data());
+    auto num = packSamples(tmp, packedCapacity(), samples);
+
+    txn.walSamplePackUpdate(pgno, pos, value);
+    for (auto i = num; i < samples.size(); ++i) {
+        auto & samp = samples[i];
+        pgno = samplePackPut(
+            txn,
+            pgno,
+            (samp.time - pageTime) / interval,
+            samp.value
+        );
+    }
+}
+
+//===========================================================================
+// Rebuilds the summary of a page of fixed size samples from its samples.
+static void summarizePage(
+    DbData::SamplePage * sp,
+    size_t pageSize,
+    size_t spp
+) {
+    auto ps = pageSummary(sp, pageSize);
+    *ps = {};
+    auto last = min((size_t) sp->pageLastSample, spp - 1);
+    for (size_t i = 0; i <= last; ++i)
+        addSummarySample(ps, getSample(sp, i));
+}
+
+//===========================================================================
+// Makes a change, by calling the function, to the samples in [first, last] of
+// a page of fixed size samples that leaves its last sample at pageLast. The
+// summary is adjusted for only the samples whose part in it changed, and
+// only rebuilt if one of those being taken out might have been the min or
+// max.
+template<typename Fn>
+static void updateSummarized(
+    DbData::SamplePage * sp,
+    size_t pageSize,
+    size_t spp,
+    size_t first,
+    size_t last,
+    size_t pageLast,
+    Fn && fn
+) {
+    // Samples updated, or moved into or out of the summarized range by the
+    // change to the last sample.
+    auto oldLast = min((size_t) sp->pageLastSample, spp - 1);
+    auto newLast = min(pageLast, spp - 1);
+    last = min(last, spp - 1);
+    if (oldLast != newLast) {
+        first = min(first, min(oldLast, newLast) + 1);
+        last = max(last, max(oldLast, newLast));
+    }
+
+    auto ps = pageSummary(sp, pageSize);
+    auto rebuild = false;
+    for (auto i = first; i <= min(last, oldLast); ++i) {
+        auto value = getSample(sp, i);
+        if (isnan(value))
+            continue;
+        if (value == ps->min || value == ps->max) {
+            rebuild = true;
+            break;
+        }
+        ps->count -= 1;
+        ps->sum -= value;
+    }
+    fn();
+    if (rebuild)
+        return summarizePage(sp, pageSize, spp);
+
+    for (auto i = first; i <= min(last, newLast); ++i) {
+        auto value = getSample(sp, i);
+        if (isnan(value))
+            continue;
+        if (!ps->count++) {
+            ps->sum = 0;
+            ps->min = ps->max = value;
+        } else if (value < ps->min) {
+            ps->min = value;
+        } else if (value > ps->max) {
+            ps->max = value;
+        }
+        ps->sum += value;
+    }
+    // First and last values, usually found at or next to the ends.
+    for (size_t i = 0; i <= newLast; ++i) {
+        if (auto value = getSample(sp, i); !isnan(value)) {
+            ps->firstValue = value;
+            break;
+        }
+    }
+    for (auto i = newLast + 1; i-- > 0;) {
+        if (auto value = getSample(sp, i); !isnan(value)) {
+            ps->lastValue = value;
+            break;
+        }
+    }
+}
+
 //===========================================================================
 void DbData::onWalApplySampleInit(
     void * ptr,
@@ -1063,6 +3017,8 @@ void DbData::onWalApplySampleInit(
     sp->pageFirstTime = pageTime;
     auto spp = samplesPerPage(sampleType);
     setSamples(sp, 0, spp, fill);
+    if (m_pageSummaries)
+        summarizePage(sp, m_pageSize, spp);
 }
 
 //===========================================================================
@@ -1075,32 +3031,300 @@ void DbData::onWalApplySampleUpdate(
 ) {
     auto sp = static_cast<SamplePage *>(ptr);
     assert(sp->hdr.type == sp->kPageType);
-    setSamples(sp, firstPos, lastPos, NAN);
-    if (!isnan(value))
-        setSample(sp, lastPos, value);
-    if (updateLast)
-        sp->pageLastSample = (uint16_t) lastPos;
+    auto update = [&]() {
+        setSamples(sp, firstPos, lastPos, NAN);
+        if (!isnan(value))
+            setSample(sp, lastPos, value);
+        if (updateLast)
+            sp->pageLastSample = (uint16_t) lastPos;
+    };
+    if (!m_pageSummaries)
+        return update();
+    updateSummarized(
+        sp,
+        m_pageSize,
+        samplesPerPage(sp->sampleType),
+        firstPos,
+        lastPos,
+        updateLast ? lastPos : sp->pageLastSample,
+        update
+    );
 }
 
 //===========================================================================
-void DbData::onWalApplySampleUpdateTime(void * ptr, Dim::TimePoint pageTime) {
+void DbData::onWalApplySampleUpdateRange(
+    void * ptr,
+    size_t firstPos,
+    span<const uint8_t> values,
+    bool updateLast
+) {
     auto sp = static_cast<SamplePage *>(ptr);
     assert(sp->hdr.type == sp->kPageType);
-    sp->pageFirstTime = pageTime;
-    sp->pageLastSample = 0;
-    setSample(sp, 0, NAN);
+    auto vsize = sampleTypeSize(sp->sampleType);
+    assert(values.size() % vsize == 0);
+    auto count = values.size() / vsize;
+    auto spp = samplesPerPage(sp->sampleType);
+    assert(firstPos + count <= spp);
+    auto lastPos = firstPos + count - 1;
+    auto update = [&]() {
+        memcpy(
+            (char *) &sp->samples + firstPos * vsize,
+            values.data(),
+            values.size()
+        );
+        if (updateLast)
+            sp->pageLastSample = (uint16_t) lastPos;
+    };
+    if (!m_pageSummaries)
+        return update();
+    updateSummarized(
+        sp,
+        m_pageSize,
+        spp,
+        firstPos,
+        lastPos,
+        updateLast ? lastPos : sp->pageLastSample,
+        update
+    );
 }
 
 //===========================================================================
-void DbData::getSamples(
-    DbTxn & txn,
+void DbData::onWalApplySampleUpdateTime(void * ptr, Dim::TimePoint pageTime) {
+    auto sp = static_cast<SamplePage *>(ptr);
+    assert(sp->hdr.type == sp->kPageType);
+    sp->pageFirstTime = pageTime;
+    sp->pageLastSample = 0;
+    if (sp->sampleType == kSampleTypePacked) {
+        // Packed samples are ordered by time, so rather than keeping the old
+        // ones (like other sample types) the page is emptied.
+        auto ps = packedSamples(sp);
+        ps->overflow = {};
+        ps->used = 0;
+        ps->unusedBits = 0;
+        ps->state = {};
+    } else {
+        setSample(sp, 0, NAN);
+        if (m_pageSummaries)
+            *pageSummary(sp, m_pageSize) = {};
+    }
+}
+
+//===========================================================================
+void DbData::onWalApplySamplePackInit(
+    void * ptr,
+    uint32_t id,
+    TimePoint pageTime,
+    Duration interval,
+    size_t lastSample,
+    double fill
+) {
+    auto sp = static_cast<SamplePage *>(ptr);
+    if (sp->hdr.type == DbPageType::kFree) {
+        memset((char *) sp + sizeof(sp->hdr), 0, m_pageSize - sizeof(sp->hdr));
+    } else {
+        assert(sp->hdr.type == DbPageType::kInvalid);
+    }
+    sp->hdr.type = sp->kPageType;
+    sp->hdr.id = id;
+    sp->sampleType = kSampleTypePacked;
+    sp->pageLastSample = (uint16_t) lastSample;
+    sp->pageFirstTime = pageTime;
+    auto ps = packedSamples(sp);
+    ps->interval = interval;
+    ps->overflow = {};
+    ps->used = 0;
+    ps->unusedBits = 0;
+    ps->state = {};
+    if (!isnan(fill)) {
+        // Identical values at regular intervals pack into two bits each, so
+        // a full page of them always fits.
+        for (size_t i = 0; i <= lastSample; ++i) {
+            [[maybe_unused]] auto packed = packSample(
+                ps,
+                packedCapacity(),
+                pageTime + i * interval,
+                fill
+            );
+            assert(packed);
+        }
+    }
+}
+
+//===========================================================================
+void DbData::onWalApplySamplePackAppend(
+    void * ptr,
+    size_t pos,
+    double value
+) {
+    auto sp = static_cast<SamplePage *>(ptr);
+    assert(sp->hdr.type == sp->kPageType);
+    if (!isnan(value)) {
+        auto ps = packedSamples(sp);
+        auto time = sp->pageFirstTime + pos * ps->interval;
+        [[maybe_unused]] auto packed =
+            packSample(ps, packedCapacity(), time, value);
+        assert(packed);
+    }
+    sp->pageLastSample = (uint16_t) pos;
+}
+
+//===========================================================================
+void DbData::onWalApplySamplePackUpdate(
+    void * ptr,
+    size_t pos,
+    double value
+) {
+    auto sp = static_cast<SamplePage *>(ptr);
+    assert(sp->hdr.type == sp->kPageType);
+    auto ps = packedSamples(sp);
+    auto samples = unpackSampleList(ps);
+    updateSampleList(&samples, sp->pageFirstTime + pos * ps->interval, value);
+
+    // Samples that no longer fit are dropped, the records that follow add
+    // them to the next page in the chain.
+    packSamples(ps, packedCapacity(), samples);
+}
+
+//===========================================================================
+void DbData::onWalApplySamplePackLink(void * ptr, pgno_t overflow) {
+    auto sp = static_cast<SamplePage *>(ptr);
+    assert(sp->hdr.type == sp->kPageType);
+    packedSamples(sp)->overflow = overflow;
+}
+
+//===========================================================================
+void DbData::onWalApplySampleRunsInit(void * ptr, uint32_t id) {
+    auto rp = static_cast<SampleRunsPage *>(ptr);
+    if (rp->hdr.type == DbPageType::kFree) {
+        memset((char *) rp + sizeof(rp->hdr), 0, m_pageSize - sizeof(rp->hdr));
+    } else {
+        assert(rp->hdr.type == DbPageType::kInvalid);
+    }
+    rp->hdr.type = rp->kPageType;
+    rp->hdr.id = id;
+    rp->refs = 0;
+    rp->used = 0;
+    rp->numEntries = 0;
+}
+
+//===========================================================================
+void DbData::onWalApplySampleRunsAdd(
+    void * ptr,
+    size_t pagePos,
+    TimePoint pageTime,
+    span<const uint8_t> runs
+) {
+    auto rp = static_cast<SampleRunsPage *>(ptr);
+    assert(rp->hdr.type == rp->kPageType);
+    assert(runs.size() % sizeof(SampleRun) == 0);
+    auto numRuns = runs.size() / sizeof(SampleRun);
+    auto bytes = runsEntrySize(numRuns);
+    assert(bytes + sizeof(uint16_t) <= runsFree(rp, m_pageSize));
+    auto index = runsLowerBound(rp, m_pageSize, pagePos);
+    assert(!findRuns(rp, m_pageSize, pagePos));
+    auto ent = reinterpret_cast<SampleRunsEntry *>(rp->data + rp->used);
+    ent->pageTime = pageTime;
+    ent->pagePos = (uint32_t) pagePos;
+    ent->numRuns = (uint16_t) numRuns;
+    memcpy(ent->runs, runs.data(), runs.size());
+
+    // Insert its offset, moving the offsets before it down to make room.
+    auto slots = runsSlots(rp, m_pageSize);
+    memmove(slots - 1, slots, index * sizeof(*slots));
+    slots[index - 1] = rp->used;
+    rp->numEntries += 1;
+    rp->used += (uint16_t) bytes;
+    rp->refs += 1;
+}
+
+//===========================================================================
+void DbData::onWalApplySampleRunsRelease(void * ptr) {
+    auto rp = static_cast<SampleRunsPage *>(ptr);
+    assert(rp->hdr.type == rp->kPageType);
+    assert(rp->refs > 1);
+    rp->refs -= 1;
+}
+
+//===========================================================================
+void DbData::onWalApplySampleRunsUpdate(
+    void * ptr,
+    size_t pagePos,
+    span<const uint8_t> runs
+) {
+    auto rp = static_cast<SampleRunsPage *>(ptr);
+    assert(rp->hdr.type == rp->kPageType);
+    assert(runs.size() % sizeof(SampleRun) == 0);
+    auto numRuns = runs.size() / sizeof(SampleRun);
+    auto index = runsLowerBound(rp, m_pageSize, pagePos);
+    assert(findRuns(rp, m_pageSize, pagePos));
+    auto ent = resizeRuns(rp, m_pageSize, index, runsEntrySize(numRuns));
+    ent->numRuns = (uint16_t) numRuns;
+    memcpy(ent->runs, runs.data(), runs.size());
+}
+
+//===========================================================================
+void DbData::onWalApplySampleRunsRemove(void * ptr, size_t pagePos) {
+    auto rp = static_cast<SampleRunsPage *>(ptr);
+    assert(rp->hdr.type == rp->kPageType);
+    auto index = runsLowerBound(rp, m_pageSize, pagePos);
+    assert(findRuns(rp, m_pageSize, pagePos));
+    resizeRuns(rp, m_pageSize, index, 0);
+
+    // Remove its offset, moving the offsets before it up to fill the gap.
+    auto slots = runsSlots(rp, m_pageSize);
+    memmove(slots + 1, slots, index * sizeof(*slots));
+    rp->numEntries -= 1;
+}
+
+//===========================================================================
+void DbData::getSamples(
+    DbTxn & txn,
+    IDbDataNotify * notify,
+    uint32_t id,
+    TimePoint first,
+    TimePoint last,
+    unsigned presamples,
+    Duration minInterval
+) {
+    // Samples are read from the rollup, if there is one, that is coarse
+    // enough, but they're reported as the metric's.
+    auto src = id;
+    if (minInterval.count())
+        src = rollupFind(txn, id, first, minInterval, false);
+    auto mi = loadMetricPos(txn, src);
+    sampleRead(txn, notify, id, mi, first, last, presamples);
+}
+
+//===========================================================================
+void DbData::getSnapshotSamples(
+    DbTxn & txn,
+    IDbDataNotify * notify,
+    uint32_t id,
+    TimePoint first,
+    TimePoint last,
+    unsigned presamples,
+    Duration minInterval
+) {
+    assert(txn.snapshot());
+    auto src = id;
+    if (minInterval.count())
+        src = rollupFind(txn, id, first, minInterval, true);
+    auto mi = snapshotMetricPos(txn, src);
+    sampleRead(txn, notify, id, mi, first, last, presamples);
+}
+
+//===========================================================================
+// Reports the samples of the metric, or rollup, at the position as being those
+// of the metric with the id.
+void DbData::sampleRead(
+    DbTxn & txn,
     IDbDataNotify * notify,
     uint32_t id,
+    const MetricPosition & mi,
     TimePoint first,
     TimePoint last,
     unsigned presamples
 ) {
-    auto mi = loadMetricPos(txn, id);
     if (!mi.infoPage)
         return noSamples(notify, id, {}, kSampleTypeInvalid, {}, {});
     auto mp = txn.pin<MetricPage>(mi.infoPage);
@@ -1127,8 +3351,7 @@ void DbData::getSamples(
 
     auto spp = samplesPerPage(stype);
     auto pageInterval = spp * mi.interval;
-    auto numSamples = mp->retention / mp->interval;
-    auto numPages = (numSamples - 1) / spp + 1;
+    auto numPages = sampleRingPages(stype, mp->retention, mp->interval);
 
     // Offset, in pages, from page being processed to the very last sample page.
     // Must be in [0, numPages - 1]
@@ -1152,6 +3375,37 @@ void DbData::getSamples(
     dsi.type = stype;
     dsi.interval = mi.interval;
     unsigned count = 0;
+    auto report = [&](TimePoint time, double value) {
+        if (!count++) {
+            dsi.first = time;
+            dsi.last = last + mi.interval;
+            if (!notify->onDbSeriesStart(dsi))
+                return false;
+        }
+        return notify->onDbSample(id, time, value);
+    };
+    // Reports run of samples, with NANs for missing ones. The series starts
+    // with the first sample that isn't NAN.
+    vector<double> values(spp);
+    auto reportRun = [&](TimePoint time, size_t num) {
+        auto vals = span<const double>(values.data(), num);
+        if (!count) {
+            auto i = find_if(vals.begin(), vals.end(), [](auto & a) {
+                return !isnan(a);
+            });
+            if (i == vals.end())
+                return true;
+            time += (i - vals.begin()) * mi.interval;
+            vals = vals.subspan(i - vals.begin());
+            count += 1;
+            dsi.first = time;
+            dsi.last = last + mi.interval;
+            if (!notify->onDbSeriesStart(dsi))
+                return false;
+        }
+        count += (unsigned) vals.size();
+        return notify->onDbSamples(id, time, mi.interval, vals);
+    };
     for (;;) {
         assert(poff == (mi.pageFirstTime - first + pageInterval - mi.interval)
             / pageInterval);
@@ -1163,6 +3417,7 @@ void DbData::getSamples(
         } else {
             double value = NAN;
             const SamplePage * sp = nullptr;
+            const SampleRunsEntry * runs = nullptr;
             auto lastSample = spp - 1;
             if (spno > kMaxPageNum) {
                 // Virtual page, get the cached value that is the same for every
@@ -1170,6 +3425,12 @@ void DbData::getSamples(
                 if (sppos == mp->lastPagePos)
                     lastSample = mp->lastPageSample;
                 value = getSample(&spno);
+            } else if (isRunsPage(txn, spno)) {
+                // Page of sample runs, which is never the tip page.
+                assert(sppos != mp->lastPagePos);
+                auto rp = txn.pin<SampleRunsPage>(spno);
+                runs = findRuns(rp, m_pageSize, sppos);
+                assert(runs && fpt == runs->pageTime);
             } else {
                 // Physical page, get values from the page
                 sp = txn.pin<SamplePage>(spno);
@@ -1190,20 +3451,39 @@ void DbData::getSamples(
             }
             if (last < lastPageTime)
                 lastPageTime = last;
-            for (; first <= lastPageTime; first += mi.interval, ++ent) {
-                if (sp) {
-                    value = getSample(sp, ent);
-                    if (isnan(value))
-                        continue;
+            if (sp && stype == kSampleTypePacked) {
+                // Packed page, report the samples from each page in its
+                // chain that are within the range.
+                for (auto pgno = spno; pgno; ) {
+                    auto ps = packedSamples(txn.pin<SamplePage>(pgno));
+                    for (auto it = unpackSamples(ps); it; ++it) {
+                        if (it->time < first)
+                            continue;
+                        if (it->time > lastPageTime)
+                            break;
+                        if (!report(it->time, it->value))
+                            return;
+                    }
+                    pgno = ps->overflow;
                 }
-                if (!count++) {
-                    dsi.first = first;
-                    dsi.last = last + mi.interval;
-                    if (!notify->onDbSeriesStart(dsi))
-                        return;
+                if (first <= lastPageTime)
+                    first = lastPageTime + mi.interval;
+            }
+            if (first <= lastPageTime) {
+                // Fixed size, sample runs, or virtual page, report the
+                // samples in the range as a single run.
+                auto num = (size_t) ((lastPageTime - first) / mi.interval) + 1;
+                num = min(num, spp - ent);
+                if (sp) {
+                    ::getSamples(values.data(), sp, ent, num);
+                } else if (runs) {
+                    ::getSamples(values.data(), runs, spp, ent, num);
+                } else {
+                    fill_n(values.data(), num, value);
                 }
-                if (!notify->onDbSample(id, first, value))
+                if (!reportRun(first, num))
                     return;
+                first += num * mi.interval;
             }
         }
         if (first > last)
@@ -1221,6 +3501,660 @@ void DbData::getSamples(
     }
 }
 
+//===========================================================================
+// Prefetches the metric pages, and the tip sample pages, of the metrics and of
+// any rollups they might be read from, as known from their in memory
+// positions.
+void DbData::prefetchMetrics(
+    DbTxn & txn,
+    span<const uint32_t> ids,
+    Duration minInterval
+) {
+    UnsignedSet pages;
+    auto addPages = [&](uint32_t id) {
+        auto mi = getMetricPos(id);
+        if (mi.infoPage)
+            pages.insert(mi.infoPage);
+        if (mi.lastPage && mi.lastPage <= kMaxPageNum)
+            pages.insert(mi.lastPage);
+        return mi;
+    };
+    for (auto && id : ids) {
+        addPages(id);
+        if (!minInterval.count())
+            continue;
+        for (auto level = 1u; level <= kMaxRollups; ++level) {
+            auto rmi = addPages(rollupId(id, level));
+            if (!rmi.infoPage || rmi.interval > minInterval)
+                break;
+        }
+    }
+    txn.prefetch(pages);
+}
+
+//===========================================================================
+// Prefetches the sample pages with samples in the range of each metric, or of
+// the coarsest rollup no coarser than minInterval. The pages are found from
+// the metric pages as of the snapshot, which may be older than the in memory
+// positions, so they're only a guess at what will be read.
+void DbData::prefetchSamples(
+    DbTxn & txn,
+    span<const uint32_t> ids,
+    TimePoint first,
+    TimePoint last,
+    unsigned presamples,
+    Duration minInterval
+) {
+    assert(txn.snapshot());
+    UnsignedSet pages;
+    for (auto && id : ids) {
+        DbTxn::PinScope pins(txn);
+        auto src = id;
+        for (auto level = kMaxRollups; level && minInterval.count(); --level) {
+            auto rmi = getMetricPos(rollupId(id, level));
+            if (rmi.infoPage && rmi.interval <= minInterval) {
+                src = rollupId(id, level);
+                break;
+            }
+        }
+        auto mi = getMetricPos(src);
+        if (!mi.infoPage || empty(mi.pageFirstTime))
+            continue;
+        auto hdr = txn.pin<DbPageHeader>(mi.infoPage);
+        if (hdr->type != DbPageType::kMetric || hdr->id != src) {
+            // Metric isn't in the snapshot, or its page has been moved.
+            continue;
+        }
+        samplePages(&pages, txn, mi, first, last, presamples);
+    }
+    txn.prefetch(pages);
+}
+
+//===========================================================================
+// Adds the physical sample pages of the metric that have samples in the range
+// to the set.
+void DbData::samplePages(
+    UnsignedSet * out,
+    DbTxn & txn,
+    const MetricPosition & mi,
+    TimePoint first,
+    TimePoint last,
+    unsigned presamples
+) {
+    if (!mi.infoPage || !mi.lastPage)
+        return;
+    auto mp = txn.pin<MetricPage>(mi.infoPage);
+    first -= first.time_since_epoch() % mi.interval;
+    last -= last.time_since_epoch() % mi.interval;
+    first -= presamples * mi.interval;
+
+    auto lastSampleTime = mi.pageFirstTime + mi.pageLastSample * mi.interval;
+    auto firstSampleTime = lastSampleTime - mp->retention + mi.interval;
+    if (first < firstSampleTime)
+        first = firstSampleTime;
+    if (last > lastSampleTime)
+        last = lastSampleTime;
+    if (first > last)
+        return;
+
+    auto pageInterval = samplesPerPage(mi.sampleType) * mi.interval;
+    auto numPages = sampleRingPages(mi.sampleType, mp->retention, mi.interval);
+    auto poff = (mi.pageFirstTime - first + pageInterval - mi.interval)
+        / pageInterval;
+    auto sppos = (uint32_t) (mp->lastPagePos + numPages - poff) % numPages;
+    for (auto i = poff; i >= 0; --i) {
+        pgno_t spno;
+        if (radixFind(txn, &spno, mi.infoPage, sppos) && spno <= kMaxPageNum)
+            out->insert(spno);
+        sppos = (sppos + 1) % numPages;
+    }
+}
+
+//===========================================================================
+void DbData::getSummaries(
+    DbTxn & txn,
+    IDbDataNotify * notify,
+    uint32_t id,
+    TimePoint first,
+    TimePoint last
+) {
+    auto mi = loadMetricPos(txn, id);
+    if (!mi.infoPage)
+        return noSamples(notify, id, {}, kSampleTypeInvalid, {}, {});
+    auto mp = txn.pin<MetricPage>(mi.infoPage);
+    auto name = string_view(mp->name);
+    auto stype = mp->sampleType;
+
+    // round time to metric's sampling interval
+    first -= first.time_since_epoch() % mi.interval;
+    last -= last.time_since_epoch() % mi.interval;
+
+    if (!mi.lastPage)
+        return noSamples(notify, id, name, stype, last, mi.interval);
+
+    auto lastSampleTime = mi.pageFirstTime + mi.pageLastSample * mi.interval;
+    auto firstSampleTime = lastSampleTime - mp->retention + mi.interval;
+    if (first < firstSampleTime)
+        first = firstSampleTime;
+    if (last > lastSampleTime)
+        last = lastSampleTime;
+    if (first > last)
+        return noSamples(notify, id, name, stype, last, mi.interval);
+
+    auto spp = samplesPerPage(stype);
+    auto pageInterval = spp * mi.interval;
+    auto numPages = sampleRingPages(stype, mp->retention, mp->interval);
+
+    DbSeriesInfo dsi;
+    dsi.id = id;
+    dsi.name = name;
+    dsi.type = stype;
+    dsi.interval = mi.interval;
+    unsigned count = 0;
+    for (auto time = first; time <= last; ) {
+        auto poff = (mi.pageFirstTime - time + pageInterval - mi.interval)
+            / pageInterval;
+        auto pageTime = mi.pageFirstTime - poff * pageInterval;
+        auto pageLast = poff
+            ? pageTime + pageInterval - mi.interval
+            : lastSampleTime;
+        auto sppos = (mp->lastPagePos + numPages - poff) % numPages;
+        pgno_t spno = {};
+        radixFind(txn, &spno, mi.infoPage, sppos);
+        auto chunkLast = min(last, pageLast);
+        DbSampleSummary sum;
+        sum.first = time;
+        sum.last = chunkLast + mi.interval;
+        if (!spno) {
+            // Missing page, interpreted as all NANs, so no samples.
+        } else if (spno > kMaxPageNum) {
+            // Virtual page, every sample has the same value.
+            auto value = getSample(&spno);
+            sum.count = (unsigned) ((sum.last - time) / mi.interval);
+            sum.sum = value * sum.count;
+            sum.min = sum.max = value;
+            sum.firstValue = sum.lastValue = value;
+        } else if (isRunsPage(txn, spno)) {
+            // Page of sample runs, summarized from the runs.
+            auto rp = txn.pin<SampleRunsPage>(spno);
+            auto runs = findRuns(rp, m_pageSize, sppos);
+            assert(runs);
+            auto pos = (time - pageTime) / mi.interval;
+            auto lastPos = (chunkLast - pageTime) / mi.interval;
+            addSummaryRuns(&sum, runs, spp, pos, lastPos + 1);
+        } else if (stype == kSampleTypePacked) {
+            // Packed pages don't keep summaries, so they're made from the
+            // samples of each page in the chain.
+            for (auto pgno = spno; pgno; ) {
+                auto ps = packedSamples(txn.pin<SamplePage>(pgno));
+                for (auto it = unpackSamples(ps); it; ++it) {
+                    if (it->time < time)
+                        continue;
+                    if (it->time > chunkLast)
+                        break;
+                    addSummarySample(&sum, it->value);
+                }
+                pgno = ps->overflow;
+            }
+        } else {
+            auto sp = txn.pin<SamplePage>(spno);
+            if (time == pageTime
+                && chunkLast == pageLast
+                && poff < numPages
+                && m_pageSummaries
+            ) {
+                // Whole page, use the summary it already has.
+                auto ps = pageSummary(sp, m_pageSize);
+                sum.count = ps->count;
+                sum.sum = ps->sum;
+                sum.min = ps->min;
+                sum.max = ps->max;
+                sum.firstValue = ps->firstValue;
+                sum.lastValue = ps->lastValue;
+            } else {
+                auto pos = (time - pageTime) / mi.interval;
+                auto lastPos = (chunkLast - pageTime) / mi.interval;
+                for (; pos <= lastPos; ++pos)
+                    addSummarySample(&sum, getSample(sp, pos));
+            }
+        }
+        time = sum.last;
+        if (!sum.count)
+            continue;
+        if (!count++) {
+            dsi.first = first;
+            dsi.last = last + mi.interval;
+            if (!notify->onDbSeriesStart(dsi))
+                return;
+        }
+        if (!notify->onDbSummary(id, sum))
+            return;
+    }
+    if (!count) {
+        return noSamples(notify, id, name, stype, last, mi.interval);
+    } else {
+        notify->onDbSeriesEnd(id);
+    }
+}
+
+
+/****************************************************************************
+*
+*   Rollups
+*
+***/
+
+//===========================================================================
+// Replaces the metric's rollups, or if none are given reapplies the existing
+// ones. If reset, all rollups are recreated without samples, otherwise only
+// the ones that changed are. Returns true if any were recreated and the
+// metric has samples to populate them from.
+bool DbData::rollupConfigure(
+    DbTxn & txn,
+    uint32_t id,
+    span<const DbMetricRollup> rollups,
+    bool reset
+) {
+    vector<DbMetricRollup> existing;
+    for (unsigned level = 1; level <= kMaxRollups; ++level) {
+        auto rmi = getMetricPos(rollupId(id, level));
+        if (!rmi.infoPage)
+            break;
+        auto rmp = txn.pin<MetricPage>(rmi.infoPage);
+        existing.push_back({rmp->retention, rmp->interval});
+    }
+    if (rollups.empty()) {
+        rollups = existing;
+    } else if (rollups.size() == 1 && !rollups[0].interval.count()) {
+        rollups = {};
+    }
+
+    auto mi = getMetricPos(txn, id);
+    auto interval = mi.interval;
+    unsigned level = 0;
+    bool added = false;
+    for (auto && ru : rollups) {
+        if (level == kMaxRollups
+            || ru.interval <= interval
+            || ru.interval % interval != 0
+            || ru.retention < ru.interval
+        ) {
+            auto mp = txn.pin<MetricPage>(mi.infoPage);
+            logMsgError() << "Invalid rollup #" << level + 1 << " of "
+                << mp->name << ", it and all after it ignored";
+            break;
+        }
+        interval = ru.interval;
+        level += 1;
+        if (!reset
+            && level <= existing.size()
+            && existing[level - 1].interval == ru.interval
+            && existing[level - 1].retention == ru.retention
+        ) {
+            continue;
+        }
+        rollupErase(txn, id, level);
+        rollupInsert(txn, id, level, ru);
+        added = true;
+
+        // Coarser rollups are made from this one, so they must be rebuilt
+        // with it.
+        reset = true;
+    }
+    for (auto i = level + 1; i <= kMaxRollups; ++i)
+        rollupErase(txn, id, i);
+
+    // New rollups are populated from the samples the metric already has by
+    // rollupBackfill(), which may take many transactions. Where it's gotten
+    // to is kept on the finest rollup, so it can resume after a restart.
+    auto last = metricLastTime(txn, id);
+    if (!added || empty(last))
+        return false;
+    auto retention = txn.pin<MetricPage>(mi.infoPage)->retention;
+    txn.walMetricUpdateBackfill(
+        getMetricPos(rollupId(id, 1)).infoPage,
+        last - retention + mi.interval
+    );
+    return true;
+}
+
+//===========================================================================
+void DbData::rollupInsert(
+    DbTxn & txn,
+    uint32_t id,
+    unsigned level,
+    const DbMetricRollup & rollup
+) {
+    auto rid = rollupId(id, level);
+    auto mi = getMetricPos(id);
+    auto mp = txn.pin<MetricPage>(mi.infoPage);
+
+    // Averages are fractional, so they're kept as floating point.
+    auto stype = mp->sampleType == kSampleTypeFloat64
+        ? kSampleTypeFloat64
+        : kSampleTypeFloat32;
+    auto pgno = allocMetricPgno(txn, rid);
+    txn.walMetricInit(
+        pgno,
+        rid,
+        mp->name,
+        {},
+        stype,
+        rollup.retention,
+        rollup.interval
+    );
+
+    // update id index
+    {
+        scoped_lock lk{m_mndxMut};
+        DbTxn::PinScope pins(txn);
+        radixInsert(txn, m_metricRoot, rid, pgno);
+    }
+
+    // update in memory references
+    MetricPosition rmi = {};
+    rmi.infoPage = pgno;
+    rmi.interval = rollup.interval;
+    rmi.sampleType = stype;
+    setMetricPos(rid, rmi);
+}
+
+//===========================================================================
+void DbData::rollupErase(DbTxn & txn, uint32_t id, unsigned level) {
+    auto rid = rollupId(id, level);
+    if (!getMetricPos(rid).infoPage)
+        return;
+
+    // Freeing the rollup's page, as it's removed from the id index, also
+    // removes its in memory references.
+    scoped_lock lk{m_mndxMut};
+    DbTxn::PinScope pins(txn);
+    radixErase(txn, m_metricRoot, rid, rid + 1);
+}
+
+//===========================================================================
+bool DbData::rollupBackfill(DbTxn & txn, uint32_t id) {
+    auto rmi = getMetricPos(rollupId(id, 1));
+    if (!rmi.infoPage)
+        return false;
+    auto first = txn.pin<MetricPage>(rmi.infoPage)->creation;
+    if (empty(first))
+        return false;
+    auto last = metricLastTime(txn, id);
+    auto next = first - first.time_since_epoch() % rmi.interval
+        + kRollupBackfillBuckets * rmi.interval;
+    if (!empty(last)) {
+        auto mi = getMetricPos(id);
+        rollupUpdate(txn, id, first, min(last, next - mi.interval), last);
+    }
+    if (empty(last) || next > last)
+        next = {};
+    txn.walMetricUpdateBackfill(rmi.infoPage, next);
+    return !empty(next);
+}
+
+//===========================================================================
+vector<uint32_t> DbData::rollupBackfills(DbTxn & txn) {
+    vector<uint32_t> out;
+    auto pos = rollupPos(1);
+    if (!pos)
+        return out;
+    for (uint32_t id = 0; id < pos->size(); ++id) {
+        auto rmi = pos->get(id);
+        if (!rmi.infoPage)
+            continue;
+        DbTxn::PinScope pins(txn);
+        if (!empty(txn.pin<MetricPage>(rmi.infoPage)->creation))
+            out.push_back(id);
+    }
+    return out;
+}
+
+//===========================================================================
+// Recalculates the rollup samples covering the range of the metric's samples,
+// each level from the one below it. Buckets are only calculated once they're
+// complete, when the metric has samples through to their end, so that
+// appending samples calculates each bucket once instead of once per sample.
+// The bucket that was still open at prevLast, the metric's last sample before
+// the update, is calculated if the update completed it.
+void DbData::rollupUpdate(
+    DbTxn & txn,
+    uint32_t id,
+    TimePoint first,
+    TimePoint last,
+    TimePoint prevLast
+) {
+    if (!getMetricPos(rollupId(id, 1)).infoPage)
+        return;
+    auto lastTime = metricLastTime(txn, id);
+    if (empty(lastTime))
+        return;
+    auto src = id;
+    auto srcInterval = getMetricPos(id).interval;
+    auto end = lastTime + srcInterval;
+    auto prevEnd = empty(prevLast) ? end : prevLast + srcInterval;
+    for (unsigned level = 1; level <= kMaxRollups; ++level) {
+        auto rid = rollupId(id, level);
+        auto rmi = getMetricPos(rid);
+        if (!rmi.infoPage)
+            break;
+
+        auto interval = rmi.interval;
+        auto open = end - end.time_since_epoch() % interval;
+        auto prevOpen = prevEnd - prevEnd.time_since_epoch() % interval;
+        first -= first.time_since_epoch() % interval;
+        last -= last.time_since_epoch() % interval;
+        last = min(last, open - interval);
+        auto update = [&](TimePoint time) {
+            DbTxn::PinScope pins(txn);
+            SampleSummarizer avg;
+            getSamples(
+                txn,
+                &avg,
+                src,
+                time,
+                time + interval - srcInterval,
+                0
+            );
+            if (auto & sum = avg.summary; sum.count)
+                sampleUpdate(txn, rid, time, sum.sum / sum.count);
+        };
+        for (auto time = first; time <= last; time += interval)
+            update(time);
+        if (prevOpen < open && (prevOpen < first || prevOpen > last))
+            update(prevOpen);
+
+        src = rid;
+        srcInterval = interval;
+    }
+}
+
+//===========================================================================
+// Returns the coarsest rollup with an interval no greater than minInterval
+// that has samples from as far back as first, or the metric itself if there
+// isn't one.
+uint32_t DbData::rollupFind(
+    DbTxn & txn,
+    uint32_t id,
+    TimePoint first,
+    Duration minInterval,
+    bool fromPages
+) {
+    for (auto level = kMaxRollups; level; --level) {
+        auto rid = rollupId(id, level);
+        pgno_t infoPage;
+        if (fromPages) {
+            radixFind(txn, &infoPage, m_metricRoot, rid);
+        } else {
+            infoPage = getMetricPos(rid).infoPage;
+        }
+        if (!infoPage)
+            continue;
+
+        // Positions are only loaded when the rollup is read, which would let
+        // the query leave its metric's queue, so the coverage is checked
+        // against the rollup's page instead. The tip page is taken to be
+        // full, making it a conservative estimate.
+        auto rmp = txn.pin<MetricPage>(infoPage);
+        if (rmp->hdr.type != rmp->kPageType || rmp->hdr.id != rid) {
+            // Rollup was added after the snapshot being read was taken.
+            continue;
+        }
+        if (rmp->interval > minInterval || empty(rmp->lastPageFirstTime))
+            continue;
+        auto pageInterval = samplesPerPage(rmp->sampleType) * rmp->interval;
+        if (first >= rmp->lastPageFirstTime + pageInterval - rmp->retention)
+            return rid;
+    }
+    return id;
+}
+
+
+/****************************************************************************
+*
+*   Compaction
+*
+***/
+
+//===========================================================================
+// Finds the metrics, including those of rollups, that own the pages that are
+// past the compaction limit. Searched from the end of the file, stopping at
+// any page that doesn't belong to a metric and therefore can't be moved.
+size_t DbData::compactBegin(UnsignedSet * ids, DbTxn & txn) {
+    ids->clear();
+    UnsignedSet tail;
+    auto limit = compactLimit(&tail, txn.minPages());
+    vector<unsigned> pages(tail.begin(), tail.end());
+    for (auto i = pages.rbegin(); i != pages.rend(); ++i) {
+        DbTxn::PinScope pins(txn);
+        auto p = txn.pin<DbPageHeader>((pgno_t) *i);
+        auto type = p->type;
+        if (type == DbPageType::kFree || type == DbPageType::kInvalid) {
+            // Freed since the limit was set.
+            continue;
+        }
+        if (type == DbPageType::kMetric
+            || type == DbPageType::kSample
+            || type == DbPageType::kSampleRuns
+            || type == DbPageType::kRadix && p->id
+        ) {
+            ids->insert(p->id & ((1u << kRollupIdShift) - 1));
+            continue;
+        }
+        limit = pgno_t(*i + 1);
+        compactRaiseLimit(limit);
+        break;
+    }
+    return m_numPages > limit ? m_numPages - limit : 0;
+}
+
+//===========================================================================
+// Moves the pages of the metric, and of its rollups, that are past the
+// compaction limit. Must be serialized with other updates to the metric.
+void DbData::compactMetric(DbTxn & txn, uint32_t id) {
+    auto limit = m_compactLimit.load();
+    if (!limit)
+        return;
+    for (unsigned level = 0; level <= kMaxRollups; ++level) {
+        auto mid = level ? rollupId(id, level) : id;
+        auto mi = getMetricPos(txn, mid);
+        if (!mi.infoPage)
+            continue;
+        auto infoPage = mi.infoPage;
+        auto lastPage = mi.lastPage;
+        unordered_map<pgno_t, pgno_t> moved;
+        compactRadix(txn, &mi, &moved, mi.infoPage, limit);
+        if (mi.infoPage >= limit) {
+            if (auto pgno = compactMovePage(txn, mi.infoPage)) {
+                radixSwapValue(txn, m_metricRoot, mid, pgno);
+                mi.infoPage = pgno;
+            }
+        }
+        if (mi.infoPage != infoPage) {
+            moveMetricPos(mid, mi);
+        } else if (mi.lastPage != lastPage) {
+            setMetricPos(mid, mi);
+        }
+    }
+}
+
+//===========================================================================
+// Moves the pages referenced by the radix page, or metric page, that are
+// past the limit. Referenced pages are updated before they're moved, so the
+// copies refer to the moved versions of their own references. Pages of sample
+// runs are referenced by several entries, so where they were moved to is
+// kept in moved for the entries after the first.
+void DbData::compactRadix(
+    DbTxn & txn,
+    MetricPosition * mi,
+    unordered_map<pgno_t, pgno_t> * moved,
+    pgno_t root,
+    pgno_t limit
+) {
+    vector<pgno_t> pages;
+    uint16_t height = 0;
+    {
+        DbTxn::PinScope pins(txn);
+        auto rd = radixData(txn.pin<DbPageHeader>(root), m_pageSize);
+        height = rd->height;
+        pages.assign(rd->begin(), rd->end());
+    }
+    for (size_t i = 0; i < pages.size(); ++i) {
+        auto pgno = pages[i];
+        if (!pgno || pgno > kMaxPageNum) {
+            // Unassigned or virtual page.
+            continue;
+        }
+        if (auto j = moved->find(pgno); j != moved->end()) {
+            // Page of sample runs already processed for another entry.
+            if (j->second != pgno)
+                txn.walRadixUpdate(root, i, j->second);
+            continue;
+        }
+        if (height) {
+            compactRadix(txn, mi, moved, pgno, limit);
+        } else {
+            compactSampleChain(txn, pgno, limit);
+        }
+        if (pgno >= limit) {
+            auto runs = !height && isRunsPage(txn, pgno);
+            auto npno = compactMovePage(txn, pgno);
+            if (npno) {
+                txn.walRadixUpdate(root, i, npno);
+                if (pgno == mi->lastPage)
+                    mi->lastPage = npno;
+            }
+            if (runs) {
+                // Whether or not it moved, the other entries must match.
+                moved->insert({pgno, npno ? npno : pgno});
+            }
+        }
+    }
+}
+
+//===========================================================================
+// Moves overflow pages, of the chain of packed sample pages, that are past
+// the limit.
+void DbData::compactSampleChain(DbTxn & txn, pgno_t spno, pgno_t limit) {
+    if (isRunsPage(txn, spno))
+        return;
+    for (auto pgno = spno;;) {
+        auto sp = txn.pin<SamplePage>(pgno);
+        if (sp->sampleType != kSampleTypePacked)
+            return;
+        auto next = packedSamples(sp)->overflow;
+        if (!next)
+            return;
+        if (next >= limit) {
+            if (auto npno = compactMovePage(txn, next)) {
+                txn.walSamplePackLink(pgno, npno);
+                next = npno;
+            }
+        }
+        pgno = next;
+    }
+}
+
 
 /****************************************************************************
 *
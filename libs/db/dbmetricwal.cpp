@@ -39,6 +39,10 @@ struct MetricUpdateRec {
     Duration retention;
     Duration interval;
 };
+struct MetricUpdateBackfillRec {
+    DbWal::Record hdr;
+    TimePoint backfill;
+};
 struct MetricUpdatePosRec {
     DbWal::Record hdr;
     uint16_t refPos;
@@ -97,6 +101,14 @@ struct SampleUpdateTimeRec {
     DbWal::Record hdr;
     TimePoint pageTime;
 };
+struct SampleUpdateRangeRec {
+    DbWal::Record hdr;
+    uint16_t firstSample;
+    uint16_t bytes;
+
+    // EXTENDS BEYOND END OF STRUCT
+    uint8_t values[1]; // in the format of the samples of the page
+};
 
 // Update (with or without last) is also an implicit transaction
 struct SampleUpdateFloat64TxnRec {
@@ -130,11 +142,84 @@ struct SampleUpdateInt8TxnRec {
     int8_t value;
 };
 
+//---------------------------------------------------------------------------
+// Packed sample
+struct SamplePackInitRec {
+    DbWal::Record hdr;
+    uint32_t id;
+    TimePoint pageTime;
+    Duration interval;
+    uint16_t lastSample;
+    double value;
+};
+struct SamplePackUpdateRec {
+    DbWal::Record hdr;
+    uint16_t pos;
+    double value;
+};
+struct SamplePackLinkRec {
+    DbWal::Record hdr;
+    pgno_t overflow;
+};
+
+// Append is also an implicit transaction
+struct SamplePackAppendTxnRec {
+    DbWalRecType type;
+    pgno_t pgno;
+    uint16_t pos;
+    double value;
+};
+
+//---------------------------------------------------------------------------
+// Sample runs
+struct SampleRunsInitRec {
+    DbWal::Record hdr;
+    uint32_t id;
+};
+struct SampleRunsAddRec {
+    DbWal::Record hdr;
+    uint32_t pagePos;
+    TimePoint pageTime;
+    uint16_t bytes;
+
+    // EXTENDS BEYOND END OF STRUCT
+    uint8_t runs[1]; // in the format of the entries of the page
+};
+struct SampleRunsReleaseRec {
+    DbWal::Record hdr;
+};
+struct SampleRunsUpdateRec {
+    DbWal::Record hdr;
+    uint32_t pagePos;
+    uint16_t bytes;
+
+    // EXTENDS BEYOND END OF STRUCT
+    uint8_t runs[1]; // in the format of the entries of the page
+};
+struct SampleRunsRemoveRec {
+    DbWal::Record hdr;
+    uint32_t pagePos;
+};
+
 } // namespace
 
 #pragma pack(pop)
 
 
+/****************************************************************************
+*
+*   Helpers
+*
+***/
+
+//===========================================================================
+// Records with the non-standard implicit transaction layout don't have a
+// localTxn field.
+static LocalTxn localTxnNone(const DbWal::Record & rec) {
+    return {};
+}
+
+
 /****************************************************************************
 *
 *   DbWalRecInfo - Metric
@@ -174,6 +259,12 @@ static void applyMetricUpdate(const DbWalApplyArgs & args) {
     );
 }
 
+//===========================================================================
+static void applyMetricUpdateBackfill(const DbWalApplyArgs & args) {
+    auto rec = reinterpret_cast<const MetricUpdateBackfillRec *>(args.rec);
+    args.notify->onWalApplyMetricUpdateBackfill(args.page, rec->backfill);
+}
+
 //===========================================================================
 static void applyMetricClearSamples(const DbWalApplyArgs & args) {
     args.notify->onWalApplyMetricClearSamples(args.page);
@@ -248,6 +339,10 @@ static DbWalRegisterRec s_metricRecInfo {
         DbWalRecInfo::sizeFn<MetricUpdateRec>,
         applyMetricUpdate,
     },
+    { kRecTypeMetricUpdateBackfill,
+        DbWalRecInfo::sizeFn<MetricUpdateBackfillRec>,
+        applyMetricUpdateBackfill,
+    },
     { kRecTypeMetricClearSamples,
         DbWalRecInfo::sizeFn<DbWal::Record>,
         applyMetricClearSamples,
@@ -263,6 +358,7 @@ static DbWalRegisterRec s_metricRecInfo {
     { kRecTypeMetricUpdateSampleTxn,
         DbWalRecInfo::sizeFn<MetricUpdateSampleTxnRec>,
         applyMetricUpdateSampleTxn,
+        localTxnNone,
     },
     { kRecTypeMetricUpdateSample,
         DbWalRecInfo::sizeFn<MetricUpdateSampleRec>,
@@ -331,6 +427,34 @@ static void applySampleUpdateLast(const DbWalApplyArgs & args) {
     );
 }
 
+//===========================================================================
+static uint16_t sizeSampleUpdateRange(const DbWal::Record & raw) {
+    auto & rec = reinterpret_cast<const SampleUpdateRangeRec &>(raw);
+    return offsetof(SampleUpdateRangeRec, values) + rec.bytes;
+}
+
+//===========================================================================
+static void applySampleUpdateRange(const DbWalApplyArgs & args) {
+    auto rec = reinterpret_cast<const SampleUpdateRangeRec *>(args.rec);
+    args.notify->onWalApplySampleUpdateRange(
+        args.page,
+        rec->firstSample,
+        {rec->values, rec->bytes},
+        false
+    );
+}
+
+//===========================================================================
+static void applySampleUpdateRangeLast(const DbWalApplyArgs & args) {
+    auto rec = reinterpret_cast<const SampleUpdateRangeRec *>(args.rec);
+    args.notify->onWalApplySampleUpdateRange(
+        args.page,
+        rec->firstSample,
+        {rec->values, rec->bytes},
+        true
+    );
+}
+
 //===========================================================================
 static void applySampleUpdateTime(const DbWalApplyArgs & args) {
     auto rec = reinterpret_cast<const SampleUpdateTimeRec *>(args.rec);
@@ -457,6 +581,43 @@ static void applySampleUpdateInt32LastTxn(const DbWalApplyArgs & args) {
     );
 }
 
+//===========================================================================
+static void applySamplePackInit(const DbWalApplyArgs & args) {
+    auto rec = reinterpret_cast<const SamplePackInitRec *>(args.rec);
+    args.notify->onWalApplySamplePackInit(
+        args.page,
+        rec->id,
+        rec->pageTime,
+        rec->interval,
+        rec->lastSample,
+        rec->value
+    );
+}
+
+//===========================================================================
+static void applySamplePackAppend(const DbWalApplyArgs & args) {
+    auto rec = reinterpret_cast<const SamplePackUpdateRec *>(args.rec);
+    args.notify->onWalApplySamplePackAppend(args.page, rec->pos, rec->value);
+}
+
+//===========================================================================
+static void applySamplePackAppendTxn(const DbWalApplyArgs & args) {
+    auto rec = reinterpret_cast<const SamplePackAppendTxnRec *>(args.rec);
+    args.notify->onWalApplySamplePackAppend(args.page, rec->pos, rec->value);
+}
+
+//===========================================================================
+static void applySamplePackUpdate(const DbWalApplyArgs & args) {
+    auto rec = reinterpret_cast<const SamplePackUpdateRec *>(args.rec);
+    args.notify->onWalApplySamplePackUpdate(args.page, rec->pos, rec->value);
+}
+
+//===========================================================================
+static void applySamplePackLink(const DbWalApplyArgs & args) {
+    auto rec = reinterpret_cast<const SamplePackLinkRec *>(args.rec);
+    args.notify->onWalApplySamplePackLink(args.page, rec->overflow);
+}
+
 
 static DbWalRegisterRec s_sampleRecInfo{
     { kRecTypeSampleInit,
@@ -479,45 +640,165 @@ static DbWalRegisterRec s_sampleRecInfo{
         DbWalRecInfo::sizeFn<SampleUpdateTimeRec>,
         applySampleUpdateTime,
     },
+    { kRecTypeSampleUpdateRange,
+        sizeSampleUpdateRange,
+        applySampleUpdateRange,
+    },
+    { kRecTypeSampleUpdateRangeLast,
+        sizeSampleUpdateRange,
+        applySampleUpdateRangeLast,
+    },
     { kRecTypeSampleUpdateFloat32Txn,
         DbWalRecInfo::sizeFn<SampleUpdateFloat32TxnRec>,
         applySampleUpdateFloat32Txn,
+        localTxnNone,
     },
     { kRecTypeSampleUpdateFloat64Txn,
         DbWalRecInfo::sizeFn<SampleUpdateFloat64TxnRec>,
         applySampleUpdateFloat64Txn,
+        localTxnNone,
     },
     { kRecTypeSampleUpdateInt8Txn,
         DbWalRecInfo::sizeFn<SampleUpdateInt8TxnRec>,
         applySampleUpdateInt8Txn,
+        localTxnNone,
     },
     { kRecTypeSampleUpdateInt16Txn,
         DbWalRecInfo::sizeFn<SampleUpdateInt16TxnRec>,
         applySampleUpdateInt16Txn,
+        localTxnNone,
     },
     { kRecTypeSampleUpdateInt32Txn,
         DbWalRecInfo::sizeFn<SampleUpdateInt32TxnRec>,
         applySampleUpdateInt32Txn,
+        localTxnNone,
     },
     { kRecTypeSampleUpdateFloat32LastTxn,
         DbWalRecInfo::sizeFn<SampleUpdateFloat32TxnRec>,
         applySampleUpdateFloat32LastTxn,
+        localTxnNone,
     },
     { kRecTypeSampleUpdateFloat64LastTxn,
         DbWalRecInfo::sizeFn<SampleUpdateFloat64TxnRec>,
         applySampleUpdateFloat64LastTxn,
+        localTxnNone,
     },
     { kRecTypeSampleUpdateInt8LastTxn,
         DbWalRecInfo::sizeFn<SampleUpdateInt8TxnRec>,
         applySampleUpdateInt8LastTxn,
+        localTxnNone,
     },
     { kRecTypeSampleUpdateInt16LastTxn,
         DbWalRecInfo::sizeFn<SampleUpdateInt16TxnRec>,
         applySampleUpdateInt16LastTxn,
+        localTxnNone,
     },
     { kRecTypeSampleUpdateInt32LastTxn,
         DbWalRecInfo::sizeFn<SampleUpdateInt32TxnRec>,
         applySampleUpdateInt32LastTxn,
+        localTxnNone,
+    },
+    { kRecTypeSamplePackInit,
+        DbWalRecInfo::sizeFn<SamplePackInitRec>,
+        applySamplePackInit,
+    },
+    { kRecTypeSamplePackAppend,
+        DbWalRecInfo::sizeFn<SamplePackUpdateRec>,
+        applySamplePackAppend,
+    },
+    { kRecTypeSamplePackAppendTxn,
+        DbWalRecInfo::sizeFn<SamplePackAppendTxnRec>,
+        applySamplePackAppendTxn,
+        localTxnNone,
+    },
+    { kRecTypeSamplePackUpdate,
+        DbWalRecInfo::sizeFn<SamplePackUpdateRec>,
+        applySamplePackUpdate,
+    },
+    { kRecTypeSamplePackLink,
+        DbWalRecInfo::sizeFn<SamplePackLinkRec>,
+        applySamplePackLink,
+    },
+};
+
+
+/****************************************************************************
+*
+*   DbWalRecInfo - Sample runs
+*
+***/
+
+//===========================================================================
+static void applySampleRunsInit(const DbWalApplyArgs & args) {
+    auto rec = reinterpret_cast<const SampleRunsInitRec *>(args.rec);
+    args.notify->onWalApplySampleRunsInit(args.page, rec->id);
+}
+
+//===========================================================================
+static uint16_t sizeSampleRunsAdd(const DbWal::Record & raw) {
+    auto & rec = reinterpret_cast<const SampleRunsAddRec &>(raw);
+    return offsetof(SampleRunsAddRec, runs) + rec.bytes;
+}
+
+//===========================================================================
+static void applySampleRunsAdd(const DbWalApplyArgs & args) {
+    auto rec = reinterpret_cast<const SampleRunsAddRec *>(args.rec);
+    args.notify->onWalApplySampleRunsAdd(
+        args.page,
+        rec->pagePos,
+        rec->pageTime,
+        {rec->runs, rec->bytes}
+    );
+}
+
+//===========================================================================
+static void applySampleRunsRelease(const DbWalApplyArgs & args) {
+    args.notify->onWalApplySampleRunsRelease(args.page);
+}
+
+//===========================================================================
+static uint16_t sizeSampleRunsUpdate(const DbWal::Record & raw) {
+    auto & rec = reinterpret_cast<const SampleRunsUpdateRec &>(raw);
+    return offsetof(SampleRunsUpdateRec, runs) + rec.bytes;
+}
+
+//===========================================================================
+static void applySampleRunsUpdate(const DbWalApplyArgs & args) {
+    auto rec = reinterpret_cast<const SampleRunsUpdateRec *>(args.rec);
+    args.notify->onWalApplySampleRunsUpdate(
+        args.page,
+        rec->pagePos,
+        {rec->runs, rec->bytes}
+    );
+}
+
+//===========================================================================
+static void applySampleRunsRemove(const DbWalApplyArgs & args) {
+    auto rec = reinterpret_cast<const SampleRunsRemoveRec *>(args.rec);
+    args.notify->onWalApplySampleRunsRemove(args.page, rec->pagePos);
+}
+
+
+static DbWalRegisterRec s_sampleRunsRecInfo{
+    { kRecTypeSampleRunsInit,
+        DbWalRecInfo::sizeFn<SampleRunsInitRec>,
+        applySampleRunsInit,
+    },
+    { kRecTypeSampleRunsAdd,
+        sizeSampleRunsAdd,
+        applySampleRunsAdd,
+    },
+    { kRecTypeSampleRunsRelease,
+        DbWalRecInfo::sizeFn<SampleRunsReleaseRec>,
+        applySampleRunsRelease,
+    },
+    { kRecTypeSampleRunsUpdate,
+        sizeSampleRunsUpdate,
+        applySampleRunsUpdate,
+    },
+    { kRecTypeSampleRunsRemove,
+        DbWalRecInfo::sizeFn<SampleRunsRemoveRec>,
+        applySampleRunsRemove,
     },
 };
 
@@ -571,6 +852,14 @@ void DbTxn::walMetricUpdate(
     wal(&rec->hdr, bytes);
 }
 
+//===========================================================================
+void DbTxn::walMetricUpdateBackfill(pgno_t pgno, TimePoint backfill) {
+    auto [rec, bytes] =
+        alloc<MetricUpdateBackfillRec>(kRecTypeMetricUpdateBackfill, pgno);
+    rec->backfill = backfill;
+    wal(&rec->hdr, bytes);
+}
+
 //===========================================================================
 void DbTxn::walMetricClearSamples(pgno_t pgno) {
     auto [rec, bytes] = alloc<DbWal::Record>(kRecTypeMetricClearSamples, pgno);
@@ -755,3 +1044,153 @@ void DbTxn::walSampleUpdateTime(pgno_t pgno, TimePoint pageTime) {
     rec->pageTime = pageTime;
     wal(&rec->hdr, bytes);
 }
+
+//===========================================================================
+void DbTxn::walSampleUpdateRange(
+    pgno_t pgno,
+    size_t firstSample,
+    span<const uint8_t> values,
+    bool updateLast
+) {
+    auto type = updateLast
+        ? kRecTypeSampleUpdateRangeLast
+        : kRecTypeSampleUpdateRange;
+    auto offset = offsetof(SampleUpdateRangeRec, values);
+    auto [rec, bytes] = alloc<SampleUpdateRangeRec>(
+        type,
+        pgno,
+        offset + values.size()
+    );
+    assert(firstSample <= numeric_limits<decltype(rec->firstSample)>::max());
+    assert(values.size() <= numeric_limits<decltype(rec->bytes)>::max());
+    rec->firstSample = (uint16_t) firstSample;
+    rec->bytes = (uint16_t) values.size();
+    memcpy(rec->values, values.data(), values.size());
+    wal(&rec->hdr, bytes);
+}
+
+//===========================================================================
+void DbTxn::walSamplePackInit(
+    pgno_t pgno,
+    uint32_t id,
+    TimePoint pageTime,
+    Duration interval,
+    size_t lastSample,
+    double fill
+) {
+    auto [rec, bytes] = alloc<SamplePackInitRec>(kRecTypeSamplePackInit, pgno);
+    rec->id = id;
+    rec->pageTime = pageTime;
+    rec->interval = interval;
+    rec->lastSample = (uint16_t) lastSample;
+    rec->value = fill;
+    wal(&rec->hdr, bytes);
+}
+
+//===========================================================================
+// Like walSampleUpdateTxn, represents a transaction with just a single
+// appended value.
+void DbTxn::walSamplePackAppendTxn(pgno_t pgno, size_t pos, double value) {
+    if (m_txn)
+        return walSamplePackAppend(pgno, pos, value);
+
+    SamplePackAppendTxnRec rec;
+    assert(pos <= numeric_limits<decltype(rec.pos)>::max());
+    rec.type = kRecTypeSamplePackAppendTxn;
+    rec.pgno = pgno;
+    rec.pos = (uint16_t) pos;
+    rec.value = value;
+    m_wal.walAndApply({}, (DbWal::Record *) &rec, sizeof(rec));
+}
+
+//===========================================================================
+void DbTxn::walSamplePackAppend(pgno_t pgno, size_t pos, double value) {
+    auto [rec, bytes] =
+        alloc<SamplePackUpdateRec>(kRecTypeSamplePackAppend, pgno);
+    assert(pos <= numeric_limits<decltype(rec->pos)>::max());
+    rec->pos = (uint16_t) pos;
+    rec->value = value;
+    wal(&rec->hdr, bytes);
+}
+
+//===========================================================================
+void DbTxn::walSamplePackUpdate(pgno_t pgno, size_t pos, double value) {
+    auto [rec, bytes] =
+        alloc<SamplePackUpdateRec>(kRecTypeSamplePackUpdate, pgno);
+    assert(pos <= numeric_limits<decltype(rec->pos)>::max());
+    rec->pos = (uint16_t) pos;
+    rec->value = value;
+    wal(&rec->hdr, bytes);
+}
+
+//===========================================================================
+void DbTxn::walSamplePackLink(pgno_t pgno, pgno_t overflow) {
+    auto [rec, bytes] = alloc<SamplePackLinkRec>(kRecTypeSamplePackLink, pgno);
+    rec->overflow = overflow;
+    wal(&rec->hdr, bytes);
+}
+
+//===========================================================================
+void DbTxn::walSampleRunsInit(pgno_t pgno, uint32_t id) {
+    auto [rec, bytes] = alloc<SampleRunsInitRec>(kRecTypeSampleRunsInit, pgno);
+    rec->id = id;
+    wal(&rec->hdr, bytes);
+}
+
+//===========================================================================
+void DbTxn::walSampleRunsAdd(
+    pgno_t pgno,
+    size_t pagePos,
+    TimePoint pageTime,
+    span<const uint8_t> runs
+) {
+    auto offset = offsetof(SampleRunsAddRec, runs);
+    auto [rec, bytes] = alloc<SampleRunsAddRec>(
+        kRecTypeSampleRunsAdd,
+        pgno,
+        offset + runs.size()
+    );
+    assert(pagePos <= numeric_limits<decltype(rec->pagePos)>::max());
+    assert(runs.size() <= numeric_limits<decltype(rec->bytes)>::max());
+    rec->pagePos = (uint32_t) pagePos;
+    rec->pageTime = pageTime;
+    rec->bytes = (uint16_t) runs.size();
+    memcpy(rec->runs, runs.data(), runs.size());
+    wal(&rec->hdr, bytes);
+}
+
+//===========================================================================
+void DbTxn::walSampleRunsRelease(pgno_t pgno) {
+    auto [rec, bytes] =
+        alloc<SampleRunsReleaseRec>(kRecTypeSampleRunsRelease, pgno);
+    wal(&rec->hdr, bytes);
+}
+
+//===========================================================================
+void DbTxn::walSampleRunsUpdate(
+    pgno_t pgno,
+    size_t pagePos,
+    span<const uint8_t> runs
+) {
+    auto offset = offsetof(SampleRunsUpdateRec, runs);
+    auto [rec, bytes] = alloc<SampleRunsUpdateRec>(
+        kRecTypeSampleRunsUpdate,
+        pgno,
+        offset + runs.size()
+    );
+    assert(pagePos <= numeric_limits<decltype(rec->pagePos)>::max());
+    assert(runs.size() <= numeric_limits<decltype(rec->bytes)>::max());
+    rec->pagePos = (uint32_t) pagePos;
+    rec->bytes = (uint16_t) runs.size();
+    memcpy(rec->runs, runs.data(), runs.size());
+    wal(&rec->hdr, bytes);
+}
+
+//===========================================================================
+void DbTxn::walSampleRunsRemove(pgno_t pgno, size_t pagePos) {
+    auto [rec, bytes] =
+        alloc<SampleRunsRemoveRec>(kRecTypeSampleRunsRemove, pgno);
+    assert(pagePos <= numeric_limits<decltype(rec->pagePos)>::max());
+    rec->pagePos = (uint32_t) pagePos;
+    wal(&rec->hdr, bytes);
+}
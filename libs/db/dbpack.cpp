@@ -51,6 +51,18 @@ DbPack::DbPack(const DbUnpackIter & unpack) {
     m_state = unpack.state();
 }
 
+//===========================================================================
+DbPack::DbPack(
+    void * out,
+    size_t outLen,
+    size_t unusedBits,
+    const DbPackState & state
+)
+    : DbPack(out, outLen, unusedBits)
+{
+    m_state = state;
+}
+
 //===========================================================================
 void DbPack::retarget(void * out, size_t outLen, size_t unusedBits) {
     assert(unusedBits <= 7);
@@ -97,19 +109,17 @@ bool DbPack::put(TimePoint time) {
             return bitput(15, (0b110 << 12) | ddt & 0xfff);
         } else {
             auto bits = kExponentInfo[m_state.expBits].bits;
+            auto mask = ~0ull >> (64 - bits);
             if (bits < 60) {
                 // ddt within [-2^59, -2049]
                 // '1110' + ddt (41 - 58 bits, depending on exponent)
-                return bitput(
-                    4 + bits,
-                    (0b1110 << bits) | ddt & ((1 << bits) - 1)
-                );
+                return bitput(4 + bits, (0b1110ull << bits) | ddt & mask);
             } else {
                 // ddt within [-2^63, -2049]
                 // '1110' + ddt (61 - 64 bits, depending on exponent)
                 return bitcheck(4 + bits)
                     && bitput(4, 0b1110)
-                    && bitput(bits, ddt & ((1 << bits) - 1));
+                    && bitput(bits, ddt & mask);
             }
         }
     } else {
@@ -131,7 +141,7 @@ bool DbPack::put(TimePoint time) {
             if (bits < 60) {
                 // ddt within [2049, 2^59]
                 // '1110' + (ddt - 1) (41 - 58 bits, depending on exponent)
-                return bitput(4 + bits, (0b1110 << bits) | ddt);
+                return bitput(4 + bits, (0b1110ull << bits) | ddt);
             } else {
                 // ddt within [2049, 2^59]
                 // '1110' + (ddt - 1) (61 - 64 bits, depending on exponent)
@@ -153,7 +163,8 @@ bool DbPack::put(double value) {
         return bitput(1, 0);
     }
 
-    auto prefix = countl_zero(dv);
+    // Leading zeros are capped at 31 so they fit in the 5 bit field.
+    auto prefix = min(countl_zero(dv), 31);
     auto len = 64 - prefix - countr_zero(dv);
     if (prefix >= m_state.prefixBits
         && prefix + len <= m_state.prefixBits + m_state.lenBits
@@ -169,11 +180,12 @@ bool DbPack::put(double value) {
 
     // Specify new range of meaningful bits as well as the new value.
     // '11' + number of leading zeros (5 bits)
-    //      + number of meaningful bits (6 bits)
+    //      + number of meaningful bits (6 bits, 64 is encoded as 0)
     //      + meaningful bits
     m_state.prefixBits = (uint8_t) prefix;
     m_state.lenBits = (uint8_t) len;
-    auto out = (0b11 << 11) | (m_state.prefixBits << 6) | m_state.lenBits;
+    auto out = (0b11 << 11) | (m_state.prefixBits << 6)
+        | (m_state.lenBits & 0x3f);
     auto suffix = 64 - m_state.prefixBits - m_state.lenBits;
     return bitcheck(13 + m_state.lenBits)
         && bitput(13, out)
@@ -237,9 +249,9 @@ DbUnpackIter::DbUnpackIter(const void * src, size_t srcLen, size_t unusedBits)
 
 //===========================================================================
 bool DbUnpackIter::operator!=(const DbUnpackIter & right) const {
-    return m_base == right.m_base
-        && m_used == right.m_used
-        && m_unusedBits == right.m_unusedBits;
+    return m_base != right.m_base
+        || m_used != right.m_used
+        || m_unusedBits != right.m_unusedBits;
 }
 
 //===========================================================================
@@ -316,7 +328,7 @@ bool DbUnpackIter::getValue() {
         m_state.prefixBits = (uint8_t) out;
         if (!bitget(&out, 6))
             return false;
-        m_state.lenBits = (uint8_t) out;
+        m_state.lenBits = out ? (uint8_t) out : 64;
     } else {
         // '10' + xor (use current leading zero and length values)
     }
@@ -333,7 +345,7 @@ bool DbUnpackIter::bitget(int64_t * out, size_t nbits) {
     if (!bitget((uint64_t *) out, nbits))
         return false;
     if (nbits && (*out & (1ull << (nbits - 1))) && nbits < 64)
-        *out |= -1 << nbits;
+        *out |= (int64_t) (~0ull << nbits);
     return true;
 }
 
@@ -359,7 +371,7 @@ bool DbUnpackIter::bitget(uint64_t * out, size_t nbits) {
             break;
         }
 
-        auto bits = m_base[m_used - 1] & ((1 << m_unusedBits) - 1);
+        uint64_t bits = m_base[m_used - 1] & ((1 << m_unusedBits) - 1);
         bits <<= cnt - m_unusedBits;
         *out |= bits;
         cnt -= m_unusedBits;
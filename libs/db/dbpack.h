@@ -45,6 +45,17 @@ public:
     DbPack(void * out, size_t outLen, size_t unusedBits = 0);
     DbPack(const DbUnpackIter & unpack);
 
+    // Resumes packing after previously packed samples. The state must be
+    // from the DbPack (or DbUnpackIter) that processed them and, if
+    // unusedBits is non-zero, they are the low bits of the byte immediately
+    // preceding out.
+    DbPack(
+        void * out,
+        size_t outLen,
+        size_t unusedBits,
+        const DbPackState & state
+    );
+
     void retarget(void * out, size_t outLen, size_t unusedBits = 0);
     bool put(Dim::TimePoint time, double value);
 
@@ -53,6 +64,7 @@ public:
     std::string_view view() const { return {(char *) m_base, m_used}; }
     uint8_t unusedBits() const { return m_unusedBits; }
     size_t capacity() const { return m_count; }
+    const DbPackState & state() const { return m_state; }
 
 private:
     bool bitput(size_t nbits, uint64_t value);
@@ -6,6 +6,7 @@
 #pragma hdrstop
 
 using namespace std;
+using namespace std::chrono;
 using namespace Dim;
 
 
@@ -15,10 +16,31 @@ using namespace Dim;
 *
 ***/
 
-// Must be a multiple of fileViewAlignment().
+// Default size of views, must be a multiple of fileViewAlignment().
 size_t const kViewSize = 0x100'0000; // 16MiB
 size_t const kDefaultFirstViewSize = 2 * kViewSize;
 
+// Limits on writes of data pages when saving work pages. Adjacent pages are
+// combined into single writes of up to the max bytes.
+unsigned const kMaxPageWrites = 16; // max outstanding writes
+size_t const kMaxPageWriteBytes = 0x10'0000; // 1MiB
+// Saving dirty pages copies them into batches of up to this size, writing each
+// batch before starting the next.
+size_t const kMaxSaveBatchBytes = 0x40'0000; // 4MiB
+
+// Limits on reads of data pages that are being prefetched. Adjacent pages are
+// combined into single reads of up to the max bytes.
+unsigned const kMaxPrefetches = 16; // max outstanding reads
+size_t const kMaxPrefetchBytes = 0x4'0000; // 256KiB
+
+// Scrubbing reads the data file in batches, waiting between them so that the
+// rate stays under the limit.
+size_t const kDefaultScrubBytesPerSec = 0x100'0000; // 16MiB
+size_t const kScrubBatchBytes = 0x10'0000; // 1MiB
+
+// Followers reread data pages torn by the writer saving them, up to a limit.
+unsigned const kMaxFollowRereads = 3;
+
 
 /****************************************************************************
 *
@@ -32,14 +54,78 @@ const Guid kWorkFileSig = "51fde6a6-6438-444a-ae02-438b4b07b284"_Guid;
 
 uint32_t const kWorkPageTypeZero = 'wZ';
 
+// Page pin state flags, the remaining bits are the count of read pins.
+uint32_t const kPinWrite = 0x8000'0000;     // write pin pending or granted
+uint32_t const kPinTracked = 0x4000'0000;   // has work page in m_pages
+uint32_t const kPinVerified = 0x2000'0000;  // checksum in data file verified
+uint32_t const kPinReadMask = 0x1fff'ffff;
+
+// Number of page pin states per allocated chunk.
+unsigned const kPinChunkBits = 16;
+size_t const kPinChunkSize = size_t{1} << kPinChunkBits;
+
 struct ZeroPage {
     DbPageHeader hdr;
     Guid signature;
     unsigned pageSize;
 };
 
+// Issues asynchronous writes, limiting how many can be outstanding.
+class PageWriter : public IFileWriteNotify {
+public:
+    explicit PageWriter(FileHandle f) : m_file(f) {}
+    ~PageWriter();
+
+    void write(int64_t offset, const void * buf, size_t bytes);
+    void wait();
+
+private:
+    void onFileWrite(const FileWriteData & data) override;
+
+    FileHandle m_file;
+    mutex m_mut;
+    condition_variable m_cv;
+    unsigned m_pending = 0;
+};
+
 } // namespace
 
+// Reads pages into the OS cache, deletes itself when done.
+class DbPage::PrefetchTask : public ITaskNotify {
+public:
+    PrefetchTask(DbPage * page, int64_t offset, size_t bytes);
+
+private:
+    // Inherited via ITaskNotify
+    void onTask() override;
+
+    DbPage * m_page;
+    int64_t m_offset;
+    size_t m_bytes;
+};
+
+// Verifies the checksums of all pages in the data file, runs on its own
+// thread and deletes itself when done.
+class DbPage::ScrubTask : public ITaskNotify {
+public:
+    ScrubTask(
+        DbPage * page,
+        IDbProgressNotify * notify,
+        size_t maxBytesPerSec
+    );
+    void stop() { m_stop = true; }
+
+private:
+    // Inherited via ITaskNotify
+    void onTask() override;
+
+    DbPage * m_page;
+    IDbProgressNotify * m_notify;
+    size_t m_maxBytesPerSec;
+    DbProgressInfo m_info;
+    atomic<bool> m_stop;
+};
+
 
 /****************************************************************************
 *
@@ -57,12 +143,149 @@ static auto & s_perfCleanToFree = uperf("db.work clean to free");
 static auto & s_perfOverduePages = uperf("db.work pages (overdue)");
 static auto & s_perfBonds = uperf("db.work bonds");
 static auto & s_perfWrites = uperf("db.work writes (total)");
+static auto & s_perfWriteOps = uperf("db.work write ops");
+static auto & s_perfPrefetchOps = uperf("db.work prefetch ops");
+static auto & s_perfPrefetchSkipped = uperf("db.work prefetch ops (skipped)");
+static auto & s_perfBadPages = uperf("db.work pages (bad checksum)");
+static auto & s_perfBackupPages = uperf("db.work pages (backup)");
+static auto & s_perfScrubbed = uperf(
+    "db.work scrubbed bytes",
+    PerfFormat::kSiUnits
+);
 static auto & s_perfDurableBytes = uperf(
     "db.wal durable bytes",
     PerfFormat::kSiUnits
 );
 // Saved WAL pages that are referenced by unsaved work pages.
 static auto & s_perfRefWalPages = uperf("db.wal pages (referenced)");
+static auto & s_perfSnapshots = uperf("db.snapshots (open)");
+static auto & s_perfSnapshotMisses = uperf("db.snapshots (missing pages)");
+static auto & s_perfFollowRereads = uperf("db.snapshots (followed rereads)");
+static auto & s_perfOldPages = uperf("db.work pages (old versions)");
+
+
+/****************************************************************************
+*
+*   DbPage::PrefetchTask
+*
+***/
+
+//===========================================================================
+static TaskQueueHandle pagePrefetchQueue() {
+    static TaskQueueHandle s_hq = taskCreateQueue("Page prefetch", 2);
+    return s_hq;
+}
+
+//===========================================================================
+DbPage::PrefetchTask::PrefetchTask(DbPage * page, int64_t offset, size_t bytes)
+    : m_page(page)
+    , m_offset(offset)
+    , m_bytes(bytes)
+{}
+
+//===========================================================================
+void DbPage::PrefetchTask::onTask() {
+    // What's read is discarded, it's done only to get the pages into the OS
+    // cache.
+    s_perfPrefetchOps += 1;
+    auto buf = make_unique<char[]>(m_bytes);
+    fileReadWait(nullptr, buf.get(), m_bytes, m_page->m_fdata, m_offset);
+
+    auto page = m_page;
+    delete this;
+    scoped_lock lk{page->m_workMut};
+    page->m_prefetches -= 1;
+    page->m_workCv.notify_all();
+}
+
+
+/****************************************************************************
+*
+*   DbPage::ScrubTask
+*
+***/
+
+//===========================================================================
+static TaskQueueHandle pageScrubQueue() {
+    static TaskQueueHandle s_hq = taskCreateQueue("Page scrub", 1);
+    return s_hq;
+}
+
+//===========================================================================
+DbPage::ScrubTask::ScrubTask(
+    DbPage * page,
+    IDbProgressNotify * notify,
+    size_t maxBytesPerSec
+)
+    : m_page(page)
+    , m_notify(notify)
+    , m_maxBytesPerSec(maxBytesPerSec)
+    , m_stop(false)
+{}
+
+//===========================================================================
+void DbPage::ScrubTask::onTask() {
+    auto pageSize = m_page->m_pageSize;
+    size_t numPages = 0;
+    {
+        scoped_lock lk{m_page->m_workMut};
+        numPages = m_page->m_pages.size();
+    }
+    m_info.totalPages = numPages;
+    m_info.totalBytes = numPages * pageSize;
+    auto keepGoing = !m_notify || m_notify->onDbProgress(kRunRunning, m_info);
+
+    auto maxPages = max<size_t>(kScrubBatchBytes / pageSize, 1);
+    auto buf = make_unique<char[]>(maxPages * pageSize);
+    auto start = steady_clock::now();
+    for (size_t pgno = 0; keepGoing && pgno < numPages && !m_stop; ) {
+        auto count = min(maxPages, numPages - pgno);
+        uint64_t bytes = 0;
+        fileReadWait(
+            &bytes,
+            buf.get(),
+            count * pageSize,
+            m_page->m_fdata,
+            pgno * pageSize
+        );
+        count = bytes / pageSize;
+        if (!count)
+            break;
+        for (size_t i = 0; i < count; ++i) {
+            auto ptr = buf.get() + i * pageSize;
+            if (m_page->verifyPage((const DbPageHeader *) ptr)
+                || m_page->recheckPage(pgno_t(pgno + i), ptr)
+            ) {
+                continue;
+            }
+            logMsgError() << "Bad checksum on data page #" << pgno + i;
+            s_perfBadPages += 1;
+            m_info.badPages += 1;
+        }
+        pgno += count;
+        m_info.pages += count;
+        m_info.bytes += count * pageSize;
+        s_perfScrubbed += (unsigned) (count * pageSize);
+        if (m_notify && !m_notify->onDbProgress(kRunRunning, m_info))
+            break;
+
+        // Wait until the time that reading this much at the max rate would
+        // have taken has passed.
+        auto due = start + duration_cast<steady_clock::duration>(
+            duration<double>((double) m_info.bytes / m_maxBytesPerSec)
+        );
+        unique_lock lk{m_page->m_workMut};
+        m_page->m_workCv.wait_until(lk, due, [&]() { return m_stop.load(); });
+    }
+    if (m_notify)
+        m_notify->onDbProgress(kRunStopped, m_info);
+
+    auto page = m_page;
+    delete this;
+    scoped_lock lk{page->m_workMut};
+    page->m_scrub = nullptr;
+    page->m_workCv.notify_all();
+}
 
 
 /****************************************************************************
@@ -89,7 +312,8 @@ bool DbPage::open(
     string_view workfile,
     size_t pageSize,
     size_t walPageSize,
-    EnumFlags<DbOpenFlags> flags
+    EnumFlags<DbOpenFlags> flags,
+    const DbMapOptions & mapOpts
 ) {
     assert(pageSize);
     assert(pageSize == bit_ceil(pageSize));
@@ -99,6 +323,13 @@ bool DbPage::open(
     m_pageSize = pageSize;
     m_walPageSize = walPageSize;
     m_flags = flags;
+    m_mapOpts = mapOpts;
+    if (!m_mapOpts.viewSize)
+        m_mapOpts.viewSize = kViewSize;
+    if (m_mapOpts.dataAccess == kMapAccessUnset)
+        m_mapOpts.dataAccess = kMapAccessDefault;
+    if (m_mapOpts.workAccess == kMapAccessUnset)
+        m_mapOpts.workAccess = kMapAccessDefault;
     m_newFiles = false;
     if (m_flags.any(fDbOpenVerbose))
         logMsgInfo() << "Open data files";
@@ -118,6 +349,10 @@ bool DbPage::open(
 bool DbPage::openData(string_view datafile) {
     using enum File::OpenMode;
     auto oflags = fReadWrite | fDenyWrite | fRandom;
+    if (m_flags.any(fDbOpenFollow)) {
+        // Shared with the writer, which also creates it.
+        oflags = fReadOnly | fDenyNone | fRandom;
+    }
     if (m_flags.any(fDbOpenCreat))
         oflags |= fCreat | fRemove;
     if (m_flags.any(fDbOpenTrunc))
@@ -151,14 +386,25 @@ bool DbPage::openData(string_view datafile) {
         // Newly created file.
         m_newFiles = true;
     }
-    if (!m_vdata.open(m_fdata, kViewSize, m_pageSize)) {
+    auto align = max(fileViewAlignment(m_fdata), m_pageSize);
+    if (auto extra = m_mapOpts.viewSize % align)
+        m_mapOpts.viewSize += align - extra;
+    auto opts = m_mapOpts;
+    opts.hugePages = false;
+    if (!m_vdata.open(m_fdata, m_mapOpts.viewSize, m_pageSize, opts)) {
         logMsgError() << "Open view failed, " << datafile;
         return false;
     }
+    m_vdata.advise(m_mapOpts.dataAccess);
 
     // Open successful, don't auto-close or auto-delete.
     fin.release();
 
+    if (m_flags.any(fDbOpenFollow)) {
+        m_dataPages = len / m_pageSize;
+        m_zeroPage = make_unique<char[]>(m_pageSize);
+    }
+
     // Remove trailing blank pages from page count.
     auto lastPage = (pgno_t) (len / m_pageSize);
     while (lastPage) {
@@ -167,7 +413,8 @@ bool DbPage::openData(string_view datafile) {
         if (p->type != DbPageType::kInvalid)
             break;
     }
-    m_pages.resize(lastPage + 1);
+    m_pinStates.reserve((kMaxPageNum >> kPinChunkBits) + 1);
+    resizePages_LK(lastPage + 1);
 
     return true;
 }
@@ -217,16 +464,19 @@ bool DbPage::openWork(string_view workfile) {
         logMsgError() << "Bad signature, " << workfile;
         return false;
     }
-    if (m_pageSize < kMinPageSize || kViewSize % m_pageSize != 0) {
+    if (m_pageSize < kMinPageSize
+        || m_mapOpts.viewSize % m_pageSize != 0
+    ) {
         logMsgError() << "Invalid page size, " << workfile;
         return false;
     }
     m_workPages = len / m_pageSize;
     m_freeWorkPages.insert(1, (unsigned) m_workPages - 1);
-    if (!m_vwork.open(m_fwork, kViewSize, m_pageSize)) {
+    if (!m_vwork.open(m_fwork, m_mapOpts.viewSize, m_pageSize, m_mapOpts)) {
         logMsgError() << "Open view failed, " << workfile;
         return false;
     }
+    m_vwork.advise(m_mapOpts.workAccess);
 
     // Open successful, don't auto-close or auto-delete.
     fin.release();
@@ -244,6 +494,19 @@ DbConfig DbPage::configure(const DbConfig & conf) {
     assert(conf.checkpointMaxInterval.count());
     assert(conf.checkpointMaxData);
 
+    if (conf.dataAccess != kMapAccessUnset
+        && conf.dataAccess != m_mapOpts.dataAccess
+    ) {
+        m_mapOpts.dataAccess = conf.dataAccess;
+        m_vdata.advise(conf.dataAccess);
+    }
+    if (conf.workAccess != kMapAccessUnset
+        && conf.workAccess != m_mapOpts.workAccess
+    ) {
+        m_mapOpts.workAccess = conf.workAccess;
+        m_vwork.advise(conf.workAccess);
+    }
+
     unique_lock lk{m_workMut};
     m_maxWalAge = conf.checkpointMaxInterval;
     m_maxWalBytes = conf.checkpointMaxData;
@@ -254,6 +517,17 @@ DbConfig DbPage::configure(const DbConfig & conf) {
 
 //===========================================================================
 void DbPage::close() {
+    {
+        // Wait for prefetches and scrubbing, which read from the data file.
+        unique_lock lk{m_workMut};
+        if (m_scrub) {
+            m_scrub->stop();
+            m_workCv.notify_all();
+        }
+        while (m_prefetches || m_scrub)
+            m_workCv.wait(lk);
+    }
+
     s_perfPages -= (unsigned) m_workPages;
     s_perfFreePages -= (unsigned) m_freeWorkPages.size();
 
@@ -263,7 +537,12 @@ void DbPage::close() {
     m_cleanPages.clear();
     m_pageBonds = 0;
     m_freeInfos.clear();
-    m_referencePages.clear();
+    m_pinStates.clear();
+    s_perfSnapshots -= (unsigned) m_snapshots.size();
+    m_snapshots.clear();
+    s_perfOldPages -= (unsigned) m_oldPages.size();
+    m_oldPages.clear();
+    m_checkpointLsn = {};
     m_durableLsn = {};
     m_currentWal.clear();
     m_overflowWal.clear();
@@ -274,6 +553,8 @@ void DbPage::close() {
 
     // Close Data File
     m_vdata.close();
+    m_dataPages = 0;
+    m_zeroPage.reset();
     if (m_newFiles
         && !m_fwork
         && fileMode(m_fdata).any(File::OpenMode::fRemove)
@@ -354,6 +635,11 @@ void DbPage::close() {
 void DbPage::onWalDurable(Lsn lsn, size_t bytes) {
     unique_lock lk{m_workMut};
     m_durableLsn = lsn;
+    // Durable updates have at least been logged, so they're either already
+    // applied or waited for by snapshots that include them. Also sets where
+    // snapshots start when opened after recovery.
+    if (lsn > m_updateLsn)
+        m_updateLsn = lsn;
     if (bytes) {
         s_perfDurableBytes += (unsigned) bytes;
         s_perfRefWalPages += (unsigned) (bytes / m_walPageSize);
@@ -382,6 +668,7 @@ Lsn DbPage::onWalCheckpointPages(Lsn lsn) {
     Lsn oldest = {};
     {
         scoped_lock lk{m_workMut};
+        m_checkpointLsn = lsn;
         if (!m_overflowWal.empty()) {
             oldest = m_overflowWal.front().lsn;
         } else if (!m_currentWal.empty()) {
@@ -481,20 +768,21 @@ void DbPage::saveOverduePages_LK() {
 
     // Get set of old pages whose WAL are durable.
     List<WorkPageInfo> pages;
+    vector<DbPageHeader *> hdrs;
     Lsn savedLsn = {};
     while (auto pi = m_overduePages.front()) {
         if (pi->hdr->lsn > m_durableLsn)
             break;
         savedLsn = pi->firstLsn;
         pages.link(pi);
+        hdrs.push_back(pi->hdr);
     }
 
     if (pages) {
         // Write the selected old pages.
         unique_lock lk(m_workMut, adopt_lock);
         lk.unlock();
-        for (auto && pi : pages)
-            writePageWait(pi.hdr);
+        writePagesWait(hdrs);
         lk.lock();
         lk.release();
 
@@ -511,6 +799,34 @@ void DbPage::saveOverduePages_LK() {
     }
 }
 
+//===========================================================================
+// Sorts the copies of pages in the buffer by page number, in place. Each
+// cycle of the permutation is moved through a single spare page.
+static void sortPages(char * buf, size_t count, size_t pageSize) {
+    auto page = [&](size_t i) { return buf + i * pageSize; };
+    auto pgno = [&](size_t i) { return ((DbPageHeader *) page(i))->pgno; };
+    // Position each page is to be moved from.
+    vector<size_t> from(count);
+    iota(from.begin(), from.end(), 0);
+    ranges::sort(from, [&](auto a, auto b) { return pgno(a) < pgno(b); });
+
+    auto tmp = make_unique<char[]>(pageSize);
+    for (size_t i = 0; i < count; ++i) {
+        if (from[i] == i)
+            continue;
+        memcpy(tmp.get(), page(i), pageSize);
+        auto j = i;
+        while (from[j] != i) {
+            auto next = from[j];
+            memcpy(page(j), page(next), pageSize);
+            from[j] = j;
+            j = next;
+        }
+        memcpy(page(j), tmp.get(), pageSize);
+        from[j] = j;
+    }
+}
+
 //===========================================================================
 // Cleans dirty pages either by saving or by adding a copy to overdue pages for
 // a later save.
@@ -557,9 +873,23 @@ Lsn DbPage::saveDirtyPages_LK(TimePoint lastTime) {
         }
     }
 
-    // Buffer to hold copy of page while it's being written.
-    auto buf = make_unique<char[]>(m_pageSize);
-    auto tmpHdr = reinterpret_cast<DbPageHeader *>(buf.get());
+    // Copies of the pages to be saved, taken as they're marked clean and
+    // written whenever the batch is full, and once the set of pages has been
+    // decided.
+    string batch;
+    auto writeBatch = [&]() {
+        // Put the copies in page number order, so runs of adjacent pages are
+        // written straight from the batch without copying them again.
+        auto count = batch.size() / m_pageSize;
+        sortPages(batch.data(), count, m_pageSize);
+        vector<DbPageHeader *> hdrs;
+        for (size_t i = 0; i < count; ++i)
+            hdrs.push_back((DbPageHeader *) (batch.data() + i * m_pageSize));
+        lk.unlock();
+        writePagesWait(hdrs);
+        lk.lock();
+        batch.clear();
+    };
 
     Lsn savedLsn = {};
     unsigned saved = 0;
@@ -581,7 +911,8 @@ Lsn DbPage::saveDirtyPages_LK(TimePoint lastTime) {
         }
 
         // Wait until the page is not pinned for update.
-        while (pi->writePin)
+        auto & state = pinState(pi->hdr->pgno);
+        while (state & kPinWrite)
             m_workCv.wait(lk);
         // Update page status from dirty to clean.
         saved += 1;
@@ -605,23 +936,18 @@ Lsn DbPage::saveDirtyPages_LK(TimePoint lastTime) {
             npi->flags = pi->flags;
             s_perfOverduePages += 1;
         } else {
-            // Page needs to be saved and doesn't have an unsaved LSN.
+            // Page needs to be saved and doesn't have an unsaved LSN. It stays
+            // in clean pages and will eventually be either dirtied or freed by
+            // removeCleanPages(), which can't happen until after the batch
+            // has been written.
             savedLsn = pi->firstLsn;
-            memcpy(tmpHdr, pi->hdr, m_pageSize);
-
-            lk.unlock();
-            writePageWait(tmpHdr);
-            lk.lock();
-            assert(m_pages[pi->hdr->pgno] == pi);
-            if (pi->flags.any(fDbPageDirty)) {
-                // The page was dirtied while the mutex was unlocked, has been
-                // moved out of clean pages, and we don't need to free it.
-            } else {
-                // The page stayed in clean pages and will eventually be either
-                // dirtied or freed by removeCleanPages().
-            }
+            batch.append((const char *) pi->hdr, m_pageSize);
+            if (batch.size() + m_pageSize > kMaxSaveBatchBytes)
+                writeBatch();
         }
     }
+    if (!batch.empty())
+        writeBatch();
 
     lk.release();
     return savedLsn;
@@ -648,15 +974,18 @@ void DbPage::removeCleanPages_LK() {
         next = m_cleanPages.next(pi);
         if (pi->firstTime >= minTime)
             break;
-        if (pi->readPins) {
-            // Page is pinned for reading (and maybe writing if pi->writePin is
-            // also true) so it can't be freed now, maybe next time.
+        auto pgno = pi->hdr ? pi->hdr->pgno : pi->pgno;
+        auto & ps = pinState(pgno);
+        auto state = (ps.load() & kPinVerified) | kPinTracked;
+        if (!ps.compare_exchange_strong(state, state & kPinVerified)) {
+            // Page is pinned for reading (and maybe writing) so it can't be
+            // freed now, maybe next time.
             continue;
         }
 
-        // Free the page.
+        // Free the page, it's now untracked and new pins will go directly to
+        // the data file, which has already been updated with it.
         freed += 1;
-        auto pgno = pi->hdr ? pi->hdr->pgno : pi->pgno;
         assert(m_pages[pgno] == pi);
         m_pages[pgno] = nullptr;
         assert(pi->hdr);
@@ -713,13 +1042,40 @@ void DbPage::removeWalPages_LK(Lsn lsn) {
 }
 
 //===========================================================================
-// Write the page with checksum.
-void DbPage::writePageWait(DbPageHeader * hdr) {
-    assert(hdr->pgno != kFreePageMark);
-    s_perfWrites += 1;
-    hdr->checksum = 0;
-    hdr->checksum = hash_crc32c(hdr, m_pageSize);
-    fileWriteWait(nullptr, m_fdata, hdr->pgno * m_pageSize, hdr, m_pageSize);
+// Write the pages with checksums. The pages must be private copies, their
+// checksums are set in place and they're written straight from where they
+// are. They are written in order of page number, with runs of pages that are
+// adjacent both in the file and in memory combined into larger writes, and
+// with a limited number of writes outstanding at a time. Reorders the vector.
+void DbPage::writePagesWait(vector<DbPageHeader *> & pages) {
+    if (pages.empty())
+        return;
+    ranges::sort(pages, [](auto a, auto b) { return a->pgno < b->pgno; });
+    for (auto && hdr : pages) {
+        assert(hdr->pgno != kFreePageMark);
+        hdr->checksum = 0;
+        hdr->checksum = hash_crc32c(hdr, m_pageSize);
+    }
+    s_perfWrites += (unsigned) pages.size();
+    backupKeepPages(pages);
+
+    PageWriter writer(m_fdata);
+    auto maxPages = max(kMaxPageWriteBytes / m_pageSize, (size_t) 1);
+    for (size_t i = 0; i < pages.size();) {
+        auto first = pages[i];
+        auto ptr = (const char *) first;
+        size_t count = 1;
+        while (i + count < pages.size()
+            && count < maxPages
+            && pages[i + count]->pgno == first->pgno + count
+            && (const char *) pages[i + count] == ptr + count * m_pageSize
+        ) {
+            count += 1;
+        }
+        writer.write(first->pgno * m_pageSize, ptr, count * m_pageSize);
+        i += count;
+    }
+    writer.wait();
 }
 
 //===========================================================================
@@ -743,65 +1099,249 @@ void DbPage::growToFit(pgno_t pgno) {
     unique_lock lk{m_workMut};
     if (pgno < m_pages.size())
         return;
+    if (m_flags.any(fDbOpenFollow)) {
+        // Followed updates may skip pages, such as ones the writer added
+        // and then freed. The view only grows as the data file does.
+        resizePages_LK(pgno + 1);
+        return;
+    }
     assert(pgno == m_pages.size());
     m_vdata.growToFit(pgno);
-    m_pages.resize(pgno + 1);
+    resizePages_LK(pgno + 1);
 }
 
 //===========================================================================
-const void * DbPage::rptr(Lsn lsn, pgno_t pgno, bool withPin) {
+pgno_t DbPage::truncate(pgno_t first) {
     unique_lock lk{m_workMut};
-    assert(pgno < m_pages.size());
-    auto pi = m_pages[pgno];
-    if (!pi) {
-        // Add reference page to track the pins. Reference pages are
-        // distinguished by having .hdr set to null.
-        //
-        // NOTE: The tracking is only to assert correctness and is no more than
-        //       a fancy assert.
-        assert(withPin);
-        pi = allocWorkInfo_LK();
-        m_pages[pgno] = pi;
-        m_referencePages.link(pi);
-        pi->pgno = pgno;
+    {
+        // Pages still to be read by a backup are kept.
+        scoped_lock lkBackup{m_backupMut};
+        if (m_backupActive)
+            first = max(first, m_backupEnd);
+    }
+    auto num = m_pages.size();
+    if (m_snapshots.empty()) {
+        // Pages that are untracked and unpinned aren't in use, and those last
+        // changed before the checkpoint have no WAL left that recovery would
+        // apply to them.
+        while (num > first) {
+            auto pgno = pgno_t(num - 1);
+            if (m_pages[pgno] || (pinState(pgno).load() & ~kPinVerified))
+                break;
+            auto hdr = static_cast<const DbPageHeader *>(m_vdata.rptr(pgno));
+            if (hdr->lsn >= m_checkpointLsn)
+                break;
+            num -= 1;
+        }
+    }
+    if (num < m_pages.size()) {
+        if (auto count = m_vdata.truncate((pgno_t) num); count < num) {
+            for (size_t i = count; i < m_pages.size(); ++i)
+                pinState(pgno_t(i)).store(0);
+            m_pages.resize(count);
+        }
+    }
+
+    // Free pages at the end of the work file.
+    if (auto i = m_freeWorkPages.find(unsigned(m_workPages - 1))) {
+        auto wpno = (pgno_t) *i.firstContiguous();
+        if (auto count = m_vwork.truncate(wpno); count < m_workPages) {
+            auto num = (unsigned) (m_workPages - count);
+            m_freeWorkPages.erase((unsigned) count, num);
+            m_workPages = count;
+            s_perfPages -= num;
+            s_perfFreePages -= num;
+        }
     }
+    return (pgno_t) m_pages.size();
+}
+
+//===========================================================================
+// Extends page tracking, including pin states, to cover count pages.
+void DbPage::resizePages_LK(size_t count) {
+    m_pages.resize(count);
+    while (m_pinStates.size() * kPinChunkSize < count) {
+        // Reserved at open for all possible pages, so never reallocated and
+        // safe for use by concurrent lock free pinners.
+        assert(m_pinStates.size() < m_pinStates.capacity());
+        auto & chunk = m_pinStates.emplace_back(
+            new atomic<uint32_t>[kPinChunkSize]
+        );
+        for (size_t i = 0; i < kPinChunkSize; ++i)
+            chunk[i].store(0, memory_order_relaxed);
+    }
+}
+
+//===========================================================================
+atomic<uint32_t> & DbPage::pinState(pgno_t pgno) {
+    assert(pgno >> kPinChunkBits < m_pinStates.size());
+    return m_pinStates[pgno >> kPinChunkBits][pgno & (kPinChunkSize - 1)];
+}
+
+//===========================================================================
+// Untracked pages, the vast majority, are pinned and read directly from the
+// data file view without taking the work mutex. Only pages that have a work
+// copy (or are waiting on a writer) need it.
+const void * DbPage::rptr(Lsn lsn, pgno_t pgno, bool withPin) {
+    auto & state = pinState(pgno);
+    auto cur = state.load();
     if (withPin) {
-        while (pi->writePin)
-            m_workCv.wait(lk);
-        if (++pi->readPins == 1)
+        for (;;) {
+            if (cur & kPinWrite) {
+                // Wait for the pending writer to finish.
+                unique_lock lk{m_workMut};
+                while ((cur = state.load()) & kPinWrite)
+                    m_workCv.wait(lk);
+                continue;
+            }
+            if (state.compare_exchange_weak(cur, cur + 1))
+                break;
+        }
+        if ((cur & kPinReadMask) == 0)
             s_perfPinnedPages += 1;
+        cur += 1;
     } else {
         // To be safely accessed a page must be pinned, otherwise the work
         // saver may choose to discard the page at a very inconvenient time.
-        assert(pi->readPins);
+        assert(cur & kPinReadMask);
+    }
+    if (~cur & kPinTracked) {
+        auto ptr = dataPage(pgno);
+        if (m_flags.any(fDbOpenVerifyPages) && ~cur & kPinVerified) {
+            if (!verifyPage(static_cast<const DbPageHeader *>(ptr))) {
+                logMsgError() << "Bad checksum on data page #" << pgno;
+                s_perfBadPages += 1;
+            }
+            state.fetch_or(kPinVerified);
+        }
+        return ptr;
     }
-    return pi->hdr
-        ? pi->hdr
-        : m_vdata.rptr(pgno);
+
+    scoped_lock lk{m_workMut};
+    auto pi = m_pages[pgno];
+    assert(pi && pi->hdr);
+    return pi->hdr;
+}
+
+//===========================================================================
+bool DbPage::scrub(IDbProgressNotify * notify, size_t maxBytesPerSec) {
+    ScrubTask * task = nullptr;
+    {
+        scoped_lock lk{m_workMut};
+        if (m_scrub)
+            return false;
+        if (!maxBytesPerSec)
+            maxBytesPerSec = kDefaultScrubBytesPerSec;
+        task = m_scrub = new ScrubTask(this, notify, maxBytesPerSec);
+    }
+    taskPush(pageScrubQueue(), task);
+    return true;
+}
+
+//===========================================================================
+// Version of the page in the data file.
+const DbPageHeader * DbPage::dataPage(pgno_t pgno) const {
+    if (m_zeroPage && pgno >= m_dataPages)
+        return reinterpret_cast<const DbPageHeader *>(m_zeroPage.get());
+    return static_cast<const DbPageHeader *>(m_vdata.rptr(pgno));
+}
+
+//===========================================================================
+// Blank pages, that have never been written, are also considered valid.
+bool DbPage::verifyPage(const DbPageHeader * hdr) const {
+    if (hdr->type == DbPageType::kInvalid && !hdr->checksum)
+        return true;
+    thread_local string buf;
+    buf.assign((const char *) hdr, m_pageSize);
+    auto tmp = reinterpret_cast<DbPageHeader *>(buf.data());
+    tmp->checksum = 0;
+    return hash_crc32c(tmp, m_pageSize) == hdr->checksum;
+}
+
+//===========================================================================
+// Returns true if a page read from the data file that failed verification
+// was only torn by a concurrent write, or is now tracked and can't be judged
+// by its copy in the data file.
+bool DbPage::recheckPage(pgno_t pgno, void * buf) {
+    if (pinState(pgno) & kPinTracked)
+        return true;
+    fileReadWait(nullptr, buf, m_pageSize, m_fdata, pgno * m_pageSize);
+    return verifyPage(static_cast<const DbPageHeader *>(buf));
+}
+
+//===========================================================================
+void DbPage::prefetch(const UnsignedSet & pages) {
+    auto maxPages = max<size_t>(kMaxPrefetchBytes / m_pageSize, 1);
+    vector<PrefetchTask *> tasks;
+    auto addTask = [&](size_t first, size_t count) {
+        if (m_prefetches == kMaxPrefetches) {
+            s_perfPrefetchSkipped += 1;
+            return;
+        }
+        m_prefetches += 1;
+        tasks.push_back(new PrefetchTask(
+            this,
+            first * m_pageSize,
+            count * m_pageSize
+        ));
+    };
+
+    {
+        scoped_lock lk{m_workMut};
+        for (auto && [low, high] : pages.ranges()) {
+            // Pages with work copies are skipped, they're already in memory.
+            auto last = min<size_t>(high + 1, m_pages.size());
+            size_t first = 0;
+            size_t count = 0;
+            for (size_t pgno = low; pgno < last; ++pgno) {
+                if (m_pages[pgno]) {
+                    if (count)
+                        addTask(first, count);
+                    count = 0;
+                } else if (!count++) {
+                    first = pgno;
+                } else if (count == maxPages) {
+                    addTask(first, count);
+                    count = 0;
+                }
+            }
+            if (count)
+                addTask(first, count);
+        }
+    }
+    for (auto && task : tasks)
+        taskPush(pagePrefetchQueue(), task);
 }
 
 //===========================================================================
 void DbPage::unpin(const UnsignedSet & pages) {
-    unique_lock lk{m_workMut};
     bool notify = false;
     for (auto&& pgno : pages) {
-        auto pi = m_pages[pgno];
-        assert(pi);
-        assert(pi->readPins && (pi->readPins > 1 || !pi->writePin));
-        if (!--pi->readPins)
-            s_perfPinnedPages -= 1;
-        if (!pi->readPins && !pi->hdr) {
-            // Don't keep reference only page info that is no longer pinned.
-            freeWorkInfo_LK(pi);
-            m_pages[pgno] = nullptr;
-        }
-        notify = true;
-    }
-    lk.unlock();
-    if (notify) {
-        // Pins were released, announce it in case the work saver was waiting.
-        m_workCv.notify_all();
+        if (unpin((pgno_t) pgno))
+            notify = true;
     }
+    if (notify)
+        notifyUnpinned();
+}
+
+//===========================================================================
+// Returns true if a writer is waiting for the pin to be released.
+bool DbPage::unpin(pgno_t pgno) {
+    auto prev = pinState(pgno).fetch_sub(1);
+    assert(prev & kPinReadMask);
+    assert((prev & kPinReadMask) > 1 || ~prev & kPinWrite);
+    if ((prev & kPinReadMask) == 1)
+        s_perfPinnedPages -= 1;
+    return prev & kPinWrite;
+}
+
+//===========================================================================
+void DbPage::notifyUnpinned() {
+    // Pins were released while a writer was waiting for them. Cycle the mutex
+    // so the waiter is either already waiting or will see the new pin count
+    // before it does.
+    { scoped_lock lk{m_workMut}; }
+    m_workCv.notify_all();
 }
 
 //===========================================================================
@@ -824,12 +1364,14 @@ void * DbPage::onWalGetPtrForRedo(
     Lsn lsn,
     LocalTxn localTxn
 ) {
-    // Only used during recovery, which is inherently single threaded, so no
-    // locking/pinning needed.
+    // Only used during recovery, so there are no readers and no pinning is
+    // needed. But with parallel redo, other pages are being redone by other
+    // threads, so the page tracking must still be locked.
+    scoped_lock lk{m_workMut};
 
     if (pgno >= m_pages.size()) {
         m_vdata.growToFit(pgno);
-        m_pages.resize(pgno + 1);
+        resizePages_LK(pgno + 1);
     }
     auto pi = m_pages[pgno];
     if (!pi || !pi->hdr) {
@@ -847,6 +1389,21 @@ void * DbPage::onWalGetPtrForRedo(
     return pi->hdr;
 }
 
+//===========================================================================
+// Pages redone in parallel may have become dirty out of LSN order, restore
+// the order that the saving of dirty pages relies on.
+void DbPage::onWalRedoComplete() {
+    scoped_lock lk{m_workMut};
+    vector<WorkPageInfo *> pages;
+    for (auto && pi : m_dirtyPages)
+        pages.push_back(&pi);
+    stable_sort(pages.begin(), pages.end(), [](auto & a, auto & b) {
+        return a->firstLsn < b->firstLsn;
+    });
+    for (auto && pi : pages)
+        m_dirtyPages.link(pi);
+}
+
 //===========================================================================
 void * DbPage::onWalGetPtrForUpdate(
     pgno_t pgno,
@@ -856,17 +1413,23 @@ void * DbPage::onWalGetPtrForUpdate(
     assert(lsn);
     unique_lock lk{m_workMut};
     assert(pgno < m_pages.size());
-    auto pi = m_pages[pgno];
-    assert(pi->readPins);
-    while (pi->writePin) {
-        assert(pi->readPins > 1);
-        m_workCv.wait(lk);
+    auto & state = pinState(pgno);
+    assert(state & kPinReadMask);
+    for (;;) {
+        auto prev = state.fetch_or(kPinWrite);
+        if (~prev & kPinWrite)
+            break;
+        assert((prev & kPinReadMask) > 1);
+        while (state & kPinWrite)
+            m_workCv.wait(lk);
     }
-    pi->writePin = true;
-    while (pi->readPins > 1) {
+    while ((state & kPinReadMask) > 1)
         m_workCv.wait(lk);
-    }
-    pi = dirtyPage_LK(pgno, lsn);
+    if (!m_snapshots.empty())
+        keepOldPage_LK(pgno, lsn);
+    if (lsn > m_updateLsn)
+        m_updateLsn = lsn;
+    auto pi = dirtyPage_LK(pgno, lsn);
     return pi->hdr;
 }
 
@@ -874,9 +1437,8 @@ void * DbPage::onWalGetPtrForUpdate(
 void DbPage::onWalUnlockPtr(pgno_t pgno) {
     unique_lock lk{m_workMut};
     assert(pgno < m_pages.size());
-    auto pi = m_pages[pgno];
-    assert(pi->readPins == 1 && pi->writePin);
-    pi->writePin = false;
+    [[maybe_unused]] auto prev = pinState(pgno).fetch_and(~kPinWrite);
+    assert((prev & kPinReadMask) == 1 && (prev & kPinWrite));
     lk.unlock();
 
     // Pins were released, announce it in case the work saver was waiting.
@@ -910,10 +1472,11 @@ DbPage::WorkPageInfo * DbPage::dirtyPage_LK(pgno_t pgno, Lsn lsn) {
         m_pages[pgno] = pi;
     }
     if (!pi->hdr) {
-        // Create new dirty page from free or reference page.
-        auto src = reinterpret_cast<const DbPageHeader *>(m_vdata.rptr(pgno));
-        pi->hdr = dupPage_LK(src);
+        // Create new dirty page from free or untracked page. New pins will now
+        // be directed to the work copy.
+        pi->hdr = dupPage_LK(dataPage(pgno));
         pi->pgno = {};
+        pinState(pgno).fetch_or(kPinTracked);
         if (!pi->firstLsn) {
             // If dirtying reference or untracked page, add page bond.
             m_pageBonds += 1;
@@ -944,3 +1507,477 @@ DbPage::WorkPageInfo * DbPage::dirtyPage_LK(pgno_t pgno, Lsn lsn) {
     }
     return pi;
 }
+
+
+/****************************************************************************
+*
+*   DbPage - snapshots
+*
+*   Snapshot readers never pin pages for longer than it takes to copy them,
+*   so they don't hold up updates. For consistency across pages, updates
+*   made after a snapshot begins leave behind a copy of the version of the
+*   page that the snapshot sees.
+*
+***/
+
+//===========================================================================
+Lsn DbPage::beginSnapshot() {
+    // The LSN is taken and the snapshot opened under the same lock that
+    // updates hold when deciding whether to keep the version they replace.
+    // So every update after the LSN sees the snapshot, and keeps the version
+    // it needs.
+    scoped_lock lk{m_workMut};
+    auto lsn = m_updateLsn;
+    m_snapshots.insert(lsn);
+    s_perfSnapshots += 1;
+    return lsn;
+}
+
+//===========================================================================
+void DbPage::endSnapshot(Lsn lsn) {
+    scoped_lock lk{m_workMut};
+    auto i = m_snapshots.find(lsn);
+    assert(i != m_snapshots.end());
+    m_snapshots.erase(i);
+    s_perfSnapshots -= 1;
+    removeOldPages_LK();
+}
+
+//===========================================================================
+bool DbPage::readSnapshot(void * out, Lsn lsn, pgno_t pgno) {
+    auto hdr = static_cast<const DbPageHeader *>(out);
+    for (unsigned rereads = 0;; ++rereads) {
+        // Pinned only long enough to make the copy.
+        auto src = rptr(lsn, pgno, true);
+        memcpy(out, src, m_pageSize);
+        auto untracked = m_flags.any(fDbOpenFollow) && src == dataPage(pgno);
+        if (unpin(pgno))
+            notifyUnpinned();
+        if (!untracked)
+            break;
+
+        // Read from the data file while the writer may be saving it, and
+        // possibly with updates saved before they could be followed.
+        if (!verifyPage(hdr)) {
+            if (rereads < kMaxFollowRereads) {
+                s_perfFollowRereads += 1;
+                continue;
+            }
+            s_perfBadPages += 1;
+            logMsgError() << "Bad checksum on followed data page #" << pgno;
+            return false;
+        }
+        if (hdr->lsn <= lsn)
+            return true;
+
+        // The writer has saved a newer version over the one the snapshot
+        // sees.
+        s_perfSnapshotMisses += 1;
+        logMsgError() << "Followed data page #" << pgno
+            << " saved ahead of snapshot, LSN " << hdr->lsn << ", snapshot "
+            << lsn;
+        return false;
+    }
+    if (hdr->lsn <= lsn)
+        return true;
+
+    // Page has been updated since the snapshot began, use the old version
+    // that was kept for it.
+    scoped_lock lk{m_workMut};
+    auto [first, last] = m_oldPages.equal_range(pgno);
+    for (auto i = first; i != last; ++i) {
+        auto & op = i->second;
+        if (op.hdr->lsn <= lsn && lsn < op.nextLsn) {
+            memcpy(out, op.hdr, m_pageSize);
+            return true;
+        }
+    }
+
+    // When following, the version replaced may have been from the data file,
+    // where the writer had already replaced the one the snapshot sees.
+    // Otherwise it shouldn't happen.
+    s_perfSnapshotMisses += 1;
+    logMsgError() << "Snapshot version of page not found, #" << pgno
+        << ", LSN " << lsn;
+    return false;
+}
+
+//===========================================================================
+// Called before the page is updated by the LSN. Keeps a copy of the current
+// version if there are open snapshots that see it.
+void DbPage::keepOldPage_LK(pgno_t pgno, Lsn lsn) {
+    auto pi = m_pages[pgno];
+    auto hdr = pi && pi->hdr ? pi->hdr : dataPage(pgno);
+    if (hdr->type == DbPageType::kInvalid || hdr->type == DbPageType::kFree) {
+        // Free pages aren't reachable by any snapshot.
+        return;
+    }
+    if (*m_snapshots.rbegin() < hdr->lsn) {
+        // No snapshot is old enough to see this version.
+        return;
+    }
+    m_oldPages.insert({pgno, {dupPage_LK(hdr), lsn}});
+    s_perfOldPages += 1;
+}
+
+//===========================================================================
+// Free old page versions that no longer fall within an open snapshot.
+void DbPage::removeOldPages_LK() {
+    for (auto i = m_oldPages.begin(); i != m_oldPages.end();) {
+        auto & op = i->second;
+        auto snap = m_snapshots.lower_bound(op.hdr->lsn);
+        if (snap != m_snapshots.end() && *snap < op.nextLsn) {
+            ++i;
+            continue;
+        }
+        freePage_LK(op.hdr);
+        i = m_oldPages.erase(i);
+        s_perfOldPages -= 1;
+    }
+}
+
+
+/****************************************************************************
+*
+*   DbPage - follow
+*
+*   Followers never save pages. Instead, work copies are released once the
+*   writer has saved a version of the page to the data file that is at least
+*   as new. Pages are only checked after they've been dirty for as long as the
+*   writer would leave them unsaved.
+*
+***/
+
+//===========================================================================
+void DbPage::followDataFile() {
+    assert(m_flags.any(fDbOpenFollow));
+    uint64_t len = 0;
+    if (fileSize(&len, m_fdata))
+        return;
+    unique_lock lk{m_workMut};
+    auto count = len / m_pageSize;
+    if (count > m_dataPages) {
+        // Map the pages added by the writer, one view at a time.
+        auto step = m_vdata.viewSize() / m_pageSize;
+        for (auto pgno = m_dataPages.load(); pgno < count; pgno += step)
+            m_vdata.growToFit((pgno_t) pgno);
+        m_vdata.growToFit(pgno_t(count - 1));
+        m_dataPages = count;
+    }
+
+    auto now = timeNow();
+    auto minTime = now - m_maxWalAge;
+    size_t freed = 0;
+    auto next = m_dirtyPages.front();
+    while (next && next->firstTime < minTime) {
+        auto pi = next;
+        next = m_dirtyPages.next(pi);
+        auto pgno = pi->hdr->pgno;
+        auto & ps = pinState(pgno);
+        auto state = (ps.load() & kPinVerified) | kPinTracked;
+        if (pgno >= count
+            || dataPage(pgno)->lsn < pi->hdr->lsn
+            || !ps.compare_exchange_strong(state, state & kPinVerified)
+        ) {
+            // Not yet saved by the writer, or pinned, check it again later.
+            pi->firstTime = now;
+            m_dirtyPages.link(pi);
+            continue;
+        }
+
+        // New pins will go directly to the data file.
+        freed += 1;
+        m_pages[pgno] = nullptr;
+        freePage_LK(pi->hdr);
+        freeWorkInfo_LK(pi);
+    }
+
+    s_perfDirtyPages -= (unsigned) freed;
+    m_pageBonds -= freed;
+    s_perfBonds -= (unsigned) freed;
+}
+
+//===========================================================================
+bool DbPage::followPage(pgno_t pgno) {
+    assert(m_flags.any(fDbOpenFollow));
+    if (pinState(pgno) & kPinTracked)
+        return true;
+    auto buf = make_unique<char[]>(m_pageSize);
+    auto hdr = reinterpret_cast<const DbPageHeader *>(buf.get());
+    memcpy(buf.get(), dataPage(pgno), m_pageSize);
+    for (unsigned rereads = 0; !verifyPage(hdr); ++rereads) {
+        if (rereads == kMaxFollowRereads) {
+            s_perfBadPages += 1;
+            logMsgError() << "Bad checksum on followed data page #" << pgno;
+            return false;
+        }
+        s_perfFollowRereads += 1;
+        fileReadWait(
+            nullptr,
+            buf.get(),
+            m_pageSize,
+            m_fdata,
+            (uint64_t) pgno * m_pageSize
+        );
+    }
+
+    scoped_lock lk{m_workMut};
+    if (pinState(pgno) & kPinTracked)
+        return true;
+    // Becomes a work page with the data file version, then replaced with the
+    // verified copy of it.
+    auto pi = dirtyPage_LK(pgno, hdr->lsn);
+    memcpy(pi->hdr, buf.get(), m_pageSize);
+    return true;
+}
+
+
+/****************************************************************************
+*
+*   DbPage - backup
+*
+*   Backups read the data file in order. Before pages it has yet to read are
+*   overwritten their original contents are copied to a temp file, and read
+*   from there instead. File reads and writes are made without holding the
+*   backup mutex, so checkpoints only wait for the pages they keep.
+*
+***/
+
+//===========================================================================
+size_t DbPage::backupBegin() {
+    using enum File::OpenMode;
+    auto path = (Path) filePath(m_fdata);
+    path.setExt("tsk");
+    auto oflags = fTemp | fReadWrite | fDenyWrite | fBlocking | fRandom
+        | fCreat | fTrunc;
+    FileHandle f;
+    if (fileOpen(&f, path, oflags); !f) {
+        logMsgError() << "Open failed, " << path;
+        return 0;
+    }
+    uint64_t len = 0;
+    fileSize(&len, m_fdata);
+
+    scoped_lock lk{m_backupMut};
+    assert(!m_backupActive);
+    m_backupActive = true;
+    m_fbackup = f;
+    m_backupFileEnd = 0;
+    m_backupPos = {};
+    m_backupKeepFrom = {};
+    m_backupEnd = pgno_t(len / m_pageSize);
+    return m_backupEnd;
+}
+
+//===========================================================================
+size_t DbPage::backupRead(char * buf, size_t bytes) {
+    unique_lock lk{m_backupMut};
+    assert(m_backupActive);
+    auto first = m_backupPos;
+    auto count = min<size_t>(bytes / m_pageSize, m_backupEnd - first);
+    if (!count)
+        return 0;
+    // Claim the pages, pages written from here on are kept until they've
+    // been read.
+    m_backupPos = pgno_t(first + count);
+    lk.unlock();
+
+    uint64_t len = 0;
+    fileReadWait(
+        &len,
+        buf,
+        count * m_pageSize,
+        m_fdata,
+        (uint64_t) first * m_pageSize
+    );
+    count = len / m_pageSize;
+
+    // Take the pages that were kept, waiting for any whose originals are
+    // still being copied.
+    vector<pair<size_t, uint64_t>> kept;
+    lk.lock();
+    for (size_t i = 0; i < count; ++i) {
+        auto pgno = pgno_t(first + i);
+        if (!m_backupPages.contains(pgno))
+            continue;
+        // Waiting lets other pages be added, which may rehash the map, so
+        // it's searched again afterwards.
+        m_backupCv.wait(lk, [&]() { return m_backupPages[pgno].ready; });
+        auto it = m_backupPages.find(pgno);
+        kept.emplace_back(i, it->second.offset);
+        m_backupPages.erase(it);
+    }
+    m_backupKeepFrom = pgno_t(first + count);
+    lk.unlock();
+
+    for (auto && [i, offset] : kept) {
+        fileReadWait(
+            nullptr,
+            buf + i * m_pageSize,
+            m_pageSize,
+            m_fbackup,
+            offset
+        );
+    }
+    if (!kept.empty()) {
+        s_perfBackupPages -= (unsigned) kept.size();
+        lk.lock();
+        for (auto && [i, offset] : kept)
+            m_backupFree.push_back(offset);
+    }
+    return count * m_pageSize;
+}
+
+//===========================================================================
+void DbPage::backupEnd() {
+    FileHandle f;
+    {
+        unique_lock lk{m_backupMut};
+        m_backupActive = false;
+        // Wait for copies still being made by checkpoints.
+        m_backupCv.wait(lk, [&]() {
+            return ranges::all_of(
+                m_backupPages,
+                [](auto & kv) { return kv.second.ready; }
+            );
+        });
+        s_perfBackupPages -= (unsigned) m_backupPages.size();
+        m_backupPages.clear();
+        m_backupFree.clear();
+        m_backupFileEnd = 0;
+        f = exchange(m_fbackup, {});
+    }
+    // Opened with fTemp, so it's also removed.
+    if (f)
+        fileClose(f);
+}
+
+//===========================================================================
+// Called before the pages, which must be sorted by page number, are written
+// to the data file.
+void DbPage::backupKeepPages(const vector<DbPageHeader *> & pages) {
+    // Reserve places for the originals of pages not yet read by the backup.
+    vector<pair<pgno_t, uint64_t>> keep;
+    {
+        unique_lock lk{m_backupMut};
+        if (!m_backupActive)
+            return;
+        for (auto && hdr : pages) {
+            auto pgno = hdr->pgno;
+            if (pgno < m_backupKeepFrom || pgno >= m_backupEnd)
+                continue;
+            if (m_backupPages.contains(pgno)) {
+                // Already kept, but make sure the copy is finished before
+                // the page gets overwritten.
+                m_backupCv.wait(lk, [&]() {
+                    return m_backupPages[pgno].ready;
+                });
+                continue;
+            }
+            uint64_t offset;
+            if (m_backupFree.empty()) {
+                offset = m_backupFileEnd;
+                m_backupFileEnd += m_pageSize;
+            } else {
+                offset = m_backupFree.back();
+                m_backupFree.pop_back();
+            }
+            m_backupPages[pgno] = { .offset = offset, .ready = false };
+            keep.emplace_back(pgno, offset);
+        }
+    }
+    if (keep.empty())
+        return;
+    s_perfBackupPages += (unsigned) keep.size();
+
+    // Copy the originals, reading runs of adjacent pages together.
+    auto maxPages = max(kMaxPageWriteBytes / m_pageSize, (size_t) 1);
+    auto buf = make_unique<char[]>(min(keep.size(), maxPages) * m_pageSize);
+    for (size_t i = 0; i < keep.size();) {
+        auto pgno = keep[i].first;
+        size_t count = 1;
+        while (i + count < keep.size()
+            && count < maxPages
+            && keep[i + count].first == pgno + count
+        ) {
+            count += 1;
+        }
+        fileReadWait(
+            nullptr,
+            buf.get(),
+            count * m_pageSize,
+            m_fdata,
+            (uint64_t) pgno * m_pageSize
+        );
+        for (size_t j = 0; j < count; ++j) {
+            auto ptr = buf.get() + j * m_pageSize;
+            if (fileWriteWait(
+                nullptr,
+                m_fbackup,
+                keep[i + j].second,
+                ptr,
+                m_pageSize
+            )) {
+                logMsgError() << "Write failed, " << filePath(m_fbackup);
+            }
+        }
+        i += count;
+    }
+
+    {
+        scoped_lock lk{m_backupMut};
+        for (auto && [pgno, offset] : keep)
+            m_backupPages[pgno].ready = true;
+    }
+    m_backupCv.notify_all();
+}
+
+
+/****************************************************************************
+*
+*   PageWriter
+*
+***/
+
+//===========================================================================
+static TaskQueueHandle pageWriteQueue() {
+    static TaskQueueHandle s_hq = taskCreateQueue("Page IO", 2);
+    return s_hq;
+}
+
+//===========================================================================
+PageWriter::~PageWriter() {
+    wait();
+}
+
+//===========================================================================
+void PageWriter::write(int64_t offset, const void * buf, size_t bytes) {
+    {
+        unique_lock lk{m_mut};
+        while (m_pending >= kMaxPageWrites)
+            m_cv.wait(lk);
+        m_pending += 1;
+    }
+    s_perfWriteOps += 1;
+    fileWrite(this, m_file, offset, buf, bytes, pageWriteQueue());
+}
+
+//===========================================================================
+void PageWriter::wait() {
+    unique_lock lk{m_mut};
+    while (m_pending)
+        m_cv.wait(lk);
+}
+
+//===========================================================================
+void PageWriter::onFileWrite(const FileWriteData & data) {
+    if (data.written != data.data.size()) {
+        logMsgFatal() << "Write to " << filePath(m_file) << " failed, "
+            << errno;
+    }
+    {
+        scoped_lock lk{m_mut};
+        m_pending -= 1;
+    }
+    m_cv.notify_all();
+}
@@ -191,7 +191,7 @@ void DbTxn::walFullPageInit(
     pgno_t pgno,
     DbPageType type,
     uint32_t id,
-    std::span<uint8_t> data
+    std::span<const uint8_t> data
 ) {
     auto extra = data.size();
     auto offset = offsetof(FullPageInitRec, data);
@@ -158,6 +158,10 @@ void DbData::radixInsert(
     auto hdr = txn.pin<DbPageHeader>(root);
     auto rd = radixData(hdr, m_pageSize);
     auto id = hdr->id;
+    // Radix pages of metrics are kept with the metric's other pages.
+    auto alloc = [&, metric = hdr->type == DbPageType::kMetric]() {
+        return metric ? allocMetricPgno(txn, id) : allocPgno(txn);
+    };
 
     int digits[10];
     size_t count = radixPageEntries(
@@ -169,7 +173,7 @@ void DbData::radixInsert(
     );
     count -= 1;
     while (rd->height < count) {
-        auto pgno = allocPgno(txn);
+        auto pgno = alloc();
         txn.walRadixInit(
             pgno,
             id,
@@ -187,7 +191,7 @@ void DbData::radixInsert(
         int pos = (height > count) ? 0 : *d;
         auto pgno = rd->pages[pos];
         if (!pgno) {
-            pgno = allocPgno(txn);
+            pgno = alloc();
             txn.walRadixInit(
                 pgno,
                 id,
@@ -9,6 +9,50 @@ using namespace std;
 using namespace Dim;
 
 
+/****************************************************************************
+*
+*   Helpers
+*
+***/
+
+//===========================================================================
+// Reads a byte from each memory page, so they're faulted in before they're
+// needed.
+static void populate(const char * ptr, size_t len) {
+    auto step = envMemoryConfig().pageSize;
+    unsigned char sum = 0;
+    for (size_t i = 0; i < len; i += step)
+        sum += ((const volatile char *) ptr)[i];
+    (void) sum;
+}
+
+//===========================================================================
+static void adviseHugePages(
+    [[maybe_unused]] const char * ptr,
+    [[maybe_unused]] size_t len
+) {
+#ifdef MADV_HUGEPAGE
+    // Only honored for file mappings by some file systems (e.g. tmpfs), it
+    // isn't an error for it to be ignored.
+    madvise((void *) ptr, len, MADV_HUGEPAGE);
+#endif
+}
+
+//===========================================================================
+static void adviseAccess(
+    [[maybe_unused]] const char * ptr,
+    [[maybe_unused]] size_t len,
+    [[maybe_unused]] DbMapAccess access
+) {
+#ifdef POSIX_MADV_NORMAL
+    auto advice = access == kMapAccessRandom ? POSIX_MADV_RANDOM
+        : access == kMapAccessSequential ? POSIX_MADV_SEQUENTIAL
+        : POSIX_MADV_NORMAL;
+    posix_madvise((void *) ptr, len, advice);
+#endif
+}
+
+
 /****************************************************************************
 *
 *   DbFileView
@@ -26,7 +70,8 @@ template<bool Writable>
 bool DbFileView<Writable>::open(
     FileHandle file,
     size_t viewSize,
-    size_t pageSize
+    size_t pageSize,
+    const DbMapOptions & opts
 ) {
     assert(!m_file && "file view already open");
     assert(pageSize);
@@ -36,6 +81,7 @@ bool DbFileView<Writable>::open(
 
     m_viewSize = viewSize;
     m_pageSize = pageSize;
+    m_hugePages = opts.hugePages;
 
     // First view is the size of the entire file rounded up to segment size, and
     // always at least two segments.
@@ -58,6 +104,9 @@ bool DbFileView<Writable>::open(
         logMsgError() << "Open view failed, " << filePath(file);
         return false;
     }
+    adviseView(m_view, m_firstViewSize);
+    if (opts.populate)
+        populate(m_view, len);
 
     m_file = file;
     return true;
@@ -70,10 +119,14 @@ void DbFileView<Writable>::close() {
         fileCloseView(m_file, m_view);
         m_view = nullptr;
     }
-    for (auto && v : m_views) {
-        fileCloseView(m_file, v);
-    }
-    m_views.clear();
+    auto views = m_views.load();
+    for (size_t i = 0; i < m_numViews; ++i)
+        fileCloseView(m_file, views[i]);
+    m_views = nullptr;
+    m_numViews = 0;
+    m_maxViews = 0;
+    m_truncSize = 0;
+    m_viewTables.clear();
     m_file = {};
 }
 
@@ -81,6 +134,15 @@ void DbFileView<Writable>::close() {
 template<bool Writable>
 void DbFileView<Writable>::growToFit(pgno_t pgno) {
     auto pos = pgno * m_pageSize;
+    if (m_truncSize && pos + m_pageSize > m_truncSize) {
+        // The file was truncated, regrow it until it again reaches the end of
+        // the views.
+        auto len = pos + m_pageSize;
+        if (fileResize(m_file, len))
+            logMsgFatal() << "Extend file failed on " << filePath(m_file);
+        auto mapped = m_firstViewSize + m_numViews * m_viewSize;
+        m_truncSize = len < mapped ? len : 0;
+    }
     if (pos < m_firstViewSize) {
         if (pos < minFirstSize()) {
             if (fileExtendView(m_file, m_view, pos + m_pageSize))
@@ -91,9 +153,10 @@ void DbFileView<Writable>::growToFit(pgno_t pgno) {
 
     auto viewPos = pos - m_firstViewSize;
     auto iview = viewPos / m_viewSize;
-    if (iview < m_views.size())
+    auto num = m_numViews.load();
+    if (iview < num)
         return;
-    assert(iview == m_views.size() && "non-contiguous grow request");
+    assert(iview == num && "non-contiguous grow request");
     Pointer view;
     if (fileOpenView(
         view,
@@ -105,7 +168,73 @@ void DbFileView<Writable>::growToFit(pgno_t pgno) {
     )) {
         logMsgFatal() << "Extend file failed on " << filePath(m_file);
     }
-    m_views.push_back(view);
+    adviseView(view, m_viewSize);
+
+    auto views = m_views.load();
+    if (num == m_maxViews) {
+        // Table is full, replace it with a larger copy.
+        m_maxViews = max<size_t>(2 * m_maxViews, 16);
+        auto & table = m_viewTables.emplace_back(new Pointer[m_maxViews]);
+        if (num)
+            memcpy(table.get(), views, num * sizeof *views);
+        views = table.get();
+    }
+    views[num] = view;
+
+    // Publish the table before the count, so anyone that sees the new count
+    // also sees a table with the new view.
+    m_views.store(views, memory_order_release);
+    m_numViews.store(num + 1, memory_order_release);
+}
+
+//===========================================================================
+template<bool Writable>
+pgno_t DbFileView<Writable>::truncate(pgno_t count) {
+    count = max(count, minPages());
+    if (count == pgno_t::npos)
+        return pgno_t::npos;
+    uint64_t len = count * m_pageSize;
+    uint64_t size = 0;
+    if (fileSize(&size, m_file) || len >= size || fileResize(m_file, len))
+        return pgno_t::npos;
+    m_truncSize = len;
+    return count;
+}
+
+//===========================================================================
+template<bool Writable>
+pgno_t DbFileView<Writable>::minPages() const {
+#ifdef _WIN32
+    // Files with mapped views can't be shrunk.
+    return pgno_t::npos;
+#else
+    // The start of the first view may be reserved without being committed,
+    // growing it is left to fileExtendView, so it's never shrunk.
+    return pgno_t(minFirstSize() / m_pageSize);
+#endif
+}
+
+//===========================================================================
+// Changes the access hint of all existing and future views.
+template<bool Writable>
+void DbFileView<Writable>::advise(DbMapAccess access) {
+    m_access = access;
+    if (!m_view)
+        return;
+    adviseAccess(m_view, m_firstViewSize, access);
+    auto num = m_numViews.load(memory_order_acquire);
+    auto views = m_views.load(memory_order_acquire);
+    for (size_t i = 0; i < num; ++i)
+        adviseAccess(views[i], m_viewSize, access);
+}
+
+//===========================================================================
+template<bool Writable>
+void DbFileView<Writable>::adviseView(Pointer view, size_t len) const {
+    if (m_hugePages)
+        adviseHugePages(view, len);
+    if (auto access = m_access.load())
+        adviseAccess(view, len, access);
 }
 
 //===========================================================================
@@ -130,8 +259,10 @@ auto DbFileView<Writable>::ptr(pgno_t pgno) const
         return m_view + pos;
     auto viewPos = pos - m_firstViewSize;
     auto iview = viewPos / m_viewSize;
-    if (iview < m_views.size())
-        return m_views[iview] + viewPos % m_viewSize;
+    if (iview < m_numViews.load(memory_order_acquire)) {
+        auto views = m_views.load(memory_order_acquire);
+        return views[iview] + viewPos % m_viewSize;
+    }
     return nullptr;
 }
 
@@ -142,7 +273,10 @@ pgno_t DbFileView<Writable>::pgno(const void * vptr) const {
     if (ptr >= m_view && ptr < m_view + m_firstViewSize)
         return pgno_t((ptr - m_view) / m_pageSize);
     auto num = m_firstViewSize / m_pageSize;
-    for (auto && v : m_views) {
+    auto numViews = m_numViews.load(memory_order_acquire);
+    auto views = m_views.load(memory_order_acquire);
+    for (size_t i = 0; i < numViews; ++i) {
+        auto v = views[i];
         if (ptr >= v && ptr < v + m_viewSize)
             return pgno_t(num + (ptr - v) / m_pageSize);
         num += m_viewSize / m_pageSize;
@@ -15,10 +15,34 @@ using namespace Dim;
 *
 ***/
 
-constexpr auto kDirtyWriteBufferTimeout = 500ms;
+// Default time allowed for WAL records to become durable.
+constexpr auto kDefaultWalFlushLatency = 500ms;
 
+// Initial number of WAL write buffers, more are added under load up to the
+// max.
 const unsigned kWalWriteBuffers = 10;
+const unsigned kMaxWalWriteBuffers = 100;
 static_assert(kWalWriteBuffers > 1);
+static_assert(kMaxWalWriteBuffers >= kWalWriteBuffers);
+
+// Parallel redo during recovery. Records are partitioned by page across the
+// threads and handed off in batches of up to the max bytes.
+const unsigned kMaxRedoThreads = 8;
+const size_t kRedoBatchBytes = 0x4'0000; // 256KiB
+const unsigned kMaxRedoBatches = 32; // max outstanding batches
+
+// Followers look for the next WAL page where the writer would have put it,
+// reading up to this many pages, before scanning the whole file. When it
+// isn't found, and nothing suggests it's anywhere else, the file is only
+// scanned after this many polls come up empty.
+const unsigned kMaxFollowProbes = 8;
+const unsigned kMaxFollowProbeFails = 10;
+
+// Updates not yet applied are counted by ranges of this many LSNs, in a ring
+// of this many ranges. Logging waits rather than get a whole ring ahead of
+// the oldest range that still has updates being applied.
+const unsigned kApplyRangeLsns = 256;
+const unsigned kApplyRanges = 64;
 
 
 /****************************************************************************
@@ -38,6 +62,10 @@ enum class DbWal::Buffer : int {
     kFullWriting,
 };
 
+// Added to the references of a buffer when it becomes full, whoever releases
+// the last of the other references starts its full page write.
+const unsigned kBufSealed = 0x8000'0000;
+
 enum class DbWal::Checkpoint : int {
     kStartRecovery,
     kComplete,
@@ -53,6 +81,46 @@ struct DbWal::AnalyzeData {
     Lsn checkpoint = {};
 
     UnsignedSet activeTxns;
+    ParallelRedo * redo = nullptr;
+};
+
+// Redoes updates on a set of threads, each of which owns the updates of the
+// pages in its partition.
+class DbWal::ParallelRedo {
+public:
+    explicit ParallelRedo(DbWal & wal);
+    ~ParallelRedo();
+
+    size_t threads() const { return m_batches.size(); }
+
+    void add(Lsn lsn, const Record & rec);
+    // Waits for all added updates to be redone.
+    void wait();
+
+private:
+    class Batch;
+    void push(size_t part);
+    void onBatchDone();
+
+    DbWal & m_wal;
+    vector<unique_ptr<Batch>> m_batches;
+    mutex m_mut;
+    condition_variable m_cv;
+    unsigned m_pending = 0;
+};
+
+class DbWal::ParallelRedo::Batch : public ITaskNotify {
+public:
+    explicit Batch(ParallelRedo & redo) : m_redo(redo) {}
+
+    // Each record is preceded by its LSN.
+    string m_recs;
+
+private:
+    // Inherited via ITaskNotify
+    void onTask() override;
+
+    ParallelRedo & m_redo;
 };
 
 namespace {
@@ -142,6 +210,9 @@ static auto & s_perfFreePages = uperf("db.wal pages (free)");
 static auto & s_perfWrites = uperf("db.wal writes (total)");
 static auto & s_perfReorderedWrites = uperf("db.wal writes (out of order)");
 static auto & s_perfPartialWrites = uperf("db.wal writes (partial)");
+static auto & s_perfBuffers = uperf("db.wal buffers");
+static auto & s_perfLateWrites = uperf("db.wal writes (late)");
+static auto & s_perfDurableLag = uperf("db.wal durable lag (total ms)");
 
 
 /****************************************************************************
@@ -252,6 +323,7 @@ static size_t walHdrLen(WalPageType type) {
 DbWal::DbWal(IApplyNotify * data, IPageNotify * page)
     : m_data(data)
     , m_page(page)
+    , m_applyCounts(make_unique<atomic<unsigned>[]>(kApplyRanges))
     , m_checkpointTimer([&](auto){ checkpoint(); return kTimerInfinite; })
     , m_checkpointPagesTask([&]{ checkpointPages(); })
     , m_checkpointDurableTask([&]{ checkpointDurable(); })
@@ -263,22 +335,44 @@ DbWal::~DbWal() {
     assert(m_checkpointBlockers.empty());
     if (m_fwal)
         fileClose(m_fwal);
-    if (m_buffers)
-        freeAligned(m_buffers);
-    if (m_partialBuffers)
-        freeAligned(m_partialBuffers);
+    for (auto&& buf : m_buffers)
+        freeAligned(buf);
+    for (auto&& buf : m_partialBuffers)
+        freeAligned(buf);
+    s_perfBuffers -= (unsigned) m_buffers.size();
 }
 
 //===========================================================================
 char * DbWal::bufPtr(size_t ibuf) {
     assert(ibuf < m_numBufs);
-    return m_buffers + ibuf * m_pageSize;
+    return m_buffers[ibuf];
 }
 
 //===========================================================================
 char * DbWal::partialPtr(size_t ibuf) {
     assert(ibuf < m_numBufs);
-    return m_partialBuffers + ibuf * m_pageSize;
+    return m_partialBuffers[ibuf];
+}
+
+//===========================================================================
+// Adds an empty buffer to the end of the ring.
+void DbWal::addBuffer_LK() {
+    auto buf = (char *) mallocAligned(m_pageSize, m_pageSize);
+    assert(buf);
+    memset(buf, 0, m_pageSize);
+    auto mp = (MinimumPage *) buf;
+    mp->type = WalPageType::kFree;
+    m_buffers.push_back(buf);
+    buf = (char *) mallocAligned(m_pageSize, m_pageSize);
+    assert(buf);
+    memset(buf, 0, m_pageSize);
+    m_partialBuffers.push_back(buf);
+    m_bufRefs.emplace_back(0);
+    m_bufStates.push_back(Buffer::kEmpty);
+    m_bufTimes.emplace_back();
+    m_numBufs += 1;
+    m_emptyBufs += 1;
+    s_perfBuffers += 1;
 }
 
 //===========================================================================
@@ -288,7 +382,8 @@ static FileHandle openWalFile(
     bool align
 ) {
     using enum File::OpenMode;
-    EnumFlags oflags = fDenyWrite;
+    // Followers must share the file with the process writing to it.
+    EnumFlags oflags = flags.any(fDbOpenFollow) ? fDenyNone : fDenyWrite;
     if (align)
         oflags |= fAligned;
     if (flags.any(fDbOpenReadOnly)) {
@@ -344,6 +439,10 @@ bool DbWal::open(
     if (fileSize(&len, m_fwal))
         return false;
     if (!len) {
+        if (flags.any(fDbOpenFollow)) {
+            logMsgError() << "Nothing to follow, " << fname;
+            return false;
+        }
         // Newly file (created or truncated).
         m_newFiles = true;
     }
@@ -392,29 +491,19 @@ bool DbWal::open(
     fin.release();
 
     // Allocate Aligned Buffers
-    m_numBufs = kWalWriteBuffers;
-    m_bufStates.resize(m_numBufs, Buffer::kEmpty);
-    m_emptyBufs = m_numBufs;
-    m_buffers = (char *) mallocAligned(m_pageSize, m_numBufs * m_pageSize);
-    assert(m_buffers);
-    memset(m_buffers, 0, m_numBufs * m_pageSize);
-    m_partialBuffers = (char *) mallocAligned(
-        m_pageSize,
-        m_numBufs * m_pageSize
-    );
-    assert(m_partialBuffers);
-    memset(m_partialBuffers, 0, m_numBufs * m_pageSize);
+    while (m_numBufs < kWalWriteBuffers)
+        addBuffer_LK();
     m_curBuf = 0;
-    for (unsigned i = 0; i < m_numBufs; ++i) {
-        auto mp = (MinimumPage *) bufPtr(i);
-        mp->type = WalPageType::kFree;
-    }
     // Set position within buffer to end of the buffer.
     m_bufPos = m_pageSize;
 
     m_phase = Checkpoint::kStartRecovery;
     m_maxCheckpointData = kDefaultMaxCheckpointData;
     m_maxCheckpointInterval = kDefaultMaxCheckpointInterval;
+    m_flushMode = kWalFlushFixedLatency;
+    m_flushLatency = kDefaultWalFlushLatency;
+    m_flushBytes = m_pageSize;
+    m_writeTime = {};
     m_checkpointBlockers.clear();
     m_lsnTasks = {};
 
@@ -448,6 +537,7 @@ bool DbWal::open(
     // skipping.
     m_localTxns.clear();
     m_lastLsn = {};
+    m_applyRange = 0;
     m_freePages.clear();
     m_pages.clear();
     m_durableLsn = {};
@@ -508,7 +598,8 @@ void DbWal::close() {
 }
 
 //===========================================================================
-// Set and return adjusted values for checkpoint max data and max interval.
+// Set and return adjusted values for checkpoint max data and max interval,
+// and for the WAL flush policy.
 DbConfig DbWal::configure(const DbConfig & conf) {
     auto maxData = conf.checkpointMaxData
         ? conf.checkpointMaxData
@@ -527,9 +618,22 @@ DbConfig DbWal::configure(const DbConfig & conf) {
     m_maxCheckpointInterval = maxInterval;
     timerUpdate(&m_checkpointTimer, maxInterval, true);
 
+    {
+        scoped_lock lk{m_bufMut};
+        if (conf.walFlush)
+            m_flushMode = conf.walFlush;
+        if (conf.walFlushLatency.count())
+            m_flushLatency = conf.walFlushLatency;
+        if (conf.walFlushBytes)
+            m_flushBytes = min(conf.walFlushBytes, m_pageSize);
+    }
+
     auto tmp = conf;
     tmp.checkpointMaxData = maxData;
     tmp.checkpointMaxInterval = maxInterval;
+    tmp.walFlush = m_flushMode;
+    tmp.walFlushLatency = m_flushLatency;
+    tmp.walFlushBytes = m_flushBytes;
     return tmp;
 }
 
@@ -597,8 +701,13 @@ bool DbWal::recover(EnumFlags<RecoverFlags> flags) {
     m_localTxns.clear();
     if (!loadPages(fwal))
         return false;
-    if (m_pages.empty())
+    if (m_pages.empty()) {
+        if (m_openFlags.any(fDbOpenFollow)) {
+            logMsgError() << "Nothing to follow, " << walfile;
+            return false;
+        }
         return true;
+    }
 
     // Go through WAL entries looking for last committed checkpoint and the set
     // of incomplete transactions that were still uncommitted when the after
@@ -617,6 +726,24 @@ bool DbWal::recover(EnumFlags<RecoverFlags> flags) {
         m_checkpointLsn = data.checkpoint;
     }
 
+    if (m_openFlags.any(fDbOpenFollow)) {
+        // Instead of being redone now, the WAL from the first page onward is
+        // read by follow(), which applies the updates from the checkpoint on.
+        // The last LSN then advances as they are applied. Nothing is ever
+        // saved, so DbPage is never told of durable LSNs.
+        m_follow = make_unique<FollowData>();
+        auto & fd = *m_follow;
+        for (auto && pi : m_pages)
+            fd.pages[pi.firstLsn] = pi.pgno;
+        fd.pageLsn = m_pages.front().firstLsn;
+        fd.lsn = fd.pageLsn;
+        fd.startLsn = m_checkpointLsn;
+        m_lastLsn = m_checkpointLsn - 1;
+        m_durableLsn = m_lastLsn;
+        m_applyRange = m_lastLsn.val / kApplyRangeLsns;
+        return true;
+    }
+
     if (flags.any(fRecoverIncompleteTxns)) {
         // Since processing incomplete transactions was requested, empty the
         // list that would be used to skip them.
@@ -650,10 +777,24 @@ bool DbWal::recover(EnumFlags<RecoverFlags> flags) {
     // Go through WAL entries starting with the last committed checkpoint and
     // redo all transactions that begin after the checkpoint and commit before
     // the end of the WAL.
-    if (m_openFlags.any(fDbOpenVerbose))
-        logMsgInfo() << "Recover database";
+    optional<ParallelRedo> redo;
+    if (flags.any(fRecoverParallel)) {
+        redo.emplace(*this);
+        data.redo = &*redo;
+    }
+    if (m_openFlags.any(fDbOpenVerbose)) {
+        if (redo) {
+            logMsgInfo() << "Recover database, " << redo->threads()
+                << " threads";
+        } else {
+            logMsgInfo() << "Recover database";
+        }
+    }
     data.analyze = false;
     applyAll(&data, fwal);
+    if (redo)
+        redo->wait();
+    m_page->onWalRedoComplete();
     if (!flags.any(fRecoverIncompleteTxns)) {
         assert(data.incompleteTxnLsns.empty());
         assert(!data.activeTxns);
@@ -662,6 +803,7 @@ bool DbWal::recover(EnumFlags<RecoverFlags> flags) {
     auto & back = m_pages.back();
     m_durableLsn = back.firstLsn + back.cleanRecs - 1;
     m_lastLsn = m_durableLsn;
+    m_applyRange = m_lastLsn.val / kApplyRangeLsns;
     m_page->onWalDurable(m_durableLsn, 0);
     return true;
 }
@@ -823,7 +965,7 @@ void DbWal::applyAll(AnalyzeData * data, FileHandle fwal) {
     // Initialize WAL write buffers with the contents of the last buffer (if
     // partial) found during analyze.
     if (data->analyze && walPos < m_pageSize) {
-        memcpy(m_buffers, curBuf, walPos);
+        memcpy(bufPtr(m_curBuf), curBuf, walPos);
         m_bufPos = walPos;
         m_bufStates[m_curBuf] = Buffer::kPartialClean;
         m_emptyBufs -= 1;
@@ -1002,12 +1144,461 @@ void DbWal::applyUpdate(
         return;
     }
 
+    if (data->redo) {
+        data->redo->add(lsn, rec);
+    } else {
+        redoUpdate(lsn, rec);
+    }
+}
+
+//===========================================================================
+void DbWal::redoUpdate(Lsn lsn, const Record & rec) {
     auto pgno = getPgno(rec);
-    if (auto ptr = m_page->onWalGetPtrForRedo(pgno, lsn, localTxn))
+    if (auto ptr = m_page->onWalGetPtrForRedo(pgno, lsn, getLocalTxn(rec)))
         applyUpdate(ptr, lsn, rec);
 }
 
 
+/****************************************************************************
+*
+*   DbWal::ParallelRedo
+*
+***/
+
+//===========================================================================
+static TaskQueueHandle redoQueue(size_t part) {
+    // Each partition has its own single threaded queue, so its batches are
+    // redone one at a time and in order.
+    static vector<TaskQueueHandle> s_queues = [] {
+        vector<TaskQueueHandle> out;
+        for (auto i = 0u; i < kMaxRedoThreads; ++i)
+            out.push_back(taskCreateQueue("WAL redo", 1));
+        return out;
+    }();
+    return s_queues[part];
+}
+
+//===========================================================================
+DbWal::ParallelRedo::ParallelRedo(DbWal & wal)
+    : m_wal(wal)
+{
+    auto threads = clamp(thread::hardware_concurrency(), 1u, kMaxRedoThreads);
+    for (auto i = 0u; i < threads; ++i)
+        m_batches.push_back(make_unique<Batch>(*this));
+}
+
+//===========================================================================
+DbWal::ParallelRedo::~ParallelRedo() {
+    wait();
+}
+
+//===========================================================================
+void DbWal::ParallelRedo::add(Lsn lsn, const Record & rec) {
+    auto part = getPgno(rec) % m_batches.size();
+    auto & recs = m_batches[part]->m_recs;
+    recs.append((const char *) &lsn, sizeof lsn);
+    recs.append((const char *) &rec, getSize(rec));
+    if (recs.size() >= kRedoBatchBytes)
+        push(part);
+}
+
+//===========================================================================
+void DbWal::ParallelRedo::push(size_t part) {
+    {
+        unique_lock lk{m_mut};
+        while (m_pending >= kMaxRedoBatches)
+            m_cv.wait(lk);
+        m_pending += 1;
+    }
+    auto batch = m_batches[part].release();
+    m_batches[part] = make_unique<Batch>(*this);
+    taskPush(redoQueue(part), batch);
+}
+
+//===========================================================================
+void DbWal::ParallelRedo::wait() {
+    for (auto i = 0u; i < m_batches.size(); ++i) {
+        if (!m_batches[i]->m_recs.empty())
+            push(i);
+    }
+    unique_lock lk{m_mut};
+    while (m_pending)
+        m_cv.wait(lk);
+}
+
+//===========================================================================
+void DbWal::ParallelRedo::onBatchDone() {
+    scoped_lock lk{m_mut};
+    m_pending -= 1;
+    m_cv.notify_all();
+}
+
+//===========================================================================
+void DbWal::ParallelRedo::Batch::onTask() {
+    auto ptr = m_recs.data();
+    auto eptr = ptr + m_recs.size();
+    while (ptr < eptr) {
+        Lsn lsn;
+        memcpy(&lsn, ptr, sizeof lsn);
+        ptr += sizeof lsn;
+        auto & rec = *(const Record *) ptr;
+        m_redo.m_wal.redoUpdate(lsn, rec);
+        ptr += getSize(rec);
+    }
+    auto & redo = m_redo;
+    delete this;
+    redo.onBatchDone();
+}
+
+
+/****************************************************************************
+*
+*   DbWal - follow
+*
+*   Followers read the WAL of a database that another process has open for
+*   update. Each call to follow() reads forward from where the last left off,
+*   rereading the page being written until it fills. When the next page isn't
+*   where the last scan of the file found it, it's looked for where the writer
+*   would have put it: at the new end of the file, or in place of a page that
+*   was free or had only updates from before the last checkpoint. The file is
+*   only scanned again if that fails.
+*
+*   Updates are held until they can be applied in LSN order without
+*   including any from transactions that are still in progress. Transactions
+*   that never commit are dropped when a checkpoint starts after them, or
+*   when their id is reused.
+*
+***/
+
+struct DbWal::FollowData {
+    // WAL pages by first LSN, as of the last scan of the file.
+    map<Lsn, pgno_t> pages;
+    // Next page was found to be missing, after one that follows it was
+    // written, by the last scan.
+    bool missing = false;
+    // Pages in the file, and those of them that weren't log pages, as of the
+    // last scan or probe.
+    size_t numPages = 0;
+    UnsignedSet freePages;
+    // Start of the last checkpoint read, the writer reuses pages with only
+    // updates from before it.
+    Lsn checkpointLsn = {};
+    // Polls since the last scan that didn't find the next page.
+    unsigned probeFails = 0;
+
+    // First LSN of the page being read, or of the next page if there isn't
+    // one being read.
+    Lsn pageLsn = {};
+    // Page being read, and offset on it of the next record. Position is zero
+    // if there's no page being read.
+    pgno_t pgno = {};
+    size_t pos = 0;
+    // LSN of next record.
+    Lsn lsn = {};
+    // Start of the record continued on the next page.
+    string fragment;
+
+    // First LSN with updates to apply, those before it are already reflected
+    // in the data file.
+    Lsn startLsn = {};
+    // LSNs at which uncommitted transactions began, by id.
+    unordered_map<LocalTxn, Lsn> txns;
+    // Updates read, but not yet applied.
+    map<Lsn, string> updates;
+};
+
+//===========================================================================
+bool DbWal::follow(const function<bool(Lsn lsn, const Record & rec)> & fn) {
+    assert(m_follow);
+    auto & fd = *m_follow;
+    if (!followRead())
+        return false;
+
+    // Updates are applied up to, but not including, the beginning of the
+    // oldest transaction still in progress. Updates made by the transactions
+    // that follow it may be to the same pages.
+    auto last = fd.lsn - 1;
+    for (auto && kv : fd.txns) {
+        if (kv.second <= last)
+            last = kv.second - 1;
+    }
+    auto i = fd.updates.begin();
+    for (; i != fd.updates.end() && i->first <= last; ++i) {
+        if (!fn(i->first, *(const Record *) i->second.data())) {
+            last = i->first - 1;
+            break;
+        }
+    }
+    fd.updates.erase(fd.updates.begin(), i);
+
+    scoped_lock lk{m_bufMut};
+    if (last > m_lastLsn) {
+        m_lastLsn = last;
+        m_durableLsn = last;
+        // Followed updates are applied directly, never counted as pending.
+        m_applyRange = m_lastLsn.val / kApplyRangeLsns;
+    }
+    return true;
+}
+
+//===========================================================================
+void DbWal::followApply(Lsn lsn, const Record & rec) {
+    auto pgno = getPgno(rec);
+    auto ptr = m_page->onWalGetPtrForUpdate(pgno, lsn, getLocalTxn(rec));
+    applyUpdate(ptr, lsn, rec);
+    m_page->onWalUnlockPtr(pgno);
+}
+
+//===========================================================================
+// Reads the records added since the last read. Returns false if the page
+// with the next of them was reused before they were read.
+bool DbWal::followRead() {
+    auto & fd = *m_follow;
+    auto buf = (char *) mallocAligned(m_pageSize, m_pageSize);
+    assert(buf);
+    auto finally = Finally([&] { freeAligned(buf); });
+    bool scanned = false;
+    WalPage wp;
+    for (;;) {
+        if (!fd.pos) {
+            auto i = fd.pages.find(fd.pageLsn);
+            if (i == fd.pages.end()) {
+                if (scanned)
+                    return true;
+                scanned = true;
+                if (fd.numPages) {
+                    followProbe();
+                    if (fd.pages.contains(fd.pageLsn)) {
+                        fd.probeFails = 0;
+                        continue;
+                    }
+                    if (fd.pages.upper_bound(fd.pageLsn) == fd.pages.end()
+                        && ++fd.probeFails < kMaxFollowProbeFails
+                    ) {
+                        // Not yet written.
+                        return true;
+                    }
+                }
+                fd.probeFails = 0;
+                followScan();
+                if (fd.pages.contains(fd.pageLsn)) {
+                    fd.missing = false;
+                } else if (fd.pages.upper_bound(fd.pageLsn)
+                    != fd.pages.end()
+                ) {
+                    // A later page has been written, the next page may be
+                    // waiting on an out of order write. But if it's still
+                    // missing on the next scan it's gone.
+                    if (fd.missing) {
+                        logMsgError() << "WAL page with LSN " << fd.pageLsn
+                            << " reused before being followed, "
+                            << filePath(m_fwal);
+                        return false;
+                    }
+                    fd.missing = true;
+                }
+                continue;
+            }
+            fd.pgno = i->second;
+        }
+
+        fileReadWait(nullptr, buf, m_pageSize, m_fwal, fd.pgno * m_pageSize);
+        auto mp = (MinimumPage *) buf;
+        bool valid = mp->type == WalPageType::kLog;
+        if (valid) {
+            unpack(&wp, buf);
+            pack(buf, wp, 0);
+            if (hash_crc32c(buf, m_pageSize) != wp.checksum) {
+                // Read while being written, try again later.
+                return true;
+            }
+            valid = wp.firstLsn == fd.pageLsn;
+        }
+        if (!valid) {
+            if (fd.pos) {
+                logMsgError() << "WAL page #" << fd.pgno
+                    << " reused while being followed, " << filePath(m_fwal);
+                return false;
+            }
+            // The page was reused since the last scan.
+            fd.pages.erase(fd.pageLsn);
+            continue;
+        }
+
+        if (!fd.pos) {
+            // Starting new page, first finish the record that was continued
+            // onto it.
+            auto hdrLen = walHdrLen(wp.type);
+            if (!fd.fragment.empty()) {
+                fd.fragment.append(buf + hdrLen, wp.firstPos - hdrLen);
+                auto & rec = *(const Record *) fd.fragment.data();
+                assert(getSize(rec) == fd.fragment.size());
+                followRecord(fd.pageLsn - 1, rec);
+                fd.fragment.clear();
+            }
+            fd.pos = wp.firstPos;
+            fd.lsn = wp.firstLsn;
+        }
+        while (fd.pos < wp.lastPos) {
+            auto & rec = *(const Record *) (buf + fd.pos);
+            followRecord(fd.lsn, rec);
+            fd.pos += getSize(rec);
+            fd.lsn += 1;
+        }
+
+        if (fd.lsn - wp.firstLsn < wp.numRecs) {
+            // Full page, with a record that continues on the next page.
+            fd.fragment.assign(buf + fd.pos, m_pageSize - fd.pos);
+            fd.pageLsn = fd.lsn + 1;
+        } else if (wp.lastPos == m_pageSize) {
+            // Full page.
+            fd.pageLsn = fd.lsn;
+        } else {
+            // Partial page, reread it next time.
+            return true;
+        }
+        fd.pos = 0;
+    }
+}
+
+//===========================================================================
+// Finds the first LSN of every page in the WAL file.
+void DbWal::followScan() {
+    auto & fd = *m_follow;
+    fd.pages.clear();
+    fd.freePages.clear();
+    fd.numPages = 0;
+    uint64_t len = 0;
+    if (fileSize(&len, m_fwal))
+        return;
+    auto buf = (char *) mallocAligned(m_pageSize, m_pageSize);
+    assert(buf);
+    auto finally = Finally([&] { freeAligned(buf); });
+    WalPage wp;
+    fd.numPages = len / m_pageSize;
+    for (auto i = (pgno_t) 1; i < fd.numPages; i = pgno_t(i + 1)) {
+        fileReadWait(nullptr, buf, m_pageSize, m_fwal, i * m_pageSize);
+        auto mp = (MinimumPage *) buf;
+        if (mp->type != WalPageType::kLog) {
+            fd.freePages.insert(i);
+            continue;
+        }
+        unpack(&wp, buf);
+        fd.pages[wp.firstLsn] = i;
+    }
+}
+
+//===========================================================================
+// Reads the pages the writer could have put the next page on, as it would
+// allocate them: the lowest numbered free page first, or a new page at the
+// end of the file if there are none. Stops when the next page is found, or
+// after kMaxFollowProbes reads.
+void DbWal::followProbe() {
+    auto & fd = *m_follow;
+    uint64_t len = 0;
+    if (fileSize(&len, m_fwal))
+        return;
+    UnsignedSet pages = fd.freePages;
+    for (auto i = fd.pages.begin(); i != fd.pages.end(); ++i) {
+        if (auto next = std::next(i);
+            next != fd.pages.end() && next->first <= fd.checkpointLsn
+        ) {
+            pages.insert(i->second);
+        }
+    }
+    auto num = len / m_pageSize;
+    if (num > fd.numPages)
+        pages.insert((unsigned) fd.numPages, unsigned(num - fd.numPages));
+    fd.numPages = num;
+
+    auto buf = (char *) mallocAligned(m_pageSize, m_pageSize);
+    assert(buf);
+    auto finally = Finally([&] { freeAligned(buf); });
+    WalPage wp;
+    unsigned probes = 0;
+    for (auto && pgno : pages) {
+        if (pgno >= num || probes++ == kMaxFollowProbes)
+            break;
+        fileReadWait(nullptr, buf, m_pageSize, m_fwal, pgno * m_pageSize);
+        erase_if(fd.pages, [&](auto & kv) { return kv.second == pgno; });
+        auto mp = (MinimumPage *) buf;
+        if (mp->type != WalPageType::kLog) {
+            fd.freePages.insert(pgno);
+            continue;
+        }
+        fd.freePages.erase(pgno);
+        unpack(&wp, buf);
+        fd.pages[wp.firstLsn] = (pgno_t) pgno;
+        if (wp.firstLsn == fd.pageLsn)
+            break;
+    }
+}
+
+//===========================================================================
+void DbWal::followRecord(Lsn lsn, const Record & rec) {
+    auto & fd = *m_follow;
+    switch (rec.type) {
+    case kRecTypeCheckpoint:
+        fd.checkpointLsn = getStartLsn(rec);
+        // Recovery doesn't redo transactions that begin before the start of
+        // the checkpoint, so any still in progress were abandoned.
+        for (auto i = fd.txns.begin(); i != fd.txns.end();) {
+            if (i->second < getStartLsn(rec)) {
+                auto localTxn = i->first;
+                ++i;
+                followDropTxn(localTxn);
+            } else {
+                ++i;
+            }
+        }
+        break;
+    case kRecTypeTxnBegin:
+        // A transaction whose id is reused was abandoned.
+        followDropTxn(getLocalTxn(rec));
+        if (lsn >= fd.startLsn)
+            fd.txns[getLocalTxn(rec)] = lsn;
+        break;
+    case kRecTypeTxnCommit:
+        fd.txns.erase(getLocalTxn(rec));
+        break;
+    case kRecTypeTxnGroupCommit:
+        for (auto && localTxn : getLocalTxns(rec))
+            fd.txns.erase(localTxn);
+        break;
+    default:
+        if (lsn < fd.startLsn || getPgno(rec) == pgno_t::npos)
+            break;
+        if (auto localTxn = getLocalTxn(rec);
+            localTxn && !fd.txns.contains(localTxn)
+        ) {
+            // Not in progress, so it belongs to a transaction that was either
+            // abandoned or began before the checkpoint. Recovery would also
+            // skip it.
+            break;
+        }
+        fd.updates[lsn].assign((const char *) &rec, getSize(rec));
+        break;
+    }
+}
+
+//===========================================================================
+// Drops the transaction, if it's in progress, along with its updates.
+void DbWal::followDropTxn(LocalTxn localTxn) {
+    auto & fd = *m_follow;
+    auto i = fd.txns.find(localTxn);
+    if (i == fd.txns.end())
+        return;
+    for (auto j = fd.updates.lower_bound(i->second); j != fd.updates.end();) {
+        if (getLocalTxn(*(const Record *) j->second.data()) == localTxn) {
+            j = fd.updates.erase(j);
+        } else {
+            ++j;
+        }
+    }
+    fd.txns.erase(i);
+}
+
+
 /****************************************************************************
 *
 *   DbWal - checkpoint
@@ -1291,6 +1882,63 @@ Lsx DbWal::beginTxn() {
     return walBeginTxn(localTxn);
 }
 
+//===========================================================================
+Lsn DbWal::lastLsn() {
+    scoped_lock lk{m_bufMut};
+    return m_lastLsn;
+}
+
+//===========================================================================
+void DbWal::waitApplied(Lsn lsn) {
+    // Updates after it in the same range of LSNs are waited for as well.
+    auto range = lsn.val / kApplyRangeLsns;
+    unique_lock lk{m_bufMut};
+    m_applyWaiters += 1;
+    for (;;) {
+        auto first = appliedRange_LK();
+        if (first > range
+            || (first == range && !m_applyCounts[range % kApplyRanges])
+        ) {
+            break;
+        }
+        m_appliedCv.wait(lk);
+    }
+    m_applyWaiters -= 1;
+}
+
+//===========================================================================
+void DbWal::updateApplied(Lsn lsn) {
+    // Wake snapshots waiting for the updates up to theirs to be applied. The
+    // lock, taken so the wakeup can't be missed, is only needed if there are
+    // any.
+    auto & count = m_applyCounts[lsn.val / kApplyRangeLsns % kApplyRanges];
+    if (--count == 0 && m_applyWaiters) {
+        scoped_lock lk{m_bufMut};
+        m_appliedCv.notify_all();
+    }
+}
+
+//===========================================================================
+uint64_t DbWal::appliedRange_LK() {
+    for (;;) {
+        auto next = (m_applyRange + 1) * kApplyRangeLsns;
+        if (m_lastLsn.val + 1 < next) {
+            // Still being assigned LSNs.
+            break;
+        }
+        if (m_applyCounts[m_applyRange % kApplyRanges])
+            break;
+        m_applyRange += 1;
+    }
+    return m_applyRange;
+}
+
+//===========================================================================
+Lsn DbWal::checkpointLsn() {
+    scoped_lock lk{m_bufMut};
+    return m_checkpointLsn;
+}
+
 //===========================================================================
 // Write transaction committed record to WAL.
 void DbWal::commit(Lsx txn) {
@@ -1314,13 +1962,34 @@ Lsn DbWal::wal(
     assert(bytes < m_pageSize - kMaxHdrLen);
     assert(bytes == getSize(rec));
 
-    // Wait for enough buffer space to be available.
+    // Wait for enough buffer space to be available, adding a buffer to the
+    // ring instead if it hasn't reached its limit. Only the reservation of
+    // the LSN and of space in the buffers is done under the lock, the record
+    // is copied after it is released.
     unique_lock lk{m_bufMut};
-    while (m_bufPos + bytes > m_pageSize && !m_emptyBufs)
-        m_bufAvailCv.wait(lk);
+    for (;;) {
+        while (m_bufPos + bytes > m_pageSize && !m_emptyBufs) {
+            if (m_numBufs < kMaxWalWriteBuffers) {
+                addBuffer_LK();
+                break;
+            }
+            m_bufAvailCv.wait(lk);
+        }
+        auto range = (m_lastLsn.val + 1) / kApplyRangeLsns;
+        if (range < appliedRange_LK() + kApplyRanges)
+            break;
+
+        // The counts of updates still to be applied would wrap onto those
+        // of the oldest range, wait for it to be finished.
+        m_applyWaiters += 1;
+        m_appliedCv.wait(lk);
+        m_applyWaiters -= 1;
+    }
 
     m_lastLsn += 1;
     auto lsn = m_lastLsn;
+    if (txnMode == TxnMode::kApply)
+        m_applyCounts[lsn.val / kApplyRangeLsns % kApplyRanges] += 1;
 
     // Count transaction beginnings on the page their WAL record started. This
     // means the current page before logging (since logging can advance to the
@@ -1331,7 +2000,7 @@ Lsn DbWal::wal(
     // Transaction commits are counted after logging, so it's always on the
     // page where they finished.
     if (m_bufPos == m_pageSize) {
-        prepareBuffer_LK(rec, 0, bytes);
+        auto copy = prepareBuffer_LK(rec, 0, bytes);
         if (txnMode == TxnMode::kBegin) {
             // Transaction began on the newly prepared page.
             countBeginTxn_LK();
@@ -1339,6 +2008,8 @@ Lsn DbWal::wal(
             // Transaction committed on newly prepared page.
             countCommitTxns_LK(txn, txns);
         }
+        lk.unlock();
+        copyRecord(copy);
         return lsn;
     }
 
@@ -1354,10 +2025,9 @@ Lsn DbWal::wal(
         overflow = bytes - avail;
         bytes = avail;
     }
-    // Copy record (as much as fits) to current page.
-    auto base = bufPtr(m_curBuf) + m_bufPos;
-    memcpy(base, &rec, bytes);
-    m_bufPos += bytes;
+    // Reserve space for the record (as much as fits) on the current page.
+    auto unflushed = m_bufPos - m_flushedPos;
+    auto copy = reserve_LK(rec, 0, bytes);
 
     if (m_bufPos != m_pageSize) {
         // The WAL record does not fill the current page. A full page write
@@ -1365,31 +2035,40 @@ Lsn DbWal::wal(
         auto & state = m_bufStates[m_curBuf];
         if (state == Buffer::kPartialClean) {
             state = Buffer::kPartialDirty;
-            timerUpdate(&m_flushTimer, kDirtyWriteBufferTimeout);
+            scheduleFlush_LK();
         } else {
             assert(state == Buffer::kPartialDirty
                 || state == Buffer::kPartialWriting
             );
         }
+        if (m_flushMode == kWalFlushThroughput
+            && unflushed < m_flushBytes
+            && unflushed + bytes >= m_flushBytes
+        ) {
+            // Unwritten part of the buffer just reached the size target.
+            timerUpdate(&m_flushTimer, 0ms, true);
+        }
         if (txnMode == TxnMode::kCommit) {
             // Transaction committed on current page.
             countCommitTxns_LK(txn, txns);
         }
+        lk.unlock();
+        copyRecord(copy);
         return lsn;
     }
 
     // WAL record fills the current page, requiring a full page write. If it
     // has overflow bytes it will also start a new page.
-
-    bool writeInProgress = m_bufStates[m_curBuf] == Buffer::kPartialWriting;
-
-    // Save pointer to the buffer that filled up, this is important because if
-    // there's overflow the "current buffer" will be moved to reference the
-    // newly prepared buffer.
-    auto rawbuf = bufPtr(m_curBuf);
+    //
+    // The buffer is sealed and its full page write is started by whoever is
+    // last to finish with it; this copy, an earlier copy still in progress,
+    // or the completion of a partial write. Waiting for a partial write
+    // prevents it from overwriting the full page.
+    auto rawbuf = copy.rawbuf;
 
     // Prepare current buffer for full page write.
     m_bufStates[m_curBuf] = Buffer::kFullWriting;
+    *copy.refs += kBufSealed;
     WalPage wp;
     unpack(&wp, rawbuf);
     wp.numRecs = (uint16_t) (m_lastLsn - wp.firstLsn + 1);
@@ -1398,9 +2077,10 @@ Lsn DbWal::wal(
         wp.lastPos -= (uint16_t) bytes;
     pack(rawbuf, wp, 0);
 
+    BufferCopy next = {};
     if (overflow) {
         // Initialize new buffer and make it the current buffer.
-        prepareBuffer_LK(rec, bytes, overflow);
+        next = prepareBuffer_LK(rec, bytes, overflow);
     }
     if (txnMode == TxnMode::kCommit) {
         // Transaction committed on current page or, if overflow, on the newly
@@ -1409,20 +2089,14 @@ Lsn DbWal::wal(
     }
 
     lk.unlock();
-    if (writeInProgress) {
-        // The buffer is already being written, when that write completes its
-        // onFileWrite() callback will start the full page write. This
-        // serialization prevents the partial from overwriting the full page.
-    } else {
-        pack(rawbuf, wp, hash_crc32c(rawbuf, m_pageSize));
-        auto offset = wp.pgno * m_pageSize;
-        fileWrite(this, m_fwal, offset, rawbuf, m_pageSize, walQueue());
-    }
+    copyRecord(copy);
+    if (overflow)
+        copyRecord(next);
     return lsn;
 }
 
 //===========================================================================
-void DbWal::prepareBuffer_LK(
+DbWal::BufferCopy DbWal::prepareBuffer_LK(
     const Record & rec,
     size_t bytesOnOldPage,
     size_t bytesOnNewPage
@@ -1472,16 +2146,85 @@ void DbWal::prepareBuffer_LK(
     pi.firstLsn = wp.firstLsn;
     pi.cleanRecs = 0;
 
-    // Set buffer insertion point and initial data.
-    m_bufPos = hdrLen + bytesOnNewPage;
-    memcpy(
-        rawbuf + hdrLen,
-        (const char *) &rec + bytesOnOldPage,
-        bytesOnNewPage
-    );
-
+    // Set buffer insertion point and reserve initial data.
+    m_bufPos = hdrLen;
+    m_flushedPos = hdrLen;
     m_bufStates[m_curBuf] = Buffer::kPartialDirty;
-    timerUpdate(&m_flushTimer, kDirtyWriteBufferTimeout);
+    scheduleFlush_LK();
+    return reserve_LK(rec, bytesOnOldPage, bytesOnNewPage);
+}
+
+//===========================================================================
+// Reserves space at the insertion point of the current buffer for bytes of
+// the record starting at recPos. The buffer can't be written until the copy
+// has been made.
+DbWal::BufferCopy DbWal::reserve_LK(
+    const Record & rec,
+    size_t recPos,
+    size_t bytes
+) {
+    assert(m_bufPos + bytes <= m_pageSize);
+    BufferCopy out = {
+        .src = (const char *) &rec + recPos,
+        .rawbuf = bufPtr(m_curBuf),
+        .pos = m_bufPos,
+        .bytes = bytes,
+        .refs = &m_bufRefs[m_curBuf],
+    };
+    *out.refs += 1;
+    m_bufPos += bytes;
+    if (auto & times = m_bufTimes[m_curBuf]; times.dirty == TimePoint{})
+        times.dirty = timeNow();
+    return out;
+}
+
+//===========================================================================
+void DbWal::copyRecord(const BufferCopy & copy) {
+    memcpy(copy.rawbuf + copy.pos, copy.src, copy.bytes);
+    releaseBuffer(copy.rawbuf, *copy.refs);
+}
+
+//===========================================================================
+// Releases reference to buffer, starting the full page write if it was the
+// last reference to a sealed buffer.
+void DbWal::releaseBuffer(char * rawbuf, atomic<unsigned> & refs) {
+    if (refs.fetch_sub(1) != kBufSealed + 1)
+        return;
+
+    // Header fields were set when the buffer was sealed.
+    WalPage wp;
+    unpack(&wp, rawbuf);
+    pack(rawbuf, wp, hash_crc32c(rawbuf, m_pageSize));
+    auto offset = wp.pgno * m_pageSize;
+    fileWrite(this, m_fwal, offset, rawbuf, m_pageSize, walQueue());
+}
+
+//===========================================================================
+// Starts flush timer, according to the flush policy, for the current buffer
+// that has just become dirty.
+void DbWal::scheduleFlush_LK() {
+    Duration wait = m_flushLatency;
+    if (m_flushMode == kWalFlushLowLatency) {
+        wait = 0ms;
+    } else if (m_flushMode == kWalFlushFixedLatency) {
+        // Leave enough time for the write to finish.
+        wait = m_flushLatency > m_writeTime ? m_flushLatency - m_writeTime
+            : 0ms;
+    }
+    timerUpdate(&m_flushTimer, wait, true);
+}
+
+//===========================================================================
+// Records time it took for the oldest record made durable by a completed
+// write to get there.
+void DbWal::recordDurableLag_LK(TimePoint oldest) {
+    if (oldest == TimePoint{})
+        return;
+    auto lag = timeNow() - oldest;
+    auto ms = duration_cast<chrono::milliseconds>(lag).count();
+    s_perfDurableLag += (unsigned) ms;
+    if (lag > m_flushLatency)
+        s_perfLateWrites += 1;
 }
 
 //===========================================================================
@@ -1570,9 +2313,9 @@ void DbWal::onFileWrite(const FileWriteData & data) {
         return;
     }
 
-    // If the data is within m_buffers it was a full page write.
-    bool fullPageWrite = rawbuf >= m_buffers
-        && rawbuf < m_buffers + m_numBufs * m_pageSize;
+    // If the data is one of m_buffers it was a full page write.
+    size_t ibuf = ranges::find(m_buffers, rawbuf) - m_buffers.begin();
+    bool fullPageWrite = ibuf < m_numBufs;
 
     updatePages_LK(wp.firstLsn, wp.numRecs, fullPageWrite);
 
@@ -1581,8 +2324,10 @@ void DbWal::onFileWrite(const FileWriteData & data) {
         assert(data.data.size() == m_pageSize);
         // Set the buffer to empty so it can be reused.
         m_emptyBufs += 1;
-        auto ibuf = (rawbuf - m_buffers) / m_pageSize;
         m_bufStates[ibuf] = Buffer::kEmpty;
+        m_bufRefs[ibuf] = 0;
+        recordDurableLag_LK(m_bufTimes[ibuf].dirty);
+        m_bufTimes[ibuf] = {};
         wp.type = WalPageType::kFree;
         pack(rawbuf, wp, wp.checksum);
         // Check if amount of data written should trigger a checkpoint.
@@ -1596,30 +2341,36 @@ void DbWal::onFileWrite(const FileWriteData & data) {
     }
 
     // Partial page was written.
-    assert(rawbuf >= m_partialBuffers
-        && rawbuf < m_partialBuffers + m_numBufs * m_pageSize
-    );
+    ibuf = ranges::find(m_partialBuffers, rawbuf) - m_partialBuffers.begin();
+    assert(ibuf < m_numBufs);
     s_perfPartialWrites += 1;
-    auto ibuf = (rawbuf - m_partialBuffers) / m_pageSize;
     // Inspect corresponding full page buffer.
     rawbuf = bufPtr(ibuf);
+    auto & refs = m_bufRefs[ibuf];
+    auto & times = m_bufTimes[ibuf];
+    recordDurableLag_LK(times.partial);
+    times.partial = {};
+    m_writeTime = (7 * m_writeTime + (timeNow() - times.started)) / 8;
     WalPage owp;
     unpack(&owp, rawbuf);
     if (m_bufStates[ibuf] == Buffer::kPartialWriting) {
         if (owp.numRecs == wp.numRecs) {
             // Buffer has not changed since the partial write was initiated.
             m_bufStates[ibuf] = Buffer::kPartialClean;
+            refs -= 1;
             lk.unlock();
             m_bufAvailCv.notify_one();
         } else {
             // Data has been added to buffer, but it's still not full.
             m_bufStates[ibuf] = Buffer::kPartialDirty;
+            refs -= 1;
             bool closing = m_closing;
-            lk.unlock();
             if (!closing) {
                 // Start the flush timer.
-                timerUpdate(&m_flushTimer, kDirtyWriteBufferTimeout);
-            } else {
+                scheduleFlush_LK();
+            }
+            lk.unlock();
+            if (closing) {
                 // Since we're closing we don't want to wait for the flush
                 // timer (and we've already closed it anyway). Immediately
                 // queue the partial write.
@@ -1629,10 +2380,9 @@ void DbWal::onFileWrite(const FileWriteData & data) {
     } else {
         assert(m_bufStates[ibuf] == Buffer::kFullWriting);
         // Buffer has become full since the partial write was initiated. Start
-        // a full page write.
+        // a full page write, unless records are still being copied into it.
         lk.unlock();
-        pack(rawbuf, owp, hash_crc32c(rawbuf, m_pageSize));
-        fileWrite(this, m_fwal, data.offset, rawbuf, m_pageSize, walQueue());
+        releaseBuffer(rawbuf, refs);
     }
 }
 
@@ -1749,12 +2499,28 @@ void DbWal::queueTask(
 //===========================================================================
 void DbWal::flushPartialBuffer() {
     unique_lock lk{m_bufMut};
-    if (m_bufStates[m_curBuf] != Buffer::kPartialDirty)
-        return;
+    for (;;) {
+        if (m_bufStates[m_curBuf] != Buffer::kPartialDirty)
+            return;
+        // Records already reserved in the buffer must finish being copied
+        // before it can be written.
+        if (!m_bufRefs[m_curBuf])
+            break;
+        lk.unlock();
+        this_thread::yield();
+        lk.lock();
+    }
 
-    // Update buffer state and header.
+    // Update buffer state and header, the partial write holds a reference to
+    // the buffer until it completes.
     auto rawbuf = bufPtr(m_curBuf);
     m_bufStates[m_curBuf] = Buffer::kPartialWriting;
+    m_bufRefs[m_curBuf] += 1;
+    auto & times = m_bufTimes[m_curBuf];
+    times.partial = times.dirty;
+    times.dirty = {};
+    times.started = timeNow();
+    m_flushedPos = m_bufPos;
     WalPage wp;
     unpack(&wp, rawbuf);
     wp.numRecs = (uint16_t) (m_lastLsn - wp.firstLsn + 1);
@@ -1837,6 +2603,8 @@ DbTxn::DbTxn(DbWal & wal, DbPage & work, shared_ptr<DbRootSet> roots)
 //===========================================================================
 DbTxn::~DbTxn() {
     commit();
+    if (m_snapshot)
+        m_page.endSnapshot(m_snapshotLsn);
 }
 
 //===========================================================================
@@ -1850,6 +2618,43 @@ Lsx DbTxn::getLsx() const {
     return m_txn;
 }
 
+//===========================================================================
+void DbTxn::beginSnapshot(function<void()> onDetach) {
+    assert(!m_txn && !m_snapshot && !m_pinnedPages);
+    m_snapshot = true;
+    m_snapshotLsn = m_page.beginSnapshot();
+    // Updates logged before it may still be being applied, so wait for them
+    // rather than see them change pages after they've been read.
+    m_wal.waitApplied(m_snapshotLsn);
+    m_onDetach = move(onDetach);
+}
+
+//===========================================================================
+void DbTxn::detachSnapshot() {
+    if (m_onDetach) {
+        auto fn = move(m_onDetach);
+        m_onDetach = {};
+        fn();
+    }
+}
+
+//===========================================================================
+const void * DbTxn::pinSnapshot(pgno_t pgno, bool withPin) {
+    auto & buf = m_snapshotPages[pgno];
+    if (withPin) {
+        if (m_sparePages.empty()) {
+            buf.resize(pageSize());
+        } else {
+            buf = move(m_sparePages.back());
+            m_sparePages.pop_back();
+        }
+        if (!m_page.readSnapshot(buf.data(), m_snapshotLsn, pgno))
+            m_snapshotMissed = true;
+    }
+    assert(buf.size() == pageSize());
+    return buf.data();
+}
+
 //===========================================================================
 UnsignedSet DbTxn::commit() {
     UnsignedSet out;
@@ -1877,6 +2682,7 @@ UnsignedSet DbTxn::commit() {
 
 //===========================================================================
 void DbTxn::wal(DbWal::Record * rec, size_t bytes) {
+    assert(!m_snapshot);
     if (!m_txn)
         m_txn = m_wal.beginTxn();
     if constexpr (DIMAPP_LIB_BUILD_DEBUG) {
@@ -1888,7 +2694,17 @@ void DbTxn::wal(DbWal::Record * rec, size_t bytes) {
 
 //===========================================================================
 void DbTxn::unpinAll() {
-    m_page.unpin(m_pinnedPages);
+    if (m_snapshot) {
+        // Snapshot pages are private copies, keep the buffers for reuse.
+        for (auto && pgno : m_pinnedPages) {
+            auto i = m_snapshotPages.find((pgno_t) pgno);
+            assert(i != m_snapshotPages.end());
+            m_sparePages.push_back(move(i->second));
+            m_snapshotPages.erase(i);
+        }
+    } else {
+        m_page.unpin(m_pinnedPages);
+    }
     m_pinnedPages.clear();
 }
 
@@ -1898,6 +2714,7 @@ std::pair<void *, size_t> DbTxn::alloc(
     pgno_t pgno,
     size_t bytes
 ) {
+    assert(!m_snapshot);
     if (!m_txn)
         m_txn = m_wal.beginTxn();
     m_buffer.resize(bytes);
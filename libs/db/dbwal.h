@@ -7,11 +7,15 @@
 #include "core/core.h"
 #include "file/file.h"
 
+#include <atomic>
 #include <condition_variable>
 #include <cstdint>
 #include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <queue>
+#include <set>
 #include <string_view>
 #include <unordered_set>
 #include <vector>
@@ -105,6 +109,12 @@ public:
         // Include WAL records from before the last checkpoint, also only for
         // WAL dump tool.
         fRecoverBeforeCheckpoint = 0x02,
+
+        // Redo updates on multiple threads, partitioned by page so that the
+        // updates to each page are still applied in LSN order. The page notify
+        // must then allow concurrent onWalGetPtrForRedo() calls for different
+        // pages.
+        fRecoverParallel = 0x04,
     };
     bool recover(Dim::EnumFlags<RecoverFlags> flags = {});
 
@@ -120,6 +130,25 @@ public:
 
     void walAndApply(Lsx txn, Record * rec, size_t bytes);
 
+    // LSN assigned to the most recently added record.
+    Lsn lastLsn();
+    // Waits until every update logged at or before the LSN has been applied.
+    void waitApplied(Lsn lsn);
+    // First LSN that recovery would redo, as of the last checkpoint.
+    Lsn checkpointLsn();
+
+    // With fDbOpenFollow, reads the records that have been added to the WAL
+    // by the process that has it open for update. Calls fn, in LSN order, for
+    // the updates that can be applied; those of committed transactions up to
+    // the oldest still in progress. If fn returns false the rest are left
+    // for the next call. The LSN of the last of them applied becomes the last
+    // LSN. Returns false if the WAL needed was discarded by the writer before
+    // it could be read.
+    bool follow(const std::function<bool(Lsn lsn, const Record & rec)> & fn);
+    // Applies an update passed to the follow() callback, its page must be
+    // pinned.
+    void followApply(Lsn lsn, const Record & rec);
+
     // Queue task to be run after the indicated LSN becomes durable (is
     // committed to stable storage).
     void queueTask(
@@ -148,7 +177,8 @@ private:
     void walCommitTxns(const std::unordered_set<Lsx> & txns);
 
     // Returns LSN.
-    enum class TxnMode { kBegin, kContinue, kCommit };
+    // With kApply the record is an update that is applied after it's logged.
+    enum class TxnMode { kBegin, kContinue, kApply, kCommit };
     Lsn wal(
         const Record & rec,
         size_t bytes,
@@ -157,14 +187,34 @@ private:
         const std::unordered_set<Lsx> * txns = nullptr
     );
 
-    void prepareBuffer_LK(
+    // Range of a WAL record reserved within a buffer, the record bytes are
+    // copied into it after the buffer lock is released.
+    struct BufferCopy {
+        const char * src;
+        char * rawbuf;
+        size_t pos;
+        size_t bytes;
+        std::atomic<unsigned> * refs;
+    };
+    void addBuffer_LK();
+    BufferCopy prepareBuffer_LK(
         const Record & rec,
         size_t bytesOnOldPage,
         size_t bytesOnNewPage
     );
+    BufferCopy reserve_LK(const Record & rec, size_t recPos, size_t bytes);
+    void copyRecord(const BufferCopy & copy);
+    void releaseBuffer(char * rawbuf, std::atomic<unsigned> & refs);
+    void scheduleFlush_LK();
+    void recordDurableLag_LK(Dim::TimePoint oldest);
     void countBeginTxn_LK();
     void countCommitTxns_LK(Lsx txn, const std::unordered_set<Lsx> * txns);
     void countCommitTxn_LK(Lsx txn);
+    // Advances past the ranges of LSNs whose updates have all been applied,
+    // returns the first that may still have updates being applied.
+    uint64_t appliedRange_LK();
+    // Called once the update logged at the LSN by walAndApply() is applied.
+    void updateApplied(Lsn lsn);
     void updatePages_LK(
         Lsn firstLsn,
         uint16_t cleanRecs,
@@ -177,6 +227,7 @@ private:
     void flushPartialBuffer();
 
     struct AnalyzeData;
+    class ParallelRedo;
     void applyAll(AnalyzeData * data, Dim::FileHandle fwal);
     void apply(AnalyzeData * data, Lsn lsn, const Record & rec);
     void applyCheckpoint(
@@ -192,9 +243,17 @@ private:
         const std::vector<LocalTxn> & localTxns
     );
     void applyUpdate(AnalyzeData * data, Lsn lsn, const Record & rec);
+    void redoUpdate(Lsn lsn, const Record & rec);
 
     void applyUpdate(void * page, Lsn lsn, const Record & rec);
 
+    struct FollowData;
+    bool followRead();
+    void followRecord(Lsn lsn, const Record & rec);
+    void followScan();
+    void followProbe();
+    void followDropTxn(LocalTxn localTxn);
+
     IApplyNotify * m_data;
     IPageNotify * m_page;
     Dim::FileHandle m_fwal;
@@ -205,6 +264,12 @@ private:
     // Last Assigned
     Dim::UnsignedSet m_localTxns; // Ids of active transactions.
     Lsn m_lastLsn = {}; // LSN assigned to most recently added record.
+    // Updates that have been logged but not yet applied, counted by range of
+    // LSNs in a ring. All updates in ranges before m_applyRange are applied.
+    std::unique_ptr<std::atomic<unsigned>[]> m_applyCounts;
+    uint64_t m_applyRange = 0;
+    std::atomic<unsigned> m_applyWaiters{0};
+    std::condition_variable m_appliedCv;
 
     Dim::UnsignedSet m_freePages;
     size_t m_numPages = 0;
@@ -239,6 +304,9 @@ private:
     // Last known LSN durably saved.
     Lsn m_durableLsn = {};
 
+    // Position in, and not yet applied updates from, the WAL being followed.
+    std::unique_ptr<FollowData> m_follow;
+
     struct LsnTaskInfo {
         Dim::ITaskNotify * notify;
         Lsn waitLsn;
@@ -254,19 +322,41 @@ private:
         std::greater<LsnTaskInfo>
     > m_lsnTasks;
 
+    // Partial buffer flush policy
+    DbWalFlush m_flushMode = {};
+    Dim::Duration m_flushLatency = {};
+    size_t m_flushBytes = 0;
+    Dim::Duration m_writeTime = {}; // Moving average of partial write times
+
     Dim::TimerProxy m_flushTimer;
     std::mutex m_bufMut;
     std::condition_variable m_bufAvailCv;
     std::vector<Buffer> m_bufStates;
 
-    // Page Aligned Buffers
-    char * m_buffers = {};
-    char * m_partialBuffers = {};
+    // Page aligned buffers, the ring grows (up to a limit) when all buffers
+    // are in use.
+    std::vector<char *> m_buffers;
+    std::vector<char *> m_partialBuffers;
+
+    // Number of record copies and partial writes in progress for each buffer,
+    // plus kBufSealed once it is full. Elements are never moved so they can be
+    // referenced without the lock.
+    std::deque<std::atomic<unsigned>> m_bufRefs;
+
+    // When the oldest records in each buffer were added, used to report
+    // how long it takes them to become durable.
+    struct BufferTimes {
+        Dim::TimePoint dirty;   // Oldest record not yet included in a write
+        Dim::TimePoint partial; // Oldest record in partial write
+        Dim::TimePoint started; // Start of partial write
+    };
+    std::vector<BufferTimes> m_bufTimes;
 
     unsigned m_numBufs = 0;
     unsigned m_emptyBufs = 0;
     unsigned m_curBuf = 0;      // Buffer currently receiving WAL
     size_t m_bufPos = 0;        // Write position within current buffer
+    size_t m_flushedPos = 0;    // End of last partial write of current buffer
 };
 
 
@@ -295,13 +385,16 @@ public:
     // Similar to onWalGetPtrForUpdate, except that if the page has already
     // been updated no action is taken and null is returned. A page is
     // considered to have been updated if the on page LSN is greater or equal
-    // to the LSN of the update. Does not lock/pin page, recovery is assumed to
-    // be single threaded.
+    // to the LSN of the update. Does not lock/pin page, updates to any one
+    // page are redone in LSN order by a single thread at a time. But, with
+    // fRecoverParallel, calls for different pages may be concurrent.
     virtual void * onWalGetPtrForRedo(
         pgno_t pgno,
         Lsn lsn,
         LocalTxn localTxn
     ) = 0;
+    // Called when recovery has finished redoing updates.
+    virtual void onWalRedoComplete() {}
 
     // Reports the durable LSN and the additional bytes of WAL that were
     // written to get there. The durable LSN is the point at which all WAL
@@ -405,6 +498,10 @@ public:
         Dim::Duration retention,
         Dim::Duration interval
     ) = 0;
+    virtual void onWalApplyMetricUpdateBackfill(
+        void * ptr,
+        Dim::TimePoint backfill
+    ) = 0;
     virtual void onWalApplyMetricClearSamples(void * ptr) = 0;
     virtual void onWalApplyMetricUpdateSamples(
         void * ptr,
@@ -432,4 +529,48 @@ public:
         void * ptr,
         Dim::TimePoint pageTime
     ) = 0;
+    // Values are in the format of the samples of the page.
+    virtual void onWalApplySampleUpdateRange(
+        void * ptr,
+        size_t firstPos,
+        std::span<const uint8_t> values,
+        bool updateLast
+    ) = 0;
+    virtual void onWalApplySamplePackInit(
+        void * ptr,
+        uint32_t id,
+        Dim::TimePoint pageTime,
+        Dim::Duration interval,
+        size_t lastSample,
+        double fill
+    ) = 0;
+    virtual void onWalApplySamplePackAppend(
+        void * ptr,
+        size_t pos,
+        double value
+    ) = 0;
+    virtual void onWalApplySamplePackUpdate(
+        void * ptr,
+        size_t pos,
+        double value
+    ) = 0;
+    virtual void onWalApplySamplePackLink(void * ptr, pgno_t overflow) = 0;
+
+    virtual void onWalApplySampleRunsInit(void * ptr, uint32_t id) = 0;
+    // Runs are in the format of the entries of the page.
+    virtual void onWalApplySampleRunsAdd(
+        void * ptr,
+        size_t pagePos,
+        Dim::TimePoint pageTime,
+        std::span<const uint8_t> runs
+    ) = 0;
+    virtual void onWalApplySampleRunsRelease(void * ptr) = 0;
+    // Replaces the runs of the entry for the position.
+    virtual void onWalApplySampleRunsUpdate(
+        void * ptr,
+        size_t pagePos,
+        std::span<const uint8_t> runs
+    ) = 0;
+    // Removes the entry for the position, whose reference was released.
+    virtual void onWalApplySampleRunsRemove(void * ptr, size_t pagePos) = 0;
 };
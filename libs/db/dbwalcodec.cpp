@@ -214,18 +214,20 @@ void DbWal::walAndApply(Lsx txn, Record * rec, size_t bytes) {
     assert(bytes >= sizeof(DbWal::Record));
     if (txn)
         rec->localTxn = getLocalTxn(txn);
-    auto lsn = wal(*rec, bytes, TxnMode::kContinue);
+    auto lsn = wal(*rec, bytes, TxnMode::kApply);
 
     void * ptr = nullptr;
     auto pgno = getPgno(*rec);
     if (pgno == pgno_t::npos) {
         applyUpdate(ptr, lsn, *rec);
-        return;
+    } else {
+        auto localTxn = getLocalTxn(*rec);
+        ptr = m_page->onWalGetPtrForUpdate(pgno, lsn, localTxn);
+        applyUpdate(ptr, lsn, *rec);
+        m_page->onWalUnlockPtr(pgno);
     }
-    auto localTxn = getLocalTxn(*rec);
-    ptr = m_page->onWalGetPtrForUpdate(pgno, lsn, localTxn);
-    applyUpdate(ptr, lsn, *rec);
-    m_page->onWalUnlockPtr(pgno);
+
+    updateApplied(lsn);
 }
 
 //===========================================================================
@@ -40,6 +40,7 @@ enum DbWalRecType : int8_t {
                                       // refSample, refPage
     // [metric] page, refSample (non-standard layout)
     kRecTypeMetricUpdateSampleTxn = 36,
+    kRecTypeMetricUpdateBackfill = 53, // [metric] backfill
 
     kRecTypeSampleInit          = 18, // [sample] id, stype, pageTime, lastPos
     kRecTypeSampleInitFill      = 37, // [sample] id, stype, pageTime, lastPos,
@@ -51,6 +52,11 @@ enum DbWalRecType : int8_t {
                                       //    lastPos = last
     kRecTypeSampleUpdateTime    = 21, // [sample] pageTime
                                       //    pos = 0, samples[0] = NAN
+    kRecTypeSampleUpdateRange   = 46, // [sample] first, values
+                                      //    [first, first + count) = values
+    kRecTypeSampleUpdateRangeLast = 47, // [sample] first, values
+                                      //    [first, first + count) = values
+                                      //    lastPos = first + count - 1
 
     // [sample] page, pos, value (non-standard layout)
     kRecTypeSampleUpdateFloat32Txn      = 22,
@@ -67,7 +73,27 @@ enum DbWalRecType : int8_t {
     kRecTypeSampleUpdateInt16LastTxn    = 29,
     kRecTypeSampleUpdateInt32LastTxn    = 31,
 
-    kRecType_LastAvailable  = 41,
+    kRecTypeSamplePackInit      = 41, // [sample] id, pageTime, interval,
+                                      //    lastPos, value
+                                      //    [0, lastPos] = value
+    kRecTypeSamplePackAppend    = 42, // [sample] pos, value
+                                      //    pos = value, lastPos = pos
+    kRecTypeSamplePackUpdate    = 44, // [sample] pos, value
+                                      //    pos = value, repacked
+    kRecTypeSamplePackLink      = 45, // [sample] overflow page
+
+    // [sample] page, pos, value (non-standard layout)
+    //    pos = value, lastPos = pos
+    kRecTypeSamplePackAppendTxn = 43,
+
+    kRecTypeSampleRunsInit      = 48, // [sampleRuns] id
+    kRecTypeSampleRunsAdd       = 49, // [sampleRuns] pagePos, pageTime, runs
+                                      //    refs += 1
+    kRecTypeSampleRunsRelease   = 50, // [sampleRuns] refs -= 1
+    kRecTypeSampleRunsUpdate    = 51, // [sampleRuns] pagePos, runs
+    kRecTypeSampleRunsRemove    = 52, // [sampleRuns] pagePos
+
+    kRecType_LastAvailable  = 54,
 };
 
 #pragma pack(push, 1)
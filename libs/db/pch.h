@@ -22,21 +22,31 @@
 #include "querydefs/querydefs.h"
 
 // Standard headers
+#include <atomic>
 #include <cassert>
 #include <cerrno>
 #include <cmath>
 #include <condition_variable>
 #include <cstdint>
 #include <deque>
+#include <functional>
+#include <map>
 #include <mutex>
+#include <numeric>
+#include <optional>
 #include <queue>
 #include <set>
 #include <span>
 #include <shared_mutex>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
 // Platform headers
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 // External library internal headers
 // Internal headers
 #include "dbint.h"
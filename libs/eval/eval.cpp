@@ -21,25 +21,21 @@ namespace {
 
 class DbDataNode : public SourceNode, ITaskNotify, IDbDataNotify {
 private:
-    void readMore();
-
     void onSourceStart() override;
     void onTask() override;
 
     bool onDbSeriesStart(const DbSeriesInfo & info) override;
     bool onDbSample(uint32_t id, TimePoint time, double value) override;
+    bool onDbSamples(
+        uint32_t id,
+        TimePoint first,
+        Duration interval,
+        span<const double> values
+    ) override;
     void onDbSeriesEnd(uint32_t id) override;
 
     SourceContext m_context;
-
-    // Used in the onDb*() callbacks to determine if it's a synchronous callback
-    // from an active readMore() loop or an async callback resuming activity
-    // from another thread. This is used to decide if a new readMore loop
-    // needs to be started.
-    thread::id m_readTid;
-
     ResultInfo m_result;
-    UnsignedSet m_unfinishedIds;
 
     size_t m_pos{0};
     TimePoint m_time;
@@ -253,7 +249,7 @@ bool SourceNode::outputContext(SourceContext * out) {
     out->last = TimePoint::min();
     out->pretime = {};
     out->presamples = 0;
-    out->minInterval = {};
+    out->minInterval = Duration::max();
     out->method = {};
 
     scoped_lock lk{m_outMut};
@@ -267,6 +263,7 @@ bool SourceNode::outputContext(SourceContext * out) {
         out->last = max(out->last, ctx.last);
         out->pretime = max(out->pretime, ctx.pretime);
         out->presamples = max(out->presamples, ctx.presamples);
+        out->minInterval = min(out->minInterval, ctx.minInterval);
     }
     return true;
 }
@@ -339,44 +336,23 @@ void DbDataNode::onTask() {
     if (!outputContext(&m_context))
         return;
 
-    assert(m_readTid != this_thread::get_id());
-    assert(!m_unfinishedIds);
     m_result = {};
     m_result.target = sourceName();
-    dbFindMetrics(&m_unfinishedIds, s_db, m_result.target.get());
-    readMore();
-}
-
-//===========================================================================
-void DbDataNode::readMore() {
-    m_readTid = this_thread::get_id();
-
-    for (auto finished = !m_unfinishedIds; !finished; ) {
-        auto id = m_unfinishedIds.pop_front();
-
-        // Capture whether there are still unfinished ids before calling
-        // dbGetSamples(). This is because dbGetSamples() may queue the
-        // execution to a different thread, and then that thread could complete
-        // the results, start pending outputs, and make a new set of unfinished
-        // ids, all before dbGetSamples returns.
-        finished = !m_unfinishedIds;
-
-        if (!dbGetSamples(
-            this,
-            s_db,
-            id,
-            m_context.first - m_context.pretime,
-            m_context.last,
-            m_context.presamples
-        )) {
-            // Request was queued. We don't reset the read tid so when the
-            // callback runs it knows it was call from outside of readMore()
-            // and must call it again to process the rest of the unfinished.
-            return;
-        }
-    }
+    UnsignedSet ids;
+    dbFindMetrics(&ids, s_db, m_result.target.get());
+
+    // All of the metrics matching the target are read together, synchronously
+    // and from the same snapshot.
+    dbGetSamplesMulti(
+        this,
+        s_db,
+        ids,
+        m_context.first - m_context.pretime,
+        m_context.last,
+        m_context.presamples,
+        m_context.minInterval
+    );
 
-    m_readTid = thread::id{};
     m_result.name = {};
     m_result.samples = {};
     outputResult(m_result);
@@ -420,6 +396,25 @@ bool DbDataNode::onDbSample(uint32_t id, TimePoint time, double value) {
     return true;
 }
 
+//===========================================================================
+bool DbDataNode::onDbSamples(
+    uint32_t id,
+    TimePoint first,
+    Duration interval,
+    span<const double> values
+) {
+    auto samples = m_result.samples->samples;
+    auto count = m_result.samples->count;
+    assert(interval == m_result.samples->interval);
+    for (; m_time < first && m_pos < count; m_time += interval, ++m_pos)
+        samples[m_pos] = NAN;
+    auto num = min(values.size(), (size_t) count - m_pos);
+    copy_n(values.data(), num, samples + m_pos);
+    m_time += num * interval;
+    m_pos += num;
+    return true;
+}
+
 //===========================================================================
 void DbDataNode::onDbSeriesEnd(uint32_t id) {
     if (m_result.samples) {
@@ -433,12 +428,6 @@ void DbDataNode::onDbSeriesEnd(uint32_t id) {
     }
     auto out = m_result;
     outputResult(out);
-
-    if (m_unfinishedIds && m_readTid != this_thread::get_id()) {
-        // Called from a new thread without an active readMore loop, start
-        // a new loop to process the rest of the unfinished ids.
-        readMore();
-    }
 }
 
 
@@ -500,6 +489,9 @@ void FuncNode::onSourceStart() {
     if (!outputContext(&context))
         return;
 
+    // Functions get their sources at full resolution, reducing is only done
+    // for their results.
+    context.minInterval = {};
     m_instance->onFuncAdjustContext(&context);
     m_unfinished = (int) m_sources.size();
     context.rn = this;
@@ -24,14 +24,17 @@
 
 // Standard headers
 #include <array>
+#include <atomic>
 #include <condition_variable>
 #include <crtdbg.h>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
+#include <functional>
 #include <mutex>
 #include <random>
 #include <string>
+#include <thread>
 #include <type_traits>
 
 // Platform headers
@@ -47,6 +47,55 @@ struct TestDbSeries : IDbDataNotify {
     ) override;
 };
 
+// Keeps a copy of each series as it ends, for reads of many metrics.
+struct TestDbSeriesList : TestDbSeries {
+    vector<TestDbSeries> m_series;
+
+    void onDbSeriesEnd(uint32_t id) override;
+};
+
+struct TestDbSummaries : IDbDataNotify {
+    vector<DbSampleSummary> m_summaries;
+
+    bool onDbSeriesStart(const DbSeriesInfo & info) override;
+    bool onDbSummary(uint32_t id, const DbSampleSummary & summary) override;
+};
+
+struct TestDbProgress : IDbProgressNotify {
+    DbProgressInfo m_info;
+    bool m_done{false};
+    bool m_stopAfterMetrics{false};
+    // Pauses partway through the pages until resumed.
+    bool m_pausePages{false};
+    bool m_paused{false};
+    bool m_resumed{false};
+    mutex m_mut;
+    condition_variable m_cv;
+
+    bool onDbProgress(RunMode mode, const DbProgressInfo & info) override;
+    void wait();
+    // Returns false if it completed without pausing.
+    bool waitPaused();
+    void resume();
+};
+
+struct TestDbDurable : ITaskNotify {
+    bool m_done{false};
+    mutex m_mut;
+    condition_variable m_cv;
+
+    void onTask() override;
+    void wait();
+};
+
+// Runs the function on a compute thread, concurrently with the test.
+struct TestDbTask : ITaskNotify {
+    function<void()> m_fn;
+    atomic<bool> m_done{false};
+
+    void onTask() override;
+};
+
 } // namespace
 
 //===========================================================================
@@ -79,6 +128,142 @@ bool TestDbSeries::onDbSample(
     return true;
 }
 
+//===========================================================================
+void TestDbSeriesList::onDbSeriesEnd(uint32_t id) {
+    m_series.push_back(static_cast<const TestDbSeries &>(*this));
+}
+
+//===========================================================================
+bool TestDbProgress::onDbProgress(RunMode mode, const DbProgressInfo & info) {
+    unique_lock lk{m_mut};
+    m_info = info;
+    if (mode == kRunStopped) {
+        m_done = true;
+        m_cv.notify_all();
+    } else if (m_pausePages
+        && !m_paused
+        && info.pages
+        && info.pages < info.totalPages
+    ) {
+        m_paused = true;
+        m_cv.notify_all();
+        while (!m_resumed)
+            m_cv.wait(lk);
+    }
+    return !m_stopAfterMetrics || info.metrics < info.totalMetrics;
+}
+
+//===========================================================================
+void TestDbProgress::wait() {
+    unique_lock lk{m_mut};
+    while (!m_done)
+        m_cv.wait(lk);
+}
+
+//===========================================================================
+bool TestDbProgress::waitPaused() {
+    unique_lock lk{m_mut};
+    while (!m_paused && !m_done)
+        m_cv.wait(lk);
+    return m_paused;
+}
+
+//===========================================================================
+void TestDbProgress::resume() {
+    scoped_lock lk{m_mut};
+    m_resumed = true;
+    m_cv.notify_all();
+}
+
+//===========================================================================
+void TestDbDurable::onTask() {
+    scoped_lock lk{m_mut};
+    m_done = true;
+    m_cv.notify_all();
+}
+
+//===========================================================================
+void TestDbDurable::wait() {
+    unique_lock lk{m_mut};
+    while (!m_done)
+        m_cv.wait(lk);
+}
+
+
+/****************************************************************************
+*
+*   TestDbTask
+*
+***/
+
+//===========================================================================
+void TestDbTask::onTask() {
+    m_fn();
+    m_done = true;
+}
+
+//===========================================================================
+bool TestDbSummaries::onDbSeriesStart(const DbSeriesInfo & info) {
+    m_summaries.clear();
+    return true;
+}
+
+//===========================================================================
+bool TestDbSummaries::onDbSummary(
+    uint32_t id,
+    const DbSampleSummary & summary
+) {
+    m_summaries.push_back(summary);
+    return true;
+}
+
+
+/****************************************************************************
+*
+*   Helpers
+*
+***/
+
+//===========================================================================
+// Returns the current value of the perf counter, or NAN if there isn't one.
+static double perfValue(string_view name) {
+    vector<PerfValue> vals;
+    perfGetValues(&vals);
+    for (auto && val : vals) {
+        if (val.name == name)
+            return val.raw;
+    }
+    return NAN;
+}
+
+//===========================================================================
+// Copies the file as it is at the moment, which for the files of an open
+// database is what a crash would leave behind.
+static bool copyFile(string_view dst, string_view src) {
+    using enum File::OpenMode;
+    FileHandle fin;
+    fileOpen(&fin, src, fReadOnly | fBlocking | fDenyNone);
+    if (!fin)
+        return false;
+    Finally finFin([&]() { fileClose(fin); });
+    FileHandle fout;
+    fileOpen(&fout, dst, fCreat | fTrunc | fReadWrite | fBlocking);
+    if (!fout)
+        return false;
+    Finally foutFin([&]() { fileClose(fout); });
+
+    string buf(0x1'0000, '\0');
+    for (uint64_t pos = 0;; ) {
+        uint64_t bytes = 0;
+        fileReadWait(&bytes, buf.data(), buf.size(), fin, pos);
+        if (!bytes)
+            return true;
+        if (fileWriteWait(nullptr, fout, pos, buf.data(), bytes))
+            return false;
+        pos += bytes;
+    }
+}
+
 
 /****************************************************************************
 *
@@ -95,7 +280,19 @@ public:
     void dataTests();
     void queryTests();
     void sampleTests();
+    void packedTests();
+    void runsTests();
+    void snapshotTests();
+    void rollupTests();
+    void lazyTests();
+    void mapTests();
+    void scrubTests();
+    void walTests();
+    void indexTests();
+    void compactTests();
+    void backupTests();
     void readonlyTests();
+    void followTests();
 
     // Inherited via ITest
     void onTestRun() override;
@@ -399,6 +596,932 @@ void Test::sampleTests() {
     );
     EXPECT(samples.m_count == 3);
 
+    // batch of updates to multiple metrics
+    uint32_t id2;
+    dbInsertMetric(&id2, h, "this.is.metric.2");
+    dbUpdateMetric(h, id2, info);
+    vector<DbSampleUpdate> batch;
+    auto batchStart = start + 6 * spp * 1min;
+    for (auto i = 0u; i < 10; ++i) {
+        batch.push_back({id, batchStart + i * 1min, 4.0});
+        batch.push_back({id2, batchStart + i * 1min, 5.0});
+    }
+    batch.push_back({id, batchStart + 9min, 6.0});
+    dbUpdateSamples(h, batch);
+    dbGetSamples(&samples, h, id, batchStart, batchStart + 9min);
+    EXPECT(samples.m_count == 10);
+    EXPECT(samples.m_samples[0] == 4.0 && samples.m_samples[9] == 6.0);
+    dbGetSamples(&samples, h, id2, batchStart, batchStart + 9min);
+    EXPECT(samples.m_count == 10);
+    EXPECT(samples.m_samples[0] == 5.0 && samples.m_samples[9] == 5.0);
+
+    // batch out of time order is applied in time order, but with updates of
+    // the same sample in the order given
+    batch.clear();
+    for (auto i = 10u; i-- > 0;)
+        batch.push_back({id, batchStart + (10 + i) * 1min, (double) i});
+    batch.push_back({id, batchStart + 10min, 7.0});
+    dbUpdateSamples(h, batch);
+    dbGetSamples(&samples, h, id, batchStart + 10min, batchStart + 19min);
+    EXPECT(samples.m_count == 10);
+    EXPECT(samples.m_samples[0] == 7.0 && samples.m_samples[9] == 9.0);
+
+    // runs appended to the tip page, one within the page and then one, after
+    // a skipped sample, that continues onto the following pages
+    auto runStart = batchStart + 20min;
+    batch.clear();
+    for (auto i = 0u; i < 3; ++i)
+        batch.push_back({id, runStart + i * 1min, 10.0 + i});
+    dbUpdateSamples(h, batch);
+    batch.clear();
+    for (auto i = 4u; i < 2 * spp; ++i)
+        batch.push_back({id, runStart + i * 1min, 10.0 + i});
+    dbUpdateSamples(h, batch);
+    dbGetSamples(&samples, h, id, runStart, runStart + (2 * spp - 1) * 1min);
+    EXPECT(samples.m_count == 2 * spp - 1);
+    auto matched = 0u;
+    for (auto i = 0u; i < samples.m_samples.size(); ++i) {
+        if (i == 3 ? isnan(samples.m_samples[i])
+            : samples.m_samples[i] == 10.0 + i
+        ) {
+            matched += 1;
+        }
+    }
+    EXPECT(matched == 2 * spp);
+
+    // read both metrics together, each reported in id order
+    UnsignedSet ids;
+    ids.insert(id);
+    ids.insert(id2);
+    TestDbSeriesList list;
+    dbGetSamplesMulti(&list, h, ids, batchStart, batchStart + 9min);
+    EXPECT(list.m_series.size() == 2);
+    if (list.m_series.size() == 2) {
+        auto & s1 = list.m_series[id < id2 ? 0 : 1];
+        EXPECT(s1.m_id == id && s1.m_count == 10);
+        EXPECT(s1.m_samples[0] == 4.0 && s1.m_samples[9] == 6.0);
+        auto & s2 = list.m_series[id < id2 ? 1 : 0];
+        EXPECT(s2.m_id == id2 && s2.m_count == 10);
+        EXPECT(s2.m_samples[0] == 5.0 && s2.m_samples[9] == 5.0);
+    }
+
+    ctx.reset();
+    dbClose(h);
+}
+
+//===========================================================================
+void Test::packedTests() {
+    auto start = timeFromUnix(900'000'000);
+    const char dat[] = "test";
+    UnsignedSet found;
+    DbContext ctx;
+    uint32_t id;
+    DbMetricInfo info;
+
+    auto h = dbOpen(dat);
+    EXPECT(h && "Failure to reopen database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    auto stats = dbQueryStats(h);
+    auto spp = stats.samplesPerPage[kSampleTypePacked];
+    EXPECT(spp > stats.samplesPerPage[kSampleTypeFloat64]);
+    auto pgt = spp * 1min;
+    dbFindMetrics(&found, h);
+    for (auto && id : found)
+        dbEraseMetric(h, id);
+    dbInsertMetric(&id, h, "this.is.packed.1");
+    info.type = kSampleTypePacked;
+    info.retention = duration_cast<Duration>(3 * pgt);
+    info.interval = 1min;
+    dbUpdateMetric(h, id, info);
+
+    // values that don't compress well, so pages spill into overflow pages
+    auto value = [](unsigned i) { return i / 7.0; };
+    for (auto i = 0u; i < 2 * spp; ++i)
+        dbUpdateSample(h, id, start + i * 1min, value(i));
+    TestDbSeries samples;
+    dbGetSamples(&samples, h, id, start, start + 2 * pgt);
+    EXPECT(samples.m_count == 2 * spp);
+    EXPECT(samples.m_first == start);
+    auto matched = 0u;
+    for (auto i = 0u; i < samples.m_samples.size(); ++i) {
+        if (samples.m_samples[i] == value(i))
+            matched += 1;
+    }
+    EXPECT(matched == 2 * spp);
+
+    // change historical values, every other one
+    for (auto i = 0u; i < 2 * spp; i += 2)
+        dbUpdateSample(h, id, start + i * 1min, value(i) + 1);
+    dbGetSamples(&samples, h, id, start, start + 2 * pgt);
+    EXPECT(samples.m_count == 2 * spp);
+    matched = 0;
+    for (auto i = 0u; i < samples.m_samples.size(); ++i) {
+        if (samples.m_samples[i] == value(i) + (i % 2 ? 0 : 1))
+            matched += 1;
+    }
+    EXPECT(matched == 2 * spp);
+
+    // fill a page with homogeneous values to trigger conversion to virtual
+    // page
+    auto pageStart = start + 2 * pgt;
+    dbUpdateSample(h, id, pageStart, 1.0);
+    auto oldFree = dbQueryStats(h).freePages;
+    for (auto time = pageStart; time < pageStart + pgt; time += 1min)
+        dbUpdateSample(h, id, time, 1.0);
+    stats = dbQueryStats(h);
+    EXPECT(oldFree == stats.freePages - 1);
+    dbGetSamples(&samples, h, id, pageStart, pageStart + pgt);
+    EXPECT(samples.m_count == spp);
+
+    // age out all sample values, with gaps
+    for (auto i = 3 * spp; i < 7 * spp; i += 3)
+        dbUpdateSample(h, id, start + i * 1min, 3.0);
+    dbGetSamples(&samples, h, id, start, start + 7 * pgt);
+    EXPECT(samples.m_count <= 3 * spp / 3 + 1);
+
+    ctx.reset();
+    dbClose(h);
+}
+
+//===========================================================================
+void Test::runsTests() {
+    auto start = timeFromUnix(900'000'000);
+    const char dat[] = "test-runs";
+    DbMetricInfo info;
+    TestDbSeries samples;
+
+    // default page size, so full pages of a step function, with a few runs
+    // per page, are run length encoded
+    auto h = dbOpen(dat, fDbOpenCreat | fDbOpenTrunc);
+    EXPECT(h && "Failure to create database");
+    if (!h)
+        return;
+    DbContext ctx(h);
+    auto stats = dbQueryStats(h);
+    auto spp = stats.samplesPerPage[kSampleTypeFloat32];
+    auto pgt = spp * 1min;
+    uint32_t id;
+    dbInsertMetric(&id, h, "this.is.runs.1");
+    info.type = kSampleTypeFloat32;
+    info.retention = duration_cast<Duration>(4 * pgt);
+    info.interval = 1min;
+    dbUpdateMetric(h, id, info);
+
+    // around the ring more than once, reusing pages that were encoded
+    auto step = [&](unsigned i) { return i / (spp / 3) % 2 ? 1.0 : 0.0; };
+    for (auto i = 0u; i < 6 * spp; ++i)
+        dbUpdateSample(h, id, start + i * 1min, step(i));
+    auto first = start + 2 * pgt;
+    auto last = start + 6 * pgt - 1min;
+    auto check = [&]() {
+        dbGetSamples(&samples, h, id, first, last);
+        EXPECT(samples.m_count == 4 * spp);
+        auto matched = 0u;
+        for (auto i = 0u; i < samples.m_samples.size(); ++i) {
+            auto value = i == spp + 5 ? 7.0 : step(2 * spp + i);
+            if (samples.m_samples[i] == value)
+                matched += 1;
+        }
+        EXPECT(matched == 4 * spp);
+    };
+
+    // change historical sample on an encoded page
+    dbUpdateSample(h, id, first + (spp + 5) * 1min, 7.0);
+    check();
+    TestDbSummaries sums;
+    dbGetSummaries(&sums, h, id, first, last);
+    unsigned count = 0;
+    double total = 0;
+    for (auto && sum : sums.m_summaries) {
+        count += sum.count;
+        total += sum.sum;
+    }
+    auto expected = 7.0 - step(3 * spp + 5);
+    for (auto i = 2 * spp; i < 6 * spp; ++i)
+        expected += step(i);
+    EXPECT(count == 4 * spp && total == expected);
+
+    // more changes to encoded pages, and changing them back, rewrite their
+    // runs in place instead of expanding them
+    auto usedPages = [&]() {
+        auto stats = dbQueryStats(h);
+        return stats.numPages - stats.freePages;
+    };
+    auto used = usedPages();
+    for (auto i = 0u; i < 3; ++i) {
+        auto pos = i * spp + 1;
+        dbUpdateSample(h, id, first + pos * 1min, 9.0);
+        dbUpdateSample(h, id, first + pos * 1min, step(2 * spp + pos));
+    }
+    EXPECT(usedPages() == used);
+    check();
+    ctx.reset();
+    dbClose(h);
+
+    // same samples after reopening
+    h = dbOpen(dat, fDbOpenVerifyPages);
+    EXPECT(h && "Failure to reopen database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    check();
+    ctx.reset();
+    dbClose(h);
+}
+
+//===========================================================================
+void Test::snapshotTests() {
+    auto start = timeFromUnix(900'000'000);
+    const char dat[] = "test-snapshot";
+    DbMetricInfo info;
+
+    auto h = dbOpen(dat, fDbOpenCreat | fDbOpenTrunc);
+    EXPECT(h && "Failure to create database");
+    if (!h)
+        return;
+    DbContext ctx(h);
+    auto spp = dbQueryStats(h).samplesPerPage[kSampleTypeFloat32];
+    uint32_t id;
+    dbInsertMetric(&id, h, "this.is.snapshot.1");
+    info.type = kSampleTypeFloat32;
+    info.retention = duration_cast<Duration>(4 * spp * 1min);
+    info.interval = 1min;
+    dbUpdateMetric(h, id, info);
+
+    // The writer goes around the ring of pages several times while the
+    // samples are read, every sample read must be one that was written.
+    auto count = 12 * spp;
+    TestDbTask writer;
+    writer.m_fn = [&]() {
+        for (auto i = 0u; i < count; ++i)
+            dbUpdateSample(h, id, start + i * 1min, i);
+    };
+    taskPushCompute(&writer);
+    UnsignedSet ids;
+    ids.insert(id);
+    TestDbSeries samples;
+    unsigned reads = 0;
+    unsigned bad = 0;
+    auto check = [&]() {
+        dbGetSamplesMulti(&samples, h, ids, start, start + count * 1min);
+        reads += 1;
+        for (auto i = 0u; i < samples.m_samples.size(); ++i) {
+            auto value = samples.m_samples[i];
+            auto pos = (samples.m_first - start) / 1min + i;
+            if (!isnan(value) && value != (double) pos)
+                bad += 1;
+        }
+    };
+    while (!writer.m_done)
+        check();
+    check();
+    EXPECT(reads > 1);
+    EXPECT(!bad);
+    EXPECT(samples.m_count == 4 * spp);
+    ctx.reset();
+    dbClose(h);
+}
+
+//===========================================================================
+void Test::rollupTests() {
+    auto start = timeFromUnix(900'000'000);
+    const char dat[] = "test";
+    UnsignedSet found;
+    DbContext ctx;
+    uint32_t id;
+    DbMetricInfo info;
+
+    auto h = dbOpen(dat);
+    EXPECT(h && "Failure to reopen database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    dbFindMetrics(&found, h);
+    for (auto && id : found)
+        dbEraseMetric(h, id);
+    dbInsertMetric(&id, h, "this.is.rolled.1");
+    DbMetricRollup rollups[] = { { 100h, 10min }, { 1000h, 1h } };
+    info.type = kSampleTypeFloat32;
+    info.retention = 24h;
+    info.interval = 1min;
+    info.rollups = rollups;
+    dbUpdateMetric(h, id, info);
+    auto stats = dbQueryStats(h);
+    EXPECT(stats.metrics == 1);
+
+    for (auto i = 0; i < 120; ++i)
+        dbUpdateSample(h, id, start + i * 1min, i % 10);
+    TestDbSeries samples;
+    dbGetSamples(&samples, h, id, start, start + 119min);
+    EXPECT(samples.m_interval == 1min && samples.m_count == 120);
+    dbGetSamples(&samples, h, id, start, start + 119min, 0, 10min);
+    EXPECT(samples.m_interval == 10min && samples.m_count == 12);
+    EXPECT(samples.m_id == id && samples.m_samples[11] == 4.5);
+    dbGetSamples(&samples, h, id, start, start + 119min, 0, 1h);
+    EXPECT(samples.m_interval == 1h && samples.m_count == 2);
+    EXPECT(samples.m_samples[0] == 4.5 && samples.m_samples[1] == 4.5);
+
+    // bucket of the last sample isn't rolled up until it's complete
+    dbUpdateSample(h, id, start + 120min, 1);
+    dbGetSamples(&samples, h, id, start, start + 129min, 0, 10min);
+    EXPECT(samples.m_interval == 10min && samples.m_count == 12);
+    dbUpdateSample(h, id, start + 130min, 1);
+    dbGetSamples(&samples, h, id, start, start + 129min, 0, 10min);
+    EXPECT(samples.m_interval == 10min && samples.m_count == 13);
+    EXPECT(samples.m_samples[12] == 1);
+
+    // page summaries, with partial pages at both ends
+    TestDbSummaries sums;
+    dbGetSummaries(&sums, h, id, start + 5min, start + 114min);
+    EXPECT(sums.m_summaries.size() > 2);
+    unsigned count = 0;
+    double total = 0;
+    for (auto && sum : sums.m_summaries) {
+        count += sum.count;
+        total += sum.sum;
+    }
+    EXPECT(count == 110 && total == 495);
+    if (!sums.m_summaries.empty()) {
+        EXPECT(sums.m_summaries.front().first == start + 5min);
+        EXPECT(sums.m_summaries.back().last == start + 115min);
+    }
+
+    // range older than the retention of the finer rollup
+    dbGetSamples(&samples, h, id, start - 200h, start + 119min, 0, 10min);
+    EXPECT(samples.m_interval == 1min);
+    dbGetSamples(&samples, h, id, start - 200h, start + 119min, 0, 1h);
+    EXPECT(samples.m_interval == 1h);
+
+    // remove them
+    DbMetricRollup none[1] = {};
+    info = {};
+    info.rollups = none;
+    dbUpdateMetric(h, id, info);
+    dbGetSamples(&samples, h, id, start, start + 119min, 0, 1h);
+    EXPECT(samples.m_interval == 1min && samples.m_count == 120);
+
+    // add them back, populated from the samples already there
+    info.rollups = rollups;
+    dbUpdateMetric(h, id, info);
+    dbGetSamples(&samples, h, id, start, start + 119min, 0, 10min);
+    EXPECT(samples.m_interval == 10min && samples.m_count == 12);
+    EXPECT(samples.m_samples[11] == 4.5);
+    dbGetSamples(&samples, h, id, start, start + 119min, 0, 1h);
+    EXPECT(samples.m_interval == 1h && samples.m_count == 2);
+
+    ctx.reset();
+    dbClose(h);
+}
+
+//===========================================================================
+void Test::lazyTests() {
+    auto start = timeFromUnix(900'000'000);
+    const char dat[] = "test";
+    UnsignedSet found;
+    DbContext ctx;
+    DbMetricInfo info;
+    TestDbSeries samples;
+
+    auto h = dbOpen(dat, fDbOpenLazyMetrics);
+    EXPECT(h && "Failure to reopen database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    dbFindMetrics(&found, h);
+    for (auto && id : found)
+        dbEraseMetric(h, id);
+
+    // more metrics than are allowed to stay loaded
+    DbConfig conf = {};
+    conf.maxLoadedMetrics = 4;
+    dbConfigure(h, conf);
+    vector<uint32_t> ids;
+    info.type = kSampleTypeFloat32;
+    info.retention = 24h;
+    info.interval = 1min;
+    for (auto i = 0; i < 10; ++i) {
+        uint32_t id;
+        dbInsertMetric(&id, h, "this.is.lazy." + to_string(i));
+        dbUpdateMetric(h, id, info);
+        ids.push_back(id);
+    }
+    for (auto i = 0; i < 10; ++i) {
+        for (auto && id : ids)
+            dbUpdateSample(h, id, start + i * 1min, i);
+    }
+    for (auto && id : ids) {
+        dbGetSamples(&samples, h, id, start, start + 9min);
+        EXPECT(samples.m_id == id && samples.m_count == 10);
+    }
+    ctx.reset();
+    dbClose(h);
+
+    // positions faulted in again after reopening
+    h = dbOpen(dat, fDbOpenLazyMetrics);
+    EXPECT(h && "Failure to reopen database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    auto stats = dbQueryStats(h);
+    EXPECT(stats.metrics == 10);
+    for (auto && id : ids)
+        dbUpdateSample(h, id, start + 10min, 10);
+    for (auto && id : ids) {
+        dbGetSamples(&samples, h, id, start, start + 10min);
+        EXPECT(samples.m_count == 11 && samples.m_samples[10] == 10);
+    }
+    ctx.reset();
+    dbClose(h);
+}
+
+//===========================================================================
+void Test::mapTests() {
+    auto start = timeFromUnix(900'000'000);
+    const char dat[] = "test";
+    UnsignedSet found;
+    TestDbSeries samples;
+
+    // larger and populated views, with access hints
+    DbMapOptions mapOpts = {
+        .viewSize = 0x200'0000,
+        .populate = true,
+        .dataAccess = kMapAccessRandom,
+    };
+    auto h = dbOpen(dat, fDbOpenLazyMetrics, 0, mapOpts);
+    EXPECT(h && "Failure to reopen database");
+    if (!h)
+        return;
+    DbContext ctx(h);
+    auto check = [&]() {
+        dbFindMetrics(&found, h);
+        EXPECT(found.size() == 10);
+        for (auto && id : found) {
+            dbGetSamples(&samples, h, id, start, start + 10min);
+            EXPECT(samples.m_count == 11 && samples.m_samples[10] == 10);
+        }
+    };
+    check();
+
+    // hints changed, left unchanged, and changed back to the default
+    DbConfig conf = {};
+    conf.dataAccess = kMapAccessSequential;
+    conf.workAccess = kMapAccessRandom;
+    dbConfigure(h, conf);
+    check();
+    conf = {};
+    dbConfigure(h, conf);
+    check();
+    conf.dataAccess = kMapAccessDefault;
+    conf.workAccess = kMapAccessDefault;
+    dbConfigure(h, conf);
+    check();
+    ctx.reset();
+    dbClose(h);
+}
+
+//===========================================================================
+void Test::scrubTests() {
+    const char dat[] = "test";
+
+    auto h = dbOpen(dat, fDbOpenVerifyPages);
+    EXPECT(h && "Failure to reopen database");
+    if (!h)
+        return;
+    DbContext ctx(h);
+
+    // checksums of all data pages
+    TestDbProgress progress;
+    EXPECT(dbScrub(&progress, h, 0x1000'0000));
+    progress.wait();
+    EXPECT(progress.m_info.pages == progress.m_info.totalPages);
+    EXPECT(progress.m_info.pages && !progress.m_info.badPages);
+    ctx.reset();
+    dbClose(h);
+}
+
+//===========================================================================
+void Test::walTests() {
+    auto start = timeFromUnix(900'000'000);
+    const char dat[] = "test-wal";
+    const unsigned kTasks = 8;
+    const unsigned kSamples = 200;
+    DbMetricInfo info;
+    TestDbSeries samples;
+
+    auto h = dbOpen(dat, fDbOpenCreat | fDbOpenTrunc, 128);
+    EXPECT(h && "Failure to create database");
+    if (!h)
+        return;
+    vector<uint32_t> ids;
+    info.type = kSampleTypeFloat32;
+    info.retention = 24h;
+    info.interval = 1min;
+    for (auto i = 0u; i < kTasks; ++i) {
+        uint32_t id;
+        dbInsertMetric(&id, h, "this.is.wal." + to_string(i));
+        dbUpdateMetric(h, id, info);
+        ids.push_back(id);
+    }
+
+    // concurrent updates appending to the WAL, grouped into partial page
+    // writes as they complete
+    DbConfig conf = {};
+    conf.walFlush = kWalFlushLowLatency;
+    dbConfigure(h, conf);
+    mutex mut;
+    condition_variable cv;
+    unsigned running = kTasks;
+    for (auto && id : ids) {
+        taskPushCompute([&, id]() {
+            {
+                DbContext ctx(h);
+                for (auto i = 0u; i < kSamples; ++i)
+                    dbUpdateSample(h, id, start + i * 1min, i);
+            }
+            scoped_lock lk{mut};
+            if (!--running)
+                cv.notify_all();
+        });
+    }
+    {
+        unique_lock lk{mut};
+        while (running)
+            cv.wait(lk);
+    }
+    dbClose(h);
+
+    // all updates recovered after reopening
+    h = dbOpen(dat, fDbOpenVerifyPages);
+    EXPECT(h && "Failure to reopen database");
+    if (!h)
+        return;
+    DbContext ctx(h);
+    for (auto && id : ids) {
+        dbGetSamples(&samples, h, id, start, start + kSamples * 1min);
+        EXPECT(samples.m_id == id && samples.m_count == kSamples);
+        EXPECT(samples.m_samples[kSamples - 1] == kSamples - 1);
+    }
+
+    // notified once updates are durable
+    vector<DbSampleUpdate> batch;
+    for (auto && id : ids)
+        batch.push_back({id, start, -1});
+    TestDbDurable durable;
+    dbUpdateSamples(h, batch, &durable);
+    durable.wait();
+    dbGetSamples(&samples, h, ids.back(), start, start + kSamples * 1min);
+    EXPECT(samples.m_count == kSamples && samples.m_samples[0] == -1);
+
+    // updates held for a size target, written when closed
+    conf.walFlush = kWalFlushThroughput;
+    conf.walFlushBytes = 1'000'000;
+    conf.walFlushLatency = 1h;
+    dbConfigure(h, conf);
+    auto partials = perfValue("db.wal writes (partial)");
+    dbUpdateSample(h, ids[0], start + kSamples * 1min, kSamples);
+    this_thread::sleep_for(100ms);
+    EXPECT(perfValue("db.wal writes (partial)") == partials);
+    ctx.reset();
+    dbClose(h);
+    h = dbOpen(dat);
+    EXPECT(h && "Failure to reopen database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    dbGetSamples(&samples, h, ids[0], start, start + kSamples * 1min);
+    EXPECT(samples.m_count == kSamples + 1);
+
+    // recovered after a crash, which is simulated by copying the files while
+    // the database is open, with the updates since the last checkpoint only
+    // in the WAL and spread over many of its pages
+    conf = {};
+    conf.checkpointMaxInterval = 1h;
+    conf.checkpointMaxData = 1'000'000'000;
+    conf.walFlush = kWalFlushLowLatency;
+    dbConfigure(h, conf);
+    TestDbProgress blocker;
+    dbBlockCheckpoint(&blocker, h, true);
+    blocker.wait();
+    for (auto i = 0u; i < kSamples; ++i) {
+        for (auto && id : ids)
+            dbUpdateSample(h, id, start + i * 1min, i + 1000);
+    }
+    batch.clear();
+    batch.push_back({ids[0], start + kSamples * 1min, kSamples + 1000});
+    TestDbDurable logged;
+    dbUpdateSamples(h, batch, &logged);
+    logged.wait();
+    const char crashed[] = "test-crashed";
+    for (auto ext : { "tsd", "tsl" }) {
+        auto src = Path(dat).setExt(ext);
+        EXPECT(copyFile(Path(crashed).setExt(ext), src));
+    }
+    dbBlockCheckpoint(&blocker, h, false);
+    ctx.reset();
+    dbClose(h);
+    uint64_t walLen = 0;
+    fileSize(&walLen, Path(crashed).setExt("tsl"));
+    EXPECT(walLen > 4 * 0x1000);
+
+    h = dbOpen(crashed, fDbOpenVerifyPages);
+    EXPECT(h && "Failure to recover database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    for (auto && id : ids) {
+        dbGetSamples(&samples, h, id, start, start + kSamples * 1min);
+        auto count = id == ids[0] ? kSamples + 1 : kSamples;
+        EXPECT(samples.m_id == id && samples.m_count == count);
+        EXPECT(samples.m_samples[kSamples - 1] == kSamples + 999);
+    }
+    ctx.reset();
+    dbClose(h);
+}
+
+//===========================================================================
+void Test::indexTests() {
+    auto start = timeFromUnix(900'000'000);
+    const char dat[] = "test-index";
+    auto tsi = Path(dat).setExt("tsi");
+    auto staleTsi = Path("test-index-stale").setExt("tsi");
+    DbMetricInfo info;
+    TestDbSeries samples;
+    uint32_t found;
+
+    auto h = dbOpen(dat, fDbOpenCreat | fDbOpenTrunc, 128);
+    EXPECT(h && "Failure to create database");
+    if (!h)
+        return;
+    DbContext ctx(h);
+    uint32_t id;
+    dbInsertMetric(&id, h, "this.is.index.1");
+    info.type = kSampleTypeFloat32;
+    info.retention = 24h;
+    info.interval = 1min;
+    dbUpdateMetric(h, id, info);
+    for (auto i = 0; i < 20; ++i)
+        dbUpdateSample(h, id, start + i * 1min, i);
+    ctx.reset();
+    dbClose(h);
+
+    // metrics loaded from the snapshot saved on close
+    bool exists = false;
+    fileExists(&exists, tsi);
+    EXPECT(exists);
+    EXPECT(copyFile(staleTsi, tsi));
+    h = dbOpen(dat);
+    EXPECT(h && "Failure to reopen database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    EXPECT(dbFindMetric(&found, h, "this.is.index.1") && found == id);
+    dbGetSamples(&samples, h, id, start, start + 19min);
+    EXPECT(samples.m_count == 20 && samples.m_samples[19] == 19);
+
+    // changes the snapshot being put back won't have
+    uint32_t id2;
+    dbInsertMetric(&id2, h, "this.is.index.2");
+    dbUpdateMetric(h, id2, info);
+    dbUpdateSample(h, id2, start, 1);
+    dbUpdateSample(h, id, start + 20min, 20);
+    ctx.reset();
+    dbClose(h);
+
+    // stale snapshot ignored, metrics loaded from their pages instead
+    EXPECT(copyFile(tsi, staleTsi));
+    h = dbOpen(dat);
+    EXPECT(h && "Failure to reopen database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    auto stats = dbQueryStats(h);
+    EXPECT(stats.metrics == 2);
+    EXPECT(dbFindMetric(&found, h, "this.is.index.2") && found == id2);
+    dbGetSamples(&samples, h, id, start, start + 20min);
+    EXPECT(samples.m_count == 21 && samples.m_samples[20] == 20);
+    dbGetSamples(&samples, h, id2, start, start);
+    EXPECT(samples.m_count == 1 && samples.m_samples[0] == 1);
+    ctx.reset();
+    dbClose(h);
+}
+
+//===========================================================================
+void Test::compactTests() {
+    auto start = timeFromUnix(900'000'000);
+    const char dat[] = "test";
+    UnsignedSet found;
+    DbContext ctx;
+    DbMetricInfo info;
+    TestDbSeries samples;
+
+    // small views, so that the file can be truncated to less than a view
+    DbMapOptions mapOpts = { .viewSize = 0x1'0000 };
+    auto h = dbOpen(dat, {}, 0, mapOpts);
+    EXPECT(h && "Failure to reopen database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    dbFindMetrics(&found, h);
+    for (auto && id : found)
+        dbEraseMetric(h, id);
+    auto stats = dbQueryStats(h);
+    auto spp = stats.samplesPerPage[kSampleTypeFloat32];
+
+    // metrics at the end of the file, after the space of erased ones
+    vector<uint32_t> ids;
+    info.type = kSampleTypeFloat32;
+    info.retention = 4 * spp * 1min;
+    info.interval = 1min;
+    for (auto i = 0; i < 20; ++i) {
+        uint32_t id;
+        dbInsertMetric(&id, h, "this.is.compact." + to_string(i));
+        dbUpdateMetric(h, id, info);
+        for (unsigned j = 0; j < 2 * spp; ++j)
+            dbUpdateSample(h, id, start + j * 1min, j);
+        ids.push_back(id);
+    }
+    for (auto i = 0; i < 15; ++i)
+        dbEraseMetric(h, ids[i]);
+    ids.erase(ids.begin(), ids.begin() + 15);
+
+    // stopped once the pages are moved, without waiting for checkpoints to
+    // allow truncation
+    TestDbProgress progress;
+    progress.m_stopAfterMetrics = true;
+    EXPECT(dbCompact(&progress, h));
+    progress.wait();
+    EXPECT(progress.m_info.metrics == progress.m_info.totalMetrics);
+    auto n = 2 * spp;
+
+    // moved metrics are still found when read together
+    UnsignedSet moved;
+    for (auto && id : ids)
+        moved.insert(id);
+    TestDbSeriesList list;
+    dbGetSamplesMulti(&list, h, moved, start, start + n * 1min);
+    EXPECT(list.m_series.size() == moved.size());
+    for (auto && series : list.m_series) {
+        EXPECT(moved.contains(series.m_id));
+        EXPECT(series.m_count == n);
+    }
+    for (auto && id : ids) {
+        dbUpdateSample(h, id, start + n * 1min, n);
+        dbGetSamples(&samples, h, id, start, start + n * 1min);
+        EXPECT(samples.m_id == id && samples.m_count == n + 1);
+    }
+    ctx.reset();
+    dbClose(h);
+
+    h = dbOpen(dat, fDbOpenVerifyPages);
+    EXPECT(h && "Failure to reopen database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    stats = dbQueryStats(h);
+    EXPECT(stats.metrics == ids.size());
+    for (auto && id : ids) {
+        dbGetSamples(&samples, h, id, start, start + n * 1min);
+        EXPECT(samples.m_count == n + 1 && samples.m_samples[n] == n);
+    }
+    ctx.reset();
+    dbClose(h);
+}
+
+//===========================================================================
+void Test::backupTests() {
+    auto start = timeFromUnix(900'000'000);
+    const char dat[] = "test";
+    const string backups[] = { "test-backup", "test-backup-1" };
+    const char restored[] = "test-restored";
+    UnsignedSet found;
+    DbContext ctx;
+    TestDbSeries samples;
+
+    auto h = dbOpen(dat);
+    EXPECT(h && "Failure to reopen database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    dbFindMetrics(&found, h);
+    EXPECT(found);
+    if (!found)
+        return;
+    auto id = found.front();
+    dbGetSamples(&samples, h, id);
+    auto count = samples.m_count;
+    auto last = samples.m_first
+        + samples.m_samples.size() * samples.m_interval;
+
+    TestDbProgress full;
+    EXPECT(dbBackup(&full, h, backups[0]));
+    full.wait();
+    EXPECT(full.m_info.files == full.m_info.totalFiles);
+
+    // only the changed pages
+    dbUpdateSample(h, id, last, 1);
+    TestDbProgress incr;
+    EXPECT(dbBackupIncremental(&incr, h, backups[1], backups[0]));
+    incr.wait();
+    EXPECT(incr.m_info.files == incr.m_info.totalFiles);
+    uint64_t len = 0;
+    fileSize(&len, Path(backups[1]).setExt("tsb"));
+    uint64_t fullLen = 0;
+    fileSize(&fullLen, Path(backups[0]).setExt("tsd"));
+    EXPECT(len && len < fullLen);
+    ctx.reset();
+    dbClose(h);
+
+    // out of order
+    EXPECT(!dbRestore(restored, span(backups).subspan(1)));
+    EXPECT(dbRestore(restored, backups));
+    h = dbOpen(restored, fDbOpenVerifyPages);
+    EXPECT(h && "Failure to open restored database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    dbGetSamples(&samples, h, id);
+    EXPECT(samples.m_count == count + 1);
+    ctx.reset();
+    dbClose(h);
+
+    // copied while checkpoints write pages that the copy hasn't reached,
+    // whose earlier versions must be kept for it
+    const char busy[] = "test-busy";
+    const string busyBackups[] = { "test-busy-backup" };
+    const char busyRestored[] = "test-busy-restored";
+    const unsigned kMetrics = 20;
+    const unsigned kSamples = 5000;
+    h = dbOpen(busy, fDbOpenCreat | fDbOpenTrunc, 128);
+    EXPECT(h && "Failure to create database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    DbMetricInfo info;
+    info.type = kSampleTypeFloat32;
+    info.retention = 100h;
+    info.interval = 1min;
+    vector<uint32_t> ids;
+    vector<DbSampleUpdate> batch;
+    for (auto i = 0u; i < kMetrics; ++i) {
+        uint32_t mid;
+        dbInsertMetric(&mid, h, "this.is.busy." + to_string(i));
+        dbUpdateMetric(h, mid, info);
+        ids.push_back(mid);
+        for (auto j = 0u; j < kSamples; ++j)
+            batch.push_back({mid, start + j * 1min, (double) j});
+    }
+    TestDbDurable loaded;
+    dbUpdateSamples(h, batch, &loaded);
+    loaded.wait();
+    DbConfig conf = {};
+    conf.checkpointMaxData = 0x1'0000;
+    dbConfigure(h, conf);
+
+    TestDbProgress paused;
+    paused.m_pausePages = true;
+    EXPECT(dbBackup(&paused, h, busyBackups[0]));
+    EXPECT(paused.waitPaused());
+    for (auto round = 0u; round < 3; ++round) {
+        // change every sample page, then wait out a checkpoint
+        batch.clear();
+        for (auto && mid : ids) {
+            for (auto j = 0u; j < kSamples; j += 10)
+                batch.push_back({mid, start + j * 1min, -1});
+            batch.push_back({mid, start + (kSamples + round) * 1min, -1});
+        }
+        TestDbDurable changed;
+        dbUpdateSamples(h, batch, &changed);
+        changed.wait();
+        TestDbProgress checkpointed;
+        dbBlockCheckpoint(&checkpointed, h, true);
+        checkpointed.wait();
+        dbBlockCheckpoint(&checkpointed, h, false);
+    }
+    paused.resume();
+    paused.wait();
+    EXPECT(paused.m_info.files == paused.m_info.totalFiles);
+    ctx.reset();
+    dbClose(h);
+
+    // restored as it was when the backup started
+    EXPECT(dbRestore(busyRestored, busyBackups));
+    h = dbOpen(busyRestored, fDbOpenVerifyPages);
+    EXPECT(h && "Failure to open restored database");
+    if (!h)
+        return;
+    ctx.reset(h);
+    for (auto && mid : ids) {
+        dbGetSamples(&samples, h, mid, start, start + (kSamples + 2) * 1min);
+        EXPECT(samples.m_count == kSamples);
+        EXPECT(samples.m_samples[0] == 0);
+        EXPECT(samples.m_samples[kSamples - 1] == kSamples - 1);
+    }
+    TestDbProgress scrubbed;
+    EXPECT(dbScrub(&scrubbed, h, 0x1000'0000));
+    scrubbed.wait();
+    EXPECT(scrubbed.m_info.pages && !scrubbed.m_info.badPages);
     ctx.reset();
     dbClose(h);
 }
@@ -424,11 +1547,102 @@ void Test::readonlyTests() {
     dbClose(h);
 }
 
+//===========================================================================
+void Test::followTests() {
+    auto start = timeFromUnix(900'000'000);
+    const char dat[] = "test-follow";
+    const unsigned kSamples = 500;
+    DbMetricInfo info;
+    TestDbSeries samples;
+
+    auto h = dbOpen(dat, fDbOpenCreat | fDbOpenTrunc, 128);
+    EXPECT(h && "Failure to create database");
+    if (!h)
+        return;
+    DbContext ctx(h);
+    uint32_t id;
+    dbInsertMetric(&id, h, "this.is.follow.1");
+    info.type = kSampleTypeFloat32;
+    info.retention = 24h;
+    info.interval = 1min;
+    dbUpdateMetric(h, id, info);
+    DbConfig conf = {};
+    conf.checkpointMaxData = 0x1'0000;
+    conf.walFlush = kWalFlushLowLatency;
+    dbConfigure(h, conf);
+
+    // Changes every sample, then waits for them to be durable and for a
+    // checkpoint to save the pages, usually before they're followed.
+    auto update = [&](double base) {
+        vector<DbSampleUpdate> batch;
+        for (auto i = 0u; i < kSamples; ++i)
+            batch.push_back({id, start + i * 1min, base + i});
+        TestDbDurable durable;
+        dbUpdateSamples(h, batch, &durable);
+        durable.wait();
+        TestDbProgress checkpointed;
+        dbBlockCheckpoint(&checkpointed, h, true);
+        checkpointed.wait();
+        dbBlockCheckpoint(&checkpointed, h, false);
+    };
+    update(0);
+
+    auto f = dbOpen(dat, fDbOpenFollow);
+    EXPECT(f && "Failure to open database to follow");
+    if (!f) {
+        ctx.reset();
+        dbClose(h);
+        return;
+    }
+    DbContext fctx(f);
+    uint32_t found = 0;
+    EXPECT(dbFindMetric(&found, f, "this.is.follow.1") && found == id);
+    dbGetSamples(&samples, f, id, start, start + kSamples * 1min);
+    EXPECT(samples.m_count == kSamples && samples.m_samples[0] == 0);
+
+    // followed while the writer saves pages ahead of the follower, with every
+    // read seeing each sample either from before or after the round, and
+    // none from after unless the last one is
+    for (auto round = 1u; round <= 3; ++round) {
+        auto base = 1000.0 * round;
+        update(base);
+        bool caughtUp = false;
+        for (auto tries = 0; tries < 100 && !caughtUp; ++tries) {
+            if (tries)
+                this_thread::sleep_for(100ms);
+            dbGetSamples(&samples, f, id, start, start + kSamples * 1min);
+            EXPECT(samples.m_count == kSamples);
+            caughtUp = samples.m_samples[kSamples - 1] == base + kSamples - 1;
+            for (auto i = 0u; i < kSamples; ++i) {
+                auto val = samples.m_samples[i] - i;
+                EXPECT(val == base || (!caughtUp && val == base - 1000));
+            }
+        }
+        EXPECT(caughtUp);
+    }
+    fctx.reset();
+    dbClose(f);
+    ctx.reset();
+    dbClose(h);
+}
+
 //===========================================================================
 void Test::onTestRun() {
     invalidFileTests();
     dataTests();
     queryTests();
     sampleTests();
+    packedTests();
+    runsTests();
+    snapshotTests();
+    rollupTests();
+    lazyTests();
+    mapTests();
+    scrubTests();
+    walTests();
+    indexTests();
+    compactTests();
+    backupTests();
     readonlyTests();
+    followTests();
 }
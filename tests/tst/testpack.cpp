@@ -84,4 +84,34 @@ void Test::onTestRun() {
     EXPECT(unpack->value == 7.0);
     ++unpack;
     EXPECT(!unpack);
+
+    // Real timestamps with irregular intervals and values using the full
+    // mantissa, packed across calls by resuming from the previous state.
+    buf.assign(1000, 0);
+    vector<DbSample> samples;
+    auto time = timeFromUnix(1'700'000'000);
+    for (auto i = 0; i < 40; ++i) {
+        time += i % 3 ? 60s : 61s + i * 1ms;
+        samples.push_back({time, i % 5 ? 1.0 / (i + 3) : -1e300 * i});
+    }
+    size_t used = 0;
+    uint8_t unusedBits = 0;
+    DbPackState state;
+    for (auto && samp : samples) {
+        DbPack rpack(buf.data() + used, 100, unusedBits, state);
+        EXPECT(rpack.put(samp.time, samp.value));
+        used += rpack.size();
+        unusedBits = rpack.unusedBits();
+        state = rpack.state();
+    }
+    auto matched = 0;
+    for (auto && samp : DbUnpackIter(buf.data(), used, unusedBits)) {
+        if (matched < samples.size()
+            && samp.time == samples[matched].time
+            && samp.value == samples[matched].value
+        ) {
+            matched += 1;
+        }
+    }
+    EXPECT(matched == samples.size());
 }
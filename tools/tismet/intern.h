@@ -12,9 +12,13 @@ void tsPerfInitialize();
 
 // Data
 void tsDataInitialize();
-void tsDataBackup(IDbProgressNotify * notify);
+void tsDataBackup(IDbProgressNotify * notify, bool incremental);
+void tsDataScrub(IDbProgressNotify * notify);
+void tsDataCompact(IDbProgressNotify * notify);
 DbHandle tsDataHandle();
 const Dim::Path & tsDataPath();
+// True if the database is updated by another instance that's being followed
+bool tsDataFollowing();
 
 // Returns false if the metric is not being stored
 bool tsDataInsertMetric(
@@ -25,7 +29,15 @@ bool tsDataInsertMetric(
 
 // Backup
 void tsBackupInitialize();
-void tsBackupStart();
+void tsBackupStart(bool incremental);
+
+// Data file checksum verification
+void tsScrubInitialize();
+void tsScrubStart();
+
+// Data file compaction
+void tsCompactInitialize();
+void tsCompactStart();
 
 // Carbon
 void tsCarbonInitialize();
@@ -75,6 +75,7 @@ void BackupProgress::buildResponse(
     addInfoElem(bld, "Metrics", info.metrics, info.totalMetrics);
     addInfoElem(bld, "Samples", info.samples, info.totalSamples);
     addInfoElem(bld, "Bytes", info.bytes, info.totalBytes);
+    addInfoElem(bld, "Pages", info.pages, info.totalPages);
     bld.end();
 }
 
@@ -144,7 +145,12 @@ class BackupStart : public IHttpRouteNotify {
 
 //===========================================================================
 void BackupStart::onHttpRequest(unsigned reqId, HttpRequest & req) {
-    tsBackupStart();
+    bool incremental = false;
+    for (auto && param : req.query().parameters) {
+        if (param.name == "incremental")
+            incremental = true;
+    }
+    tsBackupStart(incremental);
     s_progress.replyStatus(reqId, true);
 }
 
@@ -192,6 +198,6 @@ void tsBackupInitialize() {
 }
 
 //===========================================================================
-void tsBackupStart() {
-    tsDataBackup(&s_progress);
+void tsBackupStart(bool incremental) {
+    tsDataBackup(&s_progress, incremental);
 }
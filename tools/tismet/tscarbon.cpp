@@ -16,6 +16,7 @@ using namespace Dim;
 ***/
 
 static SockMgrHandle s_mgr;
+static bool s_durableAck;
 static auto & s_perfTasks = uperf("db.update tasks");
 
 
@@ -27,35 +28,31 @@ static auto & s_perfTasks = uperf("db.update tasks");
 
 namespace {
 
+// Values from a single carbon request, added to the database as a batch.
 class CarbonTask : public ITaskNotify {
 public:
-    CarbonTask(unsigned reqId, string_view name, TimePoint time, double value);
+    CarbonTask(unsigned reqId);
     ~CarbonTask();
 
+    unsigned reqId() const { return m_reqId; }
+    void add(string_view name, TimePoint time, double value);
+
     // Inherited via ITaskNotify
     void onTask() override;
 
 private:
     unsigned m_reqId;
-    unique_ptr<char[]> m_name;
-    TimePoint m_time;
-    double m_value;
+    bool m_updated{false};
+    string m_names; // null separated
+    vector<DbSampleUpdate> m_samples;
 };
 
 } // namespace
 
 
 //===========================================================================
-CarbonTask::CarbonTask(
-    unsigned reqId,
-    string_view name,
-    TimePoint time,
-    double value
-)
+CarbonTask::CarbonTask(unsigned reqId)
     : m_reqId{reqId}
-    , m_name{strDup(name)}
-    , m_time{time}
-    , m_value{value}
 {
     s_perfTasks += 1;
 }
@@ -65,20 +62,44 @@ CarbonTask::~CarbonTask() {
     s_perfTasks -= 1;
 }
 
+//===========================================================================
+void CarbonTask::add(string_view name, TimePoint time, double value) {
+    m_names.append(name);
+    m_names.push_back('\0');
+    m_samples.push_back({0, time, value});
+}
+
 //===========================================================================
 void CarbonTask::onTask() {
-    if (auto name = m_name.get()) {
+    if (!m_updated) {
         auto f = tsDataHandle();
         DbContext ctx(f);
-        uint32_t id;
-        if (tsDataInsertMetric(&id, f, name))
-            dbUpdateSample(f, id, m_time, m_value);
-        m_name.reset();
-        taskPushEvent(this);
+        auto name = m_names.data();
+        auto out = m_samples.begin();
+        for (auto && samp : m_samples) {
+            if (tsDataInsertMetric(&samp.id, f, name))
+                *out++ = samp;
+            name += strlen(name) + 1;
+        }
+        m_updated = true;
+        if (s_durableAck) {
+            // Delay the ack, and with it further reads from the producer,
+            // until the updates are durable. The ack may run before the
+            // update returns, so this task must not be touched after.
+            dbUpdateSamples(
+                f,
+                {m_samples.begin(), out},
+                this,
+                taskEventQueue()
+            );
+        } else {
+            dbUpdateSamples(f, {m_samples.begin(), out});
+            taskPushEvent(this);
+        }
         return;
     }
 
-    carbonAckValue(m_reqId, 1);
+    carbonAckValue(m_reqId, (unsigned) m_samples.size());
     delete this;
 }
 
@@ -93,6 +114,7 @@ namespace {
 
 class CarbonConn : public ICarbonSocketNotify {
     string m_buf;
+    CarbonTask * m_task{};
 public:
     // Inherited via ICarbonSocketNotify
     bool onCarbonValue(
@@ -102,6 +124,7 @@ public:
         double value,
         uint32_t idHint
     ) override;
+    void onCarbonValuesEnd() override;
 };
 
 } // namespace
@@ -114,11 +137,43 @@ bool CarbonConn::onCarbonValue(
     double value,
     uint32_t idHint
 ) {
-    auto task = new CarbonTask(reqId, name, time, value);
-    taskPushCompute(task);
+    if (!m_task)
+        m_task = new CarbonTask(reqId);
+    assert(m_task->reqId() == reqId);
+    m_task->add(name, time, value);
     return false;
 }
 
+//===========================================================================
+void CarbonConn::onCarbonValuesEnd() {
+    if (m_task) {
+        taskPushCompute(m_task);
+        m_task = nullptr;
+    }
+}
+
+
+/****************************************************************************
+*
+*   app.xml monitor
+*
+***/
+
+namespace {
+
+class AppXmlNotify : public IConfigNotify {
+    void onConfigChange(const XDocument & doc) override;
+};
+
+} // namespace
+
+static AppXmlNotify s_appXml;
+
+//===========================================================================
+void AppXmlNotify::onConfigChange(const XDocument & doc) {
+    s_durableAck = configNumber(doc, "CarbonDurableAck") != 0;
+}
+
 
 /****************************************************************************
 *
@@ -152,6 +207,7 @@ void ShutdownNotify::onShutdownClient(bool firstTry) {
 //===========================================================================
 void tsCarbonInitialize() {
     shutdownMonitor(&s_cleanup);
+    configMonitor("app.xml", &s_appXml);
     carbonInitialize();
     s_mgr = sockMgrListen(
         "carbon",
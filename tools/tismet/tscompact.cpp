@@ -0,0 +1,120 @@
+// Copyright Glen Knowles 2023.
+// Distributed under the Boost Software License, Version 1.0.
+//
+// tscompact.cpp - tismet
+#include "pch.h"
+#pragma hdrstop
+
+using namespace std;
+using namespace std::chrono;
+using namespace Dim;
+
+
+/****************************************************************************
+*
+*   CompactProgress
+*
+***/
+
+namespace {
+
+class CompactProgress : public IDbProgressNotify {
+public:
+    void write(IJBuilder * out) const;
+
+private:
+    bool onDbProgress(RunMode mode, const DbProgressInfo & info) override;
+
+    RunMode m_mode{kRunStopped};
+    DbProgressInfo m_info{};
+    TimePoint m_time;
+    mutable mutex m_mut;
+};
+
+} // namespace
+
+static CompactProgress s_progress;
+
+//===========================================================================
+void CompactProgress::write(IJBuilder * out) const {
+    scoped_lock lk{m_mut};
+    out->member("status", toString(m_mode));
+    if (!empty(m_time))
+        out->member("time", Time8601Str(m_time, 3).c_str());
+    out->member("pages", m_info.pages);
+    if (m_info.totalPages != size_t(-1))
+        out->member("totalPages", m_info.totalPages);
+    out->member("metrics", m_info.metrics);
+    if (m_info.totalMetrics != size_t(-1))
+        out->member("totalMetrics", m_info.totalMetrics);
+}
+
+//===========================================================================
+bool CompactProgress::onDbProgress(
+    RunMode mode,
+    const DbProgressInfo & info
+) {
+    scoped_lock lk{m_mut};
+    m_mode = mode;
+    m_info = info;
+    m_time = timeNow();
+    return true;
+}
+
+
+/****************************************************************************
+*
+*   JsonCompact
+*
+***/
+
+namespace {
+
+class JsonCompact : public IWebAdminNotify {
+public:
+    explicit JsonCompact(bool start) : m_start(start) {}
+
+private:
+    void onHttpRequest(unsigned reqId, HttpRequest & msg) override;
+
+    bool m_start;
+};
+
+} // namespace
+
+//===========================================================================
+void JsonCompact::onHttpRequest(unsigned reqId, HttpRequest & msg) {
+    if (m_start)
+        tsCompactStart();
+
+    auto res = HttpResponse(kHttpStatusOk);
+    auto bld = initResponse(&res, reqId, msg);
+    s_progress.write(&bld);
+    bld.end();
+    httpRouteReply(reqId, move(res));
+}
+
+
+/****************************************************************************
+*
+*   Public API
+*
+***/
+
+static JsonCompact s_jsonCompact{false};
+static JsonCompact s_jsonCompactStart{true};
+
+//===========================================================================
+void tsCompactInitialize() {
+    httpRouteAdd({.notify = &s_jsonCompact, .path = "/srv/compact.json"});
+    httpRouteAdd({
+        .notify = &s_jsonCompactStart,
+        .path = "/srv/compact.json",
+        .methods = fHttpMethodPost
+    });
+}
+
+//===========================================================================
+void tsCompactStart() {
+    tsDataCompact(&s_progress);
+}
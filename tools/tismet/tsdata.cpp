@@ -17,6 +17,10 @@ using namespace Dim;
 ***/
 
 static DbHandle s_db;
+static DbMapOptions s_mapOpts;
+static bool s_verifyPages;
+static bool s_follow;
+static size_t s_scrubBytesPerSec;
 static auto & s_perfExpired = uperf("db.metrics expired");
 static auto & s_perfIgnored = uperf("db.samples ignored (rule)");
 
@@ -34,6 +38,7 @@ struct MetricRule {
     Duration retention;
     Duration interval;
     DbSampleType type;
+    vector<DbMetricRollup> rollups;
 };
 
 } // namespace
@@ -135,14 +140,60 @@ class AppXmlNotify : public IConfigNotify {
 
 static AppXmlNotify s_appXml;
 
+//===========================================================================
+static DbMapAccess configMapAccess(const XDocument & doc, string_view name) {
+    string_view val = attrValue(configElement(doc, name), "value", "");
+    if (val == "random")
+        return kMapAccessRandom;
+    if (val == "sequential")
+        return kMapAccessSequential;
+    if (val == "default")
+        return kMapAccessDefault;
+    if (!val.empty())
+        logMsgError() << "Invalid " << name << ", " << val;
+    return kMapAccessUnset;
+}
+
+//===========================================================================
+static DbWalFlush configWalFlush(const XDocument & doc, string_view name) {
+    string_view val = attrValue(configElement(doc, name), "value", "");
+    if (val == "low-latency")
+        return kWalFlushLowLatency;
+    if (val == "throughput")
+        return kWalFlushThroughput;
+    if (val == "fixed-latency")
+        return kWalFlushFixedLatency;
+    if (!val.empty())
+        logMsgError() << "Invalid " << name << ", " << val;
+    return kWalFlushDefault;
+}
+
 //===========================================================================
 void AppXmlNotify::onConfigChange(const XDocument & doc) {
+    // Mapping options only take effect when the database is opened, except
+    // for the access hints.
+    s_mapOpts.viewSize = (size_t) configNumber(doc, "MapViewSize");
+    s_mapOpts.populate = configNumber(doc, "MapPopulate") != 0;
+    s_mapOpts.hugePages = configNumber(doc, "MapHugePages") != 0;
+    s_mapOpts.dataAccess = configMapAccess(doc, "MapDataAccess");
+    s_mapOpts.workAccess = configMapAccess(doc, "MapWorkAccess");
+    s_verifyPages = configNumber(doc, "VerifyPages") != 0;
+    s_follow = configNumber(doc, "Follow") != 0;
+    s_scrubBytesPerSec = (size_t) configNumber(doc, "ScrubMaxBytesPerSec");
+
     if (s_db) {
-        DbConfig conf;
+        DbConfig conf = {};
         conf.checkpointMaxData =
             (size_t) configNumber(doc, "CheckpointMaxData");
         conf.checkpointMaxInterval =
             configDuration(doc, "CheckpointMaxInterval");
+        conf.maxLoadedMetrics =
+            (size_t) configNumber(doc, "MaxLoadedMetrics");
+        conf.walFlush = configWalFlush(doc, "WalFlush");
+        conf.walFlushLatency = configDuration(doc, "WalFlushLatency");
+        conf.walFlushBytes = (size_t) configNumber(doc, "WalFlushBytes");
+        conf.dataAccess = s_mapOpts.dataAccess;
+        conf.workAccess = s_mapOpts.workAccess;
         dbConfigure(s_db, conf);
     }
 
@@ -152,7 +203,7 @@ void AppXmlNotify::onConfigChange(const XDocument & doc) {
     // of 0 (disable checking) is also allowed.
     if (val.count())
         val = clamp(val, Duration{5min}, Duration{168h});
-    if (!s_db)
+    if (!s_db || s_follow)
         val = 0ms;
     s_expireTimer.updateInterval(val);
 
@@ -183,7 +234,18 @@ void AppXmlNotify::onConfigChange(const XDocument & doc) {
         } else {
             (void) parse(&rule.interval, attrValue(&xrule, "interval", ""));
         }
-        s_rules.push_back(rule);
+        for (auto && xrollup : elems(&xrule, "Rollup")) {
+            auto & rollup = rule.rollups.emplace_back();
+            (void) parse(
+                &rollup.retention,
+                attrValue(&xrollup, "retention", "")
+            );
+            (void) parse(
+                &rollup.interval,
+                attrValue(&xrollup, "interval", "")
+            );
+        }
+        s_rules.push_back(move(rule));
     }
 }
 
@@ -228,7 +290,16 @@ void tsDataInitialize() {
     shutdownMonitor(&s_cleanup);
     configMonitor("app.xml", &s_appXml);
     appDataPath(&s_dbPath, "metrics");
-    s_db = dbOpen(s_dbPath, fDbOpenVerbose | fDbOpenCreat, 512);
+    EnumFlags<DbOpenFlags> flags =
+        fDbOpenVerbose | fDbOpenCreat | fDbOpenLazyMetrics;
+    if (s_follow) {
+        // Serve queries from the database of another instance, as it's
+        // updated.
+        flags = fDbOpenVerbose | fDbOpenFollow;
+    }
+    if (s_verifyPages)
+        flags |= fDbOpenVerifyPages;
+    s_db = dbOpen(s_dbPath, flags, 512, s_mapOpts);
     if (!s_db) {
         logMsgError() << "Unable to open database, " << s_dbPath;
         return appSignalShutdown(EX_DATAERR);
@@ -237,10 +308,52 @@ void tsDataInitialize() {
 }
 
 //===========================================================================
-void tsDataBackup(IDbProgressNotify * notify) {
+// Full backups are saved as "backup/metrics", and the chain of incremental
+// backups that follow it as "backup/metrics-1", "backup/metrics-2", etc.
+void tsDataBackup(IDbProgressNotify * notify, bool incremental) {
     Path path;
     appDataPath(&path, "backup/metrics");
-    dbBackup(notify, s_db, path);
+    // Returns the number of incremental backups in the chain.
+    auto countIncrementals = [&]() {
+        unsigned num = 0;
+        for (;; ++num) {
+            bool found = false;
+            auto next = Path(path.str() + "-" + to_string(num + 1));
+            if (fileExists(&found, next.setExt("tsb")); !found)
+                return num;
+        }
+    };
+    auto num = countIncrementals();
+    if (incremental) {
+        auto prev = num ? path.str() + "-" + to_string(num) : path.str();
+        auto dst = path.str() + "-" + to_string(num + 1);
+        dbBackupIncremental(notify, s_db, dst, prev);
+        return;
+    }
+
+    if (!dbBackup(notify, s_db, path))
+        return;
+    // Incremental backups of the replaced full backup can no longer be
+    // restored.
+    for (; num; --num) {
+        auto stem = Path(path.str() + "-" + to_string(num));
+        fileRemove(stem.setExt("tsb"));
+        fileRemove(stem.setExt("tsl"));
+    }
+}
+
+//===========================================================================
+void tsDataScrub(IDbProgressNotify * notify) {
+    dbScrub(notify, s_db, s_scrubBytesPerSec);
+}
+
+//===========================================================================
+void tsDataCompact(IDbProgressNotify * notify) {
+    if (s_follow) {
+        logMsgError() << "Followed database can't be compacted";
+        return;
+    }
+    dbCompact(notify, s_db);
 }
 
 //===========================================================================
@@ -249,9 +362,18 @@ DbHandle tsDataHandle() {
     return s_db;
 }
 
+//===========================================================================
+bool tsDataFollowing() {
+    return s_follow;
+}
+
 //===========================================================================
 bool tsDataInsertMetric(uint32_t * id, DbHandle f, string_view name) {
     assert(f);
+    if (s_follow) {
+        // Metrics are only added by the instance being followed.
+        return false;
+    }
     if (dbFindMetric(id, f, name))
         return true;
 
@@ -263,6 +385,7 @@ bool tsDataInsertMetric(uint32_t * id, DbHandle f, string_view name) {
             info.type = rule.type;
             info.retention = rule.retention;
             info.interval = rule.interval;
+            info.rollups = rule.rollups;
             break;
         }
     }
@@ -103,9 +103,12 @@ void InitializeTask::onTask() {
     if (!appStopping()) {
         evalInitialize(tsDataHandle());
         tsPerfInitialize();
-        tsCarbonInitialize();
+        if (!tsDataFollowing())
+            tsCarbonInitialize();
         tsGraphiteInitialize();
         tsBackupInitialize();
+        tsScrubInitialize();
+        tsCompactInitialize();
         logMsgInfo() << "Server ready";
     }
     m_ready = true;
@@ -32,6 +32,7 @@ class SampleTimer : public ITimerNotify, ITaskNotify {
     void onTask() override;
 
     vector<PerfValue> m_vals;
+    vector<DbSampleUpdate> m_samples;
     string m_tmp;
 };
 
@@ -63,6 +64,7 @@ void SampleTimer::onTask() {
     auto f = tsDataHandle();
     DbContext ctx(f);
     perfGetValues(&m_vals);
+    m_samples.clear();
     for (auto && val : m_vals) {
         m_tmp.reserve(val.name.size() + size(s_prefix));
         m_tmp.assign(s_prefix);
@@ -89,8 +91,9 @@ void SampleTimer::onTask() {
             break;
         }
         dbUpdateMetric(f, id, info);
-        dbUpdateSample(f, id, now, val.raw);
+        m_samples.push_back({id, now, val.raw});
     }
+    dbUpdateSamples(f, m_samples);
     now = timeNow();
     auto wait = ceil<SampleInterval>(now) - now;
     timerUpdate(this, wait);
@@ -0,0 +1,118 @@
+// Copyright Glen Knowles 2023.
+// Distributed under the Boost Software License, Version 1.0.
+//
+// tsscrub.cpp - tismet
+#include "pch.h"
+#pragma hdrstop
+
+using namespace std;
+using namespace std::chrono;
+using namespace Dim;
+
+
+/****************************************************************************
+*
+*   ScrubProgress
+*
+***/
+
+namespace {
+
+class ScrubProgress : public IDbProgressNotify {
+public:
+    void write(IJBuilder * out) const;
+
+private:
+    bool onDbProgress(RunMode mode, const DbProgressInfo & info) override;
+
+    RunMode m_mode{kRunStopped};
+    DbProgressInfo m_info{};
+    TimePoint m_time;
+    mutable mutex m_mut;
+};
+
+} // namespace
+
+static ScrubProgress s_progress;
+
+//===========================================================================
+void ScrubProgress::write(IJBuilder * out) const {
+    scoped_lock lk{m_mut};
+    out->member("status", toString(m_mode));
+    if (!empty(m_time))
+        out->member("time", Time8601Str(m_time, 3).c_str());
+    out->member("pages", m_info.pages);
+    if (m_info.totalPages != size_t(-1))
+        out->member("totalPages", m_info.totalPages);
+    out->member("badPages", m_info.badPages);
+    out->member("bytes", m_info.bytes);
+    if (m_info.totalBytes != size_t(-1))
+        out->member("totalBytes", m_info.totalBytes);
+}
+
+//===========================================================================
+bool ScrubProgress::onDbProgress(RunMode mode, const DbProgressInfo & info) {
+    scoped_lock lk{m_mut};
+    m_mode = mode;
+    m_info = info;
+    m_time = timeNow();
+    return true;
+}
+
+
+/****************************************************************************
+*
+*   JsonScrub
+*
+***/
+
+namespace {
+
+class JsonScrub : public IWebAdminNotify {
+public:
+    explicit JsonScrub(bool start) : m_start(start) {}
+
+private:
+    void onHttpRequest(unsigned reqId, HttpRequest & msg) override;
+
+    bool m_start;
+};
+
+} // namespace
+
+//===========================================================================
+void JsonScrub::onHttpRequest(unsigned reqId, HttpRequest & msg) {
+    if (m_start)
+        tsScrubStart();
+
+    auto res = HttpResponse(kHttpStatusOk);
+    auto bld = initResponse(&res, reqId, msg);
+    s_progress.write(&bld);
+    bld.end();
+    httpRouteReply(reqId, move(res));
+}
+
+
+/****************************************************************************
+*
+*   Public API
+*
+***/
+
+static JsonScrub s_jsonScrub{false};
+static JsonScrub s_jsonScrubStart{true};
+
+//===========================================================================
+void tsScrubInitialize() {
+    httpRouteAdd({.notify = &s_jsonScrub, .path = "/srv/scrub.json"});
+    httpRouteAdd({
+        .notify = &s_jsonScrubStart,
+        .path = "/srv/scrub.json",
+        .methods = fHttpMethodPost
+    });
+}
+
+//===========================================================================
+void tsScrubStart() {
+    tsDataScrub(&s_progress);
+}
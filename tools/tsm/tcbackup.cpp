@@ -22,6 +22,7 @@ struct CmdOpts {
     string oaddr;
     bool wait;
     bool start;
+    bool incremental;
 
     CmdOpts();
 };
@@ -156,7 +157,10 @@ void AddrConn::onSocketConnect(const AppSocketConnectInfo & info) {
         req.addHeaderRef(kHttp_Scheme, "http");
         req.addHeaderRef(kHttp_Authority, s_opts.oaddr.c_str());
         req.addHeaderRef(kHttp_Method, "POST");
-        req.addHeaderRef(kHttp_Path, "/backup");
+        req.addHeaderRef(
+            kHttp_Path,
+            s_opts.incremental ? "/backup?incremental" : "/backup"
+        );
         m_streamId = httpRequest(&out, m_conn, req);
         socketWrite(this, out);
     }
@@ -288,6 +292,8 @@ CmdOpts::CmdOpts() {
         .desc("Wait for backup to finish before returning.");
     cli.opt(&start, "start", true)
         .desc("Start backup (unless it's already running).");
+    cli.opt(&incremental, "incremental")
+        .desc("Only save data pages changed since the previous backup.");
 }
 
 //===========================================================================
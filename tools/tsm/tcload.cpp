@@ -9,6 +9,17 @@ using namespace std;
 using namespace Dim;
 
 
+/****************************************************************************
+*
+*   Tuning parameters
+*
+***/
+
+// Number of samples to collect before writing them to the database as a
+// batch.
+const size_t kMaxBatchSamples = 10'000;
+
+
 /****************************************************************************
 *
 *   Declarations
@@ -89,9 +100,12 @@ public:
     void onDumpEnd() override;
 
 private:
+    void flushSamples();
+
     uint32_t m_id{0};
     TimePoint m_time;
     Duration m_interval;
+    vector<DbSampleUpdate> m_samples;
 };
 
 } // namespace
@@ -300,6 +314,7 @@ bool DbWriter::onDumpSeries(const DbSeriesInfoEx & ex) {
     if (appStopping())
         return false;
 
+    flushSamples();
     dbInsertMetric(&m_id, s_db, ex.name);
     DbMetricInfo info;
     info.creation = ex.creation;
@@ -314,13 +329,16 @@ bool DbWriter::onDumpSeries(const DbSeriesInfoEx & ex) {
 
 //===========================================================================
 bool DbWriter::onDumpSample(double value) {
-    dbUpdateSample(s_db, m_id, m_time, value);
+    m_samples.push_back({m_id, m_time, value});
+    if (m_samples.size() >= kMaxBatchSamples)
+        flushSamples();
     m_time += m_interval;
     return true;
 }
 
 //===========================================================================
 void DbWriter::onDumpEnd() {
+    flushSamples();
     dbClose(s_db);
     s_db = {};
     if (logGetMsgCount(kLogTypeError)) {
@@ -331,6 +349,14 @@ void DbWriter::onDumpEnd() {
     }
 }
 
+//===========================================================================
+void DbWriter::flushSamples() {
+    if (!m_samples.empty()) {
+        dbUpdateSamples(s_db, m_samples);
+        m_samples.clear();
+    }
+}
+
 
 /****************************************************************************
 *
@@ -0,0 +1,93 @@
+// Copyright Glen Knowles 2023.
+// Distributed under the Boost Software License, Version 1.0.
+//
+// tcrestore.cpp - tsm
+#include "pch.h"
+#pragma hdrstop
+
+using namespace std;
+using namespace Dim;
+
+
+/****************************************************************************
+*
+*   Declarations
+*
+***/
+
+namespace {
+
+struct CmdOpts {
+    Path database;
+    vector<string> backups;
+
+    CmdOpts();
+};
+
+} // namespace
+
+
+/****************************************************************************
+*
+*   Variables
+*
+***/
+
+static CmdOpts s_opts;
+
+
+/****************************************************************************
+*
+*   Command line
+*
+***/
+
+static void restoreCmd(Cli & cli);
+
+//===========================================================================
+CmdOpts::CmdOpts() {
+    Cli cli;
+    cli.command("restore")
+        .desc("Create metrics database from a chain of backups.")
+        .action(restoreCmd);
+    cli.opt(&database, "<database>")
+        .desc("Database to create, replacing any that already exists.");
+    cli.optVec(&backups, "<backup>")
+        .desc("Full backup followed by the incremental backups made after it, "
+            "in the order they were made, all without extensions.");
+}
+
+
+/****************************************************************************
+*
+*   Restore command
+*
+***/
+
+//===========================================================================
+static void restoreCmd(Cli & cli) {
+    tcLogStart();
+    logMsgInfo() << "Restoring " << s_opts.database << " from "
+        << s_opts.backups.size() << " backups";
+    if (!dbRestore(s_opts.database, s_opts.backups)) {
+        return cli.fail(
+            EX_DATAERR,
+            s_opts.database.str() + ": restore failed"
+        );
+    }
+
+    // Opening the restored database recovers it from the WAL of the last
+    // backup.
+    auto h = dbOpen(s_opts.database, fDbOpenVerbose);
+    if (!h) {
+        return cli.fail(
+            EX_DATAERR,
+            s_opts.database.str() + ": malformed database"
+        );
+    }
+    DbProgressInfo info = {};
+    info.metrics = dbQueryStats(h).metrics;
+    info.files = s_opts.backups.size();
+    dbClose(h);
+    tcLogShutdown(&info);
+}
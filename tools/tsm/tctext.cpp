@@ -95,6 +95,10 @@ private:
         Duration retention,
         Duration interval
     ) override;
+    void onWalApplyMetricUpdateBackfill(
+        void * ptr,
+        TimePoint backfill
+    ) override;
     void onWalApplyMetricClearSamples(void * ptr) override;
     void onWalApplyMetricUpdateSamples(
         void * ptr,
@@ -119,6 +123,45 @@ private:
         bool updateLast
     ) override;
     void onWalApplySampleUpdateTime(void * ptr, TimePoint pageTime) override;
+    void onWalApplySampleUpdateRange(
+        void * ptr,
+        size_t firstPos,
+        std::span<const uint8_t> values,
+        bool updateLast
+    ) override;
+    void onWalApplySamplePackInit(
+        void * ptr,
+        uint32_t id,
+        TimePoint pageTime,
+        Duration interval,
+        size_t lastSample,
+        double fill
+    ) override;
+    void onWalApplySamplePackAppend(
+        void * ptr,
+        size_t pos,
+        double value
+    ) override;
+    void onWalApplySamplePackUpdate(
+        void * ptr,
+        size_t pos,
+        double value
+    ) override;
+    void onWalApplySamplePackLink(void * ptr, pgno_t overflow) override;
+    void onWalApplySampleRunsInit(void * ptr, uint32_t id) override;
+    void onWalApplySampleRunsAdd(
+        void * ptr,
+        size_t pagePos,
+        TimePoint pageTime,
+        std::span<const uint8_t> runs
+    ) override;
+    void onWalApplySampleRunsRelease(void * ptr) override;
+    void onWalApplySampleRunsUpdate(
+        void * ptr,
+        size_t pagePos,
+        std::span<const uint8_t> runs
+    ) override;
+    void onWalApplySampleRunsRemove(void * ptr, size_t pagePos) override;
 
     // Inherited via IPageNotify
     void * onWalGetPtrForUpdate(
@@ -329,6 +372,14 @@ void TextWriter::onWalApplyMetricUpdate(
         << toString(interval, DurationFormat::kTwoPart) << '\n';
 }
 
+//===========================================================================
+void TextWriter::onWalApplyMetricUpdateBackfill(
+    void * ptr,
+    TimePoint backfill
+) {
+    out(ptr) << "metric.backfill = " << backfill << '\n';
+}
+
 //===========================================================================
 void TextWriter::onWalApplyMetricClearSamples(void * ptr) {
     out(ptr) << "metric.samples.clear\n";
@@ -404,6 +455,99 @@ void TextWriter::onWalApplySampleUpdateTime(void * ptr, TimePoint pageTime) {
     out(ptr) << "samples.time = " << pageTime << '\n';
 }
 
+//===========================================================================
+void TextWriter::onWalApplySampleUpdateRange(
+    void * ptr,
+    size_t firstPos,
+    std::span<const uint8_t> values,
+    bool updateLast
+) {
+    // The size of each value depends on the sample type of the page, which
+    // isn't known here.
+    auto & os = out(ptr);
+    os << "samples[" << firstPos << "...] = " << values.size() << " bytes";
+    if (updateLast)
+        os << "; samples.last = (from values)";
+    os << '\n';
+}
+
+//===========================================================================
+void TextWriter::onWalApplySamplePackInit(
+    void * ptr,
+    uint32_t id,
+    TimePoint pageTime,
+    Duration interval,
+    size_t lastSample,
+    double fill
+) {
+    out(ptr) << "samples/" << id << ".init = " << fill << ", "
+        << toString(kSampleTypePacked, "UNKNOWN_TYPE") << ", "
+        << pageTime << ", "
+        << toString(interval, DurationFormat::kTwoPart) << ", "
+        << lastSample << "\n";
+}
+
+//===========================================================================
+void TextWriter::onWalApplySamplePackAppend(
+    void * ptr,
+    size_t pos,
+    double value
+) {
+    auto & os = out(ptr);
+    if (!isnan(value))
+        os << "samples[" << pos << "] += " << value << "; ";
+    os << "samples.last = " << pos << '\n';
+}
+
+//===========================================================================
+void TextWriter::onWalApplySamplePackUpdate(
+    void * ptr,
+    size_t pos,
+    double value
+) {
+    out(ptr) << "samples[" << pos << "] = " << value << " (repack)\n";
+}
+
+//===========================================================================
+void TextWriter::onWalApplySamplePackLink(void * ptr, pgno_t overflow) {
+    out(ptr) << "samples.overflow = @" << overflow << '\n';
+}
+
+//===========================================================================
+void TextWriter::onWalApplySampleRunsInit(void * ptr, uint32_t id) {
+    out(ptr) << "runs/" << id << ".init\n";
+}
+
+//===========================================================================
+void TextWriter::onWalApplySampleRunsAdd(
+    void * ptr,
+    size_t pagePos,
+    TimePoint pageTime,
+    std::span<const uint8_t> runs
+) {
+    out(ptr) << "runs[" << pagePos << "] = " << pageTime << ", "
+        << runs.size() << " bytes; runs.refs += 1\n";
+}
+
+//===========================================================================
+void TextWriter::onWalApplySampleRunsRelease(void * ptr) {
+    out(ptr) << "runs.refs -= 1\n";
+}
+
+//===========================================================================
+void TextWriter::onWalApplySampleRunsUpdate(
+    void * ptr,
+    size_t pagePos,
+    std::span<const uint8_t> runs
+) {
+    out(ptr) << "runs[" << pagePos << "] = " << runs.size() << " bytes\n";
+}
+
+//===========================================================================
+void TextWriter::onWalApplySampleRunsRemove(void * ptr, size_t pagePos) {
+    out(ptr) << "runs[" << pagePos << "].remove\n";
+}
+
 //===========================================================================
 void * TextWriter::onWalGetPtrForUpdate(
     pgno_t pgno,
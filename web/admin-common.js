@@ -27,7 +27,9 @@ function adminIntro(selected) {
                 return [
                     { name: 'About', href: 'admin-about.html' },
                     { name: 'Backup' },
+                    { name: 'Compact', href: 'admin-compact.html' },
                     { name: 'Graphite', href: 'admin-graphite.html' },
+                    { name: 'Scrub', href: 'admin-scrub.html' },
                 ]
             },
         },